@@ -0,0 +1,447 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#define G_LOG_DOMAIN "partup-bmap"
+
+#include <string.h>
+#include <gio/gio.h>
+#include "pu-bmap.h"
+#include "pu-error.h"
+#include "pu-file.h"
+
+#define BMAP_BUFFER_SIZE (1024 * 1024)
+
+typedef struct {
+    guint64 first;
+    guint64 last;
+    gchar *checksum;
+} PuBmapRange;
+
+struct _PuBmap {
+    gchar *filename;
+    guint version_major;
+    goffset image_size;
+    guint64 block_size;
+    guint64 blocks_count;
+    guint64 mapped_blocks_count;
+    GChecksumType checksum_type;
+    gchar *file_checksum;
+    GArray *ranges;
+};
+
+typedef struct {
+    PuBmap *bmap;
+    GString *text;
+    gchar *range_checksum;
+} PuBmapParser;
+
+static void
+bmap_range_clear(PuBmapRange *range)
+{
+    g_free(range->checksum);
+}
+
+static gboolean
+bmap_parse_uint64(const gchar *text,
+                  const gchar *element,
+                  guint64 *out,
+                  GError **error)
+{
+    g_autofree gchar *str = g_strstrip(g_strdup(text));
+
+    if (!g_ascii_string_to_unsigned(str, 10, 0, G_MAXUINT64, out, NULL)) {
+        g_set_error(error, PU_ERROR, PU_ERROR_BMAP_PARSE,
+                    "Invalid value '%s' for element '%s'", str, element);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+bmap_parse_range(PuBmap *bmap,
+                 const gchar *text,
+                 gchar *checksum,
+                 GError **error)
+{
+    g_autofree gchar *str = g_strstrip(g_strdup(text));
+    g_auto(GStrv) bounds = g_strsplit(str, "-", 2);
+    PuBmapRange range;
+
+    if (bounds[0] == NULL ||
+        !g_ascii_string_to_unsigned(bounds[0], 10, 0, G_MAXUINT64,
+                                    &range.first, NULL) ||
+        !g_ascii_string_to_unsigned(bounds[1] ? bounds[1] : bounds[0], 10,
+                                    range.first, G_MAXUINT64, &range.last, NULL)) {
+        g_set_error(error, PU_ERROR, PU_ERROR_BMAP_PARSE,
+                    "Invalid block range '%s'", str);
+        g_free(checksum);
+        return FALSE;
+    }
+
+    range.checksum = checksum;
+    g_array_append_val(bmap->ranges, range);
+
+    return TRUE;
+}
+
+static void
+bmap_start_element(G_GNUC_UNUSED GMarkupParseContext *context,
+                   const gchar *element_name,
+                   const gchar **attribute_names,
+                   const gchar **attribute_values,
+                   gpointer user_data,
+                   GError **error)
+{
+    PuBmapParser *parser = user_data;
+
+    g_string_truncate(parser->text, 0);
+
+    if (g_str_equal(element_name, "bmap")) {
+        const gchar *version = NULL;
+
+        if (!g_markup_collect_attributes(element_name, attribute_names,
+                                         attribute_values, error,
+                                         G_MARKUP_COLLECT_STRING, "version", &version,
+                                         G_MARKUP_COLLECT_INVALID))
+            return;
+
+        parser->bmap->version_major = g_ascii_strtoull(version, NULL, 10);
+        if (parser->bmap->version_major < 1 || parser->bmap->version_major > 2) {
+            g_set_error(error, PU_ERROR, PU_ERROR_BMAP_PARSE,
+                        "Unsupported bmap version '%s'", version);
+            return;
+        }
+    } else if (g_str_equal(element_name, "Range")) {
+        g_clear_pointer(&parser->range_checksum, g_free);
+
+        for (guint i = 0; attribute_names[i] != NULL; i++) {
+            if (g_str_equal(attribute_names[i], "chksum") ||
+                g_str_equal(attribute_names[i], "sha1"))
+                parser->range_checksum = g_strdup(attribute_values[i]);
+        }
+    }
+}
+
+static void
+bmap_end_element(G_GNUC_UNUSED GMarkupParseContext *context,
+                 const gchar *element_name,
+                 gpointer user_data,
+                 GError **error)
+{
+    PuBmapParser *parser = user_data;
+    PuBmap *bmap = parser->bmap;
+    const gchar *text = parser->text->str;
+    guint64 value;
+
+    if (g_str_equal(element_name, "ImageSize")) {
+        if (bmap_parse_uint64(text, element_name, &value, error))
+            bmap->image_size = value;
+    } else if (g_str_equal(element_name, "BlockSize")) {
+        if (bmap_parse_uint64(text, element_name, &bmap->block_size, error) &&
+            bmap->block_size == 0)
+            g_set_error(error, PU_ERROR, PU_ERROR_BMAP_PARSE,
+                        "Block size must not be zero");
+    } else if (g_str_equal(element_name, "BlocksCount")) {
+        bmap_parse_uint64(text, element_name, &bmap->blocks_count, error);
+    } else if (g_str_equal(element_name, "MappedBlocksCount")) {
+        bmap_parse_uint64(text, element_name, &bmap->mapped_blocks_count, error);
+    } else if (g_str_equal(element_name, "ChecksumType")) {
+        g_autofree gchar *type = g_strstrip(g_strdup(text));
+
+        if (g_str_equal(type, "sha1")) {
+            bmap->checksum_type = G_CHECKSUM_SHA1;
+        } else if (g_str_equal(type, "sha256")) {
+            bmap->checksum_type = G_CHECKSUM_SHA256;
+        } else {
+            g_set_error(error, PU_ERROR, PU_ERROR_BMAP_PARSE,
+                        "Unsupported checksum type '%s'", type);
+        }
+    } else if (g_str_equal(element_name, "BmapFileChecksum") ||
+               g_str_equal(element_name, "BmapFileSHA1")) {
+        g_free(bmap->file_checksum);
+        bmap->file_checksum = g_strstrip(g_strdup(text));
+    } else if (g_str_equal(element_name, "Range")) {
+        bmap_parse_range(bmap, text, g_steal_pointer(&parser->range_checksum),
+                         error);
+    }
+}
+
+static void
+bmap_text(G_GNUC_UNUSED GMarkupParseContext *context,
+          const gchar *text,
+          gsize text_len,
+          gpointer user_data,
+          G_GNUC_UNUSED GError **error)
+{
+    PuBmapParser *parser = user_data;
+
+    g_string_append_len(parser->text, text, text_len);
+}
+
+static const GMarkupParser bmap_markup_parser = {
+    bmap_start_element,
+    bmap_end_element,
+    bmap_text,
+    NULL,
+    NULL
+};
+
+/*
+ * The checksum of a bmap file is calculated over its contents with the
+ * checksum itself replaced by '0' characters.
+ */
+static gboolean
+bmap_verify_file_checksum(PuBmap *bmap,
+                          gchar *contents,
+                          gsize length,
+                          GError **error)
+{
+    GChecksumType type;
+    gchar *pos;
+    g_autofree gchar *computed_checksum = NULL;
+
+    type = bmap->version_major < 2 ? G_CHECKSUM_SHA1 : bmap->checksum_type;
+
+    pos = g_strstr_len(contents, length, bmap->file_checksum);
+    if (pos == NULL) {
+        g_set_error(error, PU_ERROR, PU_ERROR_BMAP_PARSE,
+                    "Checksum of bmap file '%s' not found", bmap->filename);
+        return FALSE;
+    }
+    memset(pos, '0', strlen(bmap->file_checksum));
+
+    computed_checksum = g_compute_checksum_for_data(type, (guchar *) contents,
+                                                    length);
+    if (!g_str_equal(bmap->file_checksum, computed_checksum)) {
+        g_set_error(error, PU_ERROR, PU_ERROR_CHECKSUM,
+                    "Given checksum '%s' of bmap file '%s' does not match '%s'",
+                    bmap->file_checksum, bmap->filename, computed_checksum);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+PuBmap *
+pu_bmap_new_from_file(const gchar *filename,
+                      GError **error)
+{
+    g_autoptr(PuBmap) bmap = NULL;
+    g_autoptr(GMarkupParseContext) context = NULL;
+    g_autofree gchar *contents = NULL;
+    gsize length;
+    PuBmapParser parser;
+    gboolean res;
+
+    g_return_val_if_fail(filename != NULL, NULL);
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    if (!g_file_get_contents(filename, &contents, &length, error))
+        return NULL;
+
+    bmap = g_new0(PuBmap, 1);
+    bmap->filename = g_strdup(filename);
+    bmap->checksum_type = G_CHECKSUM_SHA1;
+    bmap->ranges = g_array_new(FALSE, FALSE, sizeof(PuBmapRange));
+    g_array_set_clear_func(bmap->ranges, (GDestroyNotify) bmap_range_clear);
+
+    parser.bmap = bmap;
+    parser.text = g_string_new(NULL);
+    parser.range_checksum = NULL;
+
+    context = g_markup_parse_context_new(&bmap_markup_parser, 0, &parser, NULL);
+    res = g_markup_parse_context_parse(context, contents, length, error) &&
+          g_markup_parse_context_end_parse(context, error);
+
+    g_string_free(parser.text, TRUE);
+    g_free(parser.range_checksum);
+
+    if (!res) {
+        g_prefix_error(error, "Failed parsing bmap file '%s': ", filename);
+        return NULL;
+    }
+
+    if (bmap->version_major == 0 || bmap->block_size == 0 ||
+        bmap->image_size == 0) {
+        g_set_error(error, PU_ERROR, PU_ERROR_BMAP_PARSE,
+                    "Bmap file '%s' is missing mandatory elements", filename);
+        return NULL;
+    }
+
+    for (guint i = 0; i < bmap->ranges->len; i++) {
+        PuBmapRange *range = &g_array_index(bmap->ranges, PuBmapRange, i);
+
+        if (range->last >= bmap->blocks_count ||
+            (i > 0 && range->first <= (range - 1)->last)) {
+            g_set_error(error, PU_ERROR, PU_ERROR_BMAP_PARSE,
+                        "Invalid block range %" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT
+                        " in bmap file '%s'", range->first, range->last, filename);
+            return NULL;
+        }
+    }
+
+    if (bmap->file_checksum &&
+        !bmap_verify_file_checksum(bmap, contents, length, error))
+        return NULL;
+
+    g_debug("Parsed bmap '%s': image_size=%" G_GINT64_FORMAT " block_size=%"
+            G_GUINT64_FORMAT " mapped_blocks=%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT,
+            filename, bmap->image_size, bmap->block_size,
+            bmap->mapped_blocks_count, bmap->blocks_count);
+
+    return g_steal_pointer(&bmap);
+}
+
+void
+pu_bmap_free(PuBmap *bmap)
+{
+    g_return_if_fail(bmap != NULL);
+
+    g_free(bmap->filename);
+    g_free(bmap->file_checksum);
+    g_array_unref(bmap->ranges);
+    g_free(bmap);
+}
+
+/*
+ * Look for a bmap file next to the given file, as created by bmaptool or the
+ * Yocto Project's image classes. Returns NULL if there is none.
+ */
+gchar *
+pu_bmap_find_for_file(const gchar *filename)
+{
+    g_autofree gchar *path = NULL;
+
+    g_return_val_if_fail(filename != NULL, NULL);
+
+    path = g_strconcat(filename, ".bmap", NULL);
+    if (!g_file_test(path, G_FILE_TEST_IS_REGULAR))
+        return NULL;
+
+    return g_steal_pointer(&path);
+}
+
+goffset
+pu_bmap_get_image_size(PuBmap *bmap)
+{
+    g_return_val_if_fail(bmap != NULL, 0);
+
+    return bmap->image_size;
+}
+
+static void
+bmap_range_get_extent(PuBmap *bmap,
+                      PuBmapRange *range,
+                      PuFileExtent *extent)
+{
+    goffset end = (range->last + 1) * bmap->block_size;
+
+    extent->offset = range->first * bmap->block_size;
+    extent->length = MIN(end, bmap->image_size) - extent->offset;
+}
+
+/*
+ * Get the mapped ranges of the image in bytes, clipped to the image size and
+ * starting at the given offset.
+ */
+GArray *
+pu_bmap_get_extents(PuBmap *bmap,
+                    goffset offset)
+{
+    GArray *extents;
+
+    g_return_val_if_fail(bmap != NULL, NULL);
+
+    extents = g_array_sized_new(FALSE, FALSE, sizeof(PuFileExtent),
+                                bmap->ranges->len);
+
+    for (guint i = 0; i < bmap->ranges->len; i++) {
+        PuFileExtent extent;
+        goffset end;
+
+        bmap_range_get_extent(bmap, &g_array_index(bmap->ranges, PuBmapRange, i),
+                              &extent);
+        end = extent.offset + extent.length;
+        if (end <= offset)
+            continue;
+
+        extent.offset = MAX(extent.offset, offset);
+        extent.length = end - extent.offset;
+        if (extent.length > 0)
+            g_array_append_val(extents, extent);
+    }
+
+    return extents;
+}
+
+/*
+ * Verify the checksums of all mapped ranges in the given file. The ranges are
+ * read at their offset in the image plus the given shift.
+ */
+gboolean
+pu_bmap_verify(PuBmap *bmap,
+               const gchar *filename,
+               goffset shift,
+               GError **error)
+{
+    g_autoptr(GFile) file = g_file_new_for_path(filename);
+    g_autoptr(GFileInputStream) stream = NULL;
+    g_autofree guchar *buffer = NULL;
+    gsize count;
+    gsize bytes_read;
+
+    g_return_val_if_fail(bmap != NULL, FALSE);
+    g_return_val_if_fail(filename != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    stream = g_file_read(file, NULL, error);
+    if (stream == NULL)
+        return FALSE;
+
+    buffer = g_new0(guchar, BMAP_BUFFER_SIZE);
+
+    for (guint i = 0; i < bmap->ranges->len; i++) {
+        PuBmapRange *range = &g_array_index(bmap->ranges, PuBmapRange, i);
+        g_autoptr(GChecksum) checksum = NULL;
+        PuFileExtent extent;
+
+        if (range->checksum == NULL)
+            continue;
+
+        bmap_range_get_extent(bmap, range, &extent);
+        if (!g_seekable_seek(G_SEEKABLE(stream), extent.offset + shift,
+                             G_SEEK_SET, NULL, error))
+            return FALSE;
+
+        checksum = g_checksum_new(bmap->checksum_type);
+        while (extent.length > 0) {
+            count = MIN(extent.length, BMAP_BUFFER_SIZE);
+            if (!g_input_stream_read_all(G_INPUT_STREAM(stream), buffer, count,
+                                         &bytes_read, NULL, error))
+                return FALSE;
+            if (bytes_read < count) {
+                g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                            "Unexpected end of file '%s'", filename);
+                return FALSE;
+            }
+            g_checksum_update(checksum, buffer, count);
+            extent.length -= count;
+        }
+
+        if (!g_str_equal(range->checksum, g_checksum_get_string(checksum))) {
+            g_set_error(error, PU_ERROR, PU_ERROR_CHECKSUM,
+                        "Given checksum '%s' of block range %" G_GUINT64_FORMAT
+                        "-%" G_GUINT64_FORMAT " in '%s' does not match '%s'",
+                        range->checksum, range->first, range->last, filename,
+                        g_checksum_get_string(checksum));
+            return FALSE;
+        }
+    }
+
+    g_debug("Verified %u block ranges of '%s'", bmap->ranges->len, filename);
+
+    return TRUE;
+}
@@ -0,0 +1,26 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#ifndef PARTUP_BMAP_H
+#define PARTUP_BMAP_H
+
+#include <glib.h>
+
+typedef struct _PuBmap PuBmap;
+
+PuBmap * pu_bmap_new_from_file(const gchar *filename,
+                               GError **error);
+void pu_bmap_free(PuBmap *bmap);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PuBmap, pu_bmap_free)
+gchar * pu_bmap_find_for_file(const gchar *filename);
+goffset pu_bmap_get_image_size(PuBmap *bmap);
+GArray * pu_bmap_get_extents(PuBmap *bmap,
+                             goffset offset);
+gboolean pu_bmap_verify(PuBmap *bmap,
+                        const gchar *filename,
+                        goffset shift,
+                        GError **error);
+
+#endif /* PARTUP_BMAP_H */
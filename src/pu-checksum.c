@@ -7,6 +7,238 @@
 #include "pu-checksum.h"
 #include "pu-error.h"
 #include "pu-file.h"
+#include "pu-io.h"
+#include "pu-stats.h"
+
+struct _PuChecksum {
+    GChecksum *checksum;
+    guchar *buffer;
+};
+
+/* Checksums of input files computed during an installation */
+static GHashTable *checksum_cache = NULL;
+
+/*
+ * Start an incremental checksum. Data is either passed directly with
+ * pu_checksum_update() or read from a stream through a fixed size buffer with
+ * pu_checksum_update_from_stream(), so memory usage does not depend on the
+ * amount of data checksummed.
+ */
+PuChecksum *
+pu_checksum_init(GChecksumType checksum_type)
+{
+    PuChecksum *checksum = g_new0(PuChecksum, 1);
+
+    checksum->checksum = g_checksum_new(checksum_type);
+
+    return checksum;
+}
+
+void
+pu_checksum_update(PuChecksum *checksum,
+                   const guchar *data,
+                   gsize length)
+{
+    g_return_if_fail(checksum != NULL);
+
+    g_checksum_update(checksum->checksum, data, length);
+}
+
+/*
+ * Read count bytes from the stream and add them to the checksum. If count is
+ * negative, the stream is read until its end.
+ */
+gboolean
+pu_checksum_update_from_stream(PuChecksum *checksum,
+                               GInputStream *stream,
+                               gssize count,
+                               GError **error)
+{
+    gsize length;
+    gsize bytes_read;
+
+    g_return_val_if_fail(checksum != NULL, FALSE);
+    g_return_val_if_fail(G_IS_INPUT_STREAM(stream), FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    if (checksum->buffer == NULL)
+        checksum->buffer = g_new(guchar, PU_IO_BUFFER_SIZE);
+
+    while (count != 0) {
+        length = count < 0 ? PU_IO_BUFFER_SIZE : MIN(count, PU_IO_BUFFER_SIZE);
+        if (!g_input_stream_read_all(stream, checksum->buffer, length,
+                                     &bytes_read, NULL, error))
+            return FALSE;
+
+        g_checksum_update(checksum->checksum, checksum->buffer, bytes_read);
+
+        if (bytes_read < length) {
+            if (count < 0)
+                break;
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                        "Unexpected end of stream");
+            return FALSE;
+        }
+
+        if (count > 0)
+            count -= bytes_read;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Get the hexadecimal string of the checksum. No more data can be added to the
+ * checksum afterwards.
+ */
+gchar *
+pu_checksum_finish(PuChecksum *checksum)
+{
+    g_return_val_if_fail(checksum != NULL, NULL);
+
+    g_clear_pointer(&checksum->buffer, g_free);
+
+    return g_strdup(g_checksum_get_string(checksum->checksum));
+}
+
+void
+pu_checksum_free(PuChecksum *checksum)
+{
+    g_return_if_fail(checksum != NULL);
+
+    g_checksum_free(checksum->checksum);
+    g_free(checksum->buffer);
+    g_free(checksum);
+}
+
+/*
+ * Identify a file by its path, device, inode, size and modification time, so a
+ * cached checksum is not used after the file was replaced or modified.
+ */
+static gchar *
+checksum_cache_key(const gchar *filename,
+                   GChecksumType checksum_type)
+{
+    g_autoptr(GFile) file = g_file_new_for_path(filename);
+    g_autoptr(GFileInfo) info = NULL;
+    g_autoptr(GError) error = NULL;
+
+    info = g_file_query_info(file,
+                             G_FILE_ATTRIBUTE_UNIX_DEVICE ","
+                             G_FILE_ATTRIBUTE_UNIX_INODE ","
+                             G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                             G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                             G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                             G_FILE_QUERY_INFO_NONE, NULL, &error);
+    if (info == NULL) {
+        g_debug("Not caching checksum of '%s': %s", filename, error->message);
+        return NULL;
+    }
+
+    return g_strdup_printf("%s:%u:%" G_GUINT64_FORMAT ":%" G_GOFFSET_FORMAT
+                           ":%" G_GUINT64_FORMAT ".%06u:%d", filename,
+                           g_file_info_get_attribute_uint32(info,
+                                                            G_FILE_ATTRIBUTE_UNIX_DEVICE),
+                           g_file_info_get_attribute_uint64(info,
+                                                            G_FILE_ATTRIBUTE_UNIX_INODE),
+                           g_file_info_get_size(info),
+                           g_file_info_get_attribute_uint64(info,
+                                                            G_FILE_ATTRIBUTE_TIME_MODIFIED),
+                           g_file_info_get_attribute_uint32(info,
+                                                            G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC),
+                           checksum_type);
+}
+
+/*
+ * Get the checksum of a file as stored, if it was already computed since the
+ * cache was last cleared. The returned string is owned by the cache.
+ */
+const gchar *
+pu_checksum_cache_lookup(const gchar *filename,
+                         GChecksumType checksum_type)
+{
+    g_autofree gchar *key = NULL;
+
+    g_return_val_if_fail(filename != NULL, NULL);
+
+    if (checksum_cache == NULL)
+        return NULL;
+
+    key = checksum_cache_key(filename, checksum_type);
+    if (key == NULL)
+        return NULL;
+
+    return g_hash_table_lookup(checksum_cache, key);
+}
+
+/*
+ * Remember the checksum computed over all data of a file as stored. Checksums
+ * of files that cannot be identified are not cached.
+ */
+void
+pu_checksum_cache_insert(const gchar *filename,
+                         GChecksumType checksum_type,
+                         const gchar *checksum)
+{
+    gchar *key;
+
+    g_return_if_fail(filename != NULL);
+    g_return_if_fail(checksum != NULL);
+
+    key = checksum_cache_key(filename, checksum_type);
+    if (key == NULL)
+        return;
+
+    if (checksum_cache == NULL)
+        checksum_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                               g_free, g_free);
+
+    g_hash_table_replace(checksum_cache, key, g_strdup(checksum));
+}
+
+void
+pu_checksum_cache_clear(void)
+{
+    g_clear_pointer(&checksum_cache, g_hash_table_unref);
+}
+
+/*
+ * Compute the checksum of a file from offset up to its end through the fixed
+ * size buffer of an incremental checksum. Data written to a device is read
+ * back by pu_io_checksum_extents() instead, see pu_checksum_verify_raw().
+ */
+static gchar *
+checksum_compute_for_file(const gchar *filename,
+                          goffset offset,
+                          GChecksumType checksum_type,
+                          GError **error)
+{
+    g_autoptr(GFile) file = g_file_new_for_path(filename);
+    g_autoptr(GFileInputStream) stream = NULL;
+    g_autoptr(PuChecksum) checksum = NULL;
+    PuStatsStep *step;
+    gboolean res;
+
+    stream = g_file_read(file, NULL, error);
+    if (stream == NULL)
+        return NULL;
+
+    if (offset > 0 &&
+        !g_seekable_seek(G_SEEKABLE(stream), offset, G_SEEK_SET, NULL, error))
+        return NULL;
+
+    step = pu_stats_begin("checksum", filename);
+    checksum = pu_checksum_init(checksum_type);
+    res = pu_checksum_update_from_stream(checksum, G_INPUT_STREAM(stream), -1,
+                                         error);
+    pu_stats_end(step, g_seekable_tell(G_SEEKABLE(stream)) - offset, res);
+    if (!res) {
+        g_prefix_error(error, "Failed reading '%s': ", filename);
+        return NULL;
+    }
+
+    return pu_checksum_finish(checksum);
+}
 
 gboolean
 pu_checksum_verify_file(const gchar *filename,
@@ -14,31 +246,22 @@ pu_checksum_verify_file(const gchar *filename,
                         GChecksumType checksum_type,
                         GError **error)
 {
-    g_autoptr(GFile) file = g_file_new_for_path(filename);
-    g_autoptr(GFileInputStream) stream = NULL;
-    g_autoptr(GFileInfo) file_info = NULL;
-    goffset file_size;
-    g_autofree guchar *buffer = NULL;
     g_autofree gchar *computed_checksum = NULL;
 
     g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-    stream = g_file_read(file, NULL, error);
-    if (stream == NULL)
-        return FALSE;
-
-    file_info = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                                  G_FILE_QUERY_INFO_NONE, NULL, error);
-    if (file_info == NULL)
-        return FALSE;
-
-    file_size = g_file_info_get_size(file_info);
-    buffer = g_new0(guchar, file_size);
-    if (!g_input_stream_read_all(G_INPUT_STREAM(stream), buffer, file_size,
-                                 NULL, NULL, error))
-        return FALSE;
+    /* Files referenced multiple times are only read once */
+    computed_checksum = g_strdup(pu_checksum_cache_lookup(filename, checksum_type));
+    if (computed_checksum) {
+        g_debug("Using cached checksum of file '%s'", filename);
+    } else {
+        computed_checksum = checksum_compute_for_file(filename, 0, checksum_type,
+                                                      error);
+        if (computed_checksum == NULL)
+            return FALSE;
+        pu_checksum_cache_insert(filename, checksum_type, computed_checksum);
+    }
 
-    computed_checksum = g_compute_checksum_for_data(checksum_type, buffer, file_size);
     if (!g_str_equal(checksum, computed_checksum)) {
         g_set_error(error, PU_ERROR, PU_ERROR_CHECKSUM,
                     "Given checksum '%s' of file '%s' does not match '%s'",
@@ -49,6 +272,11 @@ pu_checksum_verify_file(const gchar *filename,
     return TRUE;
 }
 
+/*
+ * Verify the checksum of size bytes of written data at offset. Like the other
+ * extent based functions, it reads through the bounded buffers of
+ * pu_io_checksum_extents().
+ */
 gboolean
 pu_checksum_verify_raw(const gchar *filename,
                        goffset offset,
@@ -57,15 +285,21 @@ pu_checksum_verify_raw(const gchar *filename,
                        GChecksumType checksum_type,
                        GError **error)
 {
-    g_autofree guchar *buffer = NULL;
+    g_autoptr(GArray) extents = NULL;
     g_autofree gchar *computed_checksum = NULL;
+    PuFileExtent extent = { offset, size };
 
     g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-    if (!pu_file_read_raw(filename, &buffer, offset, size, NULL, error))
+    /* Written data is read back from the device, not from the page cache */
+    extents = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+    g_array_append_val(extents, extent);
+
+    computed_checksum = pu_io_checksum_extents(filename, extents, 0,
+                                               checksum_type, error);
+    if (computed_checksum == NULL)
         return FALSE;
 
-    computed_checksum = g_compute_checksum_for_data(checksum_type, buffer, size);
     if (!g_str_equal(checksum, computed_checksum)) {
         g_set_error(error, PU_ERROR, PU_ERROR_CHECKSUM,
                     "Given checksum '%s' of '%s' at offset %ld and size %ld does not match '%s'",
@@ -97,20 +331,58 @@ pu_checksum_verify_raw_bootpart(const gchar *device,
                                   checksum_type, error);
 }
 
-
 gchar *
 pu_checksum_new_from_file(const gchar *filename,
                           goffset offset,
                           GChecksumType checksum_type,
                           GError **error)
 {
-    g_autofree guchar *buffer = NULL;
-    gsize bytes_read = 0;
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    return checksum_compute_for_file(filename, offset, checksum_type, error);
+}
+
+/*
+ * Compute the checksum over the concatenated content of all extents of a file.
+ * The offset of each extent is moved by shift, which allows checksumming the
+ * same extents of an input file at their written location on the output.
+ */
+gchar *
+pu_checksum_new_from_extents(const gchar *filename,
+                             GArray *extents,
+                             goffset shift,
+                             GChecksumType checksum_type,
+                             GError **error)
+{
+    g_return_val_if_fail(extents != NULL, NULL);
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    return pu_io_checksum_extents(filename, extents, shift, checksum_type, error);
+}
+
+gboolean
+pu_checksum_verify_extents(const gchar *filename,
+                           GArray *extents,
+                           goffset shift,
+                           const gchar *checksum,
+                           GChecksumType checksum_type,
+                           GError **error)
+{
+    g_autofree gchar *computed_checksum = NULL;
 
     g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-    if (!pu_file_read_raw(filename, &buffer, offset, -1, &bytes_read, error))
+    computed_checksum = pu_checksum_new_from_extents(filename, extents, shift,
+                                                     checksum_type, error);
+    if (computed_checksum == NULL)
         return FALSE;
 
-    return g_compute_checksum_for_data(checksum_type, buffer, bytes_read);
+    if (!g_str_equal(checksum, computed_checksum)) {
+        g_set_error(error, PU_ERROR, PU_ERROR_CHECKSUM,
+                    "Given checksum '%s' of %u extents in '%s' does not match '%s'",
+                    checksum, extents->len, filename, computed_checksum);
+        return FALSE;
+    }
+
+    return TRUE;
 }
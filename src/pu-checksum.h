@@ -8,6 +8,29 @@
 
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <gio/gio.h>
+
+typedef struct _PuChecksum PuChecksum;
+
+PuChecksum * pu_checksum_init(GChecksumType checksum_type);
+void pu_checksum_update(PuChecksum *checksum,
+                        const guchar *data,
+                        gsize length);
+gboolean pu_checksum_update_from_stream(PuChecksum *checksum,
+                                        GInputStream *stream,
+                                        gssize count,
+                                        GError **error);
+gchar * pu_checksum_finish(PuChecksum *checksum);
+void pu_checksum_free(PuChecksum *checksum);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PuChecksum, pu_checksum_free)
+
+const gchar * pu_checksum_cache_lookup(const gchar *filename,
+                                       GChecksumType checksum_type);
+void pu_checksum_cache_insert(const gchar *filename,
+                              GChecksumType checksum_type,
+                              const gchar *checksum);
+void pu_checksum_cache_clear(void);
 
 gboolean pu_checksum_verify_file(const gchar *filename,
                                  const gchar *checksum,
@@ -30,5 +53,16 @@ gchar * pu_checksum_new_from_file(const gchar *filename,
                                   goffset offset,
                                   GChecksumType checksum_type,
                                   GError **error);
+gchar * pu_checksum_new_from_extents(const gchar *filename,
+                                     GArray *extents,
+                                     goffset shift,
+                                     GChecksumType checksum_type,
+                                     GError **error);
+gboolean pu_checksum_verify_extents(const gchar *filename,
+                                    GArray *extents,
+                                    goffset shift,
+                                    const gchar *checksum,
+                                    GChecksumType checksum_type,
+                                    GError **error);
 
 #endif /* PARTUP_CHECKSUM_H */
@@ -0,0 +1,626 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#define G_LOG_DOMAIN "partup-decompress"
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef PARTUP_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef PARTUP_HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef PARTUP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "pu-error.h"
+#include "pu-file.h"
+#include "pu-io.h"
+#include "pu-decompress.h"
+
+static const struct {
+    PuCompression compression;
+    const gchar *suffix;
+    const gchar *name;
+} compression_formats[] = {
+    { PU_COMPRESSION_GZIP, ".gz", "gzip" },
+    { PU_COMPRESSION_XZ, ".xz", "xz" },
+    { PU_COMPRESSION_ZSTD, ".zst", "zstd" }
+};
+
+struct _PuDecompressor {
+    PuCompression compression;
+    gchar *path;
+    gint fd;
+    GArray *digests;
+
+    guchar *in_buffer;
+    gsize in_length;
+    gsize in_pos;
+    gboolean in_eof;
+    /* The decoder is at the end of a stream, where the input may end */
+    gboolean stream_end;
+    /* All data was returned, the decoder must not be run anymore */
+    gboolean done;
+
+#ifdef PARTUP_HAVE_ZLIB
+    z_stream zlib;
+#endif
+#ifdef PARTUP_HAVE_LZMA
+    lzma_stream lzma;
+#endif
+#ifdef PARTUP_HAVE_ZSTD
+    ZSTD_DCtx *zstd;
+#endif
+    gboolean initialized;
+};
+
+PuCompression
+pu_compression_from_filename(const gchar *filename)
+{
+    g_return_val_if_fail(filename != NULL, PU_COMPRESSION_NONE);
+
+    for (guint i = 0; i < G_N_ELEMENTS(compression_formats); i++) {
+        if (g_str_has_suffix(filename, compression_formats[i].suffix))
+            return compression_formats[i].compression;
+    }
+
+    return PU_COMPRESSION_NONE;
+}
+
+const gchar *
+pu_compression_get_name(PuCompression compression)
+{
+    for (guint i = 0; i < G_N_ELEMENTS(compression_formats); i++) {
+        if (compression_formats[i].compression == compression)
+            return compression_formats[i].name;
+    }
+
+    return "none";
+}
+
+/*
+ * Get the filename without the suffix of its compression format, e.g.
+ * 'rootfs.ext4' for 'rootfs.ext4.zst'.
+ */
+gchar *
+pu_compression_strip_suffix(const gchar *filename)
+{
+    g_return_val_if_fail(filename != NULL, NULL);
+
+    for (guint i = 0; i < G_N_ELEMENTS(compression_formats); i++) {
+        if (g_str_has_suffix(filename, compression_formats[i].suffix))
+            return g_strndup(filename, strlen(filename) -
+                             strlen(compression_formats[i].suffix));
+    }
+
+    return g_strdup(filename);
+}
+
+static gboolean
+decompressor_init(PuDecompressor *self,
+                  GError **error)
+{
+    switch (self->compression) {
+#ifdef PARTUP_HAVE_ZLIB
+    case PU_COMPRESSION_GZIP:
+        /* Only accept gzip headers, concatenated members are handled on read */
+        if (inflateInit2(&self->zlib, 16 + MAX_WBITS) != Z_OK) {
+            g_set_error(error, PU_ERROR, PU_ERROR_DECOMPRESS,
+                        "Failed initializing gzip decoder");
+            return FALSE;
+        }
+        break;
+#endif
+#ifdef PARTUP_HAVE_LZMA
+    case PU_COMPRESSION_XZ: {
+        lzma_ret ret;
+#if LZMA_VERSION >= 50040002
+        lzma_mt mt = { 0 };
+
+        /* Falls back to a single thread if the stream has only one block */
+        mt.flags = LZMA_CONCATENATED;
+        mt.threads = g_get_num_processors();
+        mt.memlimit_threading = lzma_physmem() / 4;
+        mt.memlimit_stop = UINT64_MAX;
+        ret = lzma_stream_decoder_mt(&self->lzma, &mt);
+#else
+        ret = lzma_stream_decoder(&self->lzma, UINT64_MAX, LZMA_CONCATENATED);
+#endif
+        if (ret != LZMA_OK) {
+            g_set_error(error, PU_ERROR, PU_ERROR_DECOMPRESS,
+                        "Failed initializing xz decoder (error %d)", ret);
+            return FALSE;
+        }
+        break;
+    }
+#endif
+#ifdef PARTUP_HAVE_ZSTD
+    case PU_COMPRESSION_ZSTD:
+        self->zstd = ZSTD_createDCtx();
+        if (self->zstd == NULL) {
+            g_set_error(error, PU_ERROR, PU_ERROR_DECOMPRESS,
+                        "Failed initializing zstd decoder");
+            return FALSE;
+        }
+        break;
+#endif
+    default:
+        g_set_error(error, PU_ERROR, PU_ERROR_DECOMPRESS,
+                    "%s was built without %s support", g_get_prgname(),
+                    pu_compression_get_name(self->compression));
+        return FALSE;
+    }
+
+    self->initialized = TRUE;
+
+    return TRUE;
+}
+
+/*
+ * Create a decompressor reading the given file in the format given by its
+ * suffix.
+ */
+PuDecompressor *
+pu_decompressor_new(const gchar *filename,
+                    GError **error)
+{
+    g_autoptr(PuDecompressor) self = NULL;
+
+    g_return_val_if_fail(filename != NULL, NULL);
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    self = g_new0(PuDecompressor, 1);
+    self->compression = pu_compression_from_filename(filename);
+    self->path = g_strdup(filename);
+    self->fd = -1;
+
+    if (self->compression == PU_COMPRESSION_NONE) {
+        g_set_error(error, PU_ERROR, PU_ERROR_DECOMPRESS,
+                    "Unknown compression format of '%s'", filename);
+        return NULL;
+    }
+
+    if (!decompressor_init(self, error))
+        return NULL;
+
+    self->fd = g_open(filename, O_RDONLY | O_CLOEXEC, 0);
+    if (self->fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed opening '%s': %s", filename, g_strerror(errno));
+        return NULL;
+    }
+
+    posix_fadvise(self->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    self->in_buffer = g_new(guchar, PU_IO_BUFFER_SIZE);
+
+    return g_steal_pointer(&self);
+}
+
+/*
+ * Update the digests of scope PU_IO_DIGEST_FILE with the compressed data as it
+ * is read from the file. Digests of other scopes are left untouched.
+ */
+void
+pu_decompressor_set_digests(PuDecompressor *decompressor,
+                            GArray *digests)
+{
+    g_return_if_fail(decompressor != NULL);
+
+    decompressor->digests = digests;
+}
+
+static gboolean
+decompressor_fill(PuDecompressor *self,
+                  GError **error)
+{
+    gssize ret;
+
+    do {
+        ret = read(self->fd, self->in_buffer, PU_IO_BUFFER_SIZE);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed reading '%s': %s", self->path, g_strerror(errno));
+        return FALSE;
+    }
+
+    self->in_length = ret;
+    self->in_pos = 0;
+    self->in_eof = ret == 0;
+
+    for (guint i = 0; self->digests && i < self->digests->len; i++) {
+        PuIoDigest *digest = &g_array_index(self->digests, PuIoDigest, i);
+
+        if (digest->scope == PU_IO_DIGEST_FILE)
+            g_checksum_update(digest->checksum, self->in_buffer, ret);
+    }
+
+    return TRUE;
+}
+
+/*
+ * Run the decoder on the buffered input. Returns FALSE on corrupt data only,
+ * no progress is reported by zero consumed and produced bytes.
+ */
+static gboolean
+decompressor_decode(PuDecompressor *self,
+                    guchar *buffer,
+                    gsize count,
+                    gsize *consumed,
+                    gsize *produced,
+                    GError **error)
+{
+    const guchar *in = self->in_buffer + self->in_pos;
+    gsize in_length = self->in_length - self->in_pos;
+    gboolean end = FALSE;
+
+    *consumed = 0;
+    *produced = 0;
+
+    switch (self->compression) {
+#ifdef PARTUP_HAVE_ZLIB
+    case PU_COMPRESSION_GZIP: {
+        gint ret;
+
+        self->zlib.next_in = (Bytef *) in;
+        self->zlib.avail_in = MIN(in_length, G_MAXUINT);
+        self->zlib.next_out = buffer;
+        self->zlib.avail_out = MIN(count, G_MAXUINT);
+        ret = inflate(&self->zlib, Z_NO_FLUSH);
+        *consumed = MIN(in_length, G_MAXUINT) - self->zlib.avail_in;
+        *produced = MIN(count, G_MAXUINT) - self->zlib.avail_out;
+
+        if (ret == Z_STREAM_END) {
+            /* Further data is decoded as the next gzip member */
+            inflateReset(&self->zlib);
+            end = TRUE;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            g_set_error(error, PU_ERROR, PU_ERROR_DECOMPRESS,
+                        "Failed decompressing '%s': %s", self->path,
+                        self->zlib.msg ? self->zlib.msg : "corrupt data");
+            return FALSE;
+        }
+        break;
+    }
+#endif
+#ifdef PARTUP_HAVE_LZMA
+    case PU_COMPRESSION_XZ: {
+        lzma_ret ret;
+
+        self->lzma.next_in = in;
+        self->lzma.avail_in = in_length;
+        self->lzma.next_out = buffer;
+        self->lzma.avail_out = count;
+        ret = lzma_code(&self->lzma, self->in_eof ? LZMA_FINISH : LZMA_RUN);
+        *consumed = in_length - self->lzma.avail_in;
+        *produced = count - self->lzma.avail_out;
+
+        if (ret == LZMA_STREAM_END) {
+            end = TRUE;
+        } else if (ret != LZMA_OK && ret != LZMA_BUF_ERROR) {
+            g_set_error(error, PU_ERROR, PU_ERROR_DECOMPRESS,
+                        "Failed decompressing '%s' (error %d)", self->path, ret);
+            return FALSE;
+        }
+        break;
+    }
+#endif
+#ifdef PARTUP_HAVE_ZSTD
+    case PU_COMPRESSION_ZSTD: {
+        ZSTD_inBuffer zin = { in, in_length, 0 };
+        ZSTD_outBuffer zout = { buffer, count, 0 };
+        gsize ret;
+
+        ret = ZSTD_decompressStream(self->zstd, &zout, &zin);
+        *consumed = zin.pos;
+        *produced = zout.pos;
+
+        if (ZSTD_isError(ret)) {
+            g_set_error(error, PU_ERROR, PU_ERROR_DECOMPRESS,
+                        "Failed decompressing '%s': %s", self->path,
+                        ZSTD_getErrorName(ret));
+            return FALSE;
+        }
+        /* Frames are decoded one at a time, a frame ends on a zero hint */
+        end = ret == 0;
+        break;
+    }
+#endif
+    default:
+        g_assert_not_reached();
+    }
+
+    if (end)
+        self->stream_end = TRUE;
+    else if (*consumed > 0)
+        self->stream_end = FALSE;
+
+    return TRUE;
+}
+
+/*
+ * Read up to count bytes of decompressed data. Fewer bytes than requested are
+ * only returned at the end of the data. Truncated input is reported as error.
+ */
+gboolean
+pu_decompressor_read(PuDecompressor *decompressor,
+                     guchar *buffer,
+                     gsize count,
+                     gsize *bytes_read,
+                     GError **error)
+{
+    gsize consumed;
+    gsize produced;
+
+    g_return_val_if_fail(decompressor != NULL, FALSE);
+    g_return_val_if_fail(buffer != NULL, FALSE);
+    g_return_val_if_fail(bytes_read != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    *bytes_read = 0;
+
+    while (!decompressor->done && *bytes_read < count) {
+        if (!decompressor_decode(decompressor, buffer + *bytes_read,
+                                 count - *bytes_read, &consumed, &produced,
+                                 error))
+            return FALSE;
+
+        decompressor->in_pos += consumed;
+        *bytes_read += produced;
+        if (consumed > 0 || produced > 0)
+            continue;
+
+        /* The decoder needs more input to make progress */
+        if (decompressor->in_eof) {
+            if (!decompressor->stream_end) {
+                g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                            "Unexpected end of compressed file '%s'",
+                            decompressor->path);
+                return FALSE;
+            }
+            decompressor->done = TRUE;
+            break;
+        }
+
+        if (!decompressor_fill(decompressor, error))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Read the remaining compressed data of the file without decoding it, so the
+ * digests of the file are complete even if not all data was read.
+ */
+gboolean
+pu_decompressor_finish(PuDecompressor *decompressor,
+                       GError **error)
+{
+    gboolean file_digests = FALSE;
+
+    g_return_val_if_fail(decompressor != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    for (guint i = 0; decompressor->digests && i < decompressor->digests->len; i++) {
+        if (g_array_index(decompressor->digests, PuIoDigest, i).scope == PU_IO_DIGEST_FILE)
+            file_digests = TRUE;
+    }
+
+    while (file_digests && !decompressor->in_eof) {
+        if (!decompressor_fill(decompressor, error))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+pu_decompressor_free(PuDecompressor *decompressor)
+{
+    if (!decompressor)
+        return;
+
+    if (decompressor->initialized) {
+        switch (decompressor->compression) {
+#ifdef PARTUP_HAVE_ZLIB
+        case PU_COMPRESSION_GZIP:
+            inflateEnd(&decompressor->zlib);
+            break;
+#endif
+#ifdef PARTUP_HAVE_LZMA
+        case PU_COMPRESSION_XZ:
+            lzma_end(&decompressor->lzma);
+            break;
+#endif
+#ifdef PARTUP_HAVE_ZSTD
+        case PU_COMPRESSION_ZSTD:
+            ZSTD_freeDCtx(decompressor->zstd);
+            break;
+#endif
+        default:
+            break;
+        }
+    }
+
+    if (decompressor->fd >= 0)
+        g_close(decompressor->fd, NULL);
+    g_free(decompressor->in_buffer);
+    g_free(decompressor->path);
+    g_free(decompressor);
+}
+
+#ifdef PARTUP_HAVE_LZMA
+/*
+ * Read the uncompressed size from the index at the end of an xz file. Only
+ * files consisting of a single stream are supported.
+ */
+static gboolean
+decompress_get_size_xz(gint fd,
+                       goffset file_size,
+                       goffset *size)
+{
+    guchar footer[LZMA_STREAM_HEADER_SIZE];
+    g_autofree guchar *buffer = NULL;
+    lzma_stream_flags flags;
+    lzma_index *index = NULL;
+    guint64 memlimit = UINT64_MAX;
+    gsize pos = 0;
+    gboolean res = FALSE;
+
+    if (file_size < 2 * LZMA_STREAM_HEADER_SIZE)
+        return FALSE;
+
+    if (!pu_io_pread_all(fd, "", footer, sizeof(footer),
+                         file_size - LZMA_STREAM_HEADER_SIZE, NULL))
+        return FALSE;
+    if (lzma_stream_footer_decode(&flags, footer) != LZMA_OK)
+        return FALSE;
+    if ((goffset) flags.backward_size > file_size - 2 * LZMA_STREAM_HEADER_SIZE)
+        return FALSE;
+
+    buffer = g_new(guchar, flags.backward_size);
+    if (!pu_io_pread_all(fd, "", buffer, flags.backward_size,
+                         file_size - LZMA_STREAM_HEADER_SIZE - flags.backward_size,
+                         NULL))
+        return FALSE;
+    if (lzma_index_buffer_decode(&index, &memlimit, NULL, buffer, &pos,
+                                 flags.backward_size) != LZMA_OK)
+        return FALSE;
+
+    /* Concatenated streams or padding need decoding to be sized */
+    if ((goffset) lzma_index_stream_size(index) == file_size) {
+        *size = lzma_index_uncompressed_size(index);
+        res = TRUE;
+    }
+
+    lzma_index_end(index, NULL);
+
+    return res;
+}
+#endif
+
+#ifdef PARTUP_HAVE_ZSTD
+/*
+ * Sum up the content sizes stored in the headers of all zstd frames. Frames are
+ * skipped by their compressed size without decoding them.
+ */
+static gboolean
+decompress_get_size_zstd(gint fd,
+                         goffset file_size,
+                         goffset *size)
+{
+    const guchar *map;
+    const guchar *frame;
+    gsize remaining = file_size;
+    guint64 content_size;
+    gsize frame_size;
+    gboolean res = TRUE;
+
+    if (file_size == 0)
+        return FALSE;
+
+    map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return FALSE;
+
+    *size = 0;
+    for (frame = map; remaining > 0; frame += frame_size, remaining -= frame_size) {
+        content_size = ZSTD_getFrameContentSize(frame, remaining);
+        frame_size = ZSTD_findFrameCompressedSize(frame, remaining);
+        if (content_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+            content_size == ZSTD_CONTENTSIZE_ERROR || ZSTD_isError(frame_size)) {
+            res = FALSE;
+            break;
+        }
+        *size += content_size;
+    }
+
+    munmap((gpointer) map, file_size);
+
+    return res;
+}
+#endif
+
+/*
+ * Get the size of a file after decompressing it. The size is taken from the
+ * metadata of xz and zstd files, if available. Otherwise, and for gzip files,
+ * whose trailer only stores the size modulo 4 GiB, the file is decompressed
+ * once to determine its size. Uncompressed files return their plain size.
+ */
+gboolean
+pu_decompress_get_size(const gchar *filename,
+                       goffset *size,
+                       GError **error)
+{
+    g_autoptr(PuDecompressor) decompressor = NULL;
+    g_autofree guchar *buffer = NULL;
+    PuCompression compression;
+    gsize bytes_read;
+    goffset file_size;
+    gboolean res = FALSE;
+    gint fd;
+
+    g_return_val_if_fail(filename != NULL, FALSE);
+    g_return_val_if_fail(size != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    file_size = pu_file_get_size(filename, error);
+    if (error && *error)
+        return FALSE;
+
+    compression = pu_compression_from_filename(filename);
+    if (compression == PU_COMPRESSION_NONE) {
+        *size = file_size;
+        return TRUE;
+    }
+
+    fd = g_open(filename, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed opening '%s': %s", filename, g_strerror(errno));
+        return FALSE;
+    }
+
+#ifdef PARTUP_HAVE_LZMA
+    if (compression == PU_COMPRESSION_XZ)
+        res = decompress_get_size_xz(fd, file_size, size);
+#endif
+#ifdef PARTUP_HAVE_ZSTD
+    if (compression == PU_COMPRESSION_ZSTD)
+        res = decompress_get_size_zstd(fd, file_size, size);
+#endif
+    g_close(fd, NULL);
+
+    if (res)
+        return TRUE;
+
+    g_debug("Decompressing '%s' to determine its size", filename);
+
+    decompressor = pu_decompressor_new(filename, error);
+    if (decompressor == NULL)
+        return FALSE;
+
+    buffer = g_new(guchar, PU_IO_BUFFER_SIZE);
+    *size = 0;
+    do {
+        if (!pu_decompressor_read(decompressor, buffer, PU_IO_BUFFER_SIZE,
+                                  &bytes_read, error))
+            return FALSE;
+        *size += bytes_read;
+    } while (bytes_read == PU_IO_BUFFER_SIZE);
+
+    return TRUE;
+}
@@ -0,0 +1,41 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#ifndef PARTUP_DECOMPRESS_H
+#define PARTUP_DECOMPRESS_H
+
+#include <glib.h>
+
+typedef enum {
+    PU_COMPRESSION_NONE,
+    PU_COMPRESSION_GZIP,
+    PU_COMPRESSION_XZ,
+    PU_COMPRESSION_ZSTD
+} PuCompression;
+
+typedef struct _PuDecompressor PuDecompressor;
+
+PuCompression pu_compression_from_filename(const gchar *filename);
+const gchar * pu_compression_get_name(PuCompression compression);
+gchar * pu_compression_strip_suffix(const gchar *filename);
+gboolean pu_decompress_get_size(const gchar *filename,
+                                goffset *size,
+                                GError **error);
+PuDecompressor * pu_decompressor_new(const gchar *filename,
+                                     GError **error);
+void pu_decompressor_set_digests(PuDecompressor *decompressor,
+                                 GArray *digests);
+gboolean pu_decompressor_read(PuDecompressor *decompressor,
+                              guchar *buffer,
+                              gsize count,
+                              gsize *bytes_read,
+                              GError **error);
+gboolean pu_decompressor_finish(PuDecompressor *decompressor,
+                                GError **error);
+void pu_decompressor_free(PuDecompressor *decompressor);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PuDecompressor, pu_decompressor_free)
+
+#endif /* PARTUP_DECOMPRESS_H */
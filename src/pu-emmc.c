@@ -4,14 +4,23 @@
  */
 
 #define G_LOG_DOMAIN "partup-emmc"
+#define _GNU_SOURCE
 
+#include <errno.h>
+#include <fcntl.h>
 #include <parted/parted.h>
 #include <glib/gstdio.h>
+#include "pu-bmap.h"
 #include "pu-checksum.h"
+#include "pu-decompress.h"
 #include "pu-error.h"
+#include "pu-fat.h"
 #include "pu-file.h"
+#include "pu-gpt.h"
 #include "pu-hashtable.h"
+#include "pu-io.h"
 #include "pu-mount.h"
+#include "pu-stats.h"
 #include "pu-utils.h"
 #include "pu-emmc.h"
 
@@ -20,10 +29,17 @@
 
 #define DEFAULT_GRAIN_SIZE         PED_MEBIBYTE_SIZE
 
+#define MANIFEST_FILENAME          ".partup-manifest"
+
+#define SESSION_COPY_THREADS       4
+
 typedef struct _PuEmmcInput {
     gchar *filename;
     gchar *md5sum;
     gchar *sha256sum;
+    gchar *bmap;
+    gboolean zero_holes;
+    gboolean checksum_decompressed;
 
     /* Internal members */
     gsize _size;
@@ -59,7 +75,39 @@ typedef struct _PuEmmcControls {
 typedef struct _PuEmmcClean {
     PedSector size;
     PedSector offset;
+    PuIoCleanMethod method;
 } PuEmmcClean;
+typedef struct _PuEmmcPlanEntry {
+    /* Output range in bytes */
+    goffset offset;
+    goffset length;
+    /* Order in the plan, cleaning before any binary it overlaps */
+    goffset position;
+    PuIoCleanMethod method;
+    /* The binary written, or NULL for cleaning the range */
+    PuEmmcBinary *bin;
+    gchar *path;
+} PuEmmcPlanEntry;
+
+/*
+ * A partition mounted once for populating it with all of its archive and file
+ * inputs. Files are collected and copied concurrently until an input needs
+ * them to be in place.
+ */
+typedef struct _PuEmmcSession {
+    const gchar *part_path;
+    guint idx;
+    gchar *part_mount;
+    gboolean mounted;
+    GPtrArray *files;
+    goffset bytes;
+    gint64 time_start;
+    PuStatsStep *step;
+
+    /* First error of the copy workers */
+    GMutex lock;
+    GError *error;
+} PuEmmcSession;
 
 struct _PuEmmc {
     PuFlash parent_instance;
@@ -78,10 +126,454 @@ struct _PuEmmc {
     GList *clean;
     GList *raw;
     PuEmmcControls *mmc_controls;
+
+    gboolean discard;
+    GArray *discard_keep;
+    gboolean discarded;
+    /* The partition table on the device matches the layout and is kept */
+    gboolean layout_kept;
 };
 
 G_DEFINE_TYPE(PuEmmc, pu_emmc, PU_TYPE_FLASH)
 
+static PuEmmcInput *
+emmc_input_new_from_mapping(GHashTable *mapping,
+                            GError **error)
+{
+    PuEmmcInput *input;
+    g_autofree gchar *holes = NULL;
+    g_autofree gchar *checksum_stream = NULL;
+
+    g_return_val_if_fail(mapping != NULL, NULL);
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    holes = pu_hash_table_lookup_string(mapping, "holes", "skip");
+    if (!g_str_equal(holes, "skip") && !g_str_equal(holes, "zero")) {
+        g_set_error(error, PU_ERROR, PU_ERROR_EMMC_PARSE,
+                    "Invalid value '%s' for 'holes' of input", holes);
+        return NULL;
+    }
+
+    checksum_stream = pu_hash_table_lookup_string(mapping, "checksum-stream",
+                                                  "compressed");
+    if (!g_str_equal(checksum_stream, "compressed") &&
+        !g_str_equal(checksum_stream, "decompressed")) {
+        g_set_error(error, PU_ERROR, PU_ERROR_EMMC_PARSE,
+                    "Invalid value '%s' for 'checksum-stream' of input",
+                    checksum_stream);
+        return NULL;
+    }
+
+    input = g_new0(PuEmmcInput, 1);
+    input->filename = pu_hash_table_lookup_string(mapping, "filename", "");
+    input->md5sum = pu_hash_table_lookup_string(mapping, "md5sum", "");
+    input->sha256sum = pu_hash_table_lookup_string(mapping, "sha256sum", "");
+    input->bmap = pu_hash_table_lookup_string(mapping, "bmap", "");
+    input->zero_holes = g_str_equal(holes, "zero");
+    input->checksum_decompressed = g_str_equal(checksum_stream, "decompressed");
+
+    return input;
+}
+
+static void
+emmc_input_free(PuEmmcInput *input)
+{
+    if (!input)
+        return;
+
+    g_free(input->filename);
+    g_free(input->md5sum);
+    g_free(input->sha256sum);
+    g_free(input->bmap);
+    g_free(input);
+}
+
+static inline PuWriteFlags
+emmc_input_get_write_flags(PuEmmcInput *input)
+{
+    return input->zero_holes ? PU_WRITE_FLAGS_ZERO_HOLES : PU_WRITE_FLAGS_NONE;
+}
+
+/* The MD5 and SHA256 sums cover the file as stored unless configured otherwise */
+static inline PuIoDigestScope
+emmc_input_get_digest_scope(PuEmmcInput *input)
+{
+    return input->checksum_decompressed ? PU_IO_DIGEST_INPUT : PU_IO_DIGEST_FILE;
+}
+
+/*
+ * Get the size of an input after decompressing it, unless it was already
+ * determined while parsing.
+ */
+static gboolean
+emmc_input_update_size(PuEmmcInput *input,
+                       const gchar *path,
+                       GError **error)
+{
+    goffset size;
+
+    if (input->_size > 0)
+        return TRUE;
+
+    if (!pu_decompress_get_size(path, &size, error))
+        return FALSE;
+
+    if (size == 0) {
+        g_set_error(error, PU_ERROR, PU_ERROR_FLASH_DATA,
+                    "Input file '%s' is empty", path);
+        return FALSE;
+    }
+
+    input->_size = size;
+
+    return TRUE;
+}
+
+/*
+ * Checksums of the input file as stored are cached for the installation, so
+ * inputs referenced multiple times are only checksummed once.
+ */
+static gboolean
+emmc_input_needs_digest(PuEmmcInput *input,
+                        const gchar *path,
+                        const gchar *expected,
+                        GChecksumType checksum_type)
+{
+    if (g_str_equal(expected, ""))
+        return FALSE;
+
+    return emmc_input_get_digest_scope(input) != PU_IO_DIGEST_FILE ||
+           pu_checksum_cache_lookup(path, checksum_type) == NULL;
+}
+
+/*
+ * Create the digests computed while writing an input: its given MD5 and SHA256
+ * sums, unless already known, and, if requested, the SHA1 sum of the written
+ * data used for verifying the output.
+ */
+static GArray *
+emmc_input_new_digests(PuEmmcInput *input,
+                       const gchar *path,
+                       gboolean skip_checksums,
+                       gboolean verify_output)
+{
+    GArray *digests = pu_io_digests_new();
+
+    if (skip_checksums)
+        return digests;
+
+    if (emmc_input_needs_digest(input, path, input->md5sum, G_CHECKSUM_MD5))
+        pu_io_digests_add(digests, emmc_input_get_digest_scope(input),
+                          G_CHECKSUM_MD5);
+    if (emmc_input_needs_digest(input, path, input->sha256sum, G_CHECKSUM_SHA256))
+        pu_io_digests_add(digests, emmc_input_get_digest_scope(input),
+                          G_CHECKSUM_SHA256);
+    if (verify_output)
+        pu_io_digests_add(digests, PU_IO_DIGEST_WRITTEN, G_CHECKSUM_SHA1);
+
+    return digests;
+}
+
+static gboolean
+emmc_input_check_digest(PuEmmcInput *input,
+                        const gchar *path,
+                        const gchar *expected,
+                        GArray *digests,
+                        GChecksumType checksum_type,
+                        GError **error)
+{
+    PuIoDigestScope scope = emmc_input_get_digest_scope(input);
+    const gchar *computed = pu_io_digests_get_string(digests, scope,
+                                                     checksum_type);
+
+    if (scope == PU_IO_DIGEST_FILE) {
+        if (computed)
+            pu_checksum_cache_insert(path, checksum_type, computed);
+        else
+            computed = pu_checksum_cache_lookup(path, checksum_type);
+    }
+
+    if (g_str_equal(expected, "") || computed == NULL)
+        return TRUE;
+
+    if (!g_str_equal(expected, computed)) {
+        g_set_error(error, PU_ERROR, PU_ERROR_CHECKSUM,
+                    "Given checksum '%s' of file '%s' does not match '%s'",
+                    expected, path, computed);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Check the MD5 and SHA256 sums of an input computed while writing it. As the
+ * input is only checked after writing, a mismatch fails the installation
+ * instead of preventing the write.
+ */
+static gboolean
+emmc_input_check_digests(PuEmmcInput *input,
+                         const gchar *path,
+                         GArray *digests,
+                         GError **error)
+{
+    g_debug("Checking MD5 and SHA256 sums of input file '%s'", path);
+
+    if (!emmc_input_check_digest(input, path, input->md5sum, digests,
+                                 G_CHECKSUM_MD5, error))
+        return FALSE;
+
+    return emmc_input_check_digest(input, path, input->sha256sum, digests,
+                                   G_CHECKSUM_SHA256, error);
+}
+
+/*
+ * Load the block map of an input, either given explicitly by 'bmap' or found
+ * next to the input file. The block map of a compressed input may also be
+ * named after the decompressed file. bmap is set to NULL if there is none.
+ */
+static gboolean
+emmc_input_load_bmap(PuEmmcInput *input,
+                     const gchar *path,
+                     const gchar *prefix,
+                     PuBmap **bmap,
+                     GError **error)
+{
+    g_autofree gchar *bmap_path = NULL;
+    g_autofree gchar *stripped = NULL;
+    g_autoptr(PuBmap) map = NULL;
+    goffset size = 0;
+
+    *bmap = NULL;
+
+    if (!g_str_equal(input->bmap, "")) {
+        bmap_path = pu_path_from_filename(input->bmap, prefix, error);
+        if (bmap_path == NULL) {
+            g_prefix_error(error, "Failed parsing bmap filename for input: ");
+            return FALSE;
+        }
+    } else {
+        stripped = pu_compression_strip_suffix(path);
+        bmap_path = pu_bmap_find_for_file(path);
+        if (bmap_path == NULL)
+            bmap_path = pu_bmap_find_for_file(stripped);
+        if (bmap_path == NULL)
+            return TRUE;
+    }
+
+    g_debug("Using bmap '%s' for input '%s'", bmap_path, path);
+
+    map = pu_bmap_new_from_file(bmap_path, error);
+    if (map == NULL)
+        return FALSE;
+
+    if (!pu_decompress_get_size(path, &size, error))
+        return FALSE;
+    if (size != pu_bmap_get_image_size(map)) {
+        if (error && *error == NULL)
+            g_set_error(error, PU_ERROR, PU_ERROR_FLASH_DATA,
+                        "Image size of bmap '%s' does not match size of '%s'",
+                        bmap_path, path);
+        return FALSE;
+    }
+
+    *bmap = g_steal_pointer(&map);
+
+    return TRUE;
+}
+
+/*
+ * Extents of an input written without block map, starting at input_offset.
+ * Holes of the input are not written, so only its data extents are returned.
+ * Compressed inputs are written completely up to their decompressed size.
+ */
+static GArray *
+emmc_input_get_written_extents(PuEmmcInput *input,
+                               const gchar *path,
+                               goffset input_offset,
+                               GError **error)
+{
+    GArray *extents;
+
+    if (pu_compression_from_filename(path) != PU_COMPRESSION_NONE) {
+        PuFileExtent all = { input_offset, input->_size - input_offset };
+
+        extents = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+        g_array_append_val(extents, all);
+        return extents;
+    }
+
+    return pu_file_get_data_extents(path, input_offset, -1, error);
+}
+
+/*
+ * Verify the written output of a binary. If a block map is available, the
+ * checksums of its mapped ranges are verified. Otherwise, the SHA1 sum of the
+ * data written from the input is compared with the output.
+ */
+static gboolean
+emmc_verify_binary(PuEmmc *self,
+                   PuEmmcBinary *bin,
+                   PuBmap *bmap,
+                   const gchar *sha1sum,
+                   const gchar *input_path,
+                   const gchar *output_path,
+                   GError **error)
+{
+    g_autoptr(GArray) extents = NULL;
+    goffset input_offset = bin->input_offset * self->device->sector_size;
+    goffset output_offset = bin->output_offset * self->device->sector_size;
+
+    /* Ranges of the block map can only be verified if written completely */
+    if (bmap && input_offset == 0)
+        return pu_bmap_verify(bmap, output_path, output_offset, error);
+
+    if (bmap)
+        extents = pu_bmap_get_extents(bmap, input_offset);
+    else
+        extents = emmc_input_get_written_extents(bin->input, input_path,
+                                                 input_offset, error);
+    if (extents == NULL)
+        return FALSE;
+
+    g_debug("Verifying SHA1 sum of written output: %s", sha1sum);
+
+    return pu_checksum_verify_extents(output_path, extents,
+                                      output_offset - input_offset,
+                                      sha1sum, G_CHECKSUM_SHA1, error);
+}
+
+/*
+ * Write an input as raw data to whole partitions, taking its block map into
+ * account, if available. The input is read and its checksums are verified only
+ * once for all partitions, while each partition is read back separately,
+ * either against the block map or the SHA1 sum of the written data.
+ */
+static gboolean
+emmc_write_partition_raw(PuEmmc *self,
+                         PuEmmcInput *input,
+                         const gchar *path,
+                         GPtrArray *part_paths,
+                         const gchar *prefix,
+                         gboolean skip_checksums,
+                         GError **error)
+{
+    g_autoptr(PuBmap) bmap = NULL;
+    g_autoptr(GArray) extents = NULL;
+    g_autoptr(GArray) digests = NULL;
+    g_autofree PuIoOutput *outputs = g_new0(PuIoOutput, part_paths->len);
+    const gchar *sha1sum = NULL;
+    guint n_outputs = 0;
+    gboolean res = FALSE;
+
+    if (!emmc_input_load_bmap(input, path, prefix, &bmap, error))
+        return FALSE;
+
+    if (bmap)
+        extents = pu_bmap_get_extents(bmap, 0);
+
+    for (; n_outputs < part_paths->len; n_outputs++) {
+        outputs[n_outputs].path = g_ptr_array_index(part_paths, n_outputs);
+        outputs[n_outputs].fd = g_open(outputs[n_outputs].path,
+                                       O_WRONLY | O_CLOEXEC, 0);
+        if (outputs[n_outputs].fd < 0) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Failed opening '%s': %s", outputs[n_outputs].path,
+                        g_strerror(errno));
+            goto out;
+        }
+    }
+
+    digests = emmc_input_new_digests(input, path, skip_checksums, bmap == NULL);
+    res = pu_write_raw_extents_multi(path, outputs, n_outputs, self->device,
+                                     0, 0, 0, extents, digests,
+                                     emmc_input_get_write_flags(input), error);
+
+out:
+    for (guint i = 0; i < n_outputs; i++)
+        g_close(outputs[i].fd, NULL);
+
+    if (!res)
+        return FALSE;
+
+    if (skip_checksums)
+        return TRUE;
+
+    if (!emmc_input_check_digests(input, path, digests, error))
+        return FALSE;
+
+    if (bmap == NULL) {
+        sha1sum = pu_io_digests_get_string(digests, PU_IO_DIGEST_WRITTEN,
+                                           G_CHECKSUM_SHA1);
+        g_clear_pointer(&extents, g_array_unref);
+        extents = emmc_input_get_written_extents(input, path, 0, error);
+        if (extents == NULL)
+            return FALSE;
+    }
+
+    for (guint i = 0; i < part_paths->len; i++) {
+        const gchar *part_path = g_ptr_array_index(part_paths, i);
+
+        if (bmap)
+            res = pu_bmap_verify(bmap, part_path, 0, error);
+        else
+            res = pu_checksum_verify_extents(part_path, extents, 0, sha1sum,
+                                             G_CHECKSUM_SHA1, error);
+        if (!res)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* The only input of a partition without filesystem, otherwise NULL */
+static PuEmmcInput *
+emmc_partition_get_raw_input(PuEmmcPartition *part)
+{
+    if (part->filesystem || part->input == NULL || part->input->next)
+        return NULL;
+
+    return part->input->data;
+}
+
+static gboolean
+emmc_input_equal(PuEmmcInput *a,
+                 PuEmmcInput *b)
+{
+    return g_strcmp0(a->filename, b->filename) == 0 &&
+           g_strcmp0(a->md5sum, b->md5sum) == 0 &&
+           g_strcmp0(a->sha256sum, b->sha256sum) == 0 &&
+           g_strcmp0(a->bmap, b->bmap) == 0 &&
+           a->zero_holes == b->zero_holes &&
+           a->checksum_decompressed == b->checksum_decompressed;
+}
+
+/*
+ * Number the partitions like their device nodes, where logical partitions
+ * start at 5.
+ */
+static GArray *
+emmc_get_partition_numbers(PuEmmc *self)
+{
+    GArray *numbers = g_array_new(FALSE, FALSE, sizeof(guint));
+    gboolean first_logical_part = FALSE;
+    guint idx = 0;
+
+    for (GList *p = self->partitions; p != NULL; p = p->next) {
+        PuEmmcPartition *part = p->data;
+
+        if (part->type == PED_PARTITION_LOGICAL && first_logical_part == FALSE) {
+            first_logical_part = TRUE;
+            idx = 5;
+        } else {
+            idx++;
+        }
+        g_array_append_val(numbers, idx);
+    }
+
+    return numbers;
+}
+
 static gboolean
 emmc_create_partition(PuEmmc *self,
                       PuEmmcPartition *part,
@@ -184,108 +676,1267 @@ emmc_create_partition(PuEmmc *self,
                         "Failed setting partition flag '%s'",
                         ped_partition_flag_get_name(GPOINTER_TO_INT(f->data)));
             return FALSE;
-        }
+        }
+    }
+
+    if (ped_disk_add_partition(self->disk, newpart, final_constr) != 1) {
+        g_set_error(error, PU_ERROR, PU_ERROR_FLASH_LAYOUT,
+                    "Failed adding partition to disk");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gint
+emmc_extent_compare(gconstpointer a,
+                    gconstpointer b)
+{
+    const PuFileExtent *extent_a = a;
+    const PuFileExtent *extent_b = b;
+
+    if (extent_a->offset < extent_b->offset)
+        return -1;
+
+    return extent_a->offset > extent_b->offset;
+}
+
+/*
+ * Discard the whole user area of the device except for the ranges to keep. Boot
+ * partitions are separate devices and thus not affected. Devices not
+ * supporting discard are left as they are.
+ */
+static void
+emmc_discard_device(PuEmmc *self)
+{
+    g_autoptr(GArray) extents = NULL;
+    g_autoptr(GError) error = NULL;
+    goffset device_size = self->device->length * self->device->sector_size;
+    goffset offset = 0;
+
+    extents = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+    g_array_sort(self->discard_keep, emmc_extent_compare);
+
+    for (guint i = 0; i < self->discard_keep->len; i++) {
+        PuFileExtent *keep = &g_array_index(self->discard_keep, PuFileExtent, i);
+
+        if (keep->offset > offset) {
+            PuFileExtent extent = { offset, MIN(keep->offset, device_size) - offset };
+            if (extent.length > 0)
+                g_array_append_val(extents, extent);
+        }
+        offset = MAX(offset, keep->offset + keep->length);
+    }
+
+    if (offset < device_size) {
+        PuFileExtent extent = { offset, device_size - offset };
+        g_array_append_val(extents, extent);
+    }
+
+    g_message("Discarding MMC");
+
+    if (!pu_io_discard(self->device->path, extents, &error)) {
+        g_warning("Skipping discard of the device: %s", error->message);
+        return;
+    }
+
+    self->discarded = TRUE;
+}
+
+static gboolean
+emmc_partition_get_flag(PedPartition *part,
+                        PedPartitionFlag flag)
+{
+    return ped_partition_is_flag_available(part, flag) &&
+           ped_partition_get_flag(part, flag);
+}
+
+/*
+ * Compare a partition on the device with the one planned by the layout. The
+ * type of the partition entry is derived from the filesystem, which is only
+ * compared if the layout gives one, as the device holds any data otherwise.
+ */
+static gboolean
+emmc_partitions_equal(PedPartition *a,
+                      PedPartition *b)
+{
+    const PedPartitionType mask = PED_PARTITION_LOGICAL | PED_PARTITION_EXTENDED;
+    PedPartitionFlag flag = 0;
+    const gchar *name_a;
+    const gchar *name_b;
+
+    if (a->num != b->num || (a->type & mask) != (b->type & mask) ||
+        a->geom.start != b->geom.start || a->geom.length != b->geom.length)
+        return FALSE;
+
+    if (b->fs_type && (a->fs_type == NULL ||
+                       g_strcmp0(a->fs_type->name, b->fs_type->name) != 0))
+        return FALSE;
+
+    while ((flag = ped_partition_flag_next(flag)) != 0) {
+        if (emmc_partition_get_flag(a, flag) != emmc_partition_get_flag(b, flag))
+            return FALSE;
+    }
+
+    if (!ped_disk_type_check_feature(a->disk->type, PED_DISK_TYPE_PARTITION_NAME))
+        return TRUE;
+
+    name_a = ped_partition_get_name(a);
+    name_b = ped_partition_get_name(b);
+
+    return g_strcmp0(name_a ? name_a : "", name_b ? name_b : "") == 0;
+}
+
+/* Add the partitions of the layout to the disk, without committing it */
+static gboolean
+emmc_add_partitions(PuEmmc *self,
+                    GError **error)
+{
+    PedSector part_start = 0;
+
+    for (GList *p = self->partitions; p != NULL; p = p->next) {
+        PuEmmcPartition *part = p->data;
+
+        if (part->expand) {
+            part->size = self->expanded_part_size;
+        }
+
+        g_debug("Creating partition: type=%d filesystem=%s start=%lld size=%lld "
+                "offset=%lld block-size=%lld expand=%s",
+                part->type, part->filesystem, part_start, part->size,
+                part->offset, part->block_size, part->expand ? "true" : "false");
+
+        if (part->type == PED_PARTITION_LOGICAL && !ped_disk_extended_partition(self->disk)) {
+            PuEmmcPartition extpart = {0};
+            if (!ped_disk_type_check_feature(self->disk->type, PED_DISK_TYPE_EXTENDED)) {
+                g_set_error(error, PU_ERROR, PU_ERROR_FLASH_LAYOUT,
+                            "Logical partitions are not supported on this disk");
+                return FALSE;
+            }
+            extpart.type = PED_PARTITION_EXTENDED;
+            extpart.size = self->device->length - part_start;
+            g_debug("Creating extended partition: type=%d start=%lld size=%lld",
+                    part->type, part_start, part->size);
+            if (!emmc_create_partition(self, &extpart, part_start, error)) {
+                return FALSE;
+            }
+        }
+
+        if (!emmc_create_partition(self, part, part_start + part->offset, error)) {
+            return FALSE;
+        }
+        part_start += part->size + part->offset;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Check whether the partition table on the device is the one the layout would
+ * create. The layout is computed on a fresh disk in memory and compared by the
+ * number, type, start, length, filesystem type, flags and name of all
+ * partitions and by PARTUUIDs.
+ * Returns the disk read from the device if it matches, NULL otherwise.
+ */
+static PedDisk *
+emmc_read_matching_disk(PuEmmc *self)
+{
+    g_autoptr(GError) error = NULL;
+    PedDisk *existing;
+    PedDisk *planned;
+    PedPartition *a = NULL;
+    PedPartition *b = NULL;
+    gboolean matches = TRUE;
+    guint idx = 0;
+    gboolean first_logical_part = FALSE;
+
+    if (ped_disk_probe(self->device) != self->disktype)
+        return NULL;
+
+    existing = ped_disk_new(self->device);
+    if (existing == NULL)
+        return NULL;
+
+    planned = ped_disk_new_fresh(self->device, self->disktype);
+    if (planned == NULL) {
+        ped_disk_destroy(existing);
+        return NULL;
+    }
+
+    self->disk = planned;
+    if (!emmc_add_partitions(self, &error)) {
+        g_debug("Failed computing the partition layout: %s", error->message);
+        matches = FALSE;
+    }
+    self->disk = NULL;
+
+    while (matches) {
+        do {
+            a = ped_disk_next_partition(existing, a);
+        } while (a && a->num <= 0);
+        do {
+            b = ped_disk_next_partition(planned, b);
+        } while (b && b->num <= 0);
+
+        if (a == NULL || b == NULL) {
+            matches = a == b;
+            break;
+        }
+        matches = emmc_partitions_equal(a, b);
+    }
+
+    for (GList *p = self->partitions; matches && p != NULL; p = p->next) {
+        PuEmmcPartition *part = p->data;
+        g_autofree gchar *partuuid = NULL;
+
+        if (part->type == PED_PARTITION_LOGICAL && first_logical_part == FALSE) {
+            first_logical_part = TRUE;
+            idx = 5;
+        } else {
+            idx++;
+        }
+
+        if (g_strcmp0(part->partuuid, "") <= 0 ||
+            !g_str_equal(self->disktype->name, "gpt"))
+            continue;
+
+        partuuid = pu_partition_get_partuuid(self->device->path, idx);
+        matches = partuuid && g_ascii_strcasecmp(partuuid, part->partuuid) == 0;
+    }
+
+    ped_disk_destroy(planned);
+    if (!matches) {
+        ped_disk_destroy(existing);
+        return NULL;
+    }
+
+    return existing;
+}
+
+static gboolean
+pu_emmc_init_device(PuFlash *flash,
+                    GError **error)
+{
+    PuEmmc *self = PU_EMMC(flash);
+    PedDisk *newdisk;
+    gboolean incremental = FALSE;
+
+    g_return_val_if_fail(flash != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    g_object_get(flash,
+                 "incremental", &incremental,
+                 NULL);
+
+    if (incremental && self->disktype != NULL) {
+        newdisk = emmc_read_matching_disk(self);
+        if (newdisk) {
+            g_message("Partition table of MMC matches the layout, keeping it");
+            self->disk = newdisk;
+            self->layout_kept = TRUE;
+            return TRUE;
+        }
+        g_debug("Partition table of MMC differs from the layout");
+    }
+
+    if (self->discard)
+        emmc_discard_device(self);
+
+    if (self->disktype == NULL) {
+        g_debug("Nothing to initialize");
+        return TRUE;
+    }
+
+    g_message("Initializing MMC with new disklabel");
+
+    newdisk = ped_disk_new_fresh(self->device, self->disktype);
+    if (newdisk == NULL) {
+        g_set_error(error, PU_ERROR, PU_ERROR_FLASH_INIT,
+                    "Failed creating new disk");
+        return FALSE;
+    }
+
+    if (self->disk) {
+        ped_disk_destroy(self->disk);
+    }
+    /* The new disklabel is written along with the partitions */
+    self->disk = newdisk;
+
+    return TRUE;
+}
+
+/* PARTUUIDs by partition number, NULL if none are set */
+static GPtrArray *
+emmc_get_partuuids(PuEmmc *self)
+{
+    g_autoptr(GPtrArray) partuuids = g_ptr_array_new();
+    g_autoptr(GArray) numbers = emmc_get_partition_numbers(self);
+    gboolean any = FALSE;
+    guint pos = 0;
+
+    for (GList *p = self->partitions; p != NULL; p = p->next, pos++) {
+        PuEmmcPartition *part = p->data;
+        guint idx = g_array_index(numbers, guint, pos);
+
+        if (g_strcmp0(part->partuuid, "") <= 0)
+            continue;
+
+        if (idx > partuuids->len)
+            g_ptr_array_set_size(partuuids, idx);
+        g_ptr_array_index(partuuids, idx - 1) = part->partuuid;
+        any = TRUE;
+    }
+
+    return any ? g_steal_pointer(&partuuids) : NULL;
+}
+
+/*
+ * Write the partition table to the device, set the PARTUUIDs of a GPT in the
+ * written table and then let the kernel know about all partitions at once.
+ */
+static gboolean
+emmc_commit_disk(PuEmmc *self,
+                 GError **error)
+{
+    g_autoptr(GPtrArray) partuuids = emmc_get_partuuids(self);
+
+    if (!ped_disk_commit_to_dev(self->disk)) {
+        g_set_error(error, PU_ERROR, PU_ERROR_FLASH_LAYOUT,
+                    "Failed writing partition table to '%s'",
+                    self->device->path);
+        return FALSE;
+    }
+
+    if (partuuids) {
+        if (g_str_equal(self->disktype->name, "gpt")) {
+            if (!pu_gpt_set_partuuids(self->device, partuuids, error))
+                return FALSE;
+        } else {
+            g_warning("Setting PARTUUID is only supported on GPT partitioned devices");
+        }
+    }
+
+    if (!ped_disk_commit_to_os(self->disk))
+        g_warning("Failed informing the kernel about the partitions of '%s'",
+                  self->device->path);
+
+    return TRUE;
+}
+
+static gboolean
+pu_emmc_setup_layout(PuFlash *flash,
+                     GError **error)
+{
+    PuEmmc *self = PU_EMMC(flash);
+
+    g_return_val_if_fail(flash != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    if (self->disktype == NULL) {
+        g_debug("No partitions to set up");
+        return TRUE;
+    }
+
+    if (self->layout_kept) {
+        g_debug("Partition table matches the layout, not repartitioning");
+        return TRUE;
+    }
+
+    g_message("Partitioning MMC");
+
+    if (!emmc_add_partitions(self, error))
+        return FALSE;
+
+    if (!emmc_commit_disk(self, error))
+        return FALSE;
+
+    if (!pu_wait_for_partitions(error))
+        return FALSE;
+
+    return TRUE;
+}
+
+/*
+ * Compute a fingerprint of everything the content of a partition is created
+ * from, i.e. its filesystem options and the digests of its inputs. Inputs
+ * without checksum in the layout are hashed.
+ */
+static gchar *
+emmc_partition_get_fingerprint(PuEmmcPartition *part,
+                               const gchar *prefix,
+                               GError **error)
+{
+    g_autoptr(GString) spec = g_string_new(NULL);
+
+    g_string_append_printf(spec, "filesystem=%s\nlabel=%s\nmkfs-extra-args=%s\n",
+                           part->filesystem ? part->filesystem : "",
+                           part->label ? part->label : "",
+                           part->mkfs_extra_args ? part->mkfs_extra_args : "");
+
+    for (GList *i = part->input; i != NULL; i = i->next) {
+        PuEmmcInput *input = i->data;
+        g_autofree gchar *path = NULL;
+        g_autofree gchar *digest = NULL;
+
+        if (!g_str_equal(input->sha256sum, "")) {
+            digest = g_strdup(input->sha256sum);
+        } else if (!g_str_equal(input->md5sum, "")) {
+            digest = g_strdup(input->md5sum);
+        } else {
+            path = pu_path_from_filename(input->filename, prefix, error);
+            if (path == NULL)
+                return NULL;
+            digest = pu_checksum_new_from_file(path, 0, G_CHECKSUM_SHA256, error);
+            if (digest == NULL)
+                return NULL;
+        }
+
+        g_string_append_printf(spec, "input=%s %s\n", input->filename, digest);
+    }
+
+    return g_compute_checksum_for_string(G_CHECKSUM_SHA256, spec->str, spec->len);
+}
+
+/* Read the fingerprint stored on a partition, NULL if there is none */
+static gchar *
+emmc_manifest_read(const gchar *part_path,
+                   guint idx)
+{
+    g_autoptr(GKeyFile) manifest = g_key_file_new();
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *part_mount = NULL;
+    g_autofree gchar *path = NULL;
+    gchar *fingerprint = NULL;
+
+    part_mount = pu_create_mount_point(g_strdup_printf("p%u", idx), &error);
+    if (part_mount == NULL)
+        return NULL;
+    if (!pu_mount(part_path, part_mount, NULL, "ro", &error)) {
+        g_debug("Failed reading manifest of '%s': %s", part_path, error->message);
+        g_rmdir(part_mount);
+        return NULL;
+    }
+
+    path = g_build_filename(part_mount, MANIFEST_FILENAME, NULL);
+    if (g_key_file_load_from_file(manifest, path, G_KEY_FILE_NONE, NULL))
+        fingerprint = g_key_file_get_string(manifest, "partition", "fingerprint",
+                                            NULL);
+
+    if (!pu_umount(part_mount, &error))
+        g_warning("%s", error->message);
+    g_rmdir(part_mount);
+
+    return fingerprint;
+}
+
+/* Store the fingerprint of a partition in its mounted filesystem */
+static gboolean
+emmc_manifest_save(const gchar *part_mount,
+                   const gchar *fingerprint,
+                   GError **error)
+{
+    g_autoptr(GKeyFile) manifest = g_key_file_new();
+    g_autofree gchar *path = NULL;
+
+    g_key_file_set_string(manifest, "partition", "fingerprint", fingerprint);
+    path = g_build_filename(part_mount, MANIFEST_FILENAME, NULL);
+
+    return g_key_file_save_to_file(manifest, path, error);
+}
+
+/* Store the fingerprint of a partition in its filesystem */
+static gboolean
+emmc_manifest_write(const gchar *part_path,
+                    guint idx,
+                    const gchar *fingerprint,
+                    GError **error)
+{
+    g_autofree gchar *part_mount = NULL;
+    gboolean res;
+
+    part_mount = pu_create_mount_point(g_strdup_printf("p%u", idx), error);
+    if (part_mount == NULL)
+        return FALSE;
+    if (!pu_mount(part_path, part_mount, NULL, NULL, error)) {
+        g_rmdir(part_mount);
+        return FALSE;
+    }
+
+    res = emmc_manifest_save(part_mount, fingerprint, error) &&
+          pu_io_flush_filesystem(part_mount, error);
+
+    if (!pu_umount(part_mount, res ? error : NULL))
+        res = FALSE;
+    g_rmdir(part_mount);
+
+    return res;
+}
+
+static void
+emmc_plan_entry_clear(gpointer data)
+{
+    PuEmmcPlanEntry *entry = data;
+
+    g_free(entry->path);
+}
+
+static gint
+emmc_plan_entry_compare(gconstpointer a,
+                        gconstpointer b)
+{
+    const PuEmmcPlanEntry *entry_a = a;
+    const PuEmmcPlanEntry *entry_b = b;
+
+    if (entry_a->position != entry_b->position)
+        return entry_a->position < entry_b->position ? -1 : 1;
+
+    /* Clean before writing a binary at the same position */
+    if ((entry_a->bin == NULL) != (entry_b->bin == NULL))
+        return entry_a->bin == NULL ? -1 : 1;
+
+    if (entry_a->offset != entry_b->offset)
+        return entry_a->offset < entry_b->offset ? -1 : 1;
+
+    return 0;
+}
+
+/*
+ * Plan cleaning regions and writing binaries as a single forward sweep over the
+ * device, sorted by their output offsets. Overlapping or adjacent regions
+ * cleaned with the same method are merged into one request. A region
+ * overlapping a binary is cleaned before the binary is written, as the binary
+ * was written after all regions were cleaned in the order of the layout.
+ */
+static GArray *
+emmc_plan_raw_area(PuEmmc *self,
+                   const gchar *prefix,
+                   GError **error)
+{
+    g_autoptr(GArray) cleans = g_array_new(FALSE, FALSE, sizeof(PuEmmcPlanEntry));
+    g_autoptr(GArray) plan = g_array_new(FALSE, FALSE, sizeof(PuEmmcPlanEntry));
+    PedSector sector_size = self->device->sector_size;
+
+    g_array_set_clear_func(plan, emmc_plan_entry_clear);
+
+    for (GList *c = self->clean; c != NULL; c = c->next) {
+        PuEmmcClean *clean = c->data;
+        PuEmmcPlanEntry entry = { 0 };
+
+        if (clean->size == 0) {
+            g_warning("Size 0 specified. Skipping cleaning at %lld", clean->offset);
+            continue;
+        }
+
+        entry.offset = clean->offset * sector_size;
+        entry.length = clean->size * sector_size;
+        entry.method = clean->method;
+        entry.position = entry.offset;
+        g_array_append_val(cleans, entry);
+    }
+
+    g_array_sort(cleans, emmc_plan_entry_compare);
+
+    /* Merge regions cleaned with the same method */
+    for (guint i = 0; i < cleans->len; i++) {
+        PuEmmcPlanEntry *entry = &g_array_index(cleans, PuEmmcPlanEntry, i);
+        PuEmmcPlanEntry *last = plan->len > 0 ?
+            &g_array_index(plan, PuEmmcPlanEntry, plan->len - 1) : NULL;
+
+        if (last && last->method == entry->method &&
+            entry->offset <= last->offset + last->length) {
+            last->length = MAX(last->length, entry->offset + entry->length -
+                               last->offset);
+            continue;
+        }
+
+        g_array_append_val(plan, *entry);
+    }
+
+    for (GList *b = self->raw; b != NULL; b = b->next) {
+        PuEmmcBinary *bin = b->data;
+        PuEmmcPlanEntry entry = { 0 };
+
+        entry.path = pu_path_from_filename(bin->input->filename, prefix, error);
+        if (entry.path == NULL) {
+            g_prefix_error(error, "Failed parsing input filename for binary: ");
+            return NULL;
+        }
+
+        if (g_str_equal(entry.path, "")) {
+            g_warning("No input specified for binary");
+            g_free(entry.path);
+            continue;
+        }
+
+        if (!emmc_input_update_size(bin->input, entry.path, error)) {
+            g_prefix_error(error, "Failed retrieving file size for binary: ");
+            g_free(entry.path);
+            return NULL;
+        }
+
+        entry.bin = bin;
+        entry.offset = bin->output_offset * sector_size;
+        entry.length = bin->input->_size - bin->input_offset * sector_size;
+        entry.position = entry.offset;
+        g_array_append_val(plan, entry);
+    }
+
+    /* Move regions before the binaries they overlap */
+    for (guint i = 0; i < plan->len; i++) {
+        PuEmmcPlanEntry *entry = &g_array_index(plan, PuEmmcPlanEntry, i);
+
+        if (entry->bin != NULL)
+            continue;
+
+        for (guint j = 0; j < plan->len; j++) {
+            PuEmmcPlanEntry *bin = &g_array_index(plan, PuEmmcPlanEntry, j);
+
+            if (bin->bin != NULL && bin->offset < entry->offset + entry->length &&
+                entry->offset < bin->offset + bin->length)
+                entry->position = MIN(entry->position, bin->offset);
+        }
+    }
+
+    g_array_sort(plan, emmc_plan_entry_compare);
+
+    return g_steal_pointer(&plan);
+}
+
+/*
+ * Write a binary to the already opened device and verify it, taking its block
+ * map into account, if available.
+ */
+static gboolean
+emmc_write_binary(PuEmmc *self,
+                  PuEmmcBinary *bin,
+                  const gchar *path,
+                  gint fd,
+                  const gchar *prefix,
+                  gboolean skip_checksums,
+                  GError **error)
+{
+    PuEmmcInput *input = bin->input;
+    g_autoptr(PuBmap) bmap = NULL;
+    g_autoptr(GArray) extents = NULL;
+    g_autoptr(GArray) digests = NULL;
+
+    g_debug("Writing raw data: filename=%s input_offset=%lld output_offset=%lld",
+            input->filename, bin->input_offset, bin->output_offset);
+
+    if (!emmc_input_load_bmap(input, path, prefix, &bmap, error))
+        return FALSE;
+    if (bmap)
+        extents = pu_bmap_get_extents(bmap, bin->input_offset *
+                                      self->device->sector_size);
+
+    digests = emmc_input_new_digests(input, path, skip_checksums,
+                                     bmap == NULL || bin->input_offset > 0);
+    if (!pu_write_raw_extents_fd(path, fd, self->device->path, self->device,
+                                 bin->input_offset, bin->output_offset, 0,
+                                 extents, digests,
+                                 emmc_input_get_write_flags(input), error))
+        return FALSE;
+
+    if (skip_checksums)
+        return TRUE;
+
+    if (!emmc_input_check_digests(input, path, digests, error))
+        return FALSE;
+
+    return emmc_verify_binary(self, bin, bmap,
+                              pu_io_digests_get_string(digests, PU_IO_DIGEST_WRITTEN,
+                                                       G_CHECKSUM_SHA1),
+                              path, self->device->path, error);
+}
+
+/*
+ * Clean regions and write binaries outside of partitions following the plan,
+ * through a single handle of the device.
+ */
+static gboolean
+emmc_write_raw_area(PuEmmc *self,
+                    const gchar *prefix,
+                    gboolean skip_checksums,
+                    GError **error)
+{
+    g_autoptr(GArray) plan = NULL;
+    gboolean res = TRUE;
+    gint fd;
+
+    plan = emmc_plan_raw_area(self, prefix, error);
+    if (plan == NULL)
+        return FALSE;
+
+    if (plan->len == 0)
+        return TRUE;
+
+    fd = g_open(self->device->path, O_WRONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed opening '%s': %s", self->device->path,
+                    g_strerror(errno));
+        return FALSE;
+    }
+
+    for (guint i = 0; res && i < plan->len; i++) {
+        PuEmmcPlanEntry *entry = &g_array_index(plan, PuEmmcPlanEntry, i);
+
+        if (entry->bin) {
+            res = emmc_write_binary(self, entry->bin, entry->path, fd, prefix,
+                                    skip_checksums, error);
+            continue;
+        }
+
+        g_debug("Cleaning at offset %" G_GOFFSET_FORMAT " with size %"
+                G_GOFFSET_FORMAT, entry->offset, entry->length);
+        res = pu_io_clean_fd(fd, self->device->path, entry->offset,
+                             entry->length, entry->method, error);
+    }
+
+    g_close(fd, NULL);
+
+    return res;
+}
+
+/*
+ * Collect the partitions an input of a partition is written to. Identical
+ * inputs of later partitions without filesystem are written at the same time,
+ * e.g. the root filesystem of A/B layouts, and marked as written.
+ */
+static GPtrArray *
+emmc_get_fanout_paths(PuEmmc *self,
+                      GList *link,
+                      PuEmmcInput *input,
+                      const gchar *part_path,
+                      GArray *numbers,
+                      guint index,
+                      gboolean *written,
+                      GError **error)
+{
+    g_autoptr(GPtrArray) paths = g_ptr_array_new_with_free_func(g_free);
+    guint n = index + 1;
+
+    g_ptr_array_add(paths, g_strdup(part_path));
+
+    if (emmc_partition_get_raw_input(link->data) != input)
+        return g_steal_pointer(&paths);
+
+    for (GList *p = link->next; p != NULL; p = p->next, n++) {
+        PuEmmcInput *other = emmc_partition_get_raw_input(p->data);
+        gchar *path;
+
+        if (other == NULL || !emmc_input_equal(input, other))
+            continue;
+
+        path = pu_device_get_partition_path(self->device->path,
+                                            g_array_index(numbers, guint, n),
+                                            error);
+        if (path == NULL)
+            return NULL;
+
+        g_debug("Writing '%s' to '%s' along with '%s'", input->filename, path,
+                part_path);
+        g_ptr_array_add(paths, path);
+        written[n] = TRUE;
+    }
+
+    return g_steal_pointer(&paths);
+}
+
+static gboolean
+emmc_write_partition_fanout(PuEmmc *self,
+                            GList *link,
+                            PuEmmcInput *input,
+                            const gchar *path,
+                            const gchar *part_path,
+                            GArray *numbers,
+                            guint index,
+                            gboolean *written,
+                            const gchar *prefix,
+                            gboolean skip_checksums,
+                            GError **error)
+{
+    g_autoptr(GPtrArray) paths = NULL;
+
+    paths = emmc_get_fanout_paths(self, link, input, part_path, numbers, index,
+                                  written, error);
+    if (paths == NULL)
+        return FALSE;
+
+    return emmc_write_partition_raw(self, input, path, paths, prefix,
+                                    skip_checksums, error);
+}
+
+/*
+ * Format a FAT partition and write its input files in a single pass without
+ * mounting it. Archives, ext images, extra arguments for mkfs.fat and layouts
+ * the built-in formatter does not support are left to mkfs.fat and copying the
+ * files to the mounted filesystem, indicated by populated being FALSE.
+ */
+static gboolean
+emmc_write_partition_fat(PuEmmcPartition *part,
+                         const gchar *part_path,
+                         const gchar *prefix,
+                         const gchar *fingerprint,
+                         gboolean skip_checksums,
+                         gboolean *populated,
+                         GError **error)
+{
+    g_autoptr(PuFat) fat = NULL;
+    g_autoptr(GPtrArray) paths = g_ptr_array_new_with_free_func(g_free);
+    g_autoptr(GPtrArray) digests = NULL;
+    g_autoptr(GError) local_error = NULL;
+    PuFatType type;
+    guint n = 0;
+
+    *populated = FALSE;
+
+    if (!pu_fat_type_from_string(part->filesystem, &type) ||
+        g_strcmp0(part->mkfs_extra_args, "") > 0)
+        return TRUE;
+
+    for (GList *i = part->input; i != NULL; i = i->next) {
+        PuEmmcInput *input = i->data;
+        g_autofree gchar *path = NULL;
+        g_autofree gchar *name = NULL;
+
+        path = pu_path_from_filename(input->filename, prefix, error);
+        if (path == NULL) {
+            g_prefix_error(error, "Failed parsing input filename for partition: ");
+            return FALSE;
+        }
+
+        name = pu_compression_strip_suffix(path);
+        if (g_regex_match_simple(".tar", name, G_REGEX_CASELESS, 0) ||
+            g_regex_match_simple(".ext[234]$", name, 0, 0) ||
+            pu_is_ext234_image(path))
+            return TRUE;
+
+        g_ptr_array_add(paths, g_steal_pointer(&path));
+    }
+
+    fat = pu_fat_new(type, part->label, &local_error);
+    if (fat == NULL) {
+        if (!g_error_matches(local_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED)) {
+            g_propagate_error(error, g_steal_pointer(&local_error));
+            return FALSE;
+        }
+        g_debug("Using mkfs.fat for '%s': %s", part_path, local_error->message);
+        return TRUE;
+    }
+
+    /* Input files are checked while being written, like raw data */
+    digests = g_ptr_array_new_with_free_func((GDestroyNotify) g_array_unref);
+    for (GList *i = part->input; i != NULL; i = i->next, n++) {
+        PuEmmcInput *input = i->data;
+        const gchar *path = g_ptr_array_index(paths, n);
+        GArray *input_digests;
+
+        input_digests = emmc_input_new_digests(input, path, skip_checksums, FALSE);
+        g_ptr_array_add(digests, input_digests);
+        if (!pu_fat_add_file(fat, path, input_digests, error))
+            return FALSE;
+    }
+
+    if (fingerprint) {
+        g_autoptr(GKeyFile) manifest = g_key_file_new();
+        g_autoptr(GBytes) data = NULL;
+        gchar *text;
+        gsize length;
+
+        g_key_file_set_string(manifest, "partition", "fingerprint", fingerprint);
+        text = g_key_file_to_data(manifest, &length, NULL);
+        data = g_bytes_new_take(text, length);
+        if (!pu_fat_add_data(fat, MANIFEST_FILENAME, data, error))
+            return FALSE;
+    }
+
+    if (!pu_fat_write(fat, part_path, &local_error)) {
+        if (!g_error_matches(local_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED)) {
+            g_propagate_error(error, g_steal_pointer(&local_error));
+            return FALSE;
+        }
+        g_debug("Using mkfs.fat for '%s': %s", part_path, local_error->message);
+        return TRUE;
+    }
+    *populated = TRUE;
+
+    n = 0;
+    for (GList *i = part->input; i != NULL && !skip_checksums; i = i->next, n++) {
+        if (!emmc_input_check_digests(i->data, g_ptr_array_index(paths, n),
+                                      g_ptr_array_index(digests, n), error))
+            return FALSE;
+    }
+
+    return pu_io_flush(part_path, error);
+}
+
+/*
+ * Create an ext filesystem from its only input, a tar archive, by mke2fs
+ * instead of extracting the archive to the mounted filesystem. If mke2fs does
+ * not support tar archives, populated is FALSE and the archive is extracted.
+ */
+static gboolean
+emmc_write_partition_ext_tar(PuEmmc *self,
+                             PuEmmcPartition *part,
+                             const gchar *part_path,
+                             guint idx,
+                             const gchar *prefix,
+                             const gchar *fingerprint,
+                             gboolean skip_checksums,
+                             gboolean *populated,
+                             GError **error)
+{
+    g_autoptr(GError) local_error = NULL;
+    g_autofree gchar *path = NULL;
+    g_autofree gchar *name = NULL;
+    PuEmmcInput *input;
+
+    *populated = FALSE;
+
+    if (part->filesystem == NULL ||
+        !g_regex_match_simple("^ext[234]$", part->filesystem, 0, 0) ||
+        part->input == NULL || part->input->next != NULL)
+        return TRUE;
+
+    input = part->input->data;
+    path = pu_path_from_filename(input->filename, prefix, error);
+    if (path == NULL) {
+        g_prefix_error(error, "Failed parsing input filename for partition: ");
+        return FALSE;
+    }
+
+    name = pu_compression_strip_suffix(path);
+    if (!g_regex_match_simple(".tar", name, G_REGEX_CASELESS, 0) ||
+        !pu_mkfs_ext_supports_tar())
+        return TRUE;
+
+    if (!g_str_equal(input->md5sum, "") && !skip_checksums) {
+        g_debug("Checking MD5 sum of input file '%s'", path);
+        if (!pu_checksum_verify_file(path, input->md5sum, G_CHECKSUM_MD5, error))
+            return FALSE;
+    }
+    if (!g_str_equal(input->sha256sum, "") && !skip_checksums) {
+        g_debug("Checking SHA256 sum of input file '%s'", path);
+        if (!pu_checksum_verify_file(path, input->sha256sum, G_CHECKSUM_SHA256,
+                                     error))
+            return FALSE;
+    }
+
+    if (!pu_make_filesystem_populated(part_path, part->filesystem, part->label,
+                                      part->mkfs_extra_args,
+                                      self->discarded ? PU_MKFS_FLAGS_NO_DISCARD :
+                                                        PU_MKFS_FLAGS_NONE,
+                                      path, &local_error)) {
+        g_message("Creating filesystem on '%s' from '%s' failed, extracting it "
+                  "instead: %s", part_path, input->filename, local_error->message);
+        return TRUE;
+    }
+    *populated = TRUE;
+
+    if (fingerprint && !emmc_manifest_write(part_path, idx, fingerprint, error))
+        return FALSE;
+
+    return TRUE;
+}
+
+static void
+emmc_session_init(PuEmmcSession *session,
+                  const gchar *part_path,
+                  guint idx)
+{
+    session->part_path = part_path;
+    session->idx = idx;
+    session->files = g_ptr_array_new_with_free_func(g_free);
+    g_mutex_init(&session->lock);
+}
+
+/* Unmount the partition if it is still mounted, e.g. after an error */
+static void
+emmc_session_clear(PuEmmcSession *session)
+{
+    if (session->mounted) {
+        g_autoptr(GError) error = NULL;
+
+        if (!pu_umount(session->part_mount, &error))
+            g_warning("%s", error->message);
+        pu_stats_end(session->step, session->bytes, FALSE);
+    }
+    if (session->part_mount)
+        g_rmdir(session->part_mount);
+
+    g_free(session->part_mount);
+    g_ptr_array_unref(session->files);
+    g_clear_error(&session->error);
+    g_mutex_clear(&session->lock);
+}
+
+static gboolean
+emmc_session_open(PuEmmcSession *session,
+                  GError **error)
+{
+    if (session->mounted)
+        return TRUE;
+
+    if (!session->part_mount) {
+        g_autofree gchar *name = g_strdup_printf("p%u", session->idx);
+
+        session->part_mount = pu_create_mount_point(name, error);
+        if (session->part_mount == NULL)
+            return FALSE;
     }
 
-    if (ped_disk_add_partition(self->disk, newpart, final_constr) != 1) {
-        g_set_error(error, PU_ERROR, PU_ERROR_FLASH_LAYOUT,
-                    "Failed adding partition to disk");
+    session->step = pu_stats_begin("populate", session->part_path);
+    if (!pu_mount(session->part_path, session->part_mount, NULL, NULL, error)) {
+        pu_stats_end(session->step, 0, FALSE);
         return FALSE;
     }
 
+    session->mounted = TRUE;
+    session->time_start = g_get_monotonic_time();
+
     return TRUE;
 }
 
+static void
+emmc_session_copy_worker(gpointer data,
+                         gpointer user_data)
+{
+    const gchar *path = data;
+    PuEmmcSession *session = user_data;
+    g_autoptr(GError) error = NULL;
+
+    if (pu_file_copy(path, session->part_mount, &error))
+        return;
+
+    g_mutex_lock(&session->lock);
+    if (!session->error)
+        session->error = g_steal_pointer(&error);
+    g_mutex_unlock(&session->lock);
+}
+
+/*
+ * Copy the collected files to the mounted partition. They are all placed in
+ * its root directory under different names, so they are copied concurrently.
+ */
 static gboolean
-pu_emmc_init_device(PuFlash *flash,
-                    GError **error)
+emmc_session_copy_files(PuEmmcSession *session,
+                        GError **error)
 {
-    PuEmmc *self = PU_EMMC(flash);
-    PedDisk *newdisk;
+    GThreadPool *pool;
 
-    g_return_val_if_fail(flash != NULL, FALSE);
-    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+    if (session->files->len == 0)
+        return TRUE;
 
-    if (self->disktype == NULL) {
-        g_debug("Nothing to initialize");
+    if (!emmc_session_open(session, error))
+        return FALSE;
+
+    if (session->files->len == 1) {
+        if (!pu_file_copy(g_ptr_array_index(session->files, 0),
+                          session->part_mount, error))
+            return FALSE;
+        g_ptr_array_set_size(session->files, 0);
         return TRUE;
     }
 
-    g_message("Initializing MMC with new disklabel");
+    pool = g_thread_pool_new(emmc_session_copy_worker, session,
+                             MIN(session->files->len, SESSION_COPY_THREADS),
+                             FALSE, error);
+    if (pool == NULL)
+        return FALSE;
+    for (guint i = 0; i < session->files->len; i++) {
+        g_autoptr(GError) push_error = NULL;
 
-    newdisk = ped_disk_new_fresh(self->device, self->disktype);
-    if (newdisk == NULL) {
-        g_set_error(error, PU_ERROR, PU_ERROR_FLASH_INIT,
-                    "Failed creating new disk");
+        if (g_thread_pool_push(pool, g_ptr_array_index(session->files, i),
+                               &push_error))
+            continue;
+
+        /* Files already pushed are still copied before the pool is freed */
+        g_mutex_lock(&session->lock);
+        if (!session->error)
+            session->error = g_steal_pointer(&push_error);
+        g_mutex_unlock(&session->lock);
+        break;
+    }
+    g_thread_pool_free(pool, FALSE, TRUE);
+    g_ptr_array_set_size(session->files, 0);
+
+    if (session->error) {
+        g_propagate_error(error, g_steal_pointer(&session->error));
         return FALSE;
     }
 
-    if (self->disk) {
-        ped_disk_destroy(self->disk);
+    return TRUE;
+}
+
+/*
+ * Collect a file to be copied. Files of the same name are copied in the order
+ * given, so the collected ones are copied first and the last one wins.
+ */
+static gboolean
+emmc_session_add_file(PuEmmcSession *session,
+                      const gchar *path,
+                      GError **error)
+{
+    g_autofree gchar *name = g_path_get_basename(path);
+
+    for (guint i = 0; i < session->files->len; i++) {
+        const gchar *file = g_ptr_array_index(session->files, i);
+        g_autofree gchar *other = g_path_get_basename(file);
+
+        if (g_str_equal(name, other)) {
+            if (!emmc_session_copy_files(session, error))
+                return FALSE;
+            break;
+        }
     }
-    self->disk = newdisk;
-    ped_disk_commit(self->disk);
+
+    session->bytes += pu_file_get_size(path, NULL);
+    g_ptr_array_add(session->files, g_strdup(path));
 
     return TRUE;
 }
 
+/*
+ * Finish populating the partition: copy the remaining files, store the
+ * fingerprint if given, flush the filesystem once and unmount it.
+ */
 static gboolean
-pu_emmc_setup_layout(PuFlash *flash,
-                     GError **error)
+emmc_session_close(PuEmmcSession *session,
+                   const gchar *fingerprint,
+                   GError **error)
 {
-    PuEmmc *self = PU_EMMC(flash);
-    PedSector part_start = 0;
+    gdouble seconds;
+    gboolean res;
 
-    g_return_val_if_fail(flash != NULL, FALSE);
-    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+    if (!emmc_session_copy_files(session, error))
+        return FALSE;
 
-    if (self->disktype == NULL) {
-        g_debug("No partitions to set up");
+    if (fingerprint && !emmc_session_open(session, error))
+        return FALSE;
+
+    if (!session->mounted)
         return TRUE;
+
+    res = (!fingerprint ||
+           emmc_manifest_save(session->part_mount, fingerprint, error)) &&
+          pu_io_flush_filesystem(session->part_mount, error);
+    if (!pu_umount(session->part_mount, res ? error : NULL))
+        res = FALSE;
+    session->mounted = FALSE;
+    pu_stats_end(session->step, session->bytes, res);
+
+    if (!res)
+        return FALSE;
+
+    seconds = (g_get_monotonic_time() - session->time_start) / (gdouble) G_USEC_PER_SEC;
+    if (session->bytes > 0) {
+        g_autofree gchar *size = g_format_size(session->bytes);
+
+        g_message("Populated '%s' with %s in %.3f s (%.1f MiB/s)",
+                  session->part_path, size, seconds,
+                  session->bytes / (gdouble) PED_MEBIBYTE_SIZE / MAX(seconds, 0.001));
     }
+    session->bytes = 0;
 
-    g_message("Partitioning MMC");
+    return TRUE;
+}
 
-    for (GList *p = self->partitions; p != NULL; p = p->next) {
-        PuEmmcPartition *part = p->data;
+/*
+ * Write the inputs of a partition in the order given. Archives and files share
+ * a single mount of the partition, while raw data and ext images are written
+ * to the unmounted partition.
+ */
+static gboolean
+emmc_populate_partition(PuEmmc *self,
+                        GList *p,
+                        const gchar *part_path,
+                        guint idx,
+                        GArray *numbers,
+                        guint pos,
+                        gboolean *written,
+                        const gchar *prefix,
+                        const gchar *fingerprint,
+                        gboolean skip_checksums,
+                        GError **error)
+{
+    PuEmmcPartition *part = p->data;
+    PuEmmcSession session = { 0 };
+    gboolean res = TRUE;
 
-        if (part->expand) {
-            part->size = self->expanded_part_size;
-        }
+    emmc_session_init(&session, part_path, idx);
 
-        g_debug("Creating partition: type=%d filesystem=%s start=%lld size=%lld "
-                "offset=%lld block-size=%lld expand=%s",
-                part->type, part->filesystem, part_start, part->size,
-                part->offset, part->block_size, part->expand ? "true" : "false");
+    for (GList *i = part->input; res && i != NULL; i = i->next) {
+        PuEmmcInput *input = i->data;
+        g_autofree gchar *path = NULL;
+        g_autofree gchar *name = NULL;
+        gboolean is_ext;
+        gboolean is_raw;
 
-        if (part->type == PED_PARTITION_LOGICAL && !ped_disk_extended_partition(self->disk)) {
-            PuEmmcPartition extpart = {0};
-            if (!ped_disk_type_check_feature(self->disk->type, PED_DISK_TYPE_EXTENDED)) {
-                g_set_error(error, PU_ERROR, PU_ERROR_FLASH_LAYOUT,
-                            "Logical partitions are not supported on this disk");
-                return FALSE;
-            }
-            extpart.type = PED_PARTITION_EXTENDED;
-            extpart.size = self->device->length - part_start;
-            g_debug("Creating extended partition: type=%d start=%lld size=%lld",
-                    part->type, part_start, part->size);
-            if (!emmc_create_partition(self, &extpart, part_start, error)) {
-                return FALSE;
-            }
+        path = pu_path_from_filename(input->filename, prefix, error);
+        if (path == NULL) {
+            g_prefix_error(error, "Failed parsing input filename for partition: ");
+            res = FALSE;
+            break;
         }
 
-        if (!emmc_create_partition(self, part, part_start + part->offset, error)) {
-            return FALSE;
+        /* Compressed images are recognized by the decompressed name */
+        name = pu_compression_strip_suffix(path);
+        is_ext = g_regex_match_simple(".ext[234]$", name, 0, 0) ||
+                 pu_is_ext234_image(path);
+        is_raw = is_ext || !part->filesystem;
+
+        /* Raw inputs are checked while being written */
+        if (!g_str_equal(input->md5sum, "") && !skip_checksums && !is_raw) {
+            g_debug("Checking MD5 sum of input file '%s'", path);
+            res = pu_checksum_verify_file(path, input->md5sum, G_CHECKSUM_MD5,
+                                          error);
+        }
+        if (res && !g_str_equal(input->sha256sum, "") && !skip_checksums &&
+            !is_raw) {
+            g_debug("Checking SHA256 sum of input file '%s'", path);
+            res = pu_checksum_verify_file(path, input->sha256sum,
+                                          G_CHECKSUM_SHA256, error);
+        }
+        if (!res)
+            break;
+
+        if (g_regex_match_simple(".tar", name, G_REGEX_CASELESS, 0)) {
+            /* Files copied before may be replaced by the archive */
+            res = emmc_session_copy_files(&session, error) &&
+                  emmc_session_open(&session, error) &&
+                  pu_archive_extract(path, session.part_mount, error);
+            session.bytes += pu_file_get_size(path, NULL);
+        } else if (is_ext) {
+            /* Images are written to the unmounted partition */
+            res = emmc_session_close(&session, NULL, error) &&
+                  (written[pos] ||
+                   emmc_write_partition_fanout(self, p, input, path, part_path,
+                                               numbers, pos, written, prefix,
+                                               skip_checksums, error)) &&
+                  pu_resize_filesystem(part_path, error) &&
+                  pu_set_ext_label(part_path, part->label, error);
+        } else if (!part->filesystem) {
+            gboolean compare = pu_io_get_compare();
+
+            if (written[pos])
+                continue;
+
+            /* Unchanged data of a kept partition is not written again */
+            pu_io_set_compare(compare || self->layout_kept);
+            res = emmc_write_partition_fanout(self, p, input, path, part_path,
+                                              numbers, pos, written, prefix,
+                                              skip_checksums, error);
+            pu_io_set_compare(compare);
+        } else {
+            res = emmc_session_add_file(&session, path, error);
         }
-        part_start += part->size + part->offset;
     }
 
-    ped_disk_commit(self->disk);
-
-    if (!pu_wait_for_partitions(error))
-        return FALSE;
+    res = res && emmc_session_close(&session, fingerprint, error);
+    emmc_session_clear(&session);
 
-    return TRUE;
+    return res;
 }
 
 static gboolean
@@ -294,11 +1945,15 @@ pu_emmc_write_data(PuFlash *flash,
 {
     PuEmmc *self = PU_EMMC(flash);
     guint idx = 0;
-    gboolean first_logical_part = FALSE;
+    guint pos = 0;
     gboolean skip_checksums = FALSE;
+    gboolean incremental = FALSE;
     g_autofree gchar *part_path = NULL;
-    g_autofree gchar *part_mount = NULL;
     g_autofree gchar *prefix = NULL;
+    g_autoptr(GArray) numbers = NULL;
+    g_autofree gboolean *written = NULL;
+    gboolean compare = pu_io_get_compare();
+    gboolean res;
 
     g_return_val_if_fail(flash != NULL, FALSE);
     g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
@@ -306,177 +1961,86 @@ pu_emmc_write_data(PuFlash *flash,
     g_object_get(flash,
                  "prefix", &prefix,
                  "skip-checksums", &skip_checksums,
+                 "incremental", &incremental,
                  NULL);
 
     g_message("Writing data to MMC");
 
-    for (GList *p = self->partitions; p != NULL; p = p->next) {
+    numbers = emmc_get_partition_numbers(self);
+    written = g_new0(gboolean, numbers->len);
+
+    for (GList *p = self->partitions; p != NULL; p = p->next, pos++) {
         PuEmmcPartition *part = p->data;
-        if (part->type == PED_PARTITION_LOGICAL && first_logical_part == FALSE) {
-            first_logical_part = TRUE;
-            idx = 5;
-        } else {
-            idx++;
-        }
+        g_autofree gchar *fingerprint = NULL;
+        gboolean populated;
 
-        if (g_strcmp0(part->partuuid, "") > 0) {
-            if (g_str_equal(self->disktype->name, "gpt")) {
-                if (!pu_partition_set_partuuid(self->device->path, idx, part->partuuid, error))
-                    return FALSE;
-            } else {
-                g_warning("Setting PARTUUID is only supported on GPT partitioned devices");
-            }
-        }
+        idx = g_array_index(numbers, guint, pos);
 
+        g_free(part_path);
         part_path = pu_device_get_partition_path(self->device->path, idx, error);
         if (part_path == NULL)
             return FALSE;
 
-        g_debug("Creating filesystem '%s' on '%s'", part->filesystem, part_path);
-
-        if (!pu_make_filesystem(part_path, part->filesystem, part->label,
-                                part->mkfs_extra_args, error))
-            return FALSE;
-
-        if (!part->input) {
-            g_debug("No input specified. Skipping '%s'", part_path);
-            continue;
-        }
-
-        g_debug("Writing to partition '%s'", part_path);
-
-        part_mount = pu_create_mount_point(g_strdup_printf("p%u", idx), error);
-        if (part_mount == NULL)
-            return FALSE;
-
-        for (GList *i = part->input; i != NULL; i = i->next) {
-            PuEmmcInput *input = i->data;
-            g_autofree gchar *path = NULL;
-
-            path = pu_path_from_filename(input->filename, prefix, error);
-            if (path == NULL) {
-                g_prefix_error(error, "Failed parsing input filename for partition: ");
+        /* Only partitions with a filesystem can hold a manifest */
+        if (incremental && g_strcmp0(part->filesystem, "") > 0) {
+            fingerprint = emmc_partition_get_fingerprint(part, prefix, error);
+            if (fingerprint == NULL)
                 return FALSE;
-            }
-
-            if (!g_str_equal(input->md5sum, "") && !skip_checksums) {
-                g_debug("Checking MD5 sum of input file '%s'", path);
-                if (!pu_checksum_verify_file(path, input->md5sum,
-                                             G_CHECKSUM_MD5, error))
-                    return FALSE;
-            }
-            if (!g_str_equal(input->sha256sum, "") && !skip_checksums) {
-                g_debug("Checking SHA256 sum of input file '%s'", path);
-                if (!pu_checksum_verify_file(path, input->sha256sum,
-                                             G_CHECKSUM_SHA256, error))
-                    return FALSE;
-            }
-
-            if (g_regex_match_simple(".tar", path, G_REGEX_CASELESS, 0)) {
-                if (!pu_mount(part_path, part_mount, NULL, NULL, error))
-                    return FALSE;
-                if (!pu_archive_extract(path, part_mount, error))
-                    return FALSE;
-                if (!pu_umount(part_mount, error))
-                    return FALSE;
-            } else if (g_regex_match_simple(".ext[234]$", path, 0, 0) ||
-                       pu_is_ext234_image(path)) {
-                if (!pu_write_raw(path, part_path, self->device, 0, 0, 0, error))
-                    return FALSE;
-                if (!pu_resize_filesystem(part_path, error))
-                    return FALSE;
-                if (!pu_set_ext_label(part_path, part->label, error))
-                    return FALSE;
-            } else if (!part->filesystem) {
-                if (!pu_write_raw(path, part_path, self->device, 0, 0, 0, error))
-                    return FALSE;
-            } else {
-                if (!pu_mount(part_path, part_mount, NULL, NULL, error))
-                    return FALSE;
-                if (!pu_file_copy(path, part_mount, error))
-                    return FALSE;
-                if (!pu_umount(part_mount, error))
-                    return FALSE;
-            }
         }
-        g_rmdir(part_mount);
-    }
 
-    for (GList *c = self->clean; c != NULL; c = c->next) {
-        PuEmmcClean *clean = c->data;
+        if (fingerprint && self->layout_kept) {
+            g_autofree gchar *stored = emmc_manifest_read(part_path, idx);
 
-        if (clean->size == 0) {
-            g_warning("Size 0 specified. Skipping cleaning at %lld", clean->offset);
-            continue;
+            if (g_strcmp0(stored, fingerprint) == 0) {
+                g_message("Partition '%s' is up to date, skipping it", part_path);
+                continue;
+            }
         }
 
-        g_debug("Cleaning at offset %lld with size %lld",
-                clean->offset, clean->size);
-
-        if (!pu_write_raw("/dev/zero", self->device->path, self->device, 0,
-                          clean->offset, clean->size, error)) {
+        /* Filesystems are preferably created with their content in place */
+        if (!emmc_write_partition_fat(part, part_path, prefix, fingerprint,
+                                      skip_checksums, &populated, error))
             return FALSE;
-        }
-    }
-
-    for (GList *b = self->raw; b != NULL; b = b->next) {
-        PuEmmcBinary *bin = b->data;
-        PuEmmcInput *input = bin->input;
-        g_autofree gchar *path = NULL;
-        gsize size = 0;
-        g_autofree gchar *output_sha1sum = NULL;
-
-        path = pu_path_from_filename(input->filename, prefix, error);
-        if (path == NULL) {
-            g_prefix_error(error, "Failed parsing input filename for binary: ");
+        if (!populated &&
+            !emmc_write_partition_ext_tar(self, part, part_path, idx, prefix,
+                                          fingerprint, skip_checksums, &populated,
+                                          error))
             return FALSE;
-        }
-
-        if (g_str_equal(path, "")) {
-            g_warning("No input specified for binary");
+        if (populated)
             continue;
-        }
 
-        size = pu_file_get_size(path, error);
-        if (size == 0) {
-            g_prefix_error(error, "Failed retrieving file size for binary: ");
+        g_debug("Creating filesystem '%s' on '%s'", part->filesystem, part_path);
+
+        if (!pu_make_filesystem(part_path, part->filesystem, part->label,
+                                part->mkfs_extra_args,
+                                self->discarded ? PU_MKFS_FLAGS_NO_DISCARD :
+                                                  PU_MKFS_FLAGS_NONE,
+                                error))
             return FALSE;
-        }
 
-        if (!g_str_equal(input->md5sum, "") && !skip_checksums) {
-            g_debug("Checking MD5 sum of input file '%s'", path);
-            if (!pu_checksum_verify_file(path, input->md5sum,
-                                         G_CHECKSUM_MD5, error))
-                return FALSE;
-        }
-        if (!g_str_equal(input->sha256sum, "") && !skip_checksums) {
-            g_debug("Checking SHA256 sum of input file '%s'", path);
-            if (!pu_checksum_verify_file(path, input->sha256sum,
-                                         G_CHECKSUM_SHA256, error))
+        if (!part->input) {
+            g_debug("No input specified. Skipping '%s'", part_path);
+            if (fingerprint &&
+                !emmc_manifest_write(part_path, idx, fingerprint, error))
                 return FALSE;
+            continue;
         }
 
-        g_debug("Writing raw data: filename=%s input_offset=%lld output_offset=%lld",
-                input->filename, bin->input_offset, bin->output_offset);
+        g_debug("Writing to partition '%s'", part_path);
 
-        if (!pu_write_raw(path, self->device->path, self->device,
-                          bin->input_offset, bin->output_offset, 0, error))
+        if (!emmc_populate_partition(self, p, part_path, idx, numbers, pos,
+                                     written, prefix, fingerprint,
+                                     skip_checksums, error))
             return FALSE;
-
-        if (!skip_checksums) {
-            output_sha1sum = pu_checksum_new_from_file(path, bin->input_offset *
-                                                       self->device->sector_size,
-                                                       G_CHECKSUM_SHA1, error);
-            g_debug("Verifying SHA1 sum of written output: %s", output_sha1sum);
-            if (!pu_checksum_verify_raw(self->device->path, bin->output_offset *
-                                        self->device->sector_size,
-                                        size - bin->input_offset *
-                                        self->device->sector_size, output_sha1sum,
-                                        G_CHECKSUM_SHA1, error))
-                return FALSE;
-        }
     }
 
+    /* Unchanged binaries of a kept layout are not written again */
+    pu_io_set_compare(compare || self->layout_kept);
+    res = emmc_write_raw_area(self, prefix, skip_checksums, error);
+    pu_io_set_compare(compare);
+    if (!res)
+        return FALSE;
+
     if (self->mmc_controls) {
         PuEmmcBootPartitions *boot_partitions = NULL;
 
@@ -501,8 +2065,9 @@ pu_emmc_write_data(PuFlash *flash,
             for (GList *i = input; i != NULL; i = i->next) {
                 PuEmmcBinary *bin = i->data;
                 g_autofree gchar *path = NULL;
-                gsize size = 0;
-                g_autofree gchar *output_sha1sum = NULL;
+                g_autoptr(PuBmap) bmap = NULL;
+                g_autoptr(GArray) extents = NULL;
+                g_autoptr(GArray) digests = NULL;
 
                 path = pu_path_from_filename(bin->input->filename, prefix, error);
                 if (path == NULL) {
@@ -516,63 +2081,52 @@ pu_emmc_write_data(PuFlash *flash,
                     return FALSE;
                 }
 
-                size = pu_file_get_size(path, error);
-                if (size == 0) {
+                if (!emmc_input_update_size(bin->input, path, error)) {
                     g_prefix_error(error, "Failed retrieving file size for binary: ");
                     return FALSE;
                 }
 
-                if (!g_str_equal(bin->input->md5sum, "") && !skip_checksums) {
-                    g_debug("Checking MD5 sum of input file '%s'", path);
-                    if (!pu_checksum_verify_file(path, bin->input->md5sum,
-                                                 G_CHECKSUM_MD5, error))
-                        return FALSE;
-                }
-                if (!g_str_equal(bin->input->sha256sum, "") && !skip_checksums) {
-                    g_debug("Checking SHA256 sum of input file '%s'", path);
-                    if (!pu_checksum_verify_file(path, bin->input->sha256sum,
-                                                 G_CHECKSUM_SHA256, error))
-                        return FALSE;
-                }
-
                 g_debug("Writing eMMC boot partitions: filename=%s input_offset=%lld output_offset=%lld",
                         bin->input->filename, bin->input_offset,
                         bin->output_offset);
 
-                if (!pu_write_raw_bootpart(path, self->device, 0,
-                                           bin->input_offset,
-                                           bin->output_offset,
-                                           error))
+                if (!emmc_input_load_bmap(bin->input, path, prefix, &bmap, error))
                     return FALSE;
+                if (bmap)
+                    extents = pu_bmap_get_extents(bmap, bin->input_offset *
+                                                  self->device->sector_size);
+
+                /* The digests are computed once while writing the first */
+                digests = emmc_input_new_digests(bin->input, path, skip_checksums,
+                                                 bmap == NULL || bin->input_offset > 0);
+
+                for (guint n = 0; n <= 1; n++) {
+                    g_autofree gchar *bootpart_path = NULL;
+
+                    pu_io_set_compare(compare || self->layout_kept);
+                    res = pu_write_raw_bootpart(path, self->device, n,
+                                                bin->input_offset,
+                                                bin->output_offset, extents,
+                                                n == 0 ? digests : NULL,
+                                                emmc_input_get_write_flags(bin->input),
+                                                error);
+                    pu_io_set_compare(compare);
+                    if (!res)
+                        return FALSE;
 
-                if (!pu_write_raw_bootpart(path, self->device, 1,
-                                           bin->input_offset,
-                                           bin->output_offset,
-                                           error))
-                    return FALSE;
+                    if (skip_checksums)
+                        continue;
 
-                if (!skip_checksums) {
-                    output_sha1sum = pu_checksum_new_from_file(
-                            path, bin->input_offset * self->device->sector_size,
-                            G_CHECKSUM_SHA1, error);
-                    g_debug("Verifying SHA1 sum of written output: %s",
-                            output_sha1sum);
-                    if (!pu_checksum_verify_raw_bootpart(self->device->path, 0,
-                                                         bin->output_offset *
-                                                         self->device->sector_size,
-                                                         size - bin->input_offset *
-                                                         self->device->sector_size,
-                                                         output_sha1sum,
-                                                         G_CHECKSUM_SHA1, error))
+                    if (n == 0 &&
+                        !emmc_input_check_digests(bin->input, path, digests, error))
                         return FALSE;
 
-                    if (!pu_checksum_verify_raw_bootpart(self->device->path, 1,
-                                                         bin->output_offset *
-                                                         self->device->sector_size,
-                                                         size - bin->input_offset *
-                                                         self->device->sector_size,
-                                                         output_sha1sum,
-                                                         G_CHECKSUM_SHA1, error))
+                    bootpart_path = g_strdup_printf("%sboot%u", self->device->path, n);
+                    if (!emmc_verify_binary(self, bin, bmap,
+                                            pu_io_digests_get_string(digests,
+                                                                     PU_IO_DIGEST_WRITTEN,
+                                                                     G_CHECKSUM_SHA1),
+                                            path, bootpart_path, error))
                         return FALSE;
                 }
             }
@@ -596,25 +2150,17 @@ pu_emmc_class_finalize(GObject *object)
         g_free(part->filesystem);
         g_free(part->mkfs_extra_args);
         g_list_free(g_steal_pointer(&part->flags));
-        for (GList *i = part->input; i != NULL; i = i->next) {
-            PuEmmcInput *in = i->data;
-            g_free(in->filename);
-            g_free(in->md5sum);
-            g_free(in->sha256sum);
-            g_free(in);
-        }
-        g_list_free(g_steal_pointer(&part->input));
+        g_list_free_full(g_steal_pointer(&part->input),
+                         (GDestroyNotify) emmc_input_free);
     }
     g_list_free(g_steal_pointer(&emmc->partitions));
 
     g_list_free(g_steal_pointer(&emmc->clean));
+    g_clear_pointer(&emmc->discard_keep, g_array_unref);
 
     for (GList *b = emmc->raw; b != NULL; b = b->next) {
         PuEmmcBinary *bin = b->data;
-        g_free(bin->input->filename);
-        g_free(bin->input->md5sum);
-        g_free(bin->input->sha256sum);
-        g_free(bin->input);
+        emmc_input_free(bin->input);
         g_free(bin);
     }
     g_list_free(g_steal_pointer(&emmc->raw));
@@ -626,10 +2172,7 @@ pu_emmc_class_finalize(GObject *object)
             GList *input = emmc->mmc_controls->boot_partitions->input;
             for (GList *b = input; b != NULL; b = b->next) {
                 PuEmmcBinary *bin = b->data;
-                g_free(bin->input->filename);
-                g_free(bin->input->md5sum);
-                g_free(bin->input->sha256sum);
-                g_free(bin->input);
+                emmc_input_free(bin->input);
                 g_free(bin);
             }
             g_list_free(g_steal_pointer(&input));
@@ -754,10 +2297,11 @@ pu_emmc_parse_mmc_controls(PuEmmc *emmc,
             return FALSE;
         }
 
-        PuEmmcInput *input = g_new0(PuEmmcInput, 1);
-        input->filename = pu_hash_table_lookup_string(value_input->data.mapping, "filename", "");
-        input->md5sum = pu_hash_table_lookup_string(value_input->data.mapping, "md5sum", "");
-        input->sha256sum = pu_hash_table_lookup_string(value_input->data.mapping, "sha256sum", "");
+        PuEmmcInput *input = emmc_input_new_from_mapping(value_input->data.mapping, error);
+        if (input == NULL) {
+            g_free(bin);
+            return FALSE;
+        }
 
         bin->input = input;
         g_debug("Parsed bootpart input: filename=%s md5sum=%s sha256sum=%s",
@@ -799,7 +2343,17 @@ pu_emmc_parse_clean(PuEmmc *emmc,
 
     for (GList *c = clean; c != NULL; c = c->next) {
         PuConfigValue *v = c->data;
-        PuEmmcClean *remove = g_new0(PuEmmcClean, 1);
+        g_autofree gchar *method = NULL;
+        PuEmmcClean *remove;
+
+        method = pu_hash_table_lookup_string(v->data.mapping, "method", "auto");
+        remove = g_new0(PuEmmcClean, 1);
+        if (!pu_io_clean_method_from_string(method, &remove->method, NULL)) {
+            g_set_error(error, PU_ERROR, PU_ERROR_EMMC_PARSE,
+                        "Invalid value '%s' for 'method' of clean", method);
+            g_free(remove);
+            return FALSE;
+        }
         remove->offset = pu_hash_table_lookup_sector(v->data.mapping, emmc->device,
                                                      "offset", 0);
         remove->size = pu_hash_table_lookup_sector(v->data.mapping, emmc->device,
@@ -812,6 +2366,51 @@ pu_emmc_parse_clean(PuEmmc *emmc,
     return TRUE;
 }
 
+static gboolean
+pu_emmc_parse_discard(PuEmmc *emmc,
+                      GHashTable *root,
+                      GError **error)
+{
+    PuConfigValue *value_keep = g_hash_table_lookup(root, "discard-keep");
+
+    g_return_val_if_fail(emmc != NULL, FALSE);
+    g_return_val_if_fail(root != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    emmc->discard = pu_hash_table_lookup_boolean(root, "discard", FALSE);
+    emmc->discard_keep = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+
+    if (!value_keep)
+        return TRUE;
+
+    if (value_keep->type != PU_CONFIG_VALUE_TYPE_SEQUENCE) {
+        g_set_error(error, PU_ERROR, PU_ERROR_EMMC_PARSE,
+                    "'discard-keep' is not a sequence");
+        return FALSE;
+    }
+
+    for (GList *k = value_keep->data.sequence; k != NULL; k = k->next) {
+        PuConfigValue *v = k->data;
+        PuFileExtent keep;
+
+        if (v->type != PU_CONFIG_VALUE_TYPE_MAPPING) {
+            g_set_error(error, PU_ERROR, PU_ERROR_EMMC_PARSE,
+                        "Entry of 'discard-keep' is not a mapping");
+            return FALSE;
+        }
+
+        keep.offset = pu_hash_table_lookup_sector(v->data.mapping, emmc->device,
+                                                  "offset", 0) *
+                      emmc->device->sector_size;
+        keep.length = pu_hash_table_lookup_sector(v->data.mapping, emmc->device,
+                                                  "size", 0) *
+                      emmc->device->sector_size;
+        g_array_append_val(emmc->discard_keep, keep);
+    }
+
+    return TRUE;
+}
+
 static gboolean
 pu_emmc_parse_raw(PuEmmc *emmc,
                   GHashTable *root,
@@ -860,17 +2459,18 @@ pu_emmc_parse_raw(PuEmmc *emmc,
                         "'input' of binary does not contain a mapping");
             return FALSE;
         }
-        PuEmmcInput *input = g_new0(PuEmmcInput, 1);
-        input->filename = pu_hash_table_lookup_string(value_input->data.mapping, "filename", "");
-        input->md5sum = pu_hash_table_lookup_string(value_input->data.mapping, "md5sum", "");
-        input->sha256sum = pu_hash_table_lookup_string(value_input->data.mapping, "sha256sum", "");
+        PuEmmcInput *input = emmc_input_new_from_mapping(value_input->data.mapping, error);
+        if (input == NULL) {
+            g_free(bin);
+            return FALSE;
+        }
 
         path = pu_path_from_filename(input->filename, prefix, error);
         if (path == NULL)
             return FALSE;
 
-        input->_size = pu_file_get_size(path, error);
-        if (!input->_size)
+        /* Overlaps are checked with the size of the decompressed input */
+        if (!emmc_input_update_size(input, path, error))
             return FALSE;
 
         bin->input = input;
@@ -981,6 +2581,11 @@ pu_emmc_parse_partitions(PuEmmc *emmc,
         PuEmmcPartition *part = g_new0(PuEmmcPartition, 1);
         part->label = pu_hash_table_lookup_string(v->data.mapping, "label", NULL);
         part->partuuid = pu_hash_table_lookup_string(v->data.mapping, "partuuid", "");
+        if (g_strcmp0(part->partuuid, "") > 0 && !g_uuid_string_is_valid(part->partuuid)) {
+            g_set_error(error, PU_ERROR, PU_ERROR_EMMC_PARSE,
+                        "Invalid PARTUUID '%s' specified", part->partuuid);
+            return FALSE;
+        }
         part->filesystem = pu_hash_table_lookup_string(v->data.mapping, "filesystem", NULL);
         part->mkfs_extra_args = pu_hash_table_lookup_string(v->data.mapping, "mkfs-extra-args", NULL);
         part->size = pu_hash_table_lookup_sector(v->data.mapping, emmc->device, "size", 0);
@@ -1054,10 +2659,9 @@ pu_emmc_parse_partitions(PuEmmc *emmc,
                     return FALSE;
                 }
 
-                PuEmmcInput *input = g_new0(PuEmmcInput, 1);
-                input->filename = pu_hash_table_lookup_string(iv->data.mapping, "filename", "");
-                input->md5sum = pu_hash_table_lookup_string(iv->data.mapping, "md5sum", "");
-                input->sha256sum = pu_hash_table_lookup_string(iv->data.mapping, "sha256sum", "");
+                PuEmmcInput *input = emmc_input_new_from_mapping(iv->data.mapping, error);
+                if (input == NULL)
+                    return FALSE;
                 part->input = g_list_prepend(part->input, input);
 
                 g_debug("Parsed partition input: filename=%s md5sum=%s sha256sum=%s",
@@ -1218,6 +2822,8 @@ pu_emmc_new(const gchar *device_path,
         return NULL;
     if (!pu_emmc_parse_clean(self, root, error))
         return NULL;
+    if (!pu_emmc_parse_discard(self, root, error))
+        return NULL;
 
     if (disklabel && !pu_emmc_check_raw_overwrite(self, error))
         return NULL;
@@ -37,7 +37,13 @@ typedef enum {
     PU_ERROR_UNKNOWN_FSTYPE,
 
     /* Mount error */
-    PU_ERROR_MOUNT
+    PU_ERROR_MOUNT,
+
+    /* Block map errors */
+    PU_ERROR_BMAP_PARSE,
+
+    /* Decompression errors */
+    PU_ERROR_DECOMPRESS
 } PuErrorEnum;
 
 GQuark pu_error_quark(void);
@@ -0,0 +1,925 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#define G_LOG_DOMAIN "partup-fat"
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <linux/hdreg.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include "pu-fat.h"
+#include "pu-file.h"
+#include "pu-io.h"
+#include "pu-stats.h"
+
+#define FAT_SECTOR_SIZE      512
+#define FAT_DIR_ENTRY_SIZE   32
+#define FAT_NUM_FATS         2
+#define FAT_MEDIA            0xf8
+#define FAT16_ROOT_ENTRIES   512
+#define FAT16_MIN_CLUSTERS   4085
+#define FAT32_MIN_CLUSTERS   65525
+#define FAT32_MAX_CLUSTERS   0x0ffffff4
+#define FAT32_FSINFO_SECTOR  1
+#define FAT32_BACKUP_SECTOR  6
+#define FAT_ATTR_VOLUME_ID   0x08
+#define FAT_ATTR_ARCHIVE     0x20
+#define FAT_ATTR_LONG_NAME   0x0f
+#define FAT_LFN_CHARS        13
+#define FAT_MAX_NAME_LENGTH  255
+#define FAT_LABEL_LENGTH     11
+
+typedef struct {
+    gchar *name;
+    gchar *path;
+    GBytes *data;
+    GArray *digests;
+    goffset size;
+    GDateTime *mtime;
+    guint8 short_name[11];
+    guint lfn_entries;
+    guint32 first_cluster;
+    guint32 clusters;
+} PuFatFile;
+
+struct _PuFat {
+    PuFatType type;
+    gchar *label;
+    GPtrArray *files;
+
+    /* Layout, in sectors unless noted otherwise */
+    guint32 total_sectors;
+    guint32 cluster_sectors;
+    guint32 reserved_sectors;
+    guint32 fat_sectors;
+    guint32 root_sectors;
+    guint32 clusters;
+    guint32 root_clusters;
+    guint32 used_clusters;
+    guint16 track_sectors;
+    guint16 heads;
+    guint32 hidden_sectors;
+};
+
+static void
+fat_file_free(PuFatFile *file)
+{
+    g_free(file->name);
+    g_free(file->path);
+    if (file->data)
+        g_bytes_unref(file->data);
+    if (file->digests)
+        g_array_unref(file->digests);
+    g_date_time_unref(file->mtime);
+    g_free(file);
+}
+
+static void
+fat_put16(guint8 *buffer,
+          guint16 value)
+{
+    buffer[0] = value & 0xff;
+    buffer[1] = value >> 8;
+}
+
+static void
+fat_put32(guint8 *buffer,
+          guint32 value)
+{
+    fat_put16(buffer, value & 0xffff);
+    fat_put16(buffer + 2, value >> 16);
+}
+
+gboolean
+pu_fat_type_from_string(const gchar *fstype,
+                        PuFatType *type)
+{
+    if (g_strcmp0(fstype, "fat16") == 0) {
+        *type = PU_FAT_TYPE_16;
+        return TRUE;
+    } else if (g_strcmp0(fstype, "fat32") == 0) {
+        *type = PU_FAT_TYPE_32;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Create an empty FAT filesystem to be populated with files and written in one
+ * pass. Labels mkfs.fat would treat specially are not supported.
+ */
+PuFat *
+pu_fat_new(PuFatType type,
+           const gchar *label,
+           GError **error)
+{
+    PuFat *fat;
+
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    if (label && strlen(label) > FAT_LABEL_LENGTH) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "Label '%s' is longer than %d characters", label,
+                    FAT_LABEL_LENGTH);
+        return NULL;
+    }
+    for (const gchar *c = label; c && *c; c++) {
+        if (!g_ascii_isprint(*c)) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        "Label '%s' contains unsupported characters", label);
+            return NULL;
+        }
+    }
+
+    fat = g_new0(PuFat, 1);
+    fat->type = type;
+    fat->label = g_strdup(label ? label : "");
+    fat->files = g_ptr_array_new_with_free_func((GDestroyNotify) fat_file_free);
+
+    return fat;
+}
+
+void
+pu_fat_free(PuFat *fat)
+{
+    g_return_if_fail(fat != NULL);
+
+    g_free(fat->label);
+    g_ptr_array_unref(fat->files);
+    g_free(fat);
+}
+
+static gboolean
+fat_is_short_name_char(gchar c)
+{
+    return g_ascii_isupper(c) || g_ascii_isdigit(c) ||
+           strchr("!#$%&'()-@^_`{}~", c) != NULL;
+}
+
+/* Whether the name can be stored as short name only, i.e. in upper case 8.3 */
+static gboolean
+fat_is_short_name(const gchar *name)
+{
+    const gchar *dot = strrchr(name, '.');
+    gsize base = dot ? (gsize) (dot - name) : strlen(name);
+    gsize ext = dot ? strlen(dot + 1) : 0;
+
+    if (base == 0 || base > 8 || ext > 3 || (dot && ext == 0))
+        return FALSE;
+
+    for (const gchar *c = name; *c; c++) {
+        if (c != dot && !fat_is_short_name_char(*c))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Append the characters of a part of a long name usable in a short name,
+ * replacing others by '_'. Returns whether the part was stored lossless.
+ */
+static gboolean
+fat_short_name_append(GString *str,
+                      const gchar *start,
+                      const gchar *end,
+                      gsize max)
+{
+    gboolean lossless = TRUE;
+
+    for (const gchar *c = start; c < end; c = g_utf8_next_char(c)) {
+        gchar upper = g_ascii_toupper(*c);
+
+        if (*c == ' ' || *c == '.') {
+            lossless = FALSE;
+            continue;
+        }
+        if (str->len == max) {
+            lossless = FALSE;
+            break;
+        }
+        if (fat_is_short_name_char(upper)) {
+            g_string_append_c(str, upper);
+        } else {
+            g_string_append_c(str, '_');
+            lossless = FALSE;
+        }
+    }
+
+    return lossless;
+}
+
+static gboolean
+fat_short_name_exists(PuFat *fat,
+                      const guint8 *short_name)
+{
+    for (guint i = 0; i < fat->files->len; i++) {
+        PuFatFile *file = g_ptr_array_index(fat->files, i);
+
+        if (memcmp(file->short_name, short_name, 11) == 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Derive a unique short name from a long name as described by the FAT
+ * specification, adding a numeric tail like "~1" if the conversion is lossy.
+ */
+static void
+fat_create_short_name(PuFat *fat,
+                      const gchar *name,
+                      guint8 *short_name)
+{
+    g_autoptr(GString) base = g_string_new(NULL);
+    g_autoptr(GString) ext = g_string_new(NULL);
+    const gchar *start = name;
+    const gchar *dot;
+    gboolean lossless;
+
+    while (*start == '.' || *start == ' ')
+        start++;
+    dot = strrchr(start, '.');
+
+    lossless = fat_short_name_append(base, start, dot ? dot : start + strlen(start), 8);
+    if (dot)
+        lossless &= fat_short_name_append(ext, dot + 1, dot + strlen(dot), 3);
+    lossless &= start == name;
+    if (base->len == 0)
+        g_string_append_c(base, '_');
+
+    memset(short_name, ' ', 11);
+    memcpy(short_name, base->str, base->len);
+    memcpy(short_name + 8, ext->str, ext->len);
+
+    if (lossless && !fat_short_name_exists(fat, short_name))
+        return;
+
+    for (guint n = 1; ; n++) {
+        g_autofree gchar *tail = g_strdup_printf("~%u", n);
+        gsize keep = MIN(base->len, 8 - strlen(tail));
+
+        memset(short_name, ' ', 8);
+        memcpy(short_name, base->str, keep);
+        memcpy(short_name + keep, tail, strlen(tail));
+        if (!fat_short_name_exists(fat, short_name))
+            return;
+    }
+}
+
+static gboolean
+fat_add(PuFat *fat,
+        const gchar *name,
+        PuFatFile *file,
+        GError **error)
+{
+    g_autofree gunichar2 *utf16 = NULL;
+    g_autofree gchar *folded = NULL;
+    glong length;
+
+    utf16 = g_utf8_to_utf16(name, -1, NULL, &length, NULL);
+    if (utf16 == NULL || length == 0 || length > FAT_MAX_NAME_LENGTH ||
+        g_str_equal(name, ".") || g_str_equal(name, "..") ||
+        strpbrk(name, "\"*/:<>?\\|") != NULL) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_FILENAME,
+                    "Invalid name '%s' for a file in a FAT filesystem", name);
+        fat_file_free(file);
+        return FALSE;
+    }
+    for (const gchar *c = name; *c; c++) {
+        if ((guchar) *c < 0x20) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_FILENAME,
+                        "Invalid name '%s' for a file in a FAT filesystem", name);
+            fat_file_free(file);
+            return FALSE;
+        }
+    }
+
+    /* Long names are case insensitive */
+    folded = g_utf8_casefold(name, -1);
+    for (guint i = 0; i < fat->files->len; i++) {
+        PuFatFile *other = g_ptr_array_index(fat->files, i);
+        g_autofree gchar *other_folded = g_utf8_casefold(other->name, -1);
+
+        if (g_str_equal(folded, other_folded)) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_EXISTS,
+                        "File '%s' already exists in FAT filesystem", name);
+            fat_file_free(file);
+            return FALSE;
+        }
+    }
+
+    if (file->size > G_MAXUINT32) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                    "File '%s' is too large for a FAT filesystem", name);
+        fat_file_free(file);
+        return FALSE;
+    }
+
+    file->name = g_strdup(name);
+    memset(file->short_name, ' ', 11);
+    if (fat_is_short_name(name)) {
+        memcpy(file->short_name, name, strcspn(name, "."));
+        if (strchr(name, '.'))
+            memcpy(file->short_name + 8, strchr(name, '.') + 1,
+                   strlen(strchr(name, '.') + 1));
+    }
+
+    /* Other names need a generated short name and a long name */
+    if (file->short_name[0] == ' ' ||
+        fat_short_name_exists(fat, file->short_name)) {
+        fat_create_short_name(fat, name, file->short_name);
+        file->lfn_entries = (length + FAT_LFN_CHARS - 1) / FAT_LFN_CHARS;
+    }
+
+    g_ptr_array_add(fat->files, file);
+
+    return TRUE;
+}
+
+/*
+ * Add a file to the root directory of the filesystem, named like the input
+ * file. Its content is only read when writing the filesystem, computing the
+ * optional digests, see pu_io_copy_extents().
+ */
+gboolean
+pu_fat_add_file(PuFat *fat,
+                const gchar *path,
+                GArray *digests,
+                GError **error)
+{
+    g_autoptr(GFile) gfile = NULL;
+    g_autoptr(GFileInfo) info = NULL;
+    g_autoptr(GDateTime) mtime = NULL;
+    g_autofree gchar *name = NULL;
+    PuFatFile *file;
+
+    g_return_val_if_fail(fat != NULL, FALSE);
+    g_return_val_if_fail(path != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    gfile = g_file_new_for_path(path);
+    info = g_file_query_info(gfile,
+                             G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                             G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                             G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                             G_FILE_QUERY_INFO_NONE, NULL, error);
+    if (info == NULL)
+        return FALSE;
+
+    if (g_file_info_get_file_type(info) != G_FILE_TYPE_REGULAR) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE,
+                    "'%s' is not a regular file", path);
+        return FALSE;
+    }
+
+    file = g_new0(PuFatFile, 1);
+    file->path = g_strdup(path);
+    file->digests = digests ? g_array_ref(digests) : NULL;
+    file->size = g_file_info_get_size(info);
+    mtime = g_file_info_get_modification_date_time(info);
+    file->mtime = g_date_time_to_local(mtime);
+    name = g_path_get_basename(path);
+
+    return fat_add(fat, name, file, error);
+}
+
+/* Add a file with the given content to the root directory */
+gboolean
+pu_fat_add_data(PuFat *fat,
+                const gchar *name,
+                GBytes *data,
+                GError **error)
+{
+    PuFatFile *file;
+
+    g_return_val_if_fail(fat != NULL, FALSE);
+    g_return_val_if_fail(name != NULL, FALSE);
+    g_return_val_if_fail(data != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    file = g_new0(PuFatFile, 1);
+    file->data = g_bytes_ref(data);
+    file->size = g_bytes_get_size(data);
+    file->mtime = g_date_time_new_now_local();
+
+    return fat_add(fat, name, file, error);
+}
+
+/* Cluster sizes recommended by the FAT specification for a volume size */
+static guint32
+fat_get_cluster_sectors(PuFatType type,
+                        guint32 total_sectors)
+{
+    if (type == PU_FAT_TYPE_16) {
+        if (total_sectors <= 32680)
+            return 2;
+        if (total_sectors <= 262144)
+            return 4;
+        if (total_sectors <= 524288)
+            return 8;
+        if (total_sectors <= 1048576)
+            return 16;
+        if (total_sectors <= 2097152)
+            return 32;
+        return 64;
+    }
+
+    if (total_sectors <= 532480)
+        return 1;
+    if (total_sectors <= 16777216)
+        return 8;
+    if (total_sectors <= 33554432)
+        return 16;
+    if (total_sectors <= 67108864)
+        return 32;
+    return 64;
+}
+
+/*
+ * Lay out the filesystem on a device of the given size. The data region is
+ * aligned to the cluster size by padding the reserved sectors. Sizes the
+ * cluster count of the FAT type cannot be reached for are not supported.
+ */
+static gboolean
+fat_compute_layout(PuFat *fat,
+                   goffset device_size,
+                   GError **error)
+{
+    guint64 total = MIN(device_size / FAT_SECTOR_SIZE, G_MAXUINT32);
+    guint64 divisor;
+    guint64 meta;
+    guint32 entry_size = fat->type == PU_FAT_TYPE_16 ? 2 : 4;
+    guint32 min_clusters;
+    guint32 max_clusters;
+
+    fat->total_sectors = total;
+    fat->cluster_sectors = fat_get_cluster_sectors(fat->type, total);
+    if (fat->type == PU_FAT_TYPE_16) {
+        fat->reserved_sectors = 1;
+        fat->root_sectors = FAT16_ROOT_ENTRIES * FAT_DIR_ENTRY_SIZE / FAT_SECTOR_SIZE;
+        min_clusters = FAT16_MIN_CLUSTERS;
+        max_clusters = FAT32_MIN_CLUSTERS - 1;
+    } else {
+        fat->reserved_sectors = 32;
+        fat->root_sectors = 0;
+        min_clusters = FAT32_MIN_CLUSTERS;
+        max_clusters = FAT32_MAX_CLUSTERS;
+    }
+
+    if (total <= fat->reserved_sectors + fat->root_sectors)
+        goto unsupported;
+
+    /* Size of one FAT as computed by the FAT specification */
+    divisor = 256 * fat->cluster_sectors + FAT_NUM_FATS;
+    if (fat->type == PU_FAT_TYPE_32)
+        divisor /= 2;
+    fat->fat_sectors = (total - fat->reserved_sectors - fat->root_sectors +
+                        divisor - 1) / divisor;
+
+    meta = fat->reserved_sectors + FAT_NUM_FATS * fat->fat_sectors +
+           fat->root_sectors;
+    fat->reserved_sectors += (fat->cluster_sectors - meta % fat->cluster_sectors) %
+                             fat->cluster_sectors;
+    meta = fat->reserved_sectors + FAT_NUM_FATS * fat->fat_sectors +
+           fat->root_sectors;
+    if (meta >= total)
+        goto unsupported;
+
+    fat->clusters = (total - meta) / fat->cluster_sectors;
+    if (fat->clusters < min_clusters || fat->clusters > max_clusters ||
+        (guint64) fat->fat_sectors * FAT_SECTOR_SIZE / entry_size < fat->clusters + 2)
+        goto unsupported;
+
+    return TRUE;
+
+unsupported:
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                "Size of %" G_GOFFSET_FORMAT " bytes is not supported for FAT%s",
+                device_size, fat->type == PU_FAT_TYPE_16 ? "16" : "32");
+    return FALSE;
+}
+
+static guint32
+fat_get_cluster_size(PuFat *fat)
+{
+    return fat->cluster_sectors * FAT_SECTOR_SIZE;
+}
+
+static goffset
+fat_get_cluster_offset(PuFat *fat,
+                       guint32 cluster)
+{
+    return ((goffset) fat->reserved_sectors + FAT_NUM_FATS * fat->fat_sectors +
+            fat->root_sectors + (goffset) (cluster - 2) * fat->cluster_sectors) *
+           FAT_SECTOR_SIZE;
+}
+
+/* Assign consecutive clusters to the root directory and files, in order */
+static gboolean
+fat_allocate(PuFat *fat,
+             GError **error)
+{
+    guint32 cluster_size = fat_get_cluster_size(fat);
+    guint64 entries = g_strcmp0(fat->label, "") > 0 ? 1 : 0;
+    guint64 next = 2;
+
+    for (guint i = 0; i < fat->files->len; i++) {
+        PuFatFile *file = g_ptr_array_index(fat->files, i);
+
+        entries += 1 + file->lfn_entries;
+    }
+
+    if (fat->type == PU_FAT_TYPE_16) {
+        if (entries > FAT16_ROOT_ENTRIES) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                        "Too many files for the FAT16 root directory");
+            return FALSE;
+        }
+        fat->root_clusters = 0;
+    } else {
+        fat->root_clusters = MAX((entries * FAT_DIR_ENTRY_SIZE + cluster_size - 1) /
+                                 cluster_size, 1);
+        next += fat->root_clusters;
+    }
+
+    for (guint i = 0; i < fat->files->len; i++) {
+        PuFatFile *file = g_ptr_array_index(fat->files, i);
+
+        file->clusters = (file->size + cluster_size - 1) / cluster_size;
+        file->first_cluster = file->clusters > 0 ? next : 0;
+        next += file->clusters;
+    }
+
+    if (next - 2 > fat->clusters) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                    "Files of %" G_GUINT64_FORMAT " clusters do not fit into %u "
+                    "clusters of the FAT filesystem", next - 2, fat->clusters);
+        return FALSE;
+    }
+    fat->used_clusters = next - 2;
+
+    return TRUE;
+}
+
+/* Use the geometry of the partition, like mkfs.fat does, if available */
+static void
+fat_query_geometry(PuFat *fat,
+                   gint fd)
+{
+    struct hd_geometry geometry;
+
+    fat->track_sectors = 63;
+    fat->heads = 255;
+    fat->hidden_sectors = 0;
+
+    if (ioctl(fd, HDIO_GETGEO, &geometry) < 0)
+        return;
+
+    if (geometry.sectors > 0 && geometry.heads > 0) {
+        fat->track_sectors = geometry.sectors;
+        fat->heads = geometry.heads;
+    }
+    fat->hidden_sectors = geometry.start;
+}
+
+static void
+fat_fill_boot_sector(PuFat *fat,
+                     guint8 *sector,
+                     guint32 volume_id)
+{
+    /* Boot code asking the BIOS to try the next boot device */
+    static const guint8 boot_code[] = { 0xcd, 0x18, 0xeb, 0xfe };
+    gchar label[FAT_LABEL_LENGTH + 1];
+    guint8 *ext;
+
+    g_snprintf(label, sizeof(label), "%-11s",
+               g_strcmp0(fat->label, "") > 0 ? fat->label : "NO NAME");
+
+    sector[0] = 0xeb;
+    sector[1] = fat->type == PU_FAT_TYPE_16 ? 0x3c : 0x58;
+    sector[2] = 0x90;
+    memcpy(sector + 3, "partup  ", 8);
+    fat_put16(sector + 11, FAT_SECTOR_SIZE);
+    sector[13] = fat->cluster_sectors;
+    fat_put16(sector + 14, fat->reserved_sectors);
+    sector[16] = FAT_NUM_FATS;
+    fat_put16(sector + 17, fat->type == PU_FAT_TYPE_16 ? FAT16_ROOT_ENTRIES : 0);
+    fat_put16(sector + 19, fat->total_sectors < 0x10000 ? fat->total_sectors : 0);
+    sector[21] = FAT_MEDIA;
+    fat_put16(sector + 22, fat->type == PU_FAT_TYPE_16 ? fat->fat_sectors : 0);
+    fat_put16(sector + 24, fat->track_sectors);
+    fat_put16(sector + 26, fat->heads);
+    fat_put32(sector + 28, fat->hidden_sectors);
+    fat_put32(sector + 32, fat->total_sectors < 0x10000 ? 0 : fat->total_sectors);
+
+    if (fat->type == PU_FAT_TYPE_32) {
+        fat_put32(sector + 36, fat->fat_sectors);
+        fat_put32(sector + 44, 2);
+        fat_put16(sector + 48, FAT32_FSINFO_SECTOR);
+        fat_put16(sector + 50, FAT32_BACKUP_SECTOR);
+        ext = sector + 64;
+    } else {
+        ext = sector + 36;
+    }
+
+    ext[0] = 0x80;
+    ext[2] = 0x29;
+    fat_put32(ext + 3, volume_id);
+    memcpy(ext + 7, label, FAT_LABEL_LENGTH);
+    memcpy(ext + 18, fat->type == PU_FAT_TYPE_16 ? "FAT16   " : "FAT32   ", 8);
+    memcpy(ext + 26, boot_code, sizeof(boot_code));
+
+    sector[510] = 0x55;
+    sector[511] = 0xaa;
+}
+
+static void
+fat_fill_fsinfo(PuFat *fat,
+                guint8 *sector)
+{
+    fat_put32(sector, 0x41615252);
+    fat_put32(sector + 484, 0x61417272);
+    fat_put32(sector + 488, fat->clusters - fat->used_clusters);
+    fat_put32(sector + 492, fat->used_clusters + 2);
+    fat_put32(sector + 508, 0xaa550000);
+}
+
+static void
+fat_set_entry(PuFat *fat,
+              guint8 *table,
+              guint32 cluster,
+              guint32 value)
+{
+    if (fat->type == PU_FAT_TYPE_16)
+        fat_put16(table + cluster * 2, value);
+    else
+        fat_put32(table + cluster * 4, value);
+}
+
+static void
+fat_set_chain(PuFat *fat,
+              guint8 *table,
+              guint32 first,
+              guint32 count)
+{
+    guint32 eoc = fat->type == PU_FAT_TYPE_16 ? 0xffff : 0x0fffffff;
+
+    for (guint32 c = first; c < first + count; c++)
+        fat_set_entry(fat, table, c, c + 1 < first + count ? c + 1 : eoc);
+}
+
+static void
+fat_fill_table(PuFat *fat,
+               guint8 *table)
+{
+    if (fat->type == PU_FAT_TYPE_16) {
+        fat_set_entry(fat, table, 0, 0xff00 | FAT_MEDIA);
+        fat_set_entry(fat, table, 1, 0xffff);
+    } else {
+        fat_set_entry(fat, table, 0, 0x0fffff00 | FAT_MEDIA);
+        fat_set_entry(fat, table, 1, 0x0fffffff);
+        fat_set_chain(fat, table, 2, fat->root_clusters);
+    }
+
+    for (guint i = 0; i < fat->files->len; i++) {
+        PuFatFile *file = g_ptr_array_index(fat->files, i);
+
+        fat_set_chain(fat, table, file->first_cluster, file->clusters);
+    }
+}
+
+static void
+fat_put_time(guint8 *entry,
+             GDateTime *time)
+{
+    gint year = CLAMP(g_date_time_get_year(time), 1980, 2107);
+
+    fat_put16(entry, (g_date_time_get_hour(time) << 11) |
+                     (g_date_time_get_minute(time) << 5) |
+                     (g_date_time_get_second(time) / 2));
+    fat_put16(entry + 2, ((year - 1980) << 9) |
+                         (g_date_time_get_month(time) << 5) |
+                         g_date_time_get_day_of_month(time));
+}
+
+static guint8
+fat_short_name_checksum(const guint8 *short_name)
+{
+    guint8 sum = 0;
+
+    for (guint i = 0; i < 11; i++)
+        sum = ((sum & 1) << 7) + (sum >> 1) + short_name[i];
+
+    return sum;
+}
+
+/* Store the long name in entries preceding the short name entry */
+static guint8 *
+fat_fill_lfn_entries(PuFatFile *file,
+                     guint8 *entry)
+{
+    static const guint offsets[FAT_LFN_CHARS] = {
+        1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30
+    };
+    g_autofree gunichar2 *name = NULL;
+    guint8 checksum = fat_short_name_checksum(file->short_name);
+    glong length;
+
+    name = g_utf8_to_utf16(file->name, -1, NULL, &length, NULL);
+
+    for (guint n = file->lfn_entries; n > 0; n--, entry += FAT_DIR_ENTRY_SIZE) {
+        entry[0] = n | (n == file->lfn_entries ? 0x40 : 0);
+        entry[11] = FAT_ATTR_LONG_NAME;
+        entry[13] = checksum;
+        for (guint i = 0; i < FAT_LFN_CHARS; i++) {
+            glong pos = (n - 1) * FAT_LFN_CHARS + i;
+
+            fat_put16(entry + offsets[i],
+                      pos < length ? name[pos] : pos == length ? 0 : 0xffff);
+        }
+    }
+
+    return entry;
+}
+
+static void
+fat_fill_root(PuFat *fat,
+              guint8 *dir)
+{
+    g_autoptr(GDateTime) now = g_date_time_new_now_local();
+    guint8 *entry = dir;
+
+    if (g_strcmp0(fat->label, "") > 0) {
+        memset(entry, ' ', 11);
+        memcpy(entry, fat->label, strlen(fat->label));
+        entry[11] = FAT_ATTR_VOLUME_ID;
+        fat_put_time(entry + 22, now);
+        entry += FAT_DIR_ENTRY_SIZE;
+    }
+
+    for (guint i = 0; i < fat->files->len; i++) {
+        PuFatFile *file = g_ptr_array_index(fat->files, i);
+
+        entry = fat_fill_lfn_entries(file, entry);
+        memcpy(entry, file->short_name, 11);
+        entry[11] = FAT_ATTR_ARCHIVE;
+        fat_put_time(entry + 14, file->mtime);
+        memcpy(entry + 18, entry + 16, 2);
+        if (fat->type == PU_FAT_TYPE_32)
+            fat_put16(entry + 20, file->first_cluster >> 16);
+        fat_put_time(entry + 22, file->mtime);
+        fat_put16(entry + 26, file->first_cluster & 0xffff);
+        fat_put32(entry + 28, file->size);
+        entry += FAT_DIR_ENTRY_SIZE;
+    }
+}
+
+static gboolean
+fat_write_file(PuFat *fat,
+               PuFatFile *file,
+               gint fd,
+               const gchar *device,
+               GError **error)
+{
+    g_autoptr(GArray) extents = NULL;
+    PuFileExtent extent = { 0, file->size };
+    goffset offset = fat_get_cluster_offset(fat, file->first_cluster);
+    gboolean res;
+    gint input_fd;
+
+    if (file->data)
+        return pu_io_pwrite_all(fd, device, g_bytes_get_data(file->data, NULL),
+                                file->size, offset, error);
+
+    input_fd = g_open(file->path, O_RDONLY | O_CLOEXEC, 0);
+    if (input_fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed opening '%s': %s", file->path, g_strerror(errno));
+        return FALSE;
+    }
+
+    extents = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+    g_array_append_val(extents, extent);
+    res = pu_io_copy_extents(input_fd, file->path, fd, device, extents, offset,
+                             file->digests, error);
+    g_close(input_fd, NULL);
+
+    return res;
+}
+
+/*
+ * Format the device and write all files in a single pass in ascending order:
+ * the reserved sectors, both FATs, the root directory and the file data. The
+ * remaining clusters are left as they are, like mkfs.fat does.
+ */
+gboolean
+pu_fat_write(PuFat *fat,
+             const gchar *device,
+             GError **error)
+{
+    g_autofree guint8 *head = NULL;
+    g_autofree guint8 *table = NULL;
+    g_autofree guint8 *root = NULL;
+    goffset device_size;
+    goffset written = 0;
+    gsize table_size;
+    gsize root_size;
+    guint32 volume_id = g_random_int();
+    PuStatsStep *step;
+    gboolean res = FALSE;
+    gint fd;
+
+    g_return_val_if_fail(fat != NULL, FALSE);
+    g_return_val_if_fail(device != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    fd = g_open(device, O_WRONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed opening '%s': %s", device, g_strerror(errno));
+        return FALSE;
+    }
+
+    device_size = lseek(fd, 0, SEEK_END);
+    if (device_size < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed getting size of '%s': %s", device, g_strerror(errno));
+        g_close(fd, NULL);
+        return FALSE;
+    }
+
+    if (!fat_compute_layout(fat, device_size, error) || !fat_allocate(fat, error)) {
+        g_close(fd, NULL);
+        return FALSE;
+    }
+    fat_query_geometry(fat, fd);
+
+    g_debug("Creating FAT%s on '%s': clusters=%u cluster_size=%u fat_sectors=%u",
+            fat->type == PU_FAT_TYPE_16 ? "16" : "32", device, fat->clusters,
+            fat_get_cluster_size(fat), fat->fat_sectors);
+
+    step = pu_stats_begin("mkfs", device);
+
+    head = g_malloc0((gsize) fat->reserved_sectors * FAT_SECTOR_SIZE);
+    fat_fill_boot_sector(fat, head, volume_id);
+    if (fat->type == PU_FAT_TYPE_32) {
+        fat_fill_fsinfo(fat, head + FAT32_FSINFO_SECTOR * FAT_SECTOR_SIZE);
+        memcpy(head + FAT32_BACKUP_SECTOR * FAT_SECTOR_SIZE, head,
+               2 * FAT_SECTOR_SIZE);
+    }
+
+    table_size = (gsize) fat->fat_sectors * FAT_SECTOR_SIZE;
+    table = g_malloc0(table_size);
+    fat_fill_table(fat, table);
+
+    root_size = fat->type == PU_FAT_TYPE_16 ?
+                (gsize) fat->root_sectors * FAT_SECTOR_SIZE :
+                (gsize) fat->root_clusters * fat_get_cluster_size(fat);
+    root = g_malloc0(root_size);
+    fat_fill_root(fat, root);
+
+    if (!pu_io_pwrite_all(fd, device, head,
+                          (gsize) fat->reserved_sectors * FAT_SECTOR_SIZE, 0,
+                          error))
+        goto out;
+    written += fat->reserved_sectors * FAT_SECTOR_SIZE;
+
+    for (guint n = 0; n < FAT_NUM_FATS; n++) {
+        if (!pu_io_pwrite_all(fd, device, table, table_size, written, error))
+            goto out;
+        written += table_size;
+    }
+
+    if (!pu_io_pwrite_all(fd, device, root, root_size, written, error))
+        goto out;
+    written += root_size;
+
+    for (guint i = 0; i < fat->files->len; i++) {
+        PuFatFile *file = g_ptr_array_index(fat->files, i);
+
+        if (file->size > 0 && !fat_write_file(fat, file, fd, device, error))
+            goto out;
+        written += file->size;
+    }
+
+    res = TRUE;
+
+out:
+    pu_stats_end(step, written, res);
+    g_close(fd, NULL);
+
+    if (!res)
+        g_prefix_error(error, "Failed creating FAT filesystem on '%s': ", device);
+
+    return res;
+}
@@ -0,0 +1,37 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#ifndef PARTUP_FAT_H
+#define PARTUP_FAT_H
+
+#include <glib.h>
+
+typedef enum {
+    PU_FAT_TYPE_16,
+    PU_FAT_TYPE_32
+} PuFatType;
+
+typedef struct _PuFat PuFat;
+
+gboolean pu_fat_type_from_string(const gchar *fstype,
+                                 PuFatType *type);
+PuFat * pu_fat_new(PuFatType type,
+                   const gchar *label,
+                   GError **error);
+void pu_fat_free(PuFat *fat);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PuFat, pu_fat_free)
+gboolean pu_fat_add_file(PuFat *fat,
+                         const gchar *path,
+                         GArray *digests,
+                         GError **error);
+gboolean pu_fat_add_data(PuFat *fat,
+                         const gchar *name,
+                         GBytes *data,
+                         GError **error);
+gboolean pu_fat_write(PuFat *fat,
+                      const gchar *device,
+                      GError **error);
+
+#endif /* PARTUP_FAT_H */
@@ -4,8 +4,14 @@
  */
 
 #define G_LOG_DOMAIN "partup-file"
+#define _GNU_SOURCE
 
+#include <errno.h>
+#include <fcntl.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "pu-error.h"
 #include "pu-file.h"
 
@@ -110,3 +116,100 @@ pu_file_get_size(const gchar *path,
 
     return g_file_info_get_size(file_info);
 }
+
+/*
+ * Get the data extents of a file in the range starting at offset with the given
+ * length, skipping any holes of sparse files. A negative length selects the
+ * range up to the end of the file. Files that cannot be sparse, e.g. character
+ * devices, are returned as one single extent covering the whole range.
+ *
+ * Returns a GArray of PuFileExtent, sorted by offset.
+ */
+GArray *
+pu_file_get_data_extents(const gchar *path,
+                         goffset offset,
+                         goffset length,
+                         GError **error)
+{
+    g_autoptr(GArray) extents = NULL;
+    PuFileExtent extent;
+    struct stat st;
+    goffset end;
+    goffset pos;
+    goffset data;
+    goffset hole;
+    gint fd;
+
+    g_return_val_if_fail(g_strcmp0(path, "") > 0, NULL);
+    g_return_val_if_fail(offset >= 0, NULL);
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    fd = g_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed opening '%s': %s", path, g_strerror(errno));
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed querying '%s': %s", path, g_strerror(errno));
+        g_close(fd, NULL);
+        return NULL;
+    }
+
+    extents = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+    end = length < 0 ? st.st_size : offset + length;
+
+    if (!S_ISREG(st.st_mode)) {
+        extent.offset = offset;
+        extent.length = end - offset;
+        if (extent.length > 0)
+            g_array_append_val(extents, extent);
+        g_close(fd, NULL);
+        return g_steal_pointer(&extents);
+    }
+
+    end = MIN(end, st.st_size);
+    pos = offset;
+
+    while (pos < end) {
+        data = lseek(fd, pos, SEEK_DATA);
+        if (data < 0 && errno == ENXIO) {
+            /* Only a hole is left until the end of the file */
+            break;
+        } else if (data < 0 && errno == EINVAL) {
+            /* The filesystem does not report holes; treat the rest as data */
+            data = pos;
+            hole = end;
+        } else if (data < 0) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Failed seeking data in '%s': %s", path, g_strerror(errno));
+            g_close(fd, NULL);
+            return NULL;
+        } else {
+            hole = lseek(fd, data, SEEK_HOLE);
+            if (hole < 0) {
+                g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                            "Failed seeking hole in '%s': %s", path, g_strerror(errno));
+                g_close(fd, NULL);
+                return NULL;
+            }
+        }
+
+        if (data >= end)
+            break;
+
+        extent.offset = data;
+        extent.length = MIN(hole, end) - data;
+        g_array_append_val(extents, extent);
+        pos = data + extent.length;
+    }
+
+    g_close(fd, NULL);
+
+    g_debug("'%s' contains %u data extents between %" G_GOFFSET_FORMAT
+            " and %" G_GOFFSET_FORMAT, path, extents->len, offset, end);
+
+    return g_steal_pointer(&extents);
+}
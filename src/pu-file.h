@@ -8,6 +8,11 @@
 
 #include <glib.h>
 
+typedef struct {
+    goffset offset;
+    goffset length;
+} PuFileExtent;
+
 gboolean pu_file_read_raw(const gchar *filename,
                           guchar **buffer,
                           goffset offset,
@@ -22,5 +27,9 @@ gboolean pu_file_copy(const gchar *src,
                       GError **error);
 goffset pu_file_get_size(const gchar *path,
                          GError **error);
+GArray * pu_file_get_data_extents(const gchar *path,
+                                  goffset offset,
+                                  goffset length,
+                                  GError **error);
 
 #endif /* PARTUP_FILE_H */
@@ -7,12 +7,15 @@
 
 #include "pu-flash.h"
 #include "pu-config.h"
+#include "pu-io.h"
+#include "pu-stats.h"
 
 typedef struct {
     gchar *device_path;
     PuConfig *config;
     gchar *prefix;
     gboolean skip_checksums;
+    gboolean incremental;
 } PuFlashPrivate;
 
 enum {
@@ -21,6 +24,7 @@ enum {
     PROP_CONFIG,
     PROP_PREFIX,
     PROP_SKIP_CHECKSUMS,
+    PROP_INCREMENTAL,
     NUM_PROPS
 };
 static GParamSpec *props[NUM_PROPS] = { NULL };
@@ -81,6 +85,9 @@ pu_flash_set_property(GObject *object,
     case PROP_SKIP_CHECKSUMS:
         priv->skip_checksums = g_value_get_boolean(value);
         break;
+    case PROP_INCREMENTAL:
+        priv->incremental = g_value_get_boolean(value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
         break;
@@ -109,6 +116,9 @@ pu_flash_get_property(GObject *object,
     case PROP_SKIP_CHECKSUMS:
         g_value_set_boolean(value, priv->skip_checksums);
         break;
+    case PROP_INCREMENTAL:
+        g_value_set_boolean(value, priv->incremental);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
         break;
@@ -150,6 +160,12 @@ pu_flash_class_init(PuFlashClass *class)
                              "Modifier to skip checksum verification for all files when writing",
                              FALSE,
                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    props[PROP_INCREMENTAL] =
+        g_param_spec_boolean("incremental",
+                             "Modifier for incremental installs",
+                             "Modifier to keep a matching layout and only rewrite changed partitions",
+                             FALSE,
+                             G_PARAM_READWRITE);
 
     g_object_class_install_properties(object_class, NUM_PROPS, props);
 }
@@ -159,23 +175,64 @@ pu_flash_init(G_GNUC_UNUSED PuFlash *self)
 {
 }
 
+/*
+ * Flush the device once after each stage, so data cached while writing is not
+ * written back at some later, unpredictable point.
+ */
+static gboolean
+flash_flush_device(PuFlash *self,
+                   GError **error)
+{
+    PuFlashPrivate *priv = pu_flash_get_instance_private(self);
+    PuStatsStep *step;
+    gboolean res;
+
+    if (priv->device_path == NULL)
+        return TRUE;
+
+    step = pu_stats_begin("flush", priv->device_path);
+    res = pu_io_flush(priv->device_path, error);
+    pu_stats_end(step, 0, res);
+
+    return res;
+}
+
+/* Run a stage of the installation, recorded as a step of the statistics */
+static gboolean
+flash_run_stage(PuFlash *self,
+                const gchar *name,
+                gboolean (*stage)(PuFlash *self, GError **error),
+                GError **error)
+{
+    PuStatsStep *step = pu_stats_begin(name, G_OBJECT_TYPE_NAME(self));
+    gboolean res;
+
+    res = stage(self, error) && flash_flush_device(self, error);
+    pu_stats_end(step, 0, res);
+
+    return res;
+}
+
 gboolean
 pu_flash_init_device(PuFlash *self,
                      GError **error)
 {
-    return PU_FLASH_GET_CLASS(self)->init_device(self, error);
+    return flash_run_stage(self, "init-device",
+                           PU_FLASH_GET_CLASS(self)->init_device, error);
 }
 
 gboolean
 pu_flash_setup_layout(PuFlash *self,
                       GError **error)
 {
-    return PU_FLASH_GET_CLASS(self)->setup_layout(self, error);
+    return flash_run_stage(self, "setup-layout",
+                           PU_FLASH_GET_CLASS(self)->setup_layout, error);
 }
 
 gboolean
 pu_flash_write_data(PuFlash *self,
                     GError **error)
 {
-    return PU_FLASH_GET_CLASS(self)->write_data(self, error);
+    return flash_run_stage(self, "write-data",
+                           PU_FLASH_GET_CLASS(self)->write_data, error);
 }
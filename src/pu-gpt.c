@@ -0,0 +1,239 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#define G_LOG_DOMAIN "partup-gpt"
+
+#include <string.h>
+#include "pu-error.h"
+#include "pu-gpt.h"
+
+#define GPT_SIGNATURE             "EFI PART"
+#define GPT_PRIMARY_HEADER_LBA    1
+#define GPT_MIN_HEADER_SIZE       92
+#define GPT_MIN_ENTRY_SIZE        128
+#define GPT_MAX_ENTRIES           1024
+
+/* Offsets of the header fields */
+#define GPT_HEADER_SIZE           12
+#define GPT_HEADER_CRC            16
+#define GPT_HEADER_BACKUP_LBA     32
+#define GPT_HEADER_ENTRIES_LBA    72
+#define GPT_HEADER_NUM_ENTRIES    80
+#define GPT_HEADER_ENTRY_SIZE     84
+#define GPT_HEADER_ENTRIES_CRC    88
+
+/* Offset of the unique partition GUID in a partition entry */
+#define GPT_ENTRY_UNIQUE_GUID     16
+
+static guint32
+gpt_get_le32(const guchar *buffer)
+{
+    return (guint32) buffer[0] | (guint32) buffer[1] << 8 |
+           (guint32) buffer[2] << 16 | (guint32) buffer[3] << 24;
+}
+
+static guint64
+gpt_get_le64(const guchar *buffer)
+{
+    return (guint64) gpt_get_le32(buffer) | (guint64) gpt_get_le32(buffer + 4) << 32;
+}
+
+static void
+gpt_set_le32(guchar *buffer,
+             guint32 value)
+{
+    for (guint i = 0; i < 4; i++)
+        buffer[i] = value >> (8 * i);
+}
+
+/* CRC32 as used by GPT, i.e. the one of zlib and Ethernet */
+static guint32
+gpt_crc32(const guchar *data,
+          gsize length)
+{
+    guint32 crc = 0xffffffff;
+
+    for (gsize i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (guint k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+
+    return ~crc;
+}
+
+/*
+ * Convert a GUID in its string representation to the mixed-endian byte order
+ * stored on disk, where the first three fields are little-endian.
+ */
+gboolean
+pu_gpt_parse_guid(const gchar *str,
+                  guchar *guid)
+{
+    static const guint order[PU_GPT_GUID_SIZE] = {
+        3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15
+    };
+    guchar bytes[PU_GPT_GUID_SIZE];
+    guint n = 0;
+
+    g_return_val_if_fail(str != NULL, FALSE);
+    g_return_val_if_fail(guid != NULL, FALSE);
+
+    if (!g_uuid_string_is_valid(str))
+        return FALSE;
+
+    for (const gchar *c = str; *c != '\0'; c++) {
+        if (*c == '-')
+            continue;
+        bytes[n / 2] = (n % 2) ? bytes[n / 2] | g_ascii_xdigit_value(*c) :
+                                 g_ascii_xdigit_value(*c) << 4;
+        n++;
+    }
+
+    for (guint i = 0; i < PU_GPT_GUID_SIZE; i++)
+        guid[i] = bytes[order[i]];
+
+    return TRUE;
+}
+
+/*
+ * Set the unique GUIDs in the partition entries belonging to the header at the
+ * given LBA and update the checksums of both. Returns the LBA of the other
+ * header in alternate_lba.
+ */
+static gboolean
+gpt_update_table(PedDevice *device,
+                 PedSector header_lba,
+                 GPtrArray *guids,
+                 PedSector *alternate_lba,
+                 GError **error)
+{
+    g_autofree guchar *header = g_malloc(device->sector_size);
+    g_autofree guchar *entries = NULL;
+    guint32 header_size;
+    guint32 num_entries;
+    guint32 entry_size;
+    PedSector entries_lba;
+    PedSector entries_sectors;
+
+    if (!ped_device_read(device, header, header_lba, 1)) {
+        g_set_error(error, PU_ERROR, PU_ERROR_FLASH_LAYOUT,
+                    "Failed reading GPT header at LBA %lld", header_lba);
+        return FALSE;
+    }
+
+    header_size = gpt_get_le32(header + GPT_HEADER_SIZE);
+    num_entries = gpt_get_le32(header + GPT_HEADER_NUM_ENTRIES);
+    entry_size = gpt_get_le32(header + GPT_HEADER_ENTRY_SIZE);
+    entries_lba = gpt_get_le64(header + GPT_HEADER_ENTRIES_LBA);
+    *alternate_lba = gpt_get_le64(header + GPT_HEADER_BACKUP_LBA);
+
+    if (memcmp(header, GPT_SIGNATURE, strlen(GPT_SIGNATURE)) != 0 ||
+        header_size < GPT_MIN_HEADER_SIZE || header_size > device->sector_size ||
+        entry_size < GPT_MIN_ENTRY_SIZE || num_entries > GPT_MAX_ENTRIES ||
+        num_entries < guids->len) {
+        g_set_error(error, PU_ERROR, PU_ERROR_FLASH_LAYOUT,
+                    "Invalid GPT header at LBA %lld", header_lba);
+        return FALSE;
+    }
+
+    entries_sectors = ((PedSector) num_entries * entry_size +
+                       device->sector_size - 1) / device->sector_size;
+    entries = g_malloc(entries_sectors * device->sector_size);
+    if (!ped_device_read(device, entries, entries_lba, entries_sectors)) {
+        g_set_error(error, PU_ERROR, PU_ERROR_FLASH_LAYOUT,
+                    "Failed reading GPT entries at LBA %lld", entries_lba);
+        return FALSE;
+    }
+
+    for (guint i = 0; i < guids->len; i++) {
+        const guchar *guid = g_ptr_array_index(guids, i);
+
+        if (guid)
+            memcpy(entries + i * entry_size + GPT_ENTRY_UNIQUE_GUID, guid,
+                   PU_GPT_GUID_SIZE);
+    }
+
+    gpt_set_le32(header + GPT_HEADER_ENTRIES_CRC,
+                 gpt_crc32(entries, (gsize) num_entries * entry_size));
+    gpt_set_le32(header + GPT_HEADER_CRC, 0);
+    gpt_set_le32(header + GPT_HEADER_CRC, gpt_crc32(header, header_size));
+
+    if (!ped_device_write(device, entries, entries_lba, entries_sectors) ||
+        !ped_device_write(device, header, header_lba, 1)) {
+        g_set_error(error, PU_ERROR, PU_ERROR_FLASH_LAYOUT,
+                    "Failed writing GPT at LBA %lld", header_lba);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Set the unique partition GUIDs (PARTUUIDs) of a GPT written to the device,
+ * in the primary and backup table. Element i of partuuids is the PARTUUID of
+ * partition number i + 1, NULL or an empty string keeps the one generated by
+ * libparted. The kernel is not told about the change, so this is meant to be
+ * done between writing the partition table and committing it to the OS.
+ */
+gboolean
+pu_gpt_set_partuuids(PedDevice *device,
+                     GPtrArray *partuuids,
+                     GError **error)
+{
+    g_autoptr(GPtrArray) guids = NULL;
+    PedSector backup_lba;
+    PedSector primary_lba;
+    gboolean res;
+
+    g_return_val_if_fail(device != NULL, FALSE);
+    g_return_val_if_fail(partuuids != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    guids = g_ptr_array_new_with_free_func(g_free);
+    for (guint i = 0; i < partuuids->len; i++) {
+        const gchar *partuuid = g_ptr_array_index(partuuids, i);
+        g_autofree guchar *guid = NULL;
+
+        if (g_strcmp0(partuuid, "") > 0) {
+            guid = g_malloc(PU_GPT_GUID_SIZE);
+            if (!pu_gpt_parse_guid(partuuid, guid)) {
+                g_set_error(error, PU_ERROR, PU_ERROR_FLASH_LAYOUT,
+                            "Invalid PARTUUID '%s'", partuuid);
+                return FALSE;
+            }
+        }
+        g_ptr_array_add(guids, g_steal_pointer(&guid));
+    }
+
+    if (!ped_device_open(device)) {
+        g_set_error(error, PU_ERROR, PU_ERROR_FLASH_LAYOUT,
+                    "Failed opening '%s'", device->path);
+        return FALSE;
+    }
+
+    res = gpt_update_table(device, GPT_PRIMARY_HEADER_LBA, guids, &backup_lba,
+                           error);
+    if (res && (backup_lba <= GPT_PRIMARY_HEADER_LBA || backup_lba >= device->length)) {
+        g_set_error(error, PU_ERROR, PU_ERROR_FLASH_LAYOUT,
+                    "Invalid location of the backup GPT header at LBA %lld",
+                    backup_lba);
+        res = FALSE;
+    }
+    res = res && gpt_update_table(device, backup_lba, guids, &primary_lba, error);
+
+    if (res && !ped_device_sync(device)) {
+        g_set_error(error, PU_ERROR, PU_ERROR_FLASH_LAYOUT,
+                    "Failed flushing GPT of '%s'", device->path);
+        res = FALSE;
+    }
+
+    ped_device_close(device);
+
+    if (!res)
+        g_prefix_error(error, "Failed setting PARTUUIDs on '%s': ", device->path);
+
+    return res;
+}
@@ -0,0 +1,20 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#ifndef PARTUP_GPT_H
+#define PARTUP_GPT_H
+
+#include <glib.h>
+#include <parted/parted.h>
+
+#define PU_GPT_GUID_SIZE 16
+
+gboolean pu_gpt_parse_guid(const gchar *str,
+                           guchar *guid);
+gboolean pu_gpt_set_partuuids(PedDevice *device,
+                              GPtrArray *partuuids,
+                              GError **error);
+
+#endif /* PARTUP_GPT_H */
@@ -0,0 +1,2145 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#define G_LOG_DOMAIN "partup-io"
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef PARTUP_HAVE_IO_URING
+#include <liburing.h>
+#endif
+#include "pu-error.h"
+#include "pu-file.h"
+#include "pu-io.h"
+#include "pu-stats.h"
+#include "pu-trace.h"
+
+/* Alignment of buffers, sufficient for O_DIRECT on all common block sizes */
+#define IO_BUFFER_ALIGNMENT 4096
+
+static gsize io_max_in_flight = PU_IO_DEFAULT_MAX_IN_FLIGHT;
+static PuIoBackend io_backend = PU_IO_BACKEND_AUTO;
+static guint io_queue_depth = PU_IO_DEFAULT_QUEUE_DEPTH;
+static guint io_verify_threads = PU_IO_DEFAULT_VERIFY_THREADS;
+static gsize io_max_dirty = PU_IO_DEFAULT_MAX_DIRTY;
+static gboolean io_compare = FALSE;
+
+typedef struct _PuIoRequest PuIoRequest;
+
+typedef struct {
+    guchar *buffer;
+    goffset offset;
+    gsize count;
+    /* One write request per output and the number still outstanding */
+    PuIoRequest *requests;
+    guint pending;
+} PuIoChunk;
+
+/* A region of the input, either to be written or only read for digests */
+typedef struct {
+    goffset offset;
+    goffset length;
+    gboolean write;
+    /* The region is a hole and not read if it is not written */
+    gboolean hole;
+} PuIoSegment;
+
+typedef struct {
+    gint fd;
+    const gchar *path;
+    GArray *segments;
+    /* Decompressed input read in order instead of fd, with its extents */
+    PuDecompressor *decompressor;
+    GArray *extents;
+    GArray *digests;
+    gsize buffer_size;
+    GAsyncQueue *free_chunks;
+    GAsyncQueue *full_chunks;
+    /* Pushed to full_chunks after the last chunk or on error */
+    PuIoChunk end;
+    gint cancelled;
+    GError *error;
+} PuIoReader;
+
+typedef struct {
+    gint fd;
+    /* Descriptor opened with O_DIRECT or -1 */
+    gint direct_fd;
+    guint alignment;
+    const gchar *path;
+    goffset shift;
+    gint64 bytes_written;
+    /* Ranges of buffered writes not yet written back */
+    gsize dirty;
+    goffset window_start;
+    goffset window_end;
+    goffset prev_start;
+    goffset prev_end;
+    /* Descriptors reading back the output in compare mode or -1 */
+    gint compare_fd;
+    gint compare_direct_fd;
+    guint compare_alignment;
+    guchar *compare_buffer;
+    gint64 bytes_unchanged;
+} PuIoWriter;
+
+struct _PuIoRequest {
+    PuIoChunk *chunk;
+    PuIoWriter *writer;
+};
+
+typedef struct {
+    GArray *extents;
+    guint index;
+    goffset pos;
+    gsize buffer_size;
+} PuIoExtentIter;
+
+static void
+io_digest_clear(PuIoDigest *digest)
+{
+    g_checksum_free(digest->checksum);
+}
+
+GArray *
+pu_io_digests_new(void)
+{
+    GArray *digests = g_array_new(FALSE, FALSE, sizeof(PuIoDigest));
+
+    g_array_set_clear_func(digests, (GDestroyNotify) io_digest_clear);
+
+    return digests;
+}
+
+void
+pu_io_digests_add(GArray *digests,
+                  PuIoDigestScope scope,
+                  GChecksumType type)
+{
+    PuIoDigest digest;
+
+    g_return_if_fail(digests != NULL);
+
+    digest.scope = scope;
+    digest.type = type;
+    digest.checksum = g_checksum_new(type);
+    g_array_append_val(digests, digest);
+}
+
+/*
+ * Get the hexadecimal string of a digest computed by pu_io_copy_extents().
+ * Returns NULL if no digest of the given scope and type was requested.
+ */
+const gchar *
+pu_io_digests_get_string(GArray *digests,
+                         PuIoDigestScope scope,
+                         GChecksumType type)
+{
+    g_return_val_if_fail(digests != NULL, NULL);
+
+    for (guint i = 0; i < digests->len; i++) {
+        PuIoDigest *digest = &g_array_index(digests, PuIoDigest, i);
+
+        if (digest->scope == scope && digest->type == type)
+            return g_checksum_get_string(digest->checksum);
+    }
+
+    return NULL;
+}
+
+/*
+ * Set the maximum number of bytes buffered between reading the input and
+ * writing the output. The budget is split into at least two buffers.
+ */
+void
+pu_io_set_max_in_flight(gsize bytes)
+{
+    g_return_if_fail(bytes >= PU_IO_MIN_MAX_IN_FLIGHT);
+
+    io_max_in_flight = bytes;
+}
+
+gsize
+pu_io_get_max_in_flight(void)
+{
+    return io_max_in_flight;
+}
+
+gboolean
+pu_io_backend_from_string(const gchar *name,
+                          PuIoBackend *backend,
+                          GError **error)
+{
+    g_return_val_if_fail(name != NULL, FALSE);
+    g_return_val_if_fail(backend != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    if (g_str_equal(name, "auto")) {
+        *backend = PU_IO_BACKEND_AUTO;
+    } else if (g_str_equal(name, "sync")) {
+        *backend = PU_IO_BACKEND_SYNC;
+    } else if (g_str_equal(name, "io_uring")) {
+#ifdef PARTUP_HAVE_IO_URING
+        *backend = PU_IO_BACKEND_IO_URING;
+#else
+        g_set_error(error, PU_ERROR, PU_ERROR_FAILED,
+                    "%s was built without io_uring support", g_get_prgname());
+        return FALSE;
+#endif
+    } else {
+        g_set_error(error, PU_ERROR, PU_ERROR_FAILED,
+                    "Unknown I/O backend '%s'", name);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Select the backend used for copying and checksumming raw data. The io_uring
+ * backend falls back to synchronous I/O if it is not available at runtime.
+ */
+void
+pu_io_set_backend(PuIoBackend backend)
+{
+    io_backend = backend;
+}
+
+PuIoBackend
+pu_io_get_backend(void)
+{
+    return io_backend;
+}
+
+/*
+ * Set the number of requests submitted to the kernel at once by the io_uring
+ * backend.
+ */
+void
+pu_io_set_queue_depth(guint depth)
+{
+    g_return_if_fail(depth > 0 && depth <= PU_IO_MAX_QUEUE_DEPTH);
+
+    io_queue_depth = depth;
+}
+
+guint
+pu_io_get_queue_depth(void)
+{
+    return io_queue_depth;
+}
+
+/*
+ * Set the number of threads reading back block devices concurrently when
+ * verifying written data.
+ */
+void
+pu_io_set_verify_threads(guint threads)
+{
+    g_return_if_fail(threads > 0 && threads <= PU_IO_MAX_VERIFY_THREADS);
+
+    io_verify_threads = threads;
+}
+
+guint
+pu_io_get_verify_threads(void)
+{
+    return io_verify_threads;
+}
+
+/*
+ * Set the maximum amount of dirty page cache built up by buffered writes of raw
+ * data. Zero leaves writeback entirely to the kernel.
+ */
+void
+pu_io_set_max_dirty(gsize bytes)
+{
+    io_max_dirty = bytes;
+}
+
+gsize
+pu_io_get_max_dirty(void)
+{
+    return io_max_dirty;
+}
+
+/*
+ * Read back the target of each chunk of raw data before writing it and skip
+ * the write if the target already holds the same data.
+ */
+void
+pu_io_set_compare(gboolean compare)
+{
+    io_compare = compare;
+}
+
+gboolean
+pu_io_get_compare(void)
+{
+    return io_compare;
+}
+
+static gboolean
+io_flush_fd(gint fd,
+            const gchar *path,
+            gboolean filesystem,
+            GError **error)
+{
+    gint64 time_start = g_get_monotonic_time();
+    gint ret;
+
+    ret = filesystem ? syncfs(fd) : fdatasync(fd);
+    if (ret < 0) {
+        /* Character devices like MTD do not support flushing */
+        if (errno == EINVAL) {
+            g_debug("Flushing '%s' is not supported", path);
+            return TRUE;
+        }
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed flushing '%s': %s", path, g_strerror(errno));
+        return FALSE;
+    }
+
+    g_message("Flushed '%s' in %.3f s", path,
+              (g_get_monotonic_time() - time_start) / (gdouble) G_USEC_PER_SEC);
+
+    return TRUE;
+}
+
+/*
+ * Write back all data cached for a device and wait for its completion.
+ */
+gboolean
+pu_io_flush(const gchar *path,
+            GError **error)
+{
+    gboolean res;
+    gint fd;
+
+    g_return_val_if_fail(path != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    fd = g_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed opening '%s': %s", path, g_strerror(errno));
+        return FALSE;
+    }
+
+    res = io_flush_fd(fd, path, FALSE, error);
+    g_close(fd, NULL);
+
+    return res;
+}
+
+/*
+ * Write back all data cached for the filesystem mounted at the given path, so
+ * unmounting it afterwards does not stall.
+ */
+gboolean
+pu_io_flush_filesystem(const gchar *mount_point,
+                       GError **error)
+{
+    gboolean res;
+    gint fd;
+
+    g_return_val_if_fail(mount_point != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    fd = g_open(mount_point, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed opening '%s': %s", mount_point, g_strerror(errno));
+        return FALSE;
+    }
+
+    res = io_flush_fd(fd, mount_point, TRUE, error);
+    g_close(fd, NULL);
+
+    return res;
+}
+
+gboolean
+pu_io_pread_all(gint fd,
+                const gchar *path,
+                guchar *buffer,
+                gsize count,
+                goffset offset,
+                GError **error)
+{
+    gssize ret;
+
+    while (count > 0) {
+        ret = pread(fd, buffer, count, offset);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Failed reading '%s' at offset %" G_GOFFSET_FORMAT ": %s",
+                        path, offset, g_strerror(errno));
+            return FALSE;
+        }
+        if (ret == 0) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                        "Unexpected end of file '%s' at offset %" G_GOFFSET_FORMAT,
+                        path, offset);
+            return FALSE;
+        }
+        buffer += ret;
+        count -= ret;
+        offset += ret;
+    }
+
+    return TRUE;
+}
+
+gboolean
+pu_io_pwrite_all(gint fd,
+                 const gchar *path,
+                 const guchar *buffer,
+                 gsize count,
+                 goffset offset,
+                 GError **error)
+{
+    gssize ret;
+
+    while (count > 0) {
+        ret = pwrite(fd, buffer, count, offset);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Failed writing '%s' at offset %" G_GOFFSET_FORMAT ": %s",
+                        path, offset, g_strerror(errno));
+            return FALSE;
+        }
+        buffer += ret;
+        count -= ret;
+        offset += ret;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+io_write_zeroes_buffered(gint fd,
+                         const gchar *path,
+                         goffset offset,
+                         goffset length,
+                         GError **error)
+{
+    g_autofree guchar *buffer = NULL;
+    gsize buffer_size;
+    gsize count;
+
+    if (length <= 0)
+        return TRUE;
+
+    buffer_size = MIN(length, PU_IO_BUFFER_SIZE);
+    buffer = g_new0(guchar, buffer_size);
+
+    while (length > 0) {
+        count = MIN(length, (goffset) buffer_size);
+        if (!pu_io_pwrite_all(fd, path, buffer, count, offset, error))
+            return FALSE;
+        offset += count;
+        length -= count;
+    }
+
+    return TRUE;
+}
+
+gboolean
+pu_io_write_zeroes(gint fd,
+                   const gchar *path,
+                   goffset offset,
+                   goffset length,
+                   GError **error)
+{
+    struct stat st;
+    guint64 range[2];
+
+    if (length <= 0)
+        return TRUE;
+
+    /* Let the block layer or filesystem zero the range in bulk if possible */
+    if (fstat(fd, &st) == 0 && S_ISBLK(st.st_mode)) {
+        range[0] = offset;
+        range[1] = length;
+        if (ioctl(fd, BLKZEROOUT, range) == 0)
+            return TRUE;
+    } else if (fallocate(fd, FALLOC_FL_ZERO_RANGE, offset, length) == 0) {
+        return TRUE;
+    }
+
+    g_debug("Bulk zeroing of '%s' not supported, writing zeroes instead: %s",
+            path, g_strerror(errno));
+
+    return io_write_zeroes_buffered(fd, path, offset, length, error);
+}
+
+static const struct {
+    PuIoCleanMethod method;
+    const gchar *name;
+} io_clean_methods[] = {
+    { PU_IO_CLEAN_AUTO, "auto" },
+    { PU_IO_CLEAN_ZERO, "zero" },
+    { PU_IO_CLEAN_DISCARD, "discard" },
+    { PU_IO_CLEAN_SECURE_DISCARD, "secure-discard" },
+    { PU_IO_CLEAN_WRITE, "write" }
+};
+
+gboolean
+pu_io_clean_method_from_string(const gchar *name,
+                               PuIoCleanMethod *method,
+                               GError **error)
+{
+    g_return_val_if_fail(name != NULL, FALSE);
+    g_return_val_if_fail(method != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    for (guint i = 0; i < G_N_ELEMENTS(io_clean_methods); i++) {
+        if (g_str_equal(name, io_clean_methods[i].name)) {
+            *method = io_clean_methods[i].method;
+            return TRUE;
+        }
+    }
+
+    g_set_error(error, PU_ERROR, PU_ERROR_FAILED,
+                "Unknown clean method '%s'", name);
+
+    return FALSE;
+}
+
+static const gchar *
+io_clean_method_get_name(PuIoCleanMethod method)
+{
+    for (guint i = 0; i < G_N_ELEMENTS(io_clean_methods); i++) {
+        if (io_clean_methods[i].method == method)
+            return io_clean_methods[i].name;
+    }
+
+    return "unknown";
+}
+
+/*
+ * Discard a range of a block device or punch a hole into a regular file. Sets
+ * errno and returns FALSE if discarding is not supported.
+ */
+static gboolean
+io_discard(gint fd,
+           gboolean is_blk,
+           gboolean secure,
+           goffset offset,
+           goffset length)
+{
+    guint64 range[2] = { offset, length };
+
+    if (!is_blk) {
+        /* Holes are never backed by old data, so secure discard is the same */
+        return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                         offset, length) == 0;
+    }
+
+    return ioctl(fd, secure ? BLKSECDISCARD : BLKDISCARD, range) == 0;
+}
+
+/*
+ * Discard the given extents of a device without falling back to writing zeroes.
+ * Fails with the error reported by the first extent that could not be
+ * discarded, e.g. G_IO_ERROR_NOT_SUPPORTED.
+ */
+gboolean
+pu_io_discard(const gchar *path,
+              GArray *extents,
+              GError **error)
+{
+    gint64 time_start = g_get_monotonic_time();
+    goffset total = 0;
+    struct stat st;
+    gboolean is_blk;
+    gint fd;
+
+    g_return_val_if_fail(path != NULL, FALSE);
+    g_return_val_if_fail(extents != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    fd = g_open(path, O_WRONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed opening '%s': %s", path, g_strerror(errno));
+        return FALSE;
+    }
+
+    is_blk = fstat(fd, &st) == 0 && S_ISBLK(st.st_mode);
+
+    for (guint i = 0; i < extents->len; i++) {
+        PuFileExtent *extent = &g_array_index(extents, PuFileExtent, i);
+
+        if (extent->length <= 0)
+            continue;
+
+        if (!io_discard(fd, is_blk, FALSE, extent->offset, extent->length)) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Failed discarding %" G_GOFFSET_FORMAT " bytes of '%s' "
+                        "at offset %" G_GOFFSET_FORMAT ": %s", extent->length,
+                        path, extent->offset, g_strerror(errno));
+            g_close(fd, NULL);
+            return FALSE;
+        }
+        total += extent->length;
+    }
+
+    g_close(fd, NULL);
+
+    g_debug("Discarded %" G_GOFFSET_FORMAT " bytes of '%s' in %.3f s", total,
+            path, (g_get_monotonic_time() - time_start) / (gdouble) G_USEC_PER_SEC);
+
+    return TRUE;
+}
+
+/*
+ * Clean a range of a device with the given method. Discarding is done with
+ * BLKDISCARD or BLKSECDISCARD and zeroing with BLKZEROOUT, so no data passes
+ * through userspace. If the device does not support the method, zeroes are
+ * written instead. The automatic method only discards if the device reports to
+ * read back zeroes from discarded ranges.
+ */
+gboolean
+pu_io_clean_fd(gint fd,
+               const gchar *path,
+               goffset offset,
+               goffset length,
+               PuIoCleanMethod method,
+               GError **error)
+{
+    gint64 time_start = g_get_monotonic_time();
+    PuIoCleanMethod used = method;
+    struct stat st;
+    guint zeroes_data = 0;
+    gboolean is_blk;
+    gboolean res = TRUE;
+
+    g_return_val_if_fail(fd >= 0, FALSE);
+    g_return_val_if_fail(path != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    if (length <= 0)
+        return TRUE;
+
+    is_blk = fstat(fd, &st) == 0 && S_ISBLK(st.st_mode);
+
+    if (method == PU_IO_CLEAN_AUTO) {
+        if (is_blk && ioctl(fd, BLKDISCARDZEROES, &zeroes_data) == 0 && zeroes_data)
+            used = PU_IO_CLEAN_DISCARD;
+        else
+            used = PU_IO_CLEAN_ZERO;
+    }
+
+    switch (used) {
+    case PU_IO_CLEAN_DISCARD:
+    case PU_IO_CLEAN_SECURE_DISCARD:
+        if (io_discard(fd, is_blk, used == PU_IO_CLEAN_SECURE_DISCARD, offset, length))
+            break;
+        g_warning("Failed discarding '%s', writing zeroes instead: %s",
+                  path, g_strerror(errno));
+        used = PU_IO_CLEAN_ZERO;
+        res = pu_io_write_zeroes(fd, path, offset, length, error);
+        break;
+    case PU_IO_CLEAN_WRITE:
+        res = io_write_zeroes_buffered(fd, path, offset, length, error);
+        break;
+    default:
+        res = pu_io_write_zeroes(fd, path, offset, length, error);
+        break;
+    }
+
+    if (res)
+        g_debug("Cleaned %" G_GOFFSET_FORMAT " bytes of '%s' at offset %"
+                G_GOFFSET_FORMAT " in %.3f s (%s)", length, path, offset,
+                (g_get_monotonic_time() - time_start) / (gdouble) G_USEC_PER_SEC,
+                io_clean_method_get_name(used));
+
+    return res;
+}
+
+gboolean
+pu_io_clean(const gchar *path,
+            goffset offset,
+            goffset length,
+            PuIoCleanMethod method,
+            GError **error)
+{
+    gboolean res;
+    gint fd;
+
+    g_return_val_if_fail(path != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    if (length <= 0)
+        return TRUE;
+
+    fd = g_open(path, O_WRONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed opening '%s': %s", path, g_strerror(errno));
+        return FALSE;
+    }
+
+    res = pu_io_clean_fd(fd, path, offset, length, method, error);
+    g_close(fd, NULL);
+
+    return res;
+}
+
+/*
+ * Open a second file descriptor of a block device bypassing the page cache.
+ * Returns -1 if the file is no block device or does not support O_DIRECT.
+ */
+static gint
+io_open_direct(gint fd,
+               const gchar *path,
+               gint flags,
+               guint *alignment)
+{
+    struct stat st;
+    gint block_size;
+    gint direct_fd;
+
+    if (fstat(fd, &st) < 0 || !S_ISBLK(st.st_mode))
+        return -1;
+
+    if (ioctl(fd, BLKSSZGET, &block_size) < 0 || block_size <= 0 ||
+        block_size > IO_BUFFER_ALIGNMENT)
+        return -1;
+
+    direct_fd = g_open(path, flags | O_DIRECT | O_CLOEXEC, 0);
+    if (direct_fd < 0) {
+        g_debug("Failed opening '%s' with O_DIRECT: %s", path, g_strerror(errno));
+        return -1;
+    }
+
+    *alignment = block_size;
+
+    return direct_fd;
+}
+
+/* Split the extents into chunks of at most buffer_size bytes */
+static gboolean
+io_extent_iter_next(PuIoExtentIter *iter,
+                    goffset *offset,
+                    gsize *count)
+{
+    PuFileExtent *extent;
+
+    while (iter->index < iter->extents->len) {
+        extent = &g_array_index(iter->extents, PuFileExtent, iter->index);
+        if (iter->pos < extent->offset)
+            iter->pos = extent->offset;
+
+        if (iter->pos < extent->offset + extent->length) {
+            *offset = iter->pos;
+            *count = MIN(extent->offset + extent->length - iter->pos,
+                         (goffset) iter->buffer_size);
+            iter->pos += *count;
+            return TRUE;
+        }
+
+        iter->index++;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Feed data of the input to the digests. Digests of the input file are only
+ * updated if the data was read from the file as stored, as the decompressor
+ * updates them with the compressed data otherwise.
+ */
+static void
+io_digests_update(GArray *digests,
+                  gboolean written,
+                  gboolean file,
+                  const guchar *buffer,
+                  gsize count)
+{
+    if (digests == NULL)
+        return;
+
+    for (guint i = 0; i < digests->len; i++) {
+        PuIoDigest *digest = &g_array_index(digests, PuIoDigest, i);
+
+        if ((digest->scope == PU_IO_DIGEST_WRITTEN && written) ||
+            digest->scope == PU_IO_DIGEST_INPUT ||
+            (digest->scope == PU_IO_DIGEST_FILE && file))
+            g_checksum_update(digest->checksum, buffer, count);
+    }
+}
+
+static gboolean
+io_digests_cover_input(GArray *digests)
+{
+    for (guint i = 0; digests && i < digests->len; i++) {
+        if (g_array_index(digests, PuIoDigest, i).scope != PU_IO_DIGEST_WRITTEN)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Pop a free buffer, returns NULL once the writer failed */
+static PuIoChunk *
+io_reader_pop_free(PuIoReader *reader)
+{
+    PuIoChunk *chunk;
+
+    chunk = g_async_queue_try_pop(reader->free_chunks);
+
+    /* Buffers may never be returned once the writer failed */
+    if (chunk == NULL) {
+        pu_trace_begin("wait-free-buffer", NULL);
+        while ((chunk = g_async_queue_timeout_pop(reader->free_chunks,
+                                                  G_USEC_PER_SEC / 10)) == NULL) {
+            if (g_atomic_int_get(&reader->cancelled))
+                break;
+        }
+        pu_trace_end("wait-free-buffer");
+        if (chunk == NULL)
+            return NULL;
+    }
+
+    if (g_atomic_int_get(&reader->cancelled)) {
+        g_async_queue_push(reader->free_chunks, chunk);
+        return NULL;
+    }
+
+    return chunk;
+}
+
+/* Hand a filled buffer to the writer */
+static void
+io_reader_push_full(PuIoReader *reader,
+                    PuIoChunk *chunk)
+{
+    g_async_queue_push(reader->full_chunks, chunk);
+
+    if (pu_trace_is_enabled()) {
+        gint length = g_async_queue_length(reader->full_chunks);
+
+        pu_trace_counter("full-buffers", MAX(length, 0));
+        pu_trace_counter("bytes-in-flight", MAX(length, 0) * (gint64) reader->buffer_size);
+    }
+}
+
+static gpointer
+io_reader_thread(gpointer data)
+{
+    PuIoReader *reader = data;
+    g_autofree guchar *zeroes = NULL;
+    PuIoChunk *chunk;
+    goffset pos;
+    goffset end;
+    gsize count;
+    gboolean res;
+
+    pu_trace_set_thread_name("partup-reader");
+
+    for (guint i = 0; i < reader->segments->len; i++) {
+        PuIoSegment *segment = &g_array_index(reader->segments, PuIoSegment, i);
+
+        for (pos = segment->offset, end = pos + segment->length; pos < end; pos += count) {
+            count = MIN(end - pos, (goffset) reader->buffer_size);
+
+            /* Holes only need to be fed to the digests of the whole input */
+            if (segment->hole && !segment->write) {
+                if (zeroes == NULL)
+                    zeroes = g_new0(guchar, reader->buffer_size);
+                io_digests_update(reader->digests, FALSE, TRUE, zeroes, count);
+                continue;
+            }
+
+            chunk = io_reader_pop_free(reader);
+            if (chunk == NULL)
+                goto out;
+
+            chunk->offset = pos;
+            chunk->count = count;
+            pu_trace_begin("read", NULL);
+            res = pu_io_pread_all(reader->fd, reader->path, chunk->buffer,
+                                  chunk->count, chunk->offset, &reader->error);
+            pu_trace_end("read");
+            if (!res) {
+                g_async_queue_push(reader->free_chunks, chunk);
+                goto out;
+            }
+
+            io_digests_update(reader->digests, segment->write, TRUE,
+                              chunk->buffer, chunk->count);
+
+            if (segment->write)
+                io_reader_push_full(reader, chunk);
+            else
+                g_async_queue_push(reader->free_chunks, chunk);
+        }
+    }
+
+out:
+    g_async_queue_push(reader->full_chunks, &reader->end);
+
+    return NULL;
+}
+
+/*
+ * Read the decompressed input in order. Data in front of and between the
+ * extents is decoded but only fed to the digests. The data following the last
+ * extent is only decoded if digests of the whole input are requested.
+ */
+static gpointer
+io_stream_reader_thread(gpointer data)
+{
+    PuIoReader *reader = data;
+    PuIoChunk *chunk;
+    gboolean eof = FALSE;
+    goffset pos = 0;
+    goffset end;
+    gsize count;
+    gsize bytes_read;
+    gboolean res;
+
+    pu_trace_set_thread_name("partup-reader");
+
+    for (guint i = 0; !eof && i < reader->extents->len; i++) {
+        PuFileExtent *extent = &g_array_index(reader->extents, PuFileExtent, i);
+
+        for (end = extent->offset + extent->length; !eof && pos < end; pos += bytes_read) {
+            gboolean write = pos >= extent->offset;
+
+            chunk = io_reader_pop_free(reader);
+            if (chunk == NULL)
+                goto out;
+
+            count = MIN((write ? end : extent->offset) - pos,
+                        (goffset) reader->buffer_size);
+            pu_trace_begin("decompress", NULL);
+            res = pu_decompressor_read(reader->decompressor, chunk->buffer, count,
+                                       &bytes_read, &reader->error);
+            pu_trace_end("decompress");
+            if (!res) {
+                g_async_queue_push(reader->free_chunks, chunk);
+                goto out;
+            }
+
+            /* Only an extent reaching to the end of the input may be short */
+            eof = bytes_read < count;
+            if (eof && (!write || end < G_MAXINT64)) {
+                g_set_error(&reader->error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                            "Unexpected end of file '%s' at offset %" G_GOFFSET_FORMAT,
+                            reader->path, pos + bytes_read);
+                g_async_queue_push(reader->free_chunks, chunk);
+                goto out;
+            }
+
+            chunk->offset = pos;
+            chunk->count = bytes_read;
+            io_digests_update(reader->digests, write, FALSE, chunk->buffer,
+                              chunk->count);
+
+            if (write && chunk->count > 0)
+                io_reader_push_full(reader, chunk);
+            else
+                g_async_queue_push(reader->free_chunks, chunk);
+        }
+    }
+
+    while (!eof && io_digests_cover_input(reader->digests)) {
+        chunk = io_reader_pop_free(reader);
+        if (chunk == NULL)
+            goto out;
+
+        if (!pu_decompressor_read(reader->decompressor, chunk->buffer,
+                                  reader->buffer_size, &bytes_read,
+                                  &reader->error)) {
+            g_async_queue_push(reader->free_chunks, chunk);
+            goto out;
+        }
+        eof = bytes_read < reader->buffer_size;
+        io_digests_update(reader->digests, FALSE, FALSE, chunk->buffer, bytes_read);
+        g_async_queue_push(reader->free_chunks, chunk);
+    }
+
+    pu_decompressor_finish(reader->decompressor, &reader->error);
+
+out:
+    g_async_queue_push(reader->full_chunks, &reader->end);
+
+    return NULL;
+}
+
+/*
+ * Plan the regions to read from the input. Without digests of the whole input,
+ * only the extents to be written are read. Otherwise, the whole input is
+ * covered in order, where holes outside of the written extents are not read.
+ */
+static GArray *
+io_plan_segments(gint fd,
+                 const gchar *path,
+                 GArray *extents,
+                 GArray *digests,
+                 GError **error)
+{
+    g_autoptr(GArray) segments = g_array_new(FALSE, FALSE, sizeof(PuIoSegment));
+    g_autoptr(GArray) data = NULL;
+    PuIoSegment segment;
+    struct stat st;
+    goffset pos = 0;
+    goffset next;
+    goffset size;
+    guint w = 0;
+    guint d = 0;
+
+    if (!io_digests_cover_input(digests)) {
+        for (guint i = 0; i < extents->len; i++) {
+            PuFileExtent *extent = &g_array_index(extents, PuFileExtent, i);
+
+            segment.offset = extent->offset;
+            segment.length = extent->length;
+            segment.write = TRUE;
+            segment.hole = FALSE;
+            g_array_append_val(segments, segment);
+        }
+        return g_steal_pointer(&segments);
+    }
+
+    if (fstat(fd, &st) < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed querying '%s': %s", path, g_strerror(errno));
+        return NULL;
+    }
+
+    data = pu_file_get_data_extents(path, 0, -1, error);
+    if (data == NULL)
+        return NULL;
+
+    size = st.st_size;
+    if (extents->len > 0) {
+        PuFileExtent *last = &g_array_index(extents, PuFileExtent, extents->len - 1);
+        size = MAX(size, last->offset + last->length);
+    }
+
+    while (pos < size) {
+        PuFileExtent *wext = NULL;
+        PuFileExtent *dext = NULL;
+
+        while (w < extents->len &&
+               g_array_index(extents, PuFileExtent, w).offset +
+               g_array_index(extents, PuFileExtent, w).length <= pos)
+            w++;
+        while (d < data->len &&
+               g_array_index(data, PuFileExtent, d).offset +
+               g_array_index(data, PuFileExtent, d).length <= pos)
+            d++;
+        if (w < extents->len)
+            wext = &g_array_index(extents, PuFileExtent, w);
+        if (d < data->len)
+            dext = &g_array_index(data, PuFileExtent, d);
+
+        segment.write = wext && wext->offset <= pos;
+        segment.hole = !(dext && dext->offset <= pos);
+
+        next = size;
+        if (wext)
+            next = MIN(next, segment.write ? wext->offset + wext->length : wext->offset);
+        if (dext)
+            next = MIN(next, segment.hole ? dext->offset : dext->offset + dext->length);
+
+        segment.offset = pos;
+        segment.length = next - pos;
+        g_array_append_val(segments, segment);
+        pos = next;
+    }
+
+    return g_steal_pointer(&segments);
+}
+
+static inline gint
+io_writer_get_fd(PuIoWriter *writer,
+                 goffset offset,
+                 gsize count)
+{
+    if (writer->direct_fd >= 0 && offset % writer->alignment == 0 &&
+        count % writer->alignment == 0)
+        return writer->direct_fd;
+
+    return writer->fd;
+}
+
+/* Wait for the writeback of a range and drop it from the page cache */
+static void
+io_writer_drop_range(PuIoWriter *writer,
+                     goffset start,
+                     goffset end)
+{
+    if (end <= start)
+        return;
+
+    if (sync_file_range(writer->fd, start, end - start,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER) < 0)
+        g_debug("Failed writing back '%s': %s", writer->path, g_strerror(errno));
+    posix_fadvise(writer->fd, start, end - start, POSIX_FADV_DONTNEED);
+}
+
+/*
+ * Keep the dirty page cache of buffered writes below the configured maximum.
+ * Once half of it is dirty, writeback of the current window is started and the
+ * previous window is waited for and dropped from the cache. Writes with
+ * O_DIRECT do not leave dirty pages and are not accounted.
+ */
+static void
+io_writer_account(PuIoWriter *writer,
+                  gint fd,
+                  goffset offset,
+                  gsize count)
+{
+    writer->bytes_written += count;
+
+    if (fd != writer->fd || io_max_dirty == 0)
+        return;
+
+    if (writer->dirty == 0) {
+        writer->window_start = offset;
+        writer->window_end = offset + count;
+    } else {
+        writer->window_start = MIN(writer->window_start, offset);
+        writer->window_end = MAX(writer->window_end, (goffset) (offset + count));
+    }
+    writer->dirty += count;
+
+    if (writer->dirty < io_max_dirty / 2)
+        return;
+
+    if (sync_file_range(writer->fd, writer->window_start,
+                        writer->window_end - writer->window_start,
+                        SYNC_FILE_RANGE_WRITE) < 0)
+        g_debug("Failed writing back '%s': %s", writer->path, g_strerror(errno));
+    io_writer_drop_range(writer, writer->prev_start, writer->prev_end);
+
+    writer->prev_start = writer->window_start;
+    writer->prev_end = writer->window_end;
+    writer->dirty = 0;
+}
+
+/* Wait for all outstanding windows, leaving the final flush to the caller */
+static void
+io_writer_finish(PuIoWriter *writer)
+{
+    if (io_max_dirty == 0)
+        return;
+
+    io_writer_drop_range(writer, writer->prev_start, writer->prev_end);
+    if (writer->dirty > 0)
+        io_writer_drop_range(writer, writer->window_start, writer->window_end);
+}
+
+/*
+ * Check whether the output already holds the data of a chunk in compare mode.
+ * Any failure to read the output back only means the chunk is written.
+ */
+static gboolean
+io_writer_unchanged(PuIoWriter *writer,
+                    PuIoChunk *chunk,
+                    goffset offset)
+{
+    gsize done = 0;
+    gssize ret;
+    gint fd;
+
+    if (writer->compare_fd < 0)
+        return FALSE;
+
+    fd = writer->compare_fd;
+    if (writer->compare_direct_fd >= 0 &&
+        offset % writer->compare_alignment == 0 &&
+        chunk->count % writer->compare_alignment == 0)
+        fd = writer->compare_direct_fd;
+
+    pu_trace_begin("compare", NULL);
+    while (done < chunk->count) {
+        ret = pread(fd, writer->compare_buffer + done, chunk->count - done,
+                    offset + done);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        done += ret;
+    }
+    pu_trace_end("compare");
+
+    if (done < chunk->count ||
+        memcmp(writer->compare_buffer, chunk->buffer, chunk->count) != 0)
+        return FALSE;
+
+    writer->bytes_unchanged += chunk->count;
+
+    return TRUE;
+}
+
+/* Wait for the next filled buffer, tracing the time the writer starves */
+static PuIoChunk *
+io_writer_pop_full(PuIoReader *reader)
+{
+    PuIoChunk *chunk = g_async_queue_try_pop(reader->full_chunks);
+
+    if (chunk == NULL) {
+        pu_trace_begin("wait-full-buffer", NULL);
+        chunk = g_async_queue_pop(reader->full_chunks);
+        pu_trace_end("wait-full-buffer");
+    }
+
+    return chunk;
+}
+
+static gboolean
+io_write_chunks_sync(PuIoReader *reader,
+                     PuIoWriter *writers,
+                     guint n_writers,
+                     GError **error)
+{
+    PuIoChunk *chunk;
+    goffset offset;
+    gboolean res = TRUE;
+    gint fd;
+
+    /* Once writing failed, keep recycling buffers until the reader stopped */
+    while ((chunk = io_writer_pop_full(reader)) != &reader->end) {
+        for (guint w = 0; res && w < n_writers; w++) {
+            PuIoWriter *writer = &writers[w];
+
+            offset = chunk->offset + writer->shift;
+            if (io_writer_unchanged(writer, chunk, offset))
+                continue;
+
+            fd = io_writer_get_fd(writer, offset, chunk->count);
+            pu_trace_begin("write", NULL);
+            res = pu_io_pwrite_all(fd, writer->path, chunk->buffer, chunk->count,
+                                   offset, error);
+            pu_trace_end("write");
+            if (res)
+                io_writer_account(writer, fd, offset, chunk->count);
+            else
+                g_atomic_int_set(&reader->cancelled, 1);
+        }
+        g_async_queue_push(reader->free_chunks, chunk);
+    }
+
+    return res;
+}
+
+#ifdef PARTUP_HAVE_IO_URING
+static gboolean
+io_ring_init(struct io_uring *ring,
+             guint entries)
+{
+    gint ret;
+
+    if (io_backend == PU_IO_BACKEND_SYNC)
+        return FALSE;
+
+    ret = io_uring_queue_init(entries, ring, 0);
+    if (ret < 0) {
+        if (io_backend == PU_IO_BACKEND_IO_URING)
+            g_warning("io_uring unavailable, falling back to synchronous I/O: %s",
+                      g_strerror(-ret));
+        else
+            g_debug("io_uring unavailable, using synchronous I/O: %s",
+                    g_strerror(-ret));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Get a free entry of the submission queue. A full queue is submitted to the
+ * kernel first to make room, which is accounted in queued and in_flight.
+ */
+static struct io_uring_sqe *
+io_ring_get_sqe(struct io_uring *ring,
+                guint *queued,
+                guint *in_flight,
+                const gchar *path,
+                GError **error)
+{
+    struct io_uring_sqe *sqe;
+    gint ret;
+
+    while ((sqe = io_uring_get_sqe(ring)) == NULL) {
+        ret = io_uring_submit(ring);
+        if (ret == -EINTR)
+            continue;
+        if (ret <= 0) {
+            ret = ret < 0 ? -ret : EAGAIN;
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(ret),
+                        "Failed submitting requests for '%s': %s", path,
+                        g_strerror(ret));
+            return NULL;
+        }
+        *queued -= ret;
+        *in_flight += ret;
+    }
+
+    return sqe;
+}
+
+/*
+ * Handle the result of a completed request. Short transfers are completed
+ * synchronously, which is rare for block devices.
+ */
+static gboolean
+io_ring_complete(gint fd,
+                  const gchar *path,
+                  guchar *buffer,
+                  gsize count,
+                  goffset offset,
+                  gint ret,
+                  gboolean is_write,
+                  GError **error)
+{
+    if (ret < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(-ret),
+                    "Failed %s '%s' at offset %" G_GOFFSET_FORMAT ": %s",
+                    is_write ? "writing" : "reading", path, offset,
+                    g_strerror(-ret));
+        return FALSE;
+    }
+    if ((gsize) ret == count)
+        return TRUE;
+
+    if (is_write)
+        return pu_io_pwrite_all(fd, path, buffer + ret, count - ret,
+                                offset + ret, error);
+
+    return pu_io_pread_all(fd, path, buffer + ret, count - ret, offset + ret,
+                           error);
+}
+
+/*
+ * Wait for the completion of all requests the kernel may still access the
+ * buffers of. Requests prepared but not submitted yet stay in the submission
+ * queue after a failed submission, so they are submitted along here. The
+ * results are discarded, as this is only done after an error.
+ */
+static void
+io_ring_drain(struct io_uring *ring,
+              guint pending)
+{
+    struct io_uring_cqe *cqe;
+    gint ret;
+
+    while (pending > 0) {
+        ret = io_uring_submit_and_wait(ring, 1);
+        while (pending > 0 && io_uring_peek_cqe(ring, &cqe) == 0) {
+            io_uring_cqe_seen(ring, cqe);
+            pending--;
+        }
+
+        /* Freeing the buffers now could let the kernel access freed memory */
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY)
+            g_error("Failed waiting for %u outstanding I/O requests: %s",
+                    pending, g_strerror(-ret));
+    }
+}
+
+/*
+ * Keep up to the configured queue depth of writes outstanding. Completions are
+ * reaped whenever no further filled buffer is ready or the queue is full. A
+ * buffer is written to all outputs and recycled once the last write completed,
+ * so a buffer is only taken if the writes to all outputs fit into the queue.
+ * The ring is set up with at least one entry per output for this.
+ */
+static gboolean
+io_write_chunks_uring(struct io_uring *ring,
+                      PuIoReader *reader,
+                      PuIoWriter *writers,
+                      guint n_writers,
+                      GError **error)
+{
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    PuIoRequest *request;
+    PuIoWriter *writer;
+    PuIoChunk *chunk;
+    /* Writes submitted to the kernel and prepared but not yet submitted */
+    guint in_flight = 0;
+    guint queued = 0;
+    guint depth = MAX(io_queue_depth, n_writers);
+    goffset offset;
+    gint ret;
+    gint fd;
+    gboolean done = FALSE;
+    gboolean res = TRUE;
+
+    while (res && (!done || in_flight + queued > 0)) {
+        chunk = NULL;
+        if (!done && in_flight + queued + n_writers <= depth)
+            chunk = in_flight + queued > 0 ? g_async_queue_try_pop(reader->full_chunks)
+                                           : io_writer_pop_full(reader);
+
+        if (chunk == &reader->end) {
+            done = TRUE;
+            continue;
+        }
+
+        if (chunk) {
+            chunk->pending = 0;
+            for (guint w = 0; w < n_writers; w++) {
+                writer = &writers[w];
+                offset = chunk->offset + writer->shift;
+                if (io_writer_unchanged(writer, chunk, offset))
+                    continue;
+
+                sqe = io_ring_get_sqe(ring, &queued, &in_flight, writer->path,
+                                      error);
+                if (sqe == NULL) {
+                    res = FALSE;
+                    break;
+                }
+                io_uring_prep_write(sqe, io_writer_get_fd(writer, offset, chunk->count),
+                                    chunk->buffer, chunk->count, offset);
+                io_uring_sqe_set_data(sqe, &chunk->requests[w]);
+                chunk->pending++;
+                queued++;
+
+                ret = io_uring_submit(ring);
+                if (ret < 0) {
+                    g_set_error(error, G_IO_ERROR, g_io_error_from_errno(-ret),
+                                "Failed submitting write to '%s': %s", writer->path,
+                                g_strerror(-ret));
+                    res = FALSE;
+                    break;
+                }
+                queued -= ret;
+                in_flight += ret;
+            }
+            pu_trace_counter("writes-in-flight", in_flight);
+            if (chunk->pending == 0)
+                g_async_queue_push(reader->free_chunks, chunk);
+            continue;
+        }
+
+        /* Writes left in the queue by a short submission are submitted along */
+        pu_trace_begin("wait-completion", NULL);
+        ret = io_uring_submit_and_wait(ring, 1);
+        pu_trace_end("wait-completion");
+        if (ret == -EINTR)
+            continue;
+        if (ret < 0) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(-ret),
+                        "Failed waiting for writes of '%s': %s",
+                        reader->path, g_strerror(-ret));
+            res = FALSE;
+            break;
+        }
+        queued -= ret;
+        in_flight += ret;
+
+        while (res && io_uring_peek_cqe(ring, &cqe) == 0) {
+            request = io_uring_cqe_get_data(cqe);
+            chunk = request->chunk;
+            writer = request->writer;
+            ret = cqe->res;
+            io_uring_cqe_seen(ring, cqe);
+            in_flight--;
+
+            offset = chunk->offset + writer->shift;
+            fd = io_writer_get_fd(writer, offset, chunk->count);
+            res = io_ring_complete(fd, writer->path, chunk->buffer, chunk->count,
+                                   offset, ret, TRUE, error);
+            if (res)
+                io_writer_account(writer, fd, offset, chunk->count);
+            if (--chunk->pending == 0)
+                g_async_queue_push(reader->free_chunks, chunk);
+        }
+        pu_trace_counter("writes-in-flight", in_flight);
+    }
+
+    if (res)
+        return TRUE;
+
+    /*
+     * Wait for the writes still owned by the kernel before the buffers may be
+     * freed and keep recycling buffers until the reader stopped.
+     */
+    g_atomic_int_set(&reader->cancelled, 1);
+    io_ring_drain(ring, in_flight + queued);
+    while (!done) {
+        chunk = g_async_queue_pop(reader->full_chunks);
+        if (chunk == &reader->end)
+            done = TRUE;
+        else
+            g_async_queue_push(reader->free_chunks, chunk);
+    }
+
+    return FALSE;
+}
+#endif
+
+/*
+ * Prepare writing to an output. Block devices are additionally opened with
+ * O_DIRECT and, in compare mode, for reading back their current content.
+ */
+static gboolean
+io_writer_open(PuIoWriter *writer,
+               const PuIoOutput *output,
+               goffset shift,
+               gsize buffer_size,
+               GError **error)
+{
+    writer->fd = output->fd;
+    writer->alignment = 1;
+    writer->direct_fd = io_open_direct(output->fd, output->path, O_WRONLY,
+                                       &writer->alignment);
+    writer->path = output->path;
+    writer->shift = shift;
+    writer->compare_fd = -1;
+    writer->compare_direct_fd = -1;
+
+    if (!io_compare)
+        return TRUE;
+
+    writer->compare_fd = g_open(output->path, O_RDONLY | O_CLOEXEC, 0);
+    if (writer->compare_fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed opening '%s': %s", output->path, g_strerror(errno));
+        return FALSE;
+    }
+    writer->compare_alignment = 1;
+    writer->compare_direct_fd = io_open_direct(writer->compare_fd, output->path,
+                                               O_RDONLY,
+                                               &writer->compare_alignment);
+    if (posix_memalign((gpointer *) &writer->compare_buffer,
+                       IO_BUFFER_ALIGNMENT, buffer_size) != 0) {
+        writer->compare_buffer = NULL;
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "Failed allocating I/O buffers");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Close the descriptors opened by io_writer_open(), not the output itself */
+static void
+io_writer_close(PuIoWriter *writer)
+{
+    if (writer->direct_fd >= 0)
+        g_close(writer->direct_fd, NULL);
+    if (writer->compare_direct_fd >= 0)
+        g_close(writer->compare_direct_fd, NULL);
+    if (writer->compare_fd >= 0)
+        g_close(writer->compare_fd, NULL);
+    free(writer->compare_buffer);
+}
+
+/*
+ * Run the reader thread filling a set of aligned buffers, bounded by the
+ * in-flight budget, while the calling thread drains them to the outputs. Block
+ * devices are written with O_DIRECT where offset and size permit it, so the
+ * page cache is bypassed for the bulk of the data. Each buffer is written to
+ * all outputs before being refilled, so the input is only read once.
+ */
+static gboolean
+io_copy(PuIoReader *reader,
+        GThreadFunc reader_func,
+        const PuIoOutput *outputs,
+        guint n_outputs,
+        goffset shift,
+        GError **error)
+{
+    PuIoWriter *writers;
+    PuIoChunk *chunks;
+    PuStatsStep *step = NULL;
+    GThread *thread;
+    guint n_chunks;
+    guint n_opened = 0;
+    gint64 time_start;
+    gint64 bytes_written = 0;
+    gboolean use_uring = FALSE;
+    gboolean res = TRUE;
+#ifdef PARTUP_HAVE_IO_URING
+    struct io_uring ring;
+#endif
+
+    reader->buffer_size = CLAMP(io_max_in_flight / 2, IO_BUFFER_ALIGNMENT,
+                                PU_IO_BUFFER_SIZE);
+    reader->buffer_size -= reader->buffer_size % IO_BUFFER_ALIGNMENT;
+    n_chunks = io_max_in_flight / reader->buffer_size;
+
+    writers = g_new0(PuIoWriter, n_outputs);
+    chunks = g_new0(PuIoChunk, n_chunks);
+    reader->free_chunks = g_async_queue_new();
+    reader->full_chunks = g_async_queue_new();
+
+    for (guint i = 0; i < n_chunks; i++) {
+        if (posix_memalign((gpointer *) &chunks[i].buffer, IO_BUFFER_ALIGNMENT,
+                           reader->buffer_size) != 0) {
+            chunks[i].buffer = NULL;
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                        "Failed allocating I/O buffers");
+            res = FALSE;
+            goto out;
+        }
+        chunks[i].requests = g_new(PuIoRequest, n_outputs);
+        for (guint w = 0; w < n_outputs; w++) {
+            chunks[i].requests[w].chunk = &chunks[i];
+            chunks[i].requests[w].writer = &writers[w];
+        }
+        g_async_queue_push(reader->free_chunks, &chunks[i]);
+    }
+
+    for (; n_opened < n_outputs; n_opened++) {
+        if (!io_writer_open(&writers[n_opened], &outputs[n_opened], shift,
+                            reader->buffer_size, error)) {
+            n_opened++;
+            res = FALSE;
+            goto out_close;
+        }
+    }
+#ifdef PARTUP_HAVE_IO_URING
+    use_uring = io_ring_init(&ring, MAX(io_queue_depth, n_outputs));
+#endif
+    time_start = g_get_monotonic_time();
+    step = pu_stats_begin("raw-write", reader->path);
+
+    thread = g_thread_try_new("partup-reader", reader_func, reader, error);
+    if (thread == NULL) {
+        res = FALSE;
+        goto out_close;
+    }
+
+#ifdef PARTUP_HAVE_IO_URING
+    if (use_uring)
+        res = io_write_chunks_uring(&ring, reader, writers, n_outputs, error);
+    else
+#endif
+        res = io_write_chunks_sync(reader, writers, n_outputs, error);
+
+    g_thread_join(thread);
+    for (guint w = 0; w < n_outputs; w++)
+        io_writer_finish(&writers[w]);
+
+    if (reader->error) {
+        if (res)
+            g_propagate_error(error, g_steal_pointer(&reader->error));
+        else
+            g_clear_error(&reader->error);
+        res = FALSE;
+    }
+
+    for (guint w = 0; res && w < n_outputs; w++) {
+        PuIoWriter *writer = &writers[w];
+
+        g_debug("Copied %" G_GINT64_FORMAT " bytes from '%s' to '%s' in %.3f s "
+                "(%s%s)", writer->bytes_written, reader->path, writer->path,
+                (g_get_monotonic_time() - time_start) / (gdouble) G_USEC_PER_SEC,
+                use_uring ? "io_uring" : "sync",
+                writer->direct_fd >= 0 ? ", O_DIRECT" : "");
+
+        if (io_compare) {
+            gint64 total = writer->bytes_written + writer->bytes_unchanged;
+
+            g_message("Rewrote %" G_GINT64_FORMAT " of %" G_GINT64_FORMAT " bytes "
+                      "(%.1f %%) of '%s'", writer->bytes_written, total,
+                      total > 0 ? 100.0 * writer->bytes_written / total : 0.0,
+                      writer->path);
+        }
+    }
+
+out_close:
+    for (guint w = 0; w < n_outputs; w++)
+        bytes_written += writers[w].bytes_written;
+    pu_stats_end(step, bytes_written, res);
+#ifdef PARTUP_HAVE_IO_URING
+    if (use_uring)
+        io_uring_queue_exit(&ring);
+#endif
+    for (guint w = 0; w < n_opened; w++)
+        io_writer_close(&writers[w]);
+out:
+    for (guint i = 0; i < n_chunks; i++) {
+        free(chunks[i].buffer);
+        g_free(chunks[i].requests);
+    }
+    g_free(chunks);
+    g_free(writers);
+    g_async_queue_unref(reader->free_chunks);
+    g_async_queue_unref(reader->full_chunks);
+
+    return res;
+}
+
+/*
+ * Copy the given extents of the input to each of the outputs at their offset
+ * plus shift, see io_copy().
+ *
+ * The optional digests are updated by the reader from the same buffers, so
+ * verifying the input does not require reading it again.
+ */
+gboolean
+pu_io_copy_extents_multi(gint input_fd,
+                         const gchar *input_path,
+                         const PuIoOutput *outputs,
+                         guint n_outputs,
+                         GArray *extents,
+                         goffset shift,
+                         GArray *digests,
+                         GError **error)
+{
+    g_autoptr(GArray) segments = NULL;
+    PuIoReader reader = { 0 };
+
+    g_return_val_if_fail(outputs != NULL && n_outputs > 0, FALSE);
+    g_return_val_if_fail(extents != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    segments = io_plan_segments(input_fd, input_path, extents, digests, error);
+    if (segments == NULL)
+        return FALSE;
+
+    reader.fd = input_fd;
+    reader.path = input_path;
+    reader.segments = segments;
+    reader.digests = digests;
+
+    posix_fadvise(input_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    return io_copy(&reader, io_reader_thread, outputs, n_outputs, shift, error);
+}
+
+gboolean
+pu_io_copy_extents(gint input_fd,
+                   const gchar *input_path,
+                   gint output_fd,
+                   const gchar *output_path,
+                   GArray *extents,
+                   goffset shift,
+                   GArray *digests,
+                   GError **error)
+{
+    PuIoOutput output = { output_fd, output_path };
+
+    return pu_io_copy_extents_multi(input_fd, input_path, &output, 1, extents,
+                                    shift, digests, error);
+}
+
+/*
+ * Copy the given extents of a decompressed input to each of the outputs at
+ * their offset plus shift. The extents must be sorted, the length of the last
+ * one may reach up to G_MAXINT64 to write all data up to the end of the input.
+ * Decoding runs on the reader thread, concurrently with writing.
+ *
+ * Digests of scope PU_IO_DIGEST_FILE are computed over the compressed file by
+ * the decompressor, the others over the decompressed data.
+ */
+gboolean
+pu_io_copy_stream_multi(PuDecompressor *decompressor,
+                        const gchar *input_path,
+                        const PuIoOutput *outputs,
+                        guint n_outputs,
+                        GArray *extents,
+                        goffset shift,
+                        GArray *digests,
+                        GError **error)
+{
+    PuIoReader reader = { 0 };
+
+    g_return_val_if_fail(decompressor != NULL, FALSE);
+    g_return_val_if_fail(outputs != NULL && n_outputs > 0, FALSE);
+    g_return_val_if_fail(extents != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    reader.fd = -1;
+    reader.path = input_path;
+    reader.decompressor = decompressor;
+    reader.extents = extents;
+    reader.digests = digests;
+    pu_decompressor_set_digests(decompressor, digests);
+
+    return io_copy(&reader, io_stream_reader_thread, outputs, n_outputs, shift,
+                   error);
+}
+
+gboolean
+pu_io_copy_stream(PuDecompressor *decompressor,
+                  const gchar *input_path,
+                  gint output_fd,
+                  const gchar *output_path,
+                  GArray *extents,
+                  goffset shift,
+                  GArray *digests,
+                  GError **error)
+{
+    PuIoOutput output = { output_fd, output_path };
+
+    return pu_io_copy_stream_multi(decompressor, input_path, &output, 1, extents,
+                                   shift, digests, error);
+}
+
+static gboolean
+io_checksum_extents_sync(gint fd,
+                         const gchar *path,
+                         PuIoExtentIter *iter,
+                         goffset shift,
+                         GChecksum *checksum,
+                         GError **error)
+{
+    g_autofree guchar *buffer = g_new(guchar, iter->buffer_size);
+    goffset offset;
+    gsize count;
+
+    while (io_extent_iter_next(iter, &offset, &count)) {
+        if (!pu_io_pread_all(fd, path, buffer, count, offset + shift, error))
+            return FALSE;
+        g_checksum_update(checksum, buffer, count);
+    }
+
+    return TRUE;
+}
+
+#ifdef PARTUP_HAVE_IO_URING
+typedef struct {
+    guchar *buffer;
+    goffset offset;
+    gsize count;
+    /* Bytes read in front of the requested data to keep O_DIRECT aligned */
+    gsize skip;
+    /* Bytes read in total, starting skip bytes in front of offset */
+    gsize length;
+    gint res;
+    gboolean completed;
+} PuIoSlot;
+
+/*
+ * Keep up to the configured queue depth of reads outstanding, as far as their
+ * buffers fit into the in-flight limit. Completed reads are fed to the
+ * checksum in order, as they may complete out of order. Reads are widened to
+ * the given alignment for file descriptors opened with O_DIRECT.
+ */
+static gboolean
+io_checksum_extents_uring(struct io_uring *ring,
+                          gint fd,
+                          const gchar *path,
+                          guint alignment,
+                          PuIoExtentIter *iter,
+                          goffset shift,
+                          GChecksum *checksum,
+                          GError **error)
+{
+    /* Bound the buffers by the in-flight limit, like the write path does */
+    guint n_slots = CLAMP(io_max_in_flight / iter->buffer_size, 1, io_queue_depth);
+    gsize buffer_size = iter->buffer_size + 2 * IO_BUFFER_ALIGNMENT;
+    g_autofree PuIoSlot *slots = g_new0(PuIoSlot, n_slots);
+    guchar *buffers;
+    goffset end;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    PuIoSlot *slot;
+    guint head = 0;
+    guint tail = 0;
+    guint queued = 0;
+    guint in_flight = 0;
+    gboolean more = TRUE;
+    gboolean res = TRUE;
+    gint ret;
+
+    if (posix_memalign((gpointer *) &buffers, IO_BUFFER_ALIGNMENT,
+                       n_slots * buffer_size) != 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "Failed allocating I/O buffers");
+        return FALSE;
+    }
+
+    for (guint i = 0; i < n_slots; i++)
+        slots[i].buffer = buffers + i * buffer_size;
+
+    while (res && (more || head != tail)) {
+        while (more && tail - head < n_slots) {
+            slot = &slots[tail % n_slots];
+            more = io_extent_iter_next(iter, &slot->offset, &slot->count);
+            if (!more)
+                break;
+
+            slot->offset += shift;
+            slot->completed = FALSE;
+            slot->skip = slot->offset % alignment;
+            end = slot->offset + slot->count;
+            end += (alignment - end % alignment) % alignment;
+            slot->length = end - slot->offset + slot->skip;
+            sqe = io_ring_get_sqe(ring, &queued, &in_flight, path, error);
+            if (sqe == NULL) {
+                res = FALSE;
+                break;
+            }
+            io_uring_prep_read(sqe, fd, slot->buffer, slot->length,
+                               slot->offset - slot->skip);
+            io_uring_sqe_set_data(sqe, slot);
+            tail++;
+            queued++;
+        }
+        if (!res)
+            break;
+
+        ret = io_uring_submit_and_wait(ring, in_flight + queued > 0 ? 1 : 0);
+        if (ret == -EINTR)
+            continue;
+        if (ret < 0) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(-ret),
+                        "Failed submitting reads of '%s': %s", path,
+                        g_strerror(-ret));
+            res = FALSE;
+            break;
+        }
+        queued -= ret;
+        in_flight += ret;
+
+        while (io_uring_peek_cqe(ring, &cqe) == 0) {
+            slot = io_uring_cqe_get_data(cqe);
+            slot->res = cqe->res;
+            slot->completed = TRUE;
+            io_uring_cqe_seen(ring, cqe);
+            in_flight--;
+        }
+
+        while (res && head != tail && slots[head % n_slots].completed) {
+            slot = &slots[head % n_slots];
+            res = io_ring_complete(fd, path, slot->buffer, slot->length,
+                                   slot->offset - slot->skip, slot->res, FALSE,
+                                   error);
+            if (res)
+                g_checksum_update(checksum, slot->buffer + slot->skip,
+                                  slot->count);
+            head++;
+        }
+    }
+
+    /* Reap reads still outstanding after an error before freeing buffers */
+    io_ring_drain(ring, in_flight + queued);
+    free(buffers);
+
+    return res;
+}
+#endif
+
+typedef struct {
+    guchar *buffer;
+    goffset offset;
+    gsize count;
+    /* Bytes read in front of the requested data to keep O_DIRECT aligned */
+    gsize skip;
+    gboolean completed;
+    GError *error;
+} PuIoReadTask;
+
+typedef struct {
+    gint fd;
+    const gchar *path;
+    guint alignment;
+    GMutex mutex;
+    GCond cond;
+} PuIoReadPool;
+
+static void
+io_read_task_run(gpointer data,
+                 gpointer user_data)
+{
+    PuIoReadTask *task = data;
+    PuIoReadPool *pool = user_data;
+    goffset start = task->offset - task->offset % pool->alignment;
+    goffset end = task->offset + task->count;
+    GError *error = NULL;
+
+    end += (pool->alignment - end % pool->alignment) % pool->alignment;
+    task->skip = task->offset - start;
+
+    pu_io_pread_all(pool->fd, pool->path, task->buffer, end - start, start, &error);
+
+    g_mutex_lock(&pool->mutex);
+    task->error = error;
+    task->completed = TRUE;
+    g_cond_broadcast(&pool->cond);
+    g_mutex_unlock(&pool->mutex);
+}
+
+/*
+ * Read back the extents of a block device with O_DIRECT, so the data is read
+ * from the device and not from the page cache just filled by writing it. A
+ * pool of threads reads chunks concurrently, which are fed to the checksum in
+ * order as they complete.
+ */
+static gboolean
+io_checksum_extents_parallel(gint direct_fd,
+                             const gchar *path,
+                             guint alignment,
+                             PuIoExtentIter *iter,
+                             goffset shift,
+                             GChecksum *checksum,
+                             GError **error)
+{
+    PuIoReadPool pool = { direct_fd, path, alignment, { 0 }, { 0 } };
+    GThreadPool *threads;
+    PuIoReadTask *tasks;
+    PuIoReadTask *task;
+    guint n_tasks = 2 * io_verify_threads;
+    gsize buffer_size = iter->buffer_size + 2 * IO_BUFFER_ALIGNMENT;
+    guint head = 0;
+    guint tail = 0;
+    gboolean more = TRUE;
+    gboolean res = TRUE;
+
+    threads = g_thread_pool_new(io_read_task_run, &pool, io_verify_threads,
+                                FALSE, error);
+    if (threads == NULL)
+        return FALSE;
+
+    g_mutex_init(&pool.mutex);
+    g_cond_init(&pool.cond);
+    tasks = g_new0(PuIoReadTask, n_tasks);
+
+    for (guint i = 0; i < n_tasks; i++) {
+        if (posix_memalign((gpointer *) &tasks[i].buffer, IO_BUFFER_ALIGNMENT,
+                           buffer_size) != 0) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                        "Failed allocating I/O buffers");
+            res = FALSE;
+            goto out;
+        }
+    }
+
+    while (res && (more || head != tail)) {
+        while (more && tail - head < n_tasks) {
+            task = &tasks[tail % n_tasks];
+            more = io_extent_iter_next(iter, &task->offset, &task->count);
+            if (!more)
+                break;
+
+            task->offset += shift;
+            task->completed = FALSE;
+            g_thread_pool_push(threads, task, NULL);
+            tail++;
+        }
+
+        if (head == tail)
+            break;
+
+        task = &tasks[head % n_tasks];
+        g_mutex_lock(&pool.mutex);
+        while (!task->completed)
+            g_cond_wait(&pool.cond, &pool.mutex);
+        g_mutex_unlock(&pool.mutex);
+
+        if (task->error) {
+            g_propagate_error(error, g_steal_pointer(&task->error));
+            res = FALSE;
+            break;
+        }
+
+        g_checksum_update(checksum, task->buffer + task->skip, task->count);
+        head++;
+    }
+
+out:
+    /* Wait for reads still queued after an error before freeing buffers */
+    g_thread_pool_free(threads, FALSE, TRUE);
+
+    for (guint i = 0; i < n_tasks; i++) {
+        g_clear_error(&tasks[i].error);
+        free(tasks[i].buffer);
+    }
+    g_free(tasks);
+    g_mutex_clear(&pool.mutex);
+    g_cond_clear(&pool.cond);
+
+    return res;
+}
+
+/*
+ * Compute the checksum over the concatenated content of all extents of a file.
+ * The offset of each extent is moved by shift. Block devices are read back
+ * bypassing the page cache, through io_uring if available and with a pool of
+ * threads otherwise.
+ */
+gchar *
+pu_io_checksum_extents(const gchar *path,
+                       GArray *extents,
+                       goffset shift,
+                       GChecksumType checksum_type,
+                       GError **error)
+{
+    g_autoptr(GChecksum) checksum = NULL;
+    PuIoExtentIter iter = { extents, 0, 0, PU_IO_BUFFER_SIZE };
+    PuStatsStep *step;
+    goffset bytes = 0;
+    gboolean res = FALSE;
+    guint alignment = 1;
+    gint direct_fd;
+    gint fd;
+#ifdef PARTUP_HAVE_IO_URING
+    struct io_uring ring;
+#endif
+
+    g_return_val_if_fail(path != NULL, NULL);
+    g_return_val_if_fail(extents != NULL, NULL);
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    fd = g_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed opening '%s': %s", path, g_strerror(errno));
+        return NULL;
+    }
+
+    checksum = g_checksum_new(checksum_type);
+    direct_fd = io_open_direct(fd, path, O_RDONLY, &alignment);
+    step = pu_stats_begin("readback", path);
+
+#ifdef PARTUP_HAVE_IO_URING
+    if (io_ring_init(&ring, io_queue_depth)) {
+        res = io_checksum_extents_uring(&ring, direct_fd >= 0 ? direct_fd : fd,
+                                        path, alignment, &iter, shift, checksum,
+                                        error);
+        io_uring_queue_exit(&ring);
+    } else
+#endif
+    if (direct_fd >= 0) {
+        res = io_checksum_extents_parallel(direct_fd, path, alignment, &iter,
+                                           shift, checksum, error);
+    } else {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        res = io_checksum_extents_sync(fd, path, &iter, shift, checksum, error);
+    }
+
+    if (direct_fd >= 0)
+        g_close(direct_fd, NULL);
+    g_close(fd, NULL);
+
+    for (guint i = 0; step && i < extents->len; i++)
+        bytes += g_array_index(extents, PuFileExtent, i).length;
+    pu_stats_end(step, bytes, res);
+
+    if (!res)
+        return NULL;
+
+    return g_strdup(g_checksum_get_string(checksum));
+}
@@ -0,0 +1,159 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#ifndef PARTUP_IO_H
+#define PARTUP_IO_H
+
+#include <glib.h>
+#include "pu-decompress.h"
+
+#define PU_IO_BUFFER_SIZE            (1024 * 1024)
+#define PU_IO_DEFAULT_MAX_IN_FLIGHT  (8 * PU_IO_BUFFER_SIZE)
+#define PU_IO_MIN_MAX_IN_FLIGHT      (8 * 1024)
+#define PU_IO_DEFAULT_QUEUE_DEPTH    8
+#define PU_IO_MAX_QUEUE_DEPTH        256
+#define PU_IO_DEFAULT_VERIFY_THREADS 4
+#define PU_IO_MAX_VERIFY_THREADS     64
+#define PU_IO_DEFAULT_MAX_DIRTY      (32 * PU_IO_BUFFER_SIZE)
+
+typedef enum {
+    PU_IO_BACKEND_AUTO,
+    PU_IO_BACKEND_SYNC,
+    PU_IO_BACKEND_IO_URING
+} PuIoBackend;
+
+typedef enum {
+    /* Discard if the device reads back zeroes afterwards, otherwise zero */
+    PU_IO_CLEAN_AUTO,
+    /* Let the block layer zero the range */
+    PU_IO_CLEAN_ZERO,
+    /* Discard the range, its content is undefined afterwards */
+    PU_IO_CLEAN_DISCARD,
+    /* Discard the range, making sure the previous content is erased */
+    PU_IO_CLEAN_SECURE_DISCARD,
+    /* Write zeroes from userspace */
+    PU_IO_CLEAN_WRITE
+} PuIoCleanMethod;
+
+typedef enum {
+    /* All data of the input, in order */
+    PU_IO_DIGEST_INPUT,
+    /* Only the data written to the output, in order */
+    PU_IO_DIGEST_WRITTEN,
+    /* All data of the input file as stored, before any decompression */
+    PU_IO_DIGEST_FILE
+} PuIoDigestScope;
+
+/* An opened output written by the copy functions */
+typedef struct {
+    gint fd;
+    const gchar *path;
+} PuIoOutput;
+
+typedef struct {
+    PuIoDigestScope scope;
+    GChecksumType type;
+    GChecksum *checksum;
+} PuIoDigest;
+
+GArray * pu_io_digests_new(void);
+void pu_io_digests_add(GArray *digests,
+                       PuIoDigestScope scope,
+                       GChecksumType type);
+const gchar * pu_io_digests_get_string(GArray *digests,
+                                       PuIoDigestScope scope,
+                                       GChecksumType type);
+void pu_io_set_max_in_flight(gsize bytes);
+gsize pu_io_get_max_in_flight(void);
+gboolean pu_io_backend_from_string(const gchar *name,
+                                   PuIoBackend *backend,
+                                   GError **error);
+void pu_io_set_backend(PuIoBackend backend);
+PuIoBackend pu_io_get_backend(void);
+void pu_io_set_queue_depth(guint depth);
+guint pu_io_get_queue_depth(void);
+void pu_io_set_verify_threads(guint threads);
+guint pu_io_get_verify_threads(void);
+void pu_io_set_max_dirty(gsize bytes);
+gsize pu_io_get_max_dirty(void);
+void pu_io_set_compare(gboolean compare);
+gboolean pu_io_get_compare(void);
+gboolean pu_io_flush(const gchar *path,
+                     GError **error);
+gboolean pu_io_flush_filesystem(const gchar *mount_point,
+                                GError **error);
+gboolean pu_io_pread_all(gint fd,
+                         const gchar *path,
+                         guchar *buffer,
+                         gsize count,
+                         goffset offset,
+                         GError **error);
+gboolean pu_io_pwrite_all(gint fd,
+                          const gchar *path,
+                          const guchar *buffer,
+                          gsize count,
+                          goffset offset,
+                          GError **error);
+gboolean pu_io_write_zeroes(gint fd,
+                            const gchar *path,
+                            goffset offset,
+                            goffset length,
+                            GError **error);
+gboolean pu_io_clean_method_from_string(const gchar *name,
+                                        PuIoCleanMethod *method,
+                                        GError **error);
+gboolean pu_io_clean_fd(gint fd,
+                        const gchar *path,
+                        goffset offset,
+                        goffset length,
+                        PuIoCleanMethod method,
+                        GError **error);
+gboolean pu_io_clean(const gchar *path,
+                     goffset offset,
+                     goffset length,
+                     PuIoCleanMethod method,
+                     GError **error);
+gboolean pu_io_discard(const gchar *path,
+                       GArray *extents,
+                       GError **error);
+gboolean pu_io_copy_extents(gint input_fd,
+                            const gchar *input_path,
+                            gint output_fd,
+                            const gchar *output_path,
+                            GArray *extents,
+                            goffset shift,
+                            GArray *digests,
+                            GError **error);
+gboolean pu_io_copy_extents_multi(gint input_fd,
+                                  const gchar *input_path,
+                                  const PuIoOutput *outputs,
+                                  guint n_outputs,
+                                  GArray *extents,
+                                  goffset shift,
+                                  GArray *digests,
+                                  GError **error);
+gboolean pu_io_copy_stream(PuDecompressor *decompressor,
+                           const gchar *input_path,
+                           gint output_fd,
+                           const gchar *output_path,
+                           GArray *extents,
+                           goffset shift,
+                           GArray *digests,
+                           GError **error);
+gboolean pu_io_copy_stream_multi(PuDecompressor *decompressor,
+                                 const gchar *input_path,
+                                 const PuIoOutput *outputs,
+                                 guint n_outputs,
+                                 GArray *extents,
+                                 goffset shift,
+                                 GArray *digests,
+                                 GError **error);
+gchar * pu_io_checksum_extents(const gchar *path,
+                               GArray *extents,
+                               goffset shift,
+                               GChecksumType checksum_type,
+                               GError **error);
+
+#endif /* PARTUP_IO_H */
@@ -7,7 +7,7 @@
 #include <stdio.h>
 #include "pu-log.h"
 
-#define PU_LOG_DOMAINS "partup partup-config partup-emmc partup-file partup-mount partup-mtd partup-package partup-utils"
+#define PU_LOG_DOMAINS "partup partup-bmap partup-config partup-decompress partup-emmc partup-fat partup-file partup-gpt partup-io partup-mount partup-mtd partup-package partup-stats partup-tar partup-trace partup-utils"
 
 GLogLevelFlags log_output_level = G_LOG_LEVEL_INFO;
 
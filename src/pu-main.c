@@ -10,15 +10,20 @@
 #include <locale.h>
 #include <parted/parted.h>
 #include <unistd.h>
+#include "pu-checksum.h"
 #include "pu-command.h"
 #include "pu-config.h"
 #include "pu-emmc.h"
 #include "pu-error.h"
 #include "pu-flash.h"
+#include "pu-io.h"
 #include "pu-log.h"
 #include "pu-mount.h"
 #include "pu-mtd.h"
 #include "pu-package.h"
+#include "pu-stats.h"
+#include "pu-trace.h"
+#include "pu-unit.h"
 #include "pu-utils.h"
 #include "pu-version.h"
 
@@ -26,6 +31,15 @@ static gboolean arg_debug = FALSE;
 static gchar *arg_debug_domains = NULL;
 static gboolean arg_quiet = FALSE;
 static gboolean arg_install_skip_checksums = FALSE;
+static gchar *arg_install_max_in_flight = NULL;
+static gchar *arg_install_io_backend = NULL;
+static gint arg_install_queue_depth = PU_IO_DEFAULT_QUEUE_DEPTH;
+static gint arg_install_verify_threads = PU_IO_DEFAULT_VERIFY_THREADS;
+static gchar *arg_install_max_dirty = NULL;
+static gboolean arg_install_compare = FALSE;
+static gboolean arg_install_incremental = FALSE;
+static gchar *arg_install_stats = NULL;
+static gchar *arg_install_trace = NULL;
 static gchar *arg_package_directory = NULL;
 static gboolean arg_package_force = FALSE;
 static gboolean arg_show_size = FALSE;
@@ -47,8 +61,8 @@ error_out(const gchar *mountpoint)
 }
 
 static gboolean
-cmd_install(PuCommandContext *context,
-            GError **error)
+install_package(PuCommandContext *context,
+                GError **error)
 {
     g_autoptr(PuConfig) config = NULL;
     g_autofree gchar *mount_path = NULL;
@@ -65,6 +79,56 @@ cmd_install(PuCommandContext *context,
     if (getuid() != 0)
         return error_not_root(error);
 
+    if (arg_install_max_in_flight) {
+        gint64 bytes;
+
+        if (!pu_unit_parse_bytes(arg_install_max_in_flight, &bytes) ||
+            bytes < PU_IO_MIN_MAX_IN_FLIGHT) {
+            g_set_error(error, PU_ERROR, PU_ERROR_FAILED,
+                        "Invalid in-flight budget '%s'", arg_install_max_in_flight);
+            return FALSE;
+        }
+        pu_io_set_max_in_flight(bytes);
+    }
+
+    if (arg_install_io_backend) {
+        PuIoBackend backend;
+
+        if (!pu_io_backend_from_string(arg_install_io_backend, &backend, error))
+            return FALSE;
+        pu_io_set_backend(backend);
+    }
+
+    if (arg_install_queue_depth < 1 ||
+        arg_install_queue_depth > PU_IO_MAX_QUEUE_DEPTH) {
+        g_set_error(error, PU_ERROR, PU_ERROR_FAILED,
+                    "Queue depth must be between 1 and %d", PU_IO_MAX_QUEUE_DEPTH);
+        return FALSE;
+    }
+    pu_io_set_queue_depth(arg_install_queue_depth);
+
+    if (arg_install_verify_threads < 1 ||
+        arg_install_verify_threads > PU_IO_MAX_VERIFY_THREADS) {
+        g_set_error(error, PU_ERROR, PU_ERROR_FAILED,
+                    "Number of verify threads must be between 1 and %d",
+                    PU_IO_MAX_VERIFY_THREADS);
+        return FALSE;
+    }
+    pu_io_set_verify_threads(arg_install_verify_threads);
+
+    if (arg_install_max_dirty) {
+        gint64 bytes;
+
+        if (!pu_unit_parse_bytes(arg_install_max_dirty, &bytes) || bytes < 0) {
+            g_set_error(error, PU_ERROR, PU_ERROR_FAILED,
+                        "Invalid dirty data limit '%s'", arg_install_max_dirty);
+            return FALSE;
+        }
+        pu_io_set_max_dirty(bytes);
+    }
+
+    pu_io_set_compare(arg_install_compare);
+
     args = pu_command_context_get_args(context);
     package_path = g_strdup(args[0]);
     device_path = g_strdup(args[1]);
@@ -78,6 +142,9 @@ cmd_install(PuCommandContext *context,
     if (!pu_package_mount(package_path, &mount_path, &config_path, error))
         return FALSE;
 
+    /* Inputs are checksummed at most once per installation */
+    pu_checksum_cache_clear();
+
     config = pu_config_new_from_file(config_path, error);
     if (config == NULL) {
         g_prefix_error(error, "Failed creating configuration object for file '%s': ",
@@ -130,6 +197,10 @@ cmd_install(PuCommandContext *context,
         return error_out(mount_path);
     }
 
+    g_object_set(flash,
+                 "incremental", arg_install_incremental,
+                 NULL);
+
     if (!pu_flash_init_device(flash, error)) {
         g_prefix_error(error, "Failed initializing device: ");
         return error_out(mount_path);
@@ -147,6 +218,38 @@ cmd_install(PuCommandContext *context,
     return pu_package_umount(mount_path, error);
 }
 
+static gboolean
+cmd_install(PuCommandContext *context,
+            GError **error)
+{
+    g_autoptr(GError) stats_error = NULL;
+    g_autoptr(GError) trace_error = NULL;
+    PuStatsStep *step;
+    gboolean res;
+
+    if (arg_install_stats == NULL && arg_install_trace == NULL)
+        return install_package(context, error);
+
+    if (arg_install_stats)
+        pu_stats_enable();
+    if (arg_install_trace)
+        pu_trace_enable();
+
+    step = pu_stats_begin("install", NULL);
+    res = install_package(context, error);
+    pu_stats_end(step, 0, res);
+
+    /* Reports are also written for failed installs */
+    if (arg_install_stats && !pu_stats_write(arg_install_stats, &stats_error))
+        g_warning("Failed writing statistics to '%s': %s", arg_install_stats,
+                  stats_error->message);
+    if (arg_install_trace && !pu_trace_write(arg_install_trace, &trace_error))
+        g_warning("Failed writing trace to '%s': %s", arg_install_trace,
+                  trace_error->message);
+
+    return res;
+}
+
 static gboolean
 cmd_package(PuCommandContext *context,
             GError **error)
@@ -209,6 +312,32 @@ static GOptionEntry option_entries_main[] = {
 static GOptionEntry option_entries_install[] = {
     { "skip-checksums", 's', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
         &arg_install_skip_checksums, "Skip checksum verification for all input files", NULL },
+    { "max-in-flight", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+        &arg_install_max_in_flight, "Maximum amount of data buffered while writing raw data",
+        "SIZE" },
+    { "io-backend", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+        &arg_install_io_backend, "I/O backend for raw data (auto, sync or io_uring)",
+        "BACKEND" },
+    { "queue-depth", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+        &arg_install_queue_depth, "Number of outstanding requests of the io_uring backend",
+        "N" },
+    { "verify-threads", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+        &arg_install_verify_threads, "Number of threads reading back written data without io_uring",
+        "N" },
+    { "max-dirty", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+        &arg_install_max_dirty, "Maximum amount of cached data not yet written to the device",
+        "SIZE" },
+    { "compare", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+        &arg_install_compare, "Only write raw data differing from the device content", NULL },
+    { "incremental", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+        &arg_install_incremental, "Keep a matching partition table and only rewrite changed partitions",
+        NULL },
+    { "stats", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+        &arg_install_stats, "Write a JSON report of the time taken by each step to FILE",
+        "FILE" },
+    { "trace", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+        &arg_install_trace, "Write a timeline in the Chrome trace event format to FILE",
+        "FILE" },
     { G_OPTION_REMAINING, 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING_ARRAY,
         &arg_remaining, NULL, "install PACKAGE DEVICE" },
     { NULL }
@@ -13,6 +13,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "pu-error.h"
+#include "pu-stats.h"
 #include "pu-utils.h"
 #include "pu-mount.h"
 
@@ -94,6 +95,7 @@ pu_mount(const gchar *source,
     gint ret;
     gint status;
     struct libmnt_context *ctx;
+    PuStatsStep *step;
 
     g_return_val_if_fail(g_strcmp0(source, "") > 0, FALSE);
     g_return_val_if_fail(g_strcmp0(mount_point, "") > 0, FALSE);
@@ -116,8 +118,10 @@ pu_mount(const gchar *source,
     if (g_strcmp0(options, "") > 0)
         mnt_context_append_options(ctx, options);
 
+    step = pu_stats_begin("mount", source);
     ret = mnt_context_mount(ctx);
     status = mnt_context_get_status(ctx);
+    pu_stats_end(step, 0, !ret && status == 1);
     if (ret || status != 1) {
         g_set_error(error, PU_ERROR, PU_ERROR_MOUNT,
                     "Failed mounting '%s' to '%s': ret %d, status %d",
@@ -137,6 +141,7 @@ pu_umount(const gchar *mount_point,
     gint ret;
     gint status;
     struct libmnt_context *ctx;
+    PuStatsStep *step;
 
     g_return_val_if_fail(g_strcmp0(mount_point, "") > 0, FALSE);
     g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
@@ -151,8 +156,10 @@ pu_umount(const gchar *mount_point,
         return FALSE;
     }
     mnt_context_set_target(ctx, mount_point);
+    step = pu_stats_begin("umount", mount_point);
     ret = mnt_context_umount(ctx);
     status = mnt_context_get_status(ctx);
+    pu_stats_end(step, 0, !ret && status == 1);
     if (ret || status != 1) {
         g_set_error(error, PU_ERROR, PU_ERROR_MOUNT,
                     "Failed unmounting '%s': ret %d, status %d",
@@ -0,0 +1,229 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#define G_LOG_DOMAIN "partup-stats"
+#define _GNU_SOURCE
+
+#include <sys/resource.h>
+#include "pu-stats.h"
+#include "pu-trace.h"
+#include "pu-utils.h"
+
+struct _PuStatsStep {
+    gchar *name;
+    gchar *detail;
+    guint depth;
+    gint64 start;
+    gint64 wall_time;
+    gint64 cpu_start;
+    gint64 cpu_time;
+    goffset bytes;
+    gboolean ended;
+    gboolean success;
+    /* Only traced, not part of the statistics */
+    gboolean trace_only;
+};
+
+static gboolean stats_enabled = FALSE;
+static GMutex stats_lock;
+static GPtrArray *stats_steps = NULL;
+static guint stats_depth = 0;
+static gint64 stats_start = 0;
+
+static void
+stats_step_free(PuStatsStep *step)
+{
+    g_free(step->name);
+    g_free(step->detail);
+    g_free(step);
+}
+
+/* CPU time of the process and its finished children in microseconds */
+static gint64
+stats_get_cpu_time(void)
+{
+    struct rusage self;
+    struct rusage children;
+
+    if (getrusage(RUSAGE_SELF, &self) < 0 ||
+        getrusage(RUSAGE_CHILDREN, &children) < 0)
+        return 0;
+
+    return (self.ru_utime.tv_sec + self.ru_stime.tv_sec +
+            children.ru_utime.tv_sec + children.ru_stime.tv_sec) * G_USEC_PER_SEC +
+           self.ru_utime.tv_usec + self.ru_stime.tv_usec +
+           children.ru_utime.tv_usec + children.ru_stime.tv_usec;
+}
+
+/*
+ * Start recording the performance of install steps. Until then, recording a
+ * step costs no more than checking a flag.
+ */
+void
+pu_stats_enable(void)
+{
+    g_mutex_lock(&stats_lock);
+    if (stats_steps == NULL)
+        stats_steps = g_ptr_array_new_with_free_func((GDestroyNotify) stats_step_free);
+    stats_start = g_get_monotonic_time();
+    stats_enabled = TRUE;
+    g_mutex_unlock(&stats_lock);
+}
+
+gboolean
+pu_stats_is_enabled(void)
+{
+    return stats_enabled;
+}
+
+/* Stop recording and drop all recorded steps */
+void
+pu_stats_reset(void)
+{
+    g_mutex_lock(&stats_lock);
+    stats_enabled = FALSE;
+    stats_depth = 0;
+    g_clear_pointer(&stats_steps, g_ptr_array_unref);
+    g_mutex_unlock(&stats_lock);
+}
+
+/*
+ * Begin a step of the installation. Steps begun before ending the current one
+ * are recorded as nested in it. The detail, e.g. a file or command line, is
+ * optional. Steps also appear as spans in the trace if tracing is enabled.
+ * Returns NULL if neither is enabled.
+ */
+PuStatsStep *
+pu_stats_begin(const gchar *name,
+               const gchar *detail)
+{
+    PuStatsStep *step;
+
+    g_return_val_if_fail(name != NULL, NULL);
+
+    if (!stats_enabled && !pu_trace_is_enabled())
+        return NULL;
+
+    step = g_new0(PuStatsStep, 1);
+    step->name = g_strdup(name);
+    step->detail = g_strdup(detail);
+    step->trace_only = !stats_enabled;
+
+    if (!step->trace_only) {
+        g_mutex_lock(&stats_lock);
+        step->depth = stats_depth++;
+        g_ptr_array_add(stats_steps, step);
+        g_mutex_unlock(&stats_lock);
+    }
+
+    pu_trace_begin(name, detail);
+
+    step->cpu_start = stats_get_cpu_time();
+    step->start = g_get_monotonic_time();
+
+    return step;
+}
+
+/* End a step, recording the number of bytes it read or wrote */
+void
+pu_stats_end(PuStatsStep *step,
+             goffset bytes,
+             gboolean success)
+{
+    if (step == NULL)
+        return;
+
+    pu_trace_end(step->name);
+    if (step->trace_only) {
+        stats_step_free(step);
+        return;
+    }
+
+    step->wall_time = g_get_monotonic_time() - step->start;
+    step->cpu_time = stats_get_cpu_time() - step->cpu_start;
+    step->bytes = bytes;
+    step->success = success;
+
+    g_mutex_lock(&stats_lock);
+    step->ended = TRUE;
+    if (stats_depth > 0)
+        stats_depth--;
+    g_mutex_unlock(&stats_lock);
+}
+
+/* Append seconds independent of the locale's decimal separator */
+static void
+stats_append_seconds(GString *json,
+                     gint64 usec)
+{
+    gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+    g_string_append(json, g_ascii_formatd(buffer, sizeof(buffer), "%.6f",
+                                          usec / (gdouble) G_USEC_PER_SEC));
+}
+
+/*
+ * Serialize all recorded steps as a JSON object. Steps are listed in the order
+ * they began, their nesting is given by their depth. Throughput is given in
+ * bytes per second of wall time and is null for steps not moving data.
+ */
+gchar *
+pu_stats_to_json(void)
+{
+    g_autoptr(GString) json = g_string_new(NULL);
+    gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+    g_mutex_lock(&stats_lock);
+
+    g_string_append(json, "{\n  \"wall-time\": ");
+    stats_append_seconds(json, g_get_monotonic_time() - stats_start);
+    g_string_append(json, ",\n  \"steps\": [");
+
+    for (guint i = 0; stats_steps && i < stats_steps->len; i++) {
+        PuStatsStep *step = g_ptr_array_index(stats_steps, i);
+
+        g_string_append(json, i > 0 ? ",\n    {" : "\n    {");
+        g_string_append(json, "\"name\": ");
+        pu_json_append_string(json, step->name);
+        g_string_append(json, ", \"detail\": ");
+        pu_json_append_string(json, step->detail);
+        g_string_append_printf(json, ", \"depth\": %u, \"start\": ", step->depth);
+        stats_append_seconds(json, step->start - stats_start);
+        g_string_append(json, ", \"wall-time\": ");
+        stats_append_seconds(json, step->wall_time);
+        g_string_append(json, ", \"cpu-time\": ");
+        stats_append_seconds(json, step->cpu_time);
+        g_string_append_printf(json, ", \"bytes\": %" G_GOFFSET_FORMAT
+                               ", \"throughput\": ", step->bytes);
+        if (step->bytes > 0 && step->wall_time > 0)
+            g_string_append(json, g_ascii_formatd(buffer, sizeof(buffer), "%.0f",
+                                                  step->bytes * (gdouble) G_USEC_PER_SEC /
+                                                  step->wall_time));
+        else
+            g_string_append(json, "null");
+        g_string_append_printf(json, ", \"success\": %s}",
+                               step->ended && step->success ? "true" : "false");
+    }
+
+    g_string_append(json, "\n  ]\n}\n");
+
+    g_mutex_unlock(&stats_lock);
+
+    return g_string_free(g_steal_pointer(&json), FALSE);
+}
+
+gboolean
+pu_stats_write(const gchar *filename,
+               GError **error)
+{
+    g_autofree gchar *json = NULL;
+
+    g_return_val_if_fail(filename != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    json = pu_stats_to_json();
+
+    return g_file_set_contents(filename, json, -1, error);
+}
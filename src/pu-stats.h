@@ -0,0 +1,25 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#ifndef PARTUP_STATS_H
+#define PARTUP_STATS_H
+
+#include <glib.h>
+
+typedef struct _PuStatsStep PuStatsStep;
+
+void pu_stats_enable(void);
+gboolean pu_stats_is_enabled(void);
+PuStatsStep * pu_stats_begin(const gchar *name,
+                             const gchar *detail);
+void pu_stats_end(PuStatsStep *step,
+                  goffset bytes,
+                  gboolean success);
+gchar * pu_stats_to_json(void);
+gboolean pu_stats_write(const gchar *filename,
+                        GError **error);
+void pu_stats_reset(void);
+
+#endif /* PARTUP_STATS_H */
@@ -0,0 +1,1263 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#define G_LOG_DOMAIN "partup-tar"
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include "pu-decompress.h"
+#include "pu-error.h"
+#include "pu-io.h"
+#include "pu-tar.h"
+
+#define TAR_BLOCK_SIZE      512
+#define TAR_WORKERS         4
+/* Files up to this size are buffered and written by the worker pool */
+#define TAR_MAX_JOB_SIZE    (1024 * 1024)
+/* Upper bound of buffered file data waiting for a worker */
+#define TAR_MAX_PENDING     (32 * 1024 * 1024)
+/* Upper bound of long names and pax extended headers */
+#define TAR_MAX_HEADER_DATA (1024 * 1024)
+
+typedef struct {
+    gchar *name;
+    GBytes *value;
+} TarXattr;
+
+typedef struct {
+    gchar type;
+    gchar *path;
+    gchar *link;
+    guint32 mode;
+    guint32 uid;
+    guint32 gid;
+    guint64 size;
+    struct timespec mtime;
+    dev_t rdev;
+    GPtrArray *xattrs;
+    guchar *data;
+} TarEntry;
+
+/* Attributes of the next member given by GNU long names or pax headers */
+typedef struct {
+    gchar *path;
+    gchar *link;
+    gint64 size;
+    gint64 uid;
+    gint64 gid;
+    gboolean has_mtime;
+    struct timespec mtime;
+    GPtrArray *xattrs;
+} TarOverrides;
+
+typedef struct {
+    const gchar *filename;
+    gchar *dest;
+    PuDecompressor *decompressor;
+    gint fd;
+    goffset offset;
+    gboolean same_owner;
+    TarOverrides next;
+
+    /* Directories known to exist and paths handed to the worker pool */
+    GHashTable *dirs;
+    GHashTable *queued;
+    /* Directory metadata is applied after all files have been written */
+    GPtrArray *dir_entries;
+    /*
+     * Symlinks that could lead out of the destination are created at the end,
+     * with placeholder files in their place until then. The table maps paths
+     * to their pending symlink.
+     */
+    GPtrArray *delayed_links;
+    GHashTable *delayed;
+
+    GThreadPool *pool;
+    GMutex lock;
+    GCond cond;
+    guint pending_jobs;
+    gsize pending_bytes;
+    gboolean cancelled;
+    GError *worker_error;
+} TarExtractor;
+
+static void
+tar_xattr_free(TarXattr *xattr)
+{
+    g_free(xattr->name);
+    g_bytes_unref(xattr->value);
+    g_free(xattr);
+}
+
+static void
+tar_entry_free(TarEntry *entry)
+{
+    if (!entry)
+        return;
+
+    g_free(entry->path);
+    g_free(entry->link);
+    g_free(entry->data);
+    if (entry->xattrs)
+        g_ptr_array_unref(entry->xattrs);
+    g_free(entry);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(TarEntry, tar_entry_free)
+
+static void
+tar_overrides_clear(TarOverrides *overrides)
+{
+    g_clear_pointer(&overrides->path, g_free);
+    g_clear_pointer(&overrides->link, g_free);
+    g_clear_pointer(&overrides->xattrs, g_ptr_array_unref);
+    overrides->size = -1;
+    overrides->uid = -1;
+    overrides->gid = -1;
+    overrides->has_mtime = FALSE;
+}
+
+static gsize
+tar_padding(guint64 size)
+{
+    return (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+}
+
+static gboolean
+tar_read(TarExtractor *self,
+         guchar *buffer,
+         gsize count,
+         GError **error)
+{
+    gsize bytes_read;
+
+    if (!self->decompressor) {
+        if (!pu_io_pread_all(self->fd, self->filename, buffer, count,
+                             self->offset, error))
+            return FALSE;
+        self->offset += count;
+        return TRUE;
+    }
+
+    if (!pu_decompressor_read(self->decompressor, buffer, count, &bytes_read,
+                              error))
+        return FALSE;
+
+    if (bytes_read < count) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                    "Unexpected end of archive '%s'", self->filename);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+tar_skip(TarExtractor *self,
+         guint64 count,
+         GError **error)
+{
+    guchar buffer[16 * TAR_BLOCK_SIZE];
+
+    if (!self->decompressor) {
+        self->offset += count;
+        return TRUE;
+    }
+
+    while (count > 0) {
+        gsize chunk = MIN(count, sizeof(buffer));
+
+        if (!tar_read(self, buffer, chunk, error))
+            return FALSE;
+        count -= chunk;
+    }
+
+    return TRUE;
+}
+
+/* Read the data of a member including its padding to the next block */
+static guchar *
+tar_read_data(TarExtractor *self,
+              guint64 size,
+              GError **error)
+{
+    g_autofree guchar *data = g_malloc(size + 1);
+
+    if (!tar_read(self, data, size, error))
+        return NULL;
+    if (!tar_skip(self, tar_padding(size), error))
+        return NULL;
+    data[size] = '\0';
+
+    return g_steal_pointer(&data);
+}
+
+/*
+ * Parse a numeric header field, either as octal number or in the base-256
+ * encoding used by GNU tar for values exceeding the field.
+ */
+static gboolean
+tar_parse_number(const guchar *field,
+                 gsize size,
+                 guint64 *value)
+{
+    guint64 result = 0;
+    gsize i = 0;
+
+    if (field[0] & 0x80) {
+        /* Negative values are never valid here */
+        if (field[0] & 0x40)
+            return FALSE;
+
+        result = field[0] & 0x3f;
+        for (i = 1; i < size; i++) {
+            if (result > G_MAXUINT64 >> 8)
+                return FALSE;
+            result = result << 8 | field[i];
+        }
+        *value = result;
+        return TRUE;
+    }
+
+    while (i < size && field[i] == ' ')
+        i++;
+    for (; i < size && field[i] >= '0' && field[i] <= '7'; i++)
+        result = result << 3 | (guint64) (field[i] - '0');
+    for (; i < size; i++) {
+        if (field[i] != ' ' && field[i] != '\0')
+            return FALSE;
+    }
+
+    *value = result;
+    return TRUE;
+}
+
+static gboolean
+tar_verify_checksum(const guchar *header)
+{
+    guint64 expected;
+    gint64 unsigned_sum = 0;
+    gint64 signed_sum = 0;
+
+    if (!tar_parse_number(header + 148, 8, &expected))
+        return FALSE;
+
+    /* Some historic implementations summed up signed chars */
+    for (guint i = 0; i < TAR_BLOCK_SIZE; i++) {
+        guchar c = (i >= 148 && i < 156) ? ' ' : header[i];
+
+        unsigned_sum += c;
+        signed_sum += (gint8) c;
+    }
+
+    return (gint64) expected == unsigned_sum || (gint64) expected == signed_sum;
+}
+
+static gboolean
+tar_is_zero_block(const guchar *block)
+{
+    for (guint i = 0; i < TAR_BLOCK_SIZE; i++) {
+        if (block[i] != 0)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+tar_parse_time(const gchar *value,
+               struct timespec *mtime)
+{
+    g_auto(GStrv) parts = g_strsplit(value, ".", 2);
+    const gchar *fraction;
+    gint64 sec;
+    glong nsec = 0;
+
+    if (!parts[0])
+        return FALSE;
+    fraction = parts[1] ? parts[1] : "";
+
+    if (!g_ascii_string_to_signed(parts[0], 10, G_MININT64, G_MAXINT64, &sec,
+                                  NULL))
+        return FALSE;
+
+    for (guint i = 0; i < 9; i++) {
+        nsec *= 10;
+        if (g_ascii_isdigit(*fraction))
+            nsec += *fraction++ - '0';
+        else if (*fraction != '\0')
+            return FALSE;
+    }
+
+    mtime->tv_sec = sec;
+    mtime->tv_nsec = nsec;
+    return TRUE;
+}
+
+/* Parse the records of a pax extended header ("<length> <key>=<value>\n") */
+static gboolean
+tar_parse_pax(TarExtractor *self,
+              const gchar *data,
+              gsize size,
+              GError **error)
+{
+    const gchar *record = data;
+    const gchar *end = data + size;
+
+    while (record < end && *record != '\0') {
+        g_autofree gchar *key = NULL;
+        g_autofree gchar *value = NULL;
+        const gchar *separator;
+        const gchar *equals;
+        gchar *endptr;
+        guint64 length;
+        guint64 number;
+        gsize value_len;
+
+        length = g_ascii_strtoull(record, &endptr, 10);
+        if (endptr == record || *endptr != ' ' || length == 0 ||
+            length > (guint64) (end - record) || record[length - 1] != '\n') {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                        "Invalid pax header in '%s'", self->filename);
+            return FALSE;
+        }
+
+        separator = endptr + 1;
+        equals = memchr(separator, '=', record + length - 1 - separator);
+        if (!equals) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                        "Invalid pax record in '%s'", self->filename);
+            return FALSE;
+        }
+
+        key = g_strndup(separator, equals - separator);
+        value_len = record + length - 1 - (equals + 1);
+        value = g_strndup(equals + 1, value_len);
+
+        if (g_str_equal(key, "path")) {
+            g_free(self->next.path);
+            self->next.path = g_steal_pointer(&value);
+        } else if (g_str_equal(key, "linkpath")) {
+            g_free(self->next.link);
+            self->next.link = g_steal_pointer(&value);
+        } else if (g_str_equal(key, "size") || g_str_equal(key, "uid") ||
+                   g_str_equal(key, "gid")) {
+            if (!g_ascii_string_to_unsigned(value, 10, 0, G_MAXINT64, &number,
+                                            NULL)) {
+                g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                            "Invalid pax value '%s' for '%s' in '%s'",
+                            value, key, self->filename);
+                return FALSE;
+            }
+            if (g_str_equal(key, "size"))
+                self->next.size = number;
+            else if (g_str_equal(key, "uid"))
+                self->next.uid = number;
+            else
+                self->next.gid = number;
+        } else if (g_str_equal(key, "mtime")) {
+            if (!tar_parse_time(value, &self->next.mtime)) {
+                g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                            "Invalid pax value '%s' for '%s' in '%s'",
+                            value, key, self->filename);
+                return FALSE;
+            }
+            self->next.has_mtime = TRUE;
+        } else if (g_str_has_prefix(key, "SCHILY.xattr.")) {
+            TarXattr *xattr = g_new0(TarXattr, 1);
+
+            /* Values are binary and may contain NUL bytes */
+            xattr->name = g_strdup(key + strlen("SCHILY.xattr."));
+            xattr->value = g_bytes_new(equals + 1, value_len);
+            if (!self->next.xattrs)
+                self->next.xattrs = g_ptr_array_new_with_free_func((GDestroyNotify) tar_xattr_free);
+            g_ptr_array_add(self->next.xattrs, xattr);
+        } else if (g_str_has_prefix(key, "GNU.sparse.")) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        "Sparse members in '%s' are not supported",
+                        self->filename);
+            return FALSE;
+        }
+
+        record += length;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Resolve a member name below the destination directory. Leading slashes and
+ * '.' components are dropped, names containing '..' are rejected.
+ */
+static gchar *
+tar_resolve_path(TarExtractor *self,
+                 const gchar *name,
+                 GError **error)
+{
+    g_auto(GStrv) components = g_strsplit(name, "/", -1);
+    g_autoptr(GString) path = g_string_new(self->dest);
+
+    for (guint i = 0; components[i]; i++) {
+        if (components[i][0] == '\0' || g_str_equal(components[i], "."))
+            continue;
+        if (g_str_equal(components[i], "..")) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_FILENAME,
+                        "Member name '%s' in '%s' contains '..'",
+                        name, self->filename);
+            return NULL;
+        }
+        g_string_append_c(path, G_DIR_SEPARATOR);
+        g_string_append(path, components[i]);
+    }
+
+    return g_string_free(g_steal_pointer(&path), FALSE);
+}
+
+static TarEntry *
+tar_parse_header(TarExtractor *self,
+                 const guchar *header,
+                 GError **error)
+{
+    g_autoptr(TarEntry) entry = g_new0(TarEntry, 1);
+    g_autofree gchar *name = NULL;
+    g_autofree gchar *link = NULL;
+    guint64 mode;
+    guint64 uid;
+    guint64 gid;
+    guint64 size;
+    guint64 mtime;
+    guint64 major = 0;
+    guint64 minor = 0;
+
+    if (!tar_parse_number(header + 100, 8, &mode) ||
+        !tar_parse_number(header + 108, 8, &uid) ||
+        !tar_parse_number(header + 116, 8, &gid) ||
+        !tar_parse_number(header + 124, 12, &size) ||
+        !tar_parse_number(header + 136, 12, &mtime)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "Invalid tar header in '%s'", self->filename);
+        return NULL;
+    }
+
+    entry->type = header[156] == '\0' ? '0' : (gchar) header[156];
+
+    if (entry->type == '3' || entry->type == '4') {
+        if (!tar_parse_number(header + 329, 8, &major) ||
+            !tar_parse_number(header + 337, 8, &minor)) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                        "Invalid device number in '%s'", self->filename);
+            return NULL;
+        }
+    }
+
+    /* Only POSIX ustar uses the prefix field, GNU stores other data there */
+    if (memcmp(header + 257, "ustar\0", 6) == 0 && header[345] != '\0') {
+        g_autofree gchar *prefix = g_strndup((const gchar *) header + 345, 155);
+        g_autofree gchar *base = g_strndup((const gchar *) header, 100);
+
+        name = g_build_filename(prefix, base, NULL);
+    } else {
+        name = g_strndup((const gchar *) header, 100);
+    }
+    link = g_strndup((const gchar *) header + 157, 100);
+
+    entry->mode = mode & (self->same_owner ? 07777 : 0777);
+    entry->uid = self->next.uid >= 0 ? (guint64) self->next.uid : uid;
+    entry->gid = self->next.gid >= 0 ? (guint64) self->next.gid : gid;
+    entry->size = self->next.size >= 0 ? (guint64) self->next.size : size;
+    entry->rdev = makedev(major, minor);
+    entry->xattrs = g_steal_pointer(&self->next.xattrs);
+    if (self->next.has_mtime) {
+        entry->mtime = self->next.mtime;
+    } else {
+        entry->mtime.tv_sec = mtime;
+        entry->mtime.tv_nsec = 0;
+    }
+
+    entry->path = tar_resolve_path(self, self->next.path ? self->next.path : name,
+                                   error);
+    if (!entry->path)
+        return NULL;
+
+    if (self->next.link) {
+        g_free(link);
+        link = g_steal_pointer(&self->next.link);
+    }
+    if (entry->type == '1') {
+        /* Hard link targets name another member of the archive */
+        entry->link = tar_resolve_path(self, link, error);
+        if (!entry->link)
+            return NULL;
+    } else {
+        entry->link = g_steal_pointer(&link);
+    }
+
+    tar_overrides_clear(&self->next);
+
+    return g_steal_pointer(&entry);
+}
+
+static gboolean
+tar_check_workers(TarExtractor *self,
+                  GError **error)
+{
+    gboolean res = TRUE;
+
+    g_mutex_lock(&self->lock);
+    if (self->worker_error) {
+        g_propagate_error(error, g_steal_pointer(&self->worker_error));
+        self->cancelled = TRUE;
+        res = FALSE;
+    }
+    g_mutex_unlock(&self->lock);
+
+    return res;
+}
+
+/* Wait for all files handed to the worker pool to be written */
+static gboolean
+tar_wait_idle(TarExtractor *self,
+              GError **error)
+{
+    g_mutex_lock(&self->lock);
+    while (self->pending_jobs > 0)
+        g_cond_wait(&self->cond, &self->lock);
+    g_mutex_unlock(&self->lock);
+
+    g_hash_table_remove_all(self->queued);
+
+    return tar_check_workers(self, error);
+}
+
+/* Make sure a path does not refer to a file still being written by a worker */
+static gboolean
+tar_wait_path(TarExtractor *self,
+              const gchar *path,
+              GError **error)
+{
+    if (!g_hash_table_contains(self->queued, path))
+        return TRUE;
+
+    return tar_wait_idle(self, error);
+}
+
+static gboolean
+tar_ensure_parent(TarExtractor *self,
+                  const gchar *path,
+                  GError **error)
+{
+    g_autofree gchar *parent = g_path_get_dirname(path);
+
+    if (g_hash_table_contains(self->dirs, parent))
+        return TRUE;
+
+    if (g_mkdir_with_parents(parent, 0755) < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed creating directory '%s': %s",
+                    parent, g_strerror(errno));
+        return FALSE;
+    }
+
+    g_hash_table_add(self->dirs, g_steal_pointer(&parent));
+
+    return TRUE;
+}
+
+/* Replace existing files like tar does, but keep existing directories */
+static gboolean
+tar_remove_existing(TarExtractor *self,
+                    const gchar *path,
+                    GError **error)
+{
+    /* A member replacing a placeholder takes precedence over its symlink */
+    g_hash_table_remove(self->delayed, path);
+
+    if (unlink(path) == 0 || errno == ENOENT)
+        return TRUE;
+
+    if (errno == EISDIR && rmdir(path) == 0) {
+        g_hash_table_remove(self->dirs, path);
+        return TRUE;
+    }
+
+    g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                "Failed removing existing '%s': %s", path, g_strerror(errno));
+    return FALSE;
+}
+
+static gboolean
+tar_set_xattrs(const TarEntry *entry,
+               gint fd,
+               GError **error)
+{
+    for (guint i = 0; entry->xattrs && i < entry->xattrs->len; i++) {
+        TarXattr *xattr = g_ptr_array_index(entry->xattrs, i);
+        gsize size;
+        gconstpointer value = g_bytes_get_data(xattr->value, &size);
+        gint ret;
+
+        if (fd >= 0)
+            ret = fsetxattr(fd, xattr->name, value, size, 0);
+        else
+            ret = lsetxattr(entry->path, xattr->name, value, size, 0);
+
+        /* Like tar, silently skip attributes the filesystem cannot store */
+        if (ret < 0 && errno == ENOTSUP) {
+            g_debug("Skipping attribute '%s' of '%s': %s", xattr->name,
+                    entry->path, g_strerror(errno));
+            continue;
+        }
+        if (ret < 0) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Failed setting attribute '%s' of '%s': %s",
+                        xattr->name, entry->path, g_strerror(errno));
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/*
+ * Apply ownership, permissions, extended attributes and the modification time
+ * of an entry. Ownership is changed first, as it clears set-ID bits. Without
+ * an open file descriptor, the path is used without following symlinks.
+ */
+static gboolean
+tar_set_metadata(TarExtractor *self,
+                 const TarEntry *entry,
+                 gint fd,
+                 GError **error)
+{
+    struct timespec times[2] = { entry->mtime, entry->mtime };
+    gint ret;
+
+    if (self->same_owner) {
+        if (fd >= 0)
+            ret = fchown(fd, entry->uid, entry->gid);
+        else
+            ret = lchown(entry->path, entry->uid, entry->gid);
+        if (ret < 0) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Failed changing owner of '%s': %s",
+                        entry->path, g_strerror(errno));
+            return FALSE;
+        }
+    }
+
+    /* Symlinks do not have permissions of their own */
+    if (entry->type != '2') {
+        if (fd >= 0)
+            ret = fchmod(fd, entry->mode);
+        else
+            ret = chmod(entry->path, entry->mode);
+        if (ret < 0) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Failed changing mode of '%s': %s",
+                        entry->path, g_strerror(errno));
+            return FALSE;
+        }
+    }
+
+    if (!tar_set_xattrs(entry, fd, error))
+        return FALSE;
+
+    if (fd >= 0)
+        ret = futimens(fd, times);
+    else
+        ret = utimensat(AT_FDCWD, entry->path, times, AT_SYMLINK_NOFOLLOW);
+    if (ret < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed setting modification time of '%s': %s",
+                    entry->path, g_strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gint
+tar_create_file(const TarEntry *entry,
+                GError **error)
+{
+    gint fd;
+
+    fd = g_open(entry->path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                0600);
+    if (fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed creating '%s': %s", entry->path, g_strerror(errno));
+        return -1;
+    }
+
+    /* Preallocate the whole file to keep it contiguous on the device */
+    if (entry->size > 0 && fallocate(fd, 0, 0, entry->size) < 0 &&
+        errno == ENOSPC) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                    "Failed allocating %" G_GUINT64_FORMAT " bytes for '%s': %s",
+                    entry->size, entry->path, g_strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static gboolean
+tar_write_buffered(TarExtractor *self,
+                   const TarEntry *entry,
+                   GError **error)
+{
+    gint fd;
+    gboolean res;
+
+    fd = tar_create_file(entry, error);
+    if (fd < 0)
+        return FALSE;
+
+    res = pu_io_pwrite_all(fd, entry->path, entry->data, entry->size, 0, error) &&
+          tar_set_metadata(self, entry, fd, error);
+
+    if (close(fd) < 0 && res) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed closing '%s': %s", entry->path, g_strerror(errno));
+        return FALSE;
+    }
+
+    return res;
+}
+
+static void
+tar_worker(gpointer data,
+           gpointer user_data)
+{
+    g_autoptr(TarEntry) entry = data;
+    TarExtractor *self = user_data;
+    g_autoptr(GError) error = NULL;
+    gboolean skip;
+
+    g_mutex_lock(&self->lock);
+    skip = self->cancelled || self->worker_error != NULL;
+    g_mutex_unlock(&self->lock);
+
+    if (!skip)
+        tar_write_buffered(self, entry, &error);
+
+    g_mutex_lock(&self->lock);
+    if (error && !self->worker_error)
+        self->worker_error = g_steal_pointer(&error);
+    self->pending_jobs--;
+    self->pending_bytes -= entry->size;
+    g_cond_broadcast(&self->cond);
+    g_mutex_unlock(&self->lock);
+}
+
+/* Hand a small file to the worker pool, blocking while too much is pending */
+static gboolean
+tar_queue_file(TarExtractor *self,
+               TarEntry *entry,
+               GError **error)
+{
+    g_autoptr(TarEntry) job = entry;
+
+    job->data = tar_read_data(self, job->size, error);
+    if (!job->data)
+        return FALSE;
+
+    g_mutex_lock(&self->lock);
+    while (self->pending_bytes > 0 &&
+           self->pending_bytes + job->size > TAR_MAX_PENDING)
+        g_cond_wait(&self->cond, &self->lock);
+    self->pending_jobs++;
+    self->pending_bytes += job->size;
+    g_mutex_unlock(&self->lock);
+
+    g_hash_table_add(self->queued, g_strdup(job->path));
+
+    /*
+     * Pushing to the exclusive pool starts no threads. Should it fail anyway,
+     * the job is still queued by GLib and is dropped by a worker once the
+     * extraction is cancelled, which takes it off the pending jobs.
+     */
+    return g_thread_pool_push(self->pool, g_steal_pointer(&job), error);
+}
+
+/* Write a large file directly while the workers keep writing small ones */
+static gboolean
+tar_write_streamed(TarExtractor *self,
+                   const TarEntry *entry,
+                   GError **error)
+{
+    g_autofree guchar *buffer = g_malloc(PU_IO_BUFFER_SIZE);
+    guint64 offset = 0;
+    gboolean res = TRUE;
+    gint fd;
+
+    fd = tar_create_file(entry, error);
+    if (fd < 0)
+        return FALSE;
+
+    while (res && offset < entry->size) {
+        gsize chunk = MIN(entry->size - offset, PU_IO_BUFFER_SIZE);
+
+        res = tar_read(self, buffer, chunk, error) &&
+              pu_io_pwrite_all(fd, entry->path, buffer, chunk, offset, error);
+        offset += chunk;
+    }
+
+    res = res && tar_skip(self, tar_padding(entry->size), error) &&
+          tar_set_metadata(self, entry, fd, error);
+
+    if (close(fd) < 0 && res) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed closing '%s': %s", entry->path, g_strerror(errno));
+        return FALSE;
+    }
+
+    return res;
+}
+
+static gboolean
+tar_extract_directory(TarExtractor *self,
+                      TarEntry *entry,
+                      GError **error)
+{
+    g_autoptr(TarEntry) dir = entry;
+    GStatBuf st;
+
+    if (!g_str_equal(dir->path, self->dest)) {
+        if (!tar_ensure_parent(self, dir->path, error))
+            return FALSE;
+        if (!tar_wait_path(self, dir->path, error))
+            return FALSE;
+        if (g_lstat(dir->path, &st) == 0 && !S_ISDIR(st.st_mode) &&
+            !tar_remove_existing(self, dir->path, error))
+            return FALSE;
+        if (g_mkdir(dir->path, 0755) < 0 && errno != EEXIST) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Failed creating directory '%s': %s",
+                        dir->path, g_strerror(errno));
+            return FALSE;
+        }
+        g_hash_table_add(self->dirs, g_strdup(dir->path));
+    }
+
+    g_ptr_array_add(self->dir_entries, g_steal_pointer(&dir));
+
+    return TRUE;
+}
+
+/*
+ * Whether a symlink target stays below the directory of the symlink, i.e. is
+ * relative and has no '..' components. Paths through such symlinks cannot
+ * leave the destination.
+ */
+static gboolean
+tar_link_is_safe(const gchar *target)
+{
+    g_auto(GStrv) components = NULL;
+
+    if (g_path_is_absolute(target))
+        return FALSE;
+
+    components = g_strsplit(target, "/", -1);
+    for (guint i = 0; components[i]; i++) {
+        if (g_str_equal(components[i], ".."))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Create an empty placeholder file for a symlink that could lead out of the
+ * destination, like GNU tar does. Later members below it then fail instead of
+ * being written outside of the destination. Hard links to a delayed symlink
+ * become delayed symlinks themselves.
+ */
+static gboolean
+tar_delay_symlink(TarExtractor *self,
+                  TarEntry *entry,
+                  GError **error)
+{
+    g_autoptr(TarEntry) symlink_entry = entry;
+    gint fd;
+
+    if (symlink_entry->type == '1') {
+        TarEntry *target = g_hash_table_lookup(self->delayed, symlink_entry->link);
+
+        symlink_entry->type = '2';
+        g_free(symlink_entry->link);
+        symlink_entry->link = g_strdup(target->link);
+        symlink_entry->uid = target->uid;
+        symlink_entry->gid = target->gid;
+        symlink_entry->mtime = target->mtime;
+    }
+
+    if (!tar_wait_path(self, symlink_entry->path, error))
+        return FALSE;
+    if (!tar_remove_existing(self, symlink_entry->path, error))
+        return FALSE;
+
+    fd = g_open(symlink_entry->path,
+                O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0);
+    if (fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed creating placeholder '%s': %s",
+                    symlink_entry->path, g_strerror(errno));
+        return FALSE;
+    }
+    close(fd);
+
+    g_hash_table_replace(self->delayed, symlink_entry->path, symlink_entry);
+    g_ptr_array_add(self->delayed_links, g_steal_pointer(&symlink_entry));
+
+    return TRUE;
+}
+
+/* Replace the placeholders still in place by their symlinks */
+static gboolean
+tar_create_delayed_links(TarExtractor *self,
+                         GError **error)
+{
+    for (guint i = 0; i < self->delayed_links->len; i++) {
+        TarEntry *entry = g_ptr_array_index(self->delayed_links, i);
+
+        if (g_hash_table_lookup(self->delayed, entry->path) != entry)
+            continue;
+
+        if (unlink(entry->path) < 0 || symlink(entry->link, entry->path) < 0) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Failed creating symlink '%s': %s",
+                        entry->path, g_strerror(errno));
+            return FALSE;
+        }
+
+        if (!tar_set_metadata(self, entry, -1, error))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+tar_extract_special(TarExtractor *self,
+                    const TarEntry *entry,
+                    GError **error)
+{
+    gint ret;
+
+    if (!tar_wait_path(self, entry->path, error))
+        return FALSE;
+    if (!tar_remove_existing(self, entry->path, error))
+        return FALSE;
+
+    switch (entry->type) {
+    case '1':
+        if (!tar_wait_path(self, entry->link, error))
+            return FALSE;
+        if (link(entry->link, entry->path) < 0) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Failed linking '%s' to '%s': %s", entry->path,
+                        entry->link, g_strerror(errno));
+            return FALSE;
+        }
+        /* Hard links share the metadata of their target */
+        return TRUE;
+    case '2':
+        ret = symlink(entry->link, entry->path);
+        break;
+    case '3':
+        ret = mknod(entry->path, S_IFCHR | entry->mode, entry->rdev);
+        break;
+    case '4':
+        ret = mknod(entry->path, S_IFBLK | entry->mode, entry->rdev);
+        break;
+    default:
+        ret = mkfifo(entry->path, entry->mode);
+        break;
+    }
+
+    if (ret < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed creating '%s': %s", entry->path, g_strerror(errno));
+        return FALSE;
+    }
+
+    return tar_set_metadata(self, entry, -1, error);
+}
+
+static gboolean
+tar_extract_entry(TarExtractor *self,
+                  TarEntry *entry,
+                  GError **error)
+{
+    g_autoptr(TarEntry) member = entry;
+    guint64 size;
+
+    if (member->type == '5')
+        return tar_extract_directory(self, g_steal_pointer(&member), error);
+
+    if (g_str_equal(member->path, self->dest)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_FILENAME,
+                    "Invalid member name in '%s'", self->filename);
+        return FALSE;
+    }
+
+    if (!tar_ensure_parent(self, member->path, error))
+        return FALSE;
+
+    switch (member->type) {
+    case '0':
+    case '7':
+        if (!tar_wait_path(self, member->path, error))
+            return FALSE;
+        if (!tar_remove_existing(self, member->path, error))
+            return FALSE;
+        if (member->size <= TAR_MAX_JOB_SIZE)
+            return tar_queue_file(self, g_steal_pointer(&member), error);
+        return tar_write_streamed(self, member, error);
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '6':
+        size = member->size;
+        if ((member->type == '2' && !tar_link_is_safe(member->link)) ||
+            (member->type == '1' && g_hash_table_contains(self->delayed, member->link))) {
+            if (!tar_delay_symlink(self, g_steal_pointer(&member), error))
+                return FALSE;
+        } else if (!tar_extract_special(self, member, error)) {
+            return FALSE;
+        }
+        return tar_skip(self, size + tar_padding(size), error);
+    default:
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "Unsupported member type '%c' in '%s'",
+                    member->type, self->filename);
+        return FALSE;
+    }
+}
+
+static gboolean
+tar_extract_members(TarExtractor *self,
+                    GError **error)
+{
+    guchar header[TAR_BLOCK_SIZE];
+    gboolean first = TRUE;
+
+    while (TRUE) {
+        g_autoptr(TarEntry) entry = NULL;
+        g_autofree guchar *data = NULL;
+        guint64 size;
+
+        if (!tar_check_workers(self, error))
+            return FALSE;
+
+        if (!tar_read(self, header, TAR_BLOCK_SIZE, error))
+            return FALSE;
+
+        /* The archive ends with zero blocks */
+        if (tar_is_zero_block(header))
+            return TRUE;
+
+        if (!tar_verify_checksum(header)) {
+            /* Let tar figure out archives in formats not known by suffix */
+            g_set_error(error, G_IO_ERROR,
+                        first ? G_IO_ERROR_NOT_SUPPORTED : G_IO_ERROR_INVALID_DATA,
+                        "Invalid tar header checksum in '%s'", self->filename);
+            return FALSE;
+        }
+        first = FALSE;
+
+        switch (header[156]) {
+        case 'L':
+        case 'K':
+        case 'x':
+            if (!tar_parse_number(header + 124, 12, &size) ||
+                size > TAR_MAX_HEADER_DATA) {
+                g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                            "Invalid extended header size in '%s'",
+                            self->filename);
+                return FALSE;
+            }
+            data = tar_read_data(self, size, error);
+            if (!data)
+                return FALSE;
+
+            if (header[156] == 'x') {
+                if (!tar_parse_pax(self, (const gchar *) data, size, error))
+                    return FALSE;
+            } else if (header[156] == 'L') {
+                g_free(self->next.path);
+                self->next.path = g_strndup((const gchar *) data, size);
+            } else {
+                g_free(self->next.link);
+                self->next.link = g_strndup((const gchar *) data, size);
+            }
+            continue;
+        case 'g':
+        case 'V':
+            /* Global pax headers and volume labels carry nothing to extract */
+            if (!tar_parse_number(header + 124, 12, &size)) {
+                g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                            "Invalid tar header in '%s'", self->filename);
+                return FALSE;
+            }
+            if (!tar_skip(self, size + tar_padding(size), error))
+                return FALSE;
+            continue;
+        default:
+            break;
+        }
+
+        entry = tar_parse_header(self, header, error);
+        if (!entry)
+            return FALSE;
+
+        if (!tar_extract_entry(self, g_steal_pointer(&entry), error))
+            return FALSE;
+    }
+}
+
+static gboolean
+tar_finish(TarExtractor *self,
+           GError **error)
+{
+    if (!tar_wait_idle(self, error))
+        return FALSE;
+
+    if (!tar_create_delayed_links(self, error))
+        return FALSE;
+
+    /* Apply in reverse, so that nested directories come before their parents */
+    for (guint i = self->dir_entries->len; i > 0; i--) {
+        TarEntry *dir = g_ptr_array_index(self->dir_entries, i - 1);
+        gboolean res;
+        gint fd;
+
+        fd = g_open(dir->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC, 0);
+        if (fd < 0) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Failed opening directory '%s': %s",
+                        dir->path, g_strerror(errno));
+            return FALSE;
+        }
+
+        res = tar_set_metadata(self, dir, fd, error);
+        close(fd);
+        if (!res)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+tar_extractor_free(TarExtractor *self)
+{
+    if (self->pool) {
+        /* Let queued jobs drain without writing anything */
+        g_mutex_lock(&self->lock);
+        self->cancelled = TRUE;
+        g_mutex_unlock(&self->lock);
+        g_thread_pool_free(self->pool, FALSE, TRUE);
+    }
+
+    tar_overrides_clear(&self->next);
+    g_clear_pointer(&self->decompressor, pu_decompressor_free);
+    if (self->fd >= 0)
+        close(self->fd);
+    g_hash_table_unref(self->dirs);
+    g_hash_table_unref(self->queued);
+    g_ptr_array_unref(self->dir_entries);
+    g_hash_table_unref(self->delayed);
+    g_ptr_array_unref(self->delayed_links);
+    g_clear_error(&self->worker_error);
+    g_mutex_clear(&self->lock);
+    g_cond_clear(&self->cond);
+    g_free(self->dest);
+}
+
+/*
+ * Extract a tar archive, optionally compressed in one of the formats known to
+ * the decompressor, to the given directory. The archive is streamed and small
+ * files are written by a pool of workers. Ownership is restored by numeric
+ * IDs when running as root, like 'tar --numeric-owner'. Symlinks that could
+ * lead out of the destination are only created after all other members, so
+ * that no member is written through them. Archive features not handled here,
+ * e.g. sparse members, are reported as G_IO_ERROR_NOT_SUPPORTED, possibly after
+ * other members were written already.
+ */
+gboolean
+pu_tar_extract(const gchar *filename,
+               const gchar *dest,
+               GError **error)
+{
+    TarExtractor self = { 0 };
+    g_autoptr(GError) local_error = NULL;
+    gboolean res;
+
+    g_return_val_if_fail(filename != NULL, FALSE);
+    g_return_val_if_fail(dest != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    self.filename = filename;
+    self.dest = g_canonicalize_filename(dest, NULL);
+    self.fd = -1;
+    self.same_owner = geteuid() == 0;
+    self.dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    self.queued = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    self.dir_entries = g_ptr_array_new_with_free_func((GDestroyNotify) tar_entry_free);
+    self.delayed_links = g_ptr_array_new_with_free_func((GDestroyNotify) tar_entry_free);
+    self.delayed = g_hash_table_new(g_str_hash, g_str_equal);
+    g_mutex_init(&self.lock);
+    g_cond_init(&self.cond);
+    tar_overrides_clear(&self.next);
+    g_hash_table_add(self.dirs, g_strdup(self.dest));
+
+    if (pu_compression_from_filename(filename) != PU_COMPRESSION_NONE) {
+        self.decompressor = pu_decompressor_new(filename, &local_error);
+        if (!self.decompressor) {
+            /* Leave formats partup was built without to tar */
+            if (g_error_matches(local_error, PU_ERROR, PU_ERROR_DECOMPRESS))
+                g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                    local_error->message);
+            else
+                g_propagate_error(error, g_steal_pointer(&local_error));
+            tar_extractor_free(&self);
+            return FALSE;
+        }
+    } else {
+        self.fd = g_open(filename, O_RDONLY | O_CLOEXEC, 0);
+        if (self.fd < 0) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Failed opening '%s': %s", filename, g_strerror(errno));
+            tar_extractor_free(&self);
+            return FALSE;
+        }
+    }
+
+    /* Start the workers up front, so that handing them files starts no threads */
+    self.pool = g_thread_pool_new(tar_worker, &self, TAR_WORKERS, TRUE, error);
+    if (!self.pool) {
+        tar_extractor_free(&self);
+        return FALSE;
+    }
+
+    res = tar_extract_members(&self, error) && tar_finish(&self, error);
+
+    tar_extractor_free(&self);
+
+    return res;
+}
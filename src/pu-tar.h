@@ -0,0 +1,15 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#ifndef PARTUP_TAR_H
+#define PARTUP_TAR_H
+
+#include <glib.h>
+
+gboolean pu_tar_extract(const gchar *filename,
+                        const gchar *dest,
+                        GError **error);
+
+#endif /* PARTUP_TAR_H */
@@ -0,0 +1,205 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#define G_LOG_DOMAIN "partup-trace"
+#define _GNU_SOURCE
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "pu-trace.h"
+#include "pu-utils.h"
+
+typedef struct {
+    /* Phase of the Chrome trace event format: B, E, C or M */
+    gchar phase;
+    gchar *name;
+    gchar *detail;
+    gint64 ts;
+    gint tid;
+    gint64 value;
+} PuTraceEvent;
+
+static gint trace_enabled = FALSE;
+static GMutex trace_lock;
+static GArray *trace_events = NULL;
+static gint64 trace_start = 0;
+
+static void
+trace_event_clear(PuTraceEvent *event)
+{
+    g_free(event->name);
+    g_free(event->detail);
+}
+
+static void
+trace_add(gchar phase,
+          const gchar *name,
+          const gchar *detail,
+          gint64 value)
+{
+    PuTraceEvent event;
+
+    event.phase = phase;
+    event.name = g_strdup(name);
+    event.detail = g_strdup(detail);
+    event.ts = g_get_monotonic_time();
+    event.tid = syscall(SYS_gettid);
+    event.value = value;
+
+    g_mutex_lock(&trace_lock);
+    if (trace_events)
+        g_array_append_val(trace_events, event);
+    else
+        trace_event_clear(&event);
+    g_mutex_unlock(&trace_lock);
+}
+
+/*
+ * Start recording a timeline of the installation. Until then, each trace point
+ * costs no more than an atomic read of a flag.
+ */
+void
+pu_trace_enable(void)
+{
+    g_mutex_lock(&trace_lock);
+    if (trace_events == NULL) {
+        trace_events = g_array_new(FALSE, FALSE, sizeof(PuTraceEvent));
+        g_array_set_clear_func(trace_events, (GDestroyNotify) trace_event_clear);
+    }
+    trace_start = g_get_monotonic_time();
+    g_mutex_unlock(&trace_lock);
+
+    g_atomic_int_set(&trace_enabled, TRUE);
+    pu_trace_set_thread_name("partup");
+}
+
+gboolean
+pu_trace_is_enabled(void)
+{
+    return g_atomic_int_get(&trace_enabled);
+}
+
+/* Stop recording and drop all recorded events */
+void
+pu_trace_reset(void)
+{
+    g_atomic_int_set(&trace_enabled, FALSE);
+
+    g_mutex_lock(&trace_lock);
+    g_clear_pointer(&trace_events, g_array_unref);
+    g_mutex_unlock(&trace_lock);
+}
+
+/* Name the calling thread in the timeline */
+void
+pu_trace_set_thread_name(const gchar *name)
+{
+    if (G_LIKELY(!g_atomic_int_get(&trace_enabled)))
+        return;
+
+    trace_add('M', name, NULL, 0);
+}
+
+/*
+ * Begin a span on the calling thread, e.g. while waiting for a buffer or
+ * running an external command. Spans must be ended on the same thread and in
+ * reverse order.
+ */
+void
+pu_trace_begin(const gchar *name,
+               const gchar *detail)
+{
+    if (G_LIKELY(!g_atomic_int_get(&trace_enabled)))
+        return;
+
+    trace_add('B', name, detail, 0);
+}
+
+void
+pu_trace_end(const gchar *name)
+{
+    if (G_LIKELY(!g_atomic_int_get(&trace_enabled)))
+        return;
+
+    trace_add('E', name, NULL, 0);
+}
+
+/* Record the current value of a counter, e.g. the number of filled buffers */
+void
+pu_trace_counter(const gchar *name,
+                 gint64 value)
+{
+    if (G_LIKELY(!g_atomic_int_get(&trace_enabled)))
+        return;
+
+    trace_add('C', name, NULL, value);
+}
+
+/*
+ * Serialize the recorded events in the Chrome trace event format, which can be
+ * loaded by Perfetto or chrome://tracing. Timestamps are in microseconds since
+ * tracing was enabled.
+ */
+gchar *
+pu_trace_to_json(void)
+{
+    g_autoptr(GString) json = g_string_new("{\"traceEvents\": [");
+    gint pid = getpid();
+
+    g_mutex_lock(&trace_lock);
+
+    for (guint i = 0; trace_events && i < trace_events->len; i++) {
+        PuTraceEvent *event = &g_array_index(trace_events, PuTraceEvent, i);
+
+        g_string_append(json, i > 0 ? ",\n  {" : "\n  {");
+
+        if (event->phase == 'M') {
+            g_string_append_printf(json, "\"name\": \"thread_name\", \"ph\": \"M\", "
+                                   "\"pid\": %d, \"tid\": %d, \"args\": {\"name\": ",
+                                   pid, event->tid);
+            pu_json_append_string(json, event->name);
+            g_string_append(json, "}}");
+            continue;
+        }
+
+        g_string_append(json, "\"name\": ");
+        pu_json_append_string(json, event->name);
+        g_string_append_printf(json, ", \"cat\": \"partup\", \"ph\": \"%c\", "
+                               "\"ts\": %" G_GINT64_FORMAT ", \"pid\": %d, "
+                               "\"tid\": %d", event->phase,
+                               event->ts - trace_start, pid, event->tid);
+
+        if (event->phase == 'C') {
+            g_string_append(json, ", \"args\": {");
+            pu_json_append_string(json, event->name);
+            g_string_append_printf(json, ": %" G_GINT64_FORMAT "}", event->value);
+        } else if (event->detail) {
+            g_string_append(json, ", \"args\": {\"detail\": ");
+            pu_json_append_string(json, event->detail);
+            g_string_append_c(json, '}');
+        }
+        g_string_append_c(json, '}');
+    }
+
+    g_mutex_unlock(&trace_lock);
+
+    g_string_append(json, "\n], \"displayTimeUnit\": \"ms\"}\n");
+
+    return g_string_free(g_steal_pointer(&json), FALSE);
+}
+
+gboolean
+pu_trace_write(const gchar *filename,
+               GError **error)
+{
+    g_autofree gchar *json = NULL;
+
+    g_return_val_if_fail(filename != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    json = pu_trace_to_json();
+
+    return g_file_set_contents(filename, json, -1, error);
+}
@@ -0,0 +1,24 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#ifndef PARTUP_TRACE_H
+#define PARTUP_TRACE_H
+
+#include <glib.h>
+
+void pu_trace_enable(void);
+gboolean pu_trace_is_enabled(void);
+void pu_trace_set_thread_name(const gchar *name);
+void pu_trace_begin(const gchar *name,
+                    const gchar *detail);
+void pu_trace_end(const gchar *name);
+void pu_trace_counter(const gchar *name,
+                      gint64 value);
+gchar * pu_trace_to_json(void);
+gboolean pu_trace_write(const gchar *filename,
+                        GError **error);
+void pu_trace_reset(void);
+
+#endif /* PARTUP_TRACE_H */
@@ -4,7 +4,9 @@
  */
 
 #define G_LOG_DOMAIN "partup-utils"
+#define _GNU_SOURCE
 
+#include <errno.h>
 #include <fcntl.h>
 #include <gio/gio.h>
 #include <glib.h>
@@ -14,8 +16,13 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "pu-config.h"
+#include "pu-decompress.h"
 #include "pu-error.h"
+#include "pu-file.h"
 #include "pu-glib-compat.h"
+#include "pu-io.h"
+#include "pu-stats.h"
+#include "pu-tar.h"
 #include "pu-utils.h"
 
 #define UDEVADM_SETTLE_TIMEOUT 10
@@ -28,6 +35,7 @@ pu_spawn_command_line_sync(const gchar *command_line,
     gchar **argv = NULL;
     gint wait_status;
     g_autofree gchar *errmsg = NULL;
+    PuStatsStep *step;
 
     g_return_val_if_fail(command_line != NULL, FALSE);
 
@@ -36,12 +44,15 @@ pu_spawn_command_line_sync(const gchar *command_line,
     if (!g_shell_parse_argv(command_line, NULL, &argv, error))
         return FALSE;
 
+    step = pu_stats_begin("command", command_line);
+
     spawn_flags = G_SPAWN_SEARCH_PATH |
                   G_SPAWN_STDOUT_TO_DEV_NULL;
     if (!g_spawn_sync(NULL, argv, NULL, spawn_flags, NULL, NULL, NULL, &errmsg,
                       &wait_status, error)) {
         g_prefix_error(error, "Failed spawning process: ");
         g_strfreev(argv);
+        pu_stats_end(step, 0, FALSE);
         return FALSE;
     }
 
@@ -49,19 +60,32 @@ pu_spawn_command_line_sync(const gchar *command_line,
         g_prefix_error(error, "Command '%s' failed with error message: '%s': ",
                        command_line, errmsg);
         g_strfreev(argv);
+        pu_stats_end(step, 0, FALSE);
         return FALSE;
     }
 
     g_strfreev(argv);
+    pu_stats_end(step, 0, TRUE);
     return TRUE;
 }
 
+/*
+ * Extract an archive natively and leave archive features not handled by
+ * pu_tar_extract() to tar. These may only show up in the middle of the archive,
+ * e.g. with a sparse member, after other members were already written. As the
+ * native extraction stops without applying the metadata of directories, tar
+ * then extracts the whole archive again over the partial tree. It replaces all
+ * files written so far and sets the metadata of all directories itself.
+ */
 gboolean
 pu_archive_extract(const gchar *filename,
                    const gchar *dest,
                    GError **error)
 {
+    g_autoptr(GError) local_error = NULL;
     g_autofree gchar *cmd = NULL;
+    PuStatsStep *step;
+    gboolean res;
 
     g_return_val_if_fail(filename != NULL, FALSE);
     g_return_val_if_fail(dest != NULL, FALSE);
@@ -69,27 +93,41 @@ pu_archive_extract(const gchar *filename,
 
     g_debug("Extracting '%s' to '%s'", filename, dest);
 
-    cmd = g_strdup_printf("tar -xf %s -C %s", filename, dest);
+    step = pu_stats_begin("tar-extract", filename);
+    res = pu_tar_extract(filename, dest, &local_error);
 
-    if (!pu_spawn_command_line_sync(cmd, error)) {
-        g_prefix_error(error, "Failed extracting '%s' to '%s': ", filename, dest);
+    /* Extract the whole archive again, replacing what was written so far */
+    if (!res && g_error_matches(local_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED)) {
+        g_debug("Falling back to tar for '%s': %s", filename,
+                local_error->message);
+        g_clear_error(&local_error);
+        cmd = g_strdup_printf("tar -xf %s -C %s", filename, dest);
+        res = pu_spawn_command_line_sync(cmd, &local_error);
+    }
+    pu_stats_end(step, step ? pu_file_get_size(filename, NULL) : 0, res);
+
+    if (!res) {
+        g_propagate_prefixed_error(error, g_steal_pointer(&local_error),
+                                   "Failed extracting '%s' to '%s': ",
+                                   filename, dest);
         return FALSE;
     }
 
     return TRUE;
 }
 
-gboolean
-pu_make_filesystem(const gchar *part,
-                   const gchar *fstype,
-                   const gchar *label,
-                   const gchar *extra_args,
-                   GError **error)
+static gboolean
+utils_make_filesystem(const gchar *part,
+                      const gchar *fstype,
+                      const gchar *label,
+                      const gchar *extra_args,
+                      PuMkfsFlags flags,
+                      const gchar *source,
+                      GError **error)
 {
     g_autoptr(GString) cmd = NULL;
-
-    g_return_val_if_fail(part != NULL, FALSE);
-    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+    PuStatsStep *step;
+    gboolean res;
 
     cmd = g_string_new(NULL);
 
@@ -120,13 +158,27 @@ pu_make_filesystem(const gchar *part,
         }
     }
 
+    /* mkfs.fat does not discard, extra arguments may override this for ext */
+    if ((flags & PU_MKFS_FLAGS_NO_DISCARD) &&
+        g_regex_match_simple("^ext[234]$", fstype, 0, 0)) {
+        g_string_append(cmd, "-E nodiscard ");
+    }
+
+    if (source) {
+        g_string_append_printf(cmd, "-d %s ", source);
+    }
+
     if (g_strcmp0(extra_args, "") > 0) {
         g_string_append_printf(cmd, "%s ", extra_args);
     }
 
     g_string_append(cmd, part);
 
-    if (!pu_spawn_command_line_sync(cmd->str, error)) {
+    step = pu_stats_begin("mkfs", part);
+    res = pu_spawn_command_line_sync(cmd->str, error);
+    pu_stats_end(step, source && step ? pu_file_get_size(source, NULL) : 0, res);
+
+    if (!res) {
         g_prefix_error(error, "Failed creating filesystem '%s' on '%s': ", fstype, part);
         return FALSE;
     }
@@ -134,6 +186,96 @@ pu_make_filesystem(const gchar *part,
     return TRUE;
 }
 
+gboolean
+pu_make_filesystem(const gchar *part,
+                   const gchar *fstype,
+                   const gchar *label,
+                   const gchar *extra_args,
+                   PuMkfsFlags flags,
+                   GError **error)
+{
+    g_return_val_if_fail(part != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    return utils_make_filesystem(part, fstype, label, extra_args, flags, NULL,
+                                 error);
+}
+
+/*
+ * Check whether mke2fs populates filesystems from tar archives, which it does
+ * since e2fsprogs 1.47.1 if built with libarchive. Only the version is checked,
+ * callers need to handle a missing libarchive by falling back.
+ */
+gboolean
+pu_mkfs_ext_supports_tar(void)
+{
+    static gint supported = -1;
+    g_autofree gchar *output = NULL;
+    g_autoptr(GRegex) regex = NULL;
+    g_autoptr(GMatchInfo) match = NULL;
+    gint wait_status;
+    guint64 version[3];
+
+    if (supported >= 0)
+        return supported;
+
+    supported = FALSE;
+
+    /* mke2fs prints its version to stderr */
+    if (!g_spawn_command_line_sync("mke2fs -V", NULL, &output, &wait_status, NULL))
+        return FALSE;
+
+    regex = g_regex_new("^mke2fs (\\d+)\\.(\\d+)\\.?(\\d*)", G_REGEX_MULTILINE, 0,
+                        NULL);
+    if (!g_regex_match(regex, output, 0, &match))
+        return FALSE;
+
+    for (guint i = 0; i < G_N_ELEMENTS(version); i++) {
+        g_autofree gchar *number = g_match_info_fetch(match, i + 1);
+
+        version[i] = g_ascii_strtoull(number, NULL, 10);
+    }
+
+    supported = version[0] > 1 ||
+                (version[0] == 1 && (version[1] > 47 ||
+                                     (version[1] == 47 && version[2] >= 1)));
+    g_debug("mke2fs %" G_GUINT64_FORMAT ".%" G_GUINT64_FORMAT ".%" G_GUINT64_FORMAT
+            " %s populating filesystems from tar archives", version[0], version[1],
+            version[2], supported ? "supports" : "does not support");
+
+    return supported;
+}
+
+/*
+ * Create an ext filesystem already holding the content of source, either a
+ * directory or, see pu_mkfs_ext_supports_tar(), a tar archive. mke2fs writes
+ * the filesystem with its content in place, so it does not need to be mounted.
+ */
+gboolean
+pu_make_filesystem_populated(const gchar *part,
+                             const gchar *fstype,
+                             const gchar *label,
+                             const gchar *extra_args,
+                             PuMkfsFlags flags,
+                             const gchar *source,
+                             GError **error)
+{
+    g_return_val_if_fail(part != NULL, FALSE);
+    g_return_val_if_fail(source != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    if (!g_regex_match_simple("^ext[234]$", fstype, 0, 0)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "Populating filesystem '%s' is not supported", fstype);
+        return FALSE;
+    }
+
+    g_debug("Creating filesystem '%s' on '%s' from '%s'", fstype, part, source);
+
+    return utils_make_filesystem(part, fstype, label, extra_args, flags, source,
+                                 error);
+}
+
 gboolean
 pu_set_ext_label(const gchar *part,
                  const gchar *label,
@@ -162,6 +304,8 @@ pu_resize_filesystem(const gchar *part,
                      GError **error)
 {
     g_autofree gchar *cmd = NULL;
+    PuStatsStep *step;
+    gboolean res;
 
     g_return_val_if_fail(part != NULL, FALSE);
     g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
@@ -170,7 +314,11 @@ pu_resize_filesystem(const gchar *part,
 
     cmd = g_strdup_printf("resize2fs %s", part);
 
-    if (!pu_spawn_command_line_sync(cmd, error)) {
+    step = pu_stats_begin("resize2fs", part);
+    res = pu_spawn_command_line_sync(cmd, error);
+    pu_stats_end(step, 0, res);
+
+    if (!res) {
         g_prefix_error(error, "Failed resizing filesystem on '%s': ", part);
         return FALSE;
     }
@@ -178,49 +326,80 @@ pu_resize_filesystem(const gchar *part,
     return TRUE;
 }
 
+static gboolean
+pu_write_raw_zeroes(const PuIoOutput *outputs,
+                    guint n_outputs,
+                    goffset offset,
+                    goffset length,
+                    GError **error)
+{
+    for (guint i = 0; i < n_outputs; i++) {
+        if (!pu_io_write_zeroes(outputs[i].fd, outputs[i].path, offset, length,
+                                error))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Write the given extents of the input to the outputs. The extents are given in
+ * bytes relative to the start of the input and are clipped to the range
+ * starting at input_offset. If no extents are given, the data extents of the
+ * input are used instead. The optional digests are computed while writing, see
+ * pu_io_copy_extents().
+ *
+ * Inputs compressed with gzip, xz or zstd are decompressed while writing and
+ * offsets, sizes and extents refer to the decompressed data. Without extents,
+ * all of their data is written.
+ *
+ * The outputs are already opened, e.g. to write several inputs and clean
+ * regions through a single handle of the device. Given multiple outputs, the
+ * input is read once and written to all of them at the same offset.
+ */
 gboolean
-pu_write_raw(const gchar *input_path,
-             const gchar *output_path,
-             PedDevice *device,
-             PedSector input_offset,
-             PedSector output_offset,
-             PedSector size,
-             GError **error)
+pu_write_raw_extents_multi(const gchar *input_path,
+                           const PuIoOutput *outputs,
+                           guint n_outputs,
+                           PedDevice *device,
+                           PedSector input_offset,
+                           PedSector output_offset,
+                           PedSector size,
+                           GArray *extents,
+                           GArray *digests,
+                           PuWriteFlags flags,
+                           GError **error)
 {
-    g_autoptr(GFile) input_file = NULL;
-    g_autoptr(GFile) output_file = NULL;
-    g_autoptr(GFileInputStream) input_fistream = NULL;
-    g_autoptr(GFileIOStream) output_fiostream = NULL;
-    GOutputStream *output_ostream;
-    g_autoptr(GFileInfo) input_finfo = NULL;
-    g_autoptr(GFileInfo) output_finfo = NULL;
+    g_autoptr(GArray) data_extents = NULL;
+    g_autoptr(GArray) clipped = NULL;
     goffset input_size;
-    gsize buffer_size;
-    gsize num_read;
-    gsize input_remaining;
-    gssize ret;
-    g_autofree guchar *buffer = NULL;
+    goffset input_pos;
+    goffset shift;
+    g_autoptr(PuDecompressor) decompressor = NULL;
+    gboolean compressed;
+    gint input_fd = -1;
+    gboolean res = FALSE;
 
     g_return_val_if_fail(input_path != NULL, FALSE);
-    g_return_val_if_fail(output_path != NULL, FALSE);
+    g_return_val_if_fail(outputs != NULL && n_outputs > 0, FALSE);
     g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-    g_debug("Writing '%s' to '%s'", input_path, output_path);
+    for (guint i = 0; i < n_outputs; i++)
+        g_debug("Writing '%s' to '%s'", input_path, outputs[i].path);
 
     /* glib uses bytes not sectors */
     input_offset *= device->sector_size;
     output_offset *= device->sector_size;
+    compressed = pu_compression_from_filename(input_path) != PU_COMPRESSION_NONE;
 
-    input_file = g_file_new_for_path(input_path);
-    input_finfo = g_file_query_info(input_file, G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                                    G_FILE_QUERY_INFO_NONE, NULL, error);
-    if (input_finfo == NULL)
-        return FALSE;
-
-    if (size > 0)
+    if (size > 0) {
         input_size = size * device->sector_size;
-    else
-        input_size = g_file_info_get_size(input_finfo);
+    } else if (compressed && !(extents && (flags & PU_WRITE_FLAGS_ZERO_HOLES))) {
+        /* Written up to its end, the size is only needed for zeroing the tail */
+        input_size = G_MAXINT64;
+    } else if (!pu_decompress_get_size(input_path, &input_size, error)) {
+        return FALSE;
+    }
 
     if (input_offset >= input_size) {
         g_set_error(error, PU_ERROR, PU_ERROR_FAILED,
@@ -228,48 +407,149 @@ pu_write_raw(const gchar *input_path,
         return FALSE;
     }
 
-    output_file = g_file_new_for_path(output_path);
+    /* Only the data extents of sparse inputs need to be copied */
+    if (extents == NULL && compressed) {
+        PuFileExtent all = { input_offset, input_size - input_offset };
+
+        data_extents = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+        g_array_append_val(data_extents, all);
+        extents = data_extents;
+    } else if (extents == NULL) {
+        data_extents = pu_file_get_data_extents(input_path, input_offset,
+                                                input_size - input_offset, error);
+        if (data_extents == NULL)
+            return FALSE;
+        extents = data_extents;
+    }
 
-    /* Open input and output stream */
-    input_fistream = g_file_read(input_file, NULL, error);
-    if (input_fistream == NULL)
-        return FALSE;
+    if (compressed) {
+        decompressor = pu_decompressor_new(input_path, error);
+        if (decompressor == NULL)
+            return FALSE;
+    } else {
+        input_fd = g_open(input_path, O_RDONLY | O_CLOEXEC, 0);
+        if (input_fd < 0) {
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Failed opening '%s': %s", input_path, g_strerror(errno));
+            return FALSE;
+        }
+    }
 
-    output_fiostream = g_file_open_readwrite(output_file, NULL, error);
-    if (output_fiostream == NULL)
-        return FALSE;
-    output_ostream = g_io_stream_get_output_stream(G_IO_STREAM(output_fiostream));
+    /* Clip the extents to the input range and zero the holes in between */
+    shift = output_offset - input_offset;
+    clipped = g_array_sized_new(FALSE, FALSE, sizeof(PuFileExtent), extents->len);
+    input_pos = input_offset;
 
-    if (g_input_stream_skip(G_INPUT_STREAM(input_fistream), input_offset, NULL,
-                            error) < 0)
-        return FALSE;
+    for (guint i = 0; i < extents->len; i++) {
+        PuFileExtent *extent = &g_array_index(extents, PuFileExtent, i);
+        PuFileExtent clip;
 
-    if (!g_seekable_seek(G_SEEKABLE(output_fiostream), output_offset,
-                         G_SEEK_SET, NULL, error))
-        return FALSE;
+        clip.offset = MAX(extent->offset, input_pos);
+        clip.length = MIN(extent->offset + extent->length, input_size) - clip.offset;
+        if (clip.length <= 0)
+            continue;
 
-    /* Begin reading and writing */
-    input_remaining = input_size - input_offset;
-    buffer_size = input_remaining < PED_MEBIBYTE_SIZE ? input_remaining : PED_MEBIBYTE_SIZE;
-    buffer = g_new0(guchar, buffer_size);
+        if ((flags & PU_WRITE_FLAGS_ZERO_HOLES) &&
+            !pu_write_raw_zeroes(outputs, n_outputs, input_pos + shift,
+                                 clip.offset - input_pos, error))
+            goto out;
 
-    while (input_remaining > 0) {
-        if (input_remaining < buffer_size)
-            buffer_size = input_remaining;
+        g_array_append_val(clipped, clip);
+        input_pos = clip.offset + clip.length;
+    }
 
-        ret = g_input_stream_read(G_INPUT_STREAM(input_fistream), buffer,
-                                  buffer_size, NULL, error);
-        if (ret < 0)
-            return FALSE;
-        num_read = ret;
+    if ((flags & PU_WRITE_FLAGS_ZERO_HOLES) &&
+        !pu_write_raw_zeroes(outputs, n_outputs, input_pos + shift,
+                             input_size - input_pos, error))
+        goto out;
+
+    if (compressed) {
+        if (!pu_io_copy_stream_multi(decompressor, input_path, outputs, n_outputs,
+                                     clipped, shift, digests, error))
+            goto out;
+    } else if (!pu_io_copy_extents_multi(input_fd, input_path, outputs, n_outputs,
+                                         clipped, shift, digests, error)) {
+        goto out;
+    }
 
-        if (g_output_stream_write(output_ostream, buffer, num_read, NULL, error) < 0)
-            return FALSE;
+    g_debug("Wrote %u extents of '%s'", clipped->len, input_path);
+    res = TRUE;
+
+out:
+    if (input_fd >= 0)
+        g_close(input_fd, NULL);
+
+    return res;
+}
+
+gboolean
+pu_write_raw_extents_fd(const gchar *input_path,
+                        gint output_fd,
+                        const gchar *output_path,
+                        PedDevice *device,
+                        PedSector input_offset,
+                        PedSector output_offset,
+                        PedSector size,
+                        GArray *extents,
+                        GArray *digests,
+                        PuWriteFlags flags,
+                        GError **error)
+{
+    PuIoOutput output = { output_fd, output_path };
+
+    g_return_val_if_fail(output_fd >= 0, FALSE);
+    g_return_val_if_fail(output_path != NULL, FALSE);
+
+    return pu_write_raw_extents_multi(input_path, &output, 1, device,
+                                      input_offset, output_offset, size,
+                                      extents, digests, flags, error);
+}
+
+gboolean
+pu_write_raw_extents(const gchar *input_path,
+                     const gchar *output_path,
+                     PedDevice *device,
+                     PedSector input_offset,
+                     PedSector output_offset,
+                     PedSector size,
+                     GArray *extents,
+                     GArray *digests,
+                     PuWriteFlags flags,
+                     GError **error)
+{
+    gint output_fd;
+    gboolean res;
+
+    g_return_val_if_fail(output_path != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-        input_remaining -= num_read;
+    output_fd = g_open(output_path, O_WRONLY | O_CLOEXEC, 0);
+    if (output_fd < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Failed opening '%s': %s", output_path, g_strerror(errno));
+        return FALSE;
     }
 
-    return TRUE;
+    res = pu_write_raw_extents_fd(input_path, output_fd, output_path, device,
+                                  input_offset, output_offset, size, extents,
+                                  digests, flags, error);
+    g_close(output_fd, NULL);
+
+    return res;
+}
+
+gboolean
+pu_write_raw(const gchar *input_path,
+             const gchar *output_path,
+             PedDevice *device,
+             PedSector input_offset,
+             PedSector output_offset,
+             PedSector size,
+             PuWriteFlags flags,
+             GError **error)
+{
+    return pu_write_raw_extents(input_path, output_path, device, input_offset,
+                                output_offset, size, NULL, NULL, flags, error);
 }
 
 gboolean
@@ -326,6 +606,9 @@ pu_write_raw_bootpart(const gchar *input,
                       guint bootpart,
                       PedSector input_offset,
                       PedSector output_offset,
+                      GArray *extents,
+                      GArray *digests,
+                      PuWriteFlags flags,
                       GError **error)
 {
     gboolean res;
@@ -341,8 +624,9 @@ pu_write_raw_bootpart(const gchar *input,
     if (!pu_bootpart_force_ro(bootpart_device, 0, error))
         return FALSE;
 
-    res = pu_write_raw(input, bootpart_device, device,
-                       input_offset, output_offset, 0, error);
+    res = pu_write_raw_extents(input, bootpart_device, device, input_offset,
+                               output_offset, 0, extents, digests, flags,
+                               error);
 
     if (!pu_bootpart_force_ro(bootpart_device, 1, error))
         return FALSE;
@@ -367,29 +651,33 @@ pu_bootpart_enable(const gchar *device,
     return pu_spawn_command_line_sync(cmd, error);
 }
 
-gboolean
-pu_partition_set_partuuid(const gchar *device,
-                          guint index,
-                          const gchar *partuuid,
-                          GError **error)
+/* Read the PARTUUID of a partition from the partition table, NULL if unset */
+gchar *
+pu_partition_get_partuuid(const gchar *device,
+                          guint index)
 {
-    g_autofree gchar *cmd = NULL;
+    blkid_probe pr;
+    blkid_partlist list;
+    blkid_partition part;
+    gchar *partuuid = NULL;
 
-    g_return_val_if_fail(g_strcmp0(device, "") > 0, FALSE);
-    g_return_val_if_fail(index > 0, FALSE);
-    g_return_val_if_fail(g_strcmp0(partuuid, "") > 0, FALSE);
-    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+    g_return_val_if_fail(g_strcmp0(device, "") > 0, NULL);
+    g_return_val_if_fail(index > 0, NULL);
 
-    cmd = g_strdup_printf("sfdisk --part-uuid %s %d %s",
-                          device, index, partuuid);
+    pr = blkid_new_probe_from_filename(device);
+    if (pr == NULL)
+        return NULL;
 
-    if (!pu_spawn_command_line_sync(cmd, error)) {
-        g_prefix_error(error, "Failed setting PARTUUID on %s partition %d: ",
-                       device, index);
-        return FALSE;
+    list = blkid_probe_get_partitions(pr);
+    if (list) {
+        part = blkid_partlist_get_partition_by_partno(list, index);
+        if (part && blkid_partition_get_uuid(part))
+            partuuid = g_strdup(blkid_partition_get_uuid(part));
     }
 
-    return TRUE;
+    blkid_free_probe(pr);
+
+    return partuuid;
 }
 
 gboolean
@@ -439,12 +727,16 @@ gboolean
 pu_wait_for_partitions(GError **error)
 {
     g_autofree gchar *udevadm_cmd = NULL;
+    PuStatsStep *step;
+    gboolean res;
+
     udevadm_cmd = g_strdup_printf("udevadm settle --timeout %d", UDEVADM_SETTLE_TIMEOUT);
 
-    if (!pu_spawn_command_line_sync(udevadm_cmd, error))
-        return FALSE;
+    step = pu_stats_begin("udev-settle", NULL);
+    res = pu_spawn_command_line_sync(udevadm_cmd, error);
+    pu_stats_end(step, 0, res);
 
-    return TRUE;
+    return res;
 }
 
 gboolean
@@ -584,3 +876,41 @@ pu_str_pre_remove(gchar *string,
 
     return string;
 }
+
+/* Append a string as quoted and escaped JSON string, or null if it is NULL */
+void
+pu_json_append_string(GString *json,
+                      const gchar *str)
+{
+    g_return_if_fail(json != NULL);
+
+    if (str == NULL) {
+        g_string_append(json, "null");
+        return;
+    }
+
+    g_string_append_c(json, '"');
+    for (const gchar *c = str; *c != '\0'; c++) {
+        switch (*c) {
+        case '"':
+            g_string_append(json, "\\\"");
+            break;
+        case '\\':
+            g_string_append(json, "\\\\");
+            break;
+        case '\n':
+            g_string_append(json, "\\n");
+            break;
+        case '\t':
+            g_string_append(json, "\\t");
+            break;
+        default:
+            if ((guchar) *c < 0x20)
+                g_string_append_printf(json, "\\u%04x", (guchar) *c);
+            else
+                g_string_append_c(json, *c);
+            break;
+        }
+    }
+    g_string_append_c(json, '"');
+}
@@ -8,6 +8,19 @@
 
 #include <glib.h>
 #include <parted/parted.h>
+#include "pu-io.h"
+
+typedef enum {
+    PU_WRITE_FLAGS_NONE = 0,
+    /* Explicitly zero the output where the input contains holes */
+    PU_WRITE_FLAGS_ZERO_HOLES = 1 << 0
+} PuWriteFlags;
+
+typedef enum {
+    PU_MKFS_FLAGS_NONE = 0,
+    /* The partition was discarded already, skip discarding it again */
+    PU_MKFS_FLAGS_NO_DISCARD = 1 << 0
+} PuMkfsFlags;
 
 gboolean pu_spawn_command_line_sync(const gchar *command_line,
                                     GError **error);
@@ -18,7 +31,16 @@ gboolean pu_make_filesystem(const gchar *part,
                             const gchar *type,
                             const gchar *label,
                             const gchar *extra_args,
+                            PuMkfsFlags flags,
                             GError **error);
+gboolean pu_mkfs_ext_supports_tar(void);
+gboolean pu_make_filesystem_populated(const gchar *part,
+                                      const gchar *fstype,
+                                      const gchar *label,
+                                      const gchar *extra_args,
+                                      PuMkfsFlags flags,
+                                      const gchar *source,
+                                      GError **error);
 gboolean pu_set_ext_label(const gchar *part,
                           const gchar *label,
                           GError **error);
@@ -30,22 +52,56 @@ gboolean pu_write_raw(const gchar *input_path,
                       PedSector input_offset,
                       PedSector output_offset,
                       PedSector size,
+                      PuWriteFlags flags,
                       GError **error);
+gboolean pu_write_raw_extents_multi(const gchar *input_path,
+                                    const PuIoOutput *outputs,
+                                    guint n_outputs,
+                                    PedDevice *device,
+                                    PedSector input_offset,
+                                    PedSector output_offset,
+                                    PedSector size,
+                                    GArray *extents,
+                                    GArray *digests,
+                                    PuWriteFlags flags,
+                                    GError **error);
+gboolean pu_write_raw_extents_fd(const gchar *input_path,
+                                 gint output_fd,
+                                 const gchar *output_path,
+                                 PedDevice *device,
+                                 PedSector input_offset,
+                                 PedSector output_offset,
+                                 PedSector size,
+                                 GArray *extents,
+                                 GArray *digests,
+                                 PuWriteFlags flags,
+                                 GError **error);
+gboolean pu_write_raw_extents(const gchar *input_path,
+                              const gchar *output_path,
+                              PedDevice *device,
+                              PedSector input_offset,
+                              PedSector output_offset,
+                              PedSector size,
+                              GArray *extents,
+                              GArray *digests,
+                              PuWriteFlags flags,
+                              GError **error);
 gboolean pu_has_bootpart(const gchar *device);
 gboolean pu_write_raw_bootpart(const gchar *input,
                                PedDevice *device,
                                guint bootpart,
                                PedSector input_offset,
                                PedSector output_offset,
+                               GArray *extents,
+                               GArray *digests,
+                               PuWriteFlags flags,
                                GError **error);
 gboolean pu_bootpart_enable(const gchar *device,
                             guint bootpart,
                             gboolean boot_ack,
                             GError **error);
-gboolean pu_partition_set_partuuid(const gchar *device,
-                                   guint index,
-                                   const gchar *partuuid,
-                                   GError **error);
+gchar * pu_partition_get_partuuid(const gchar *device,
+                                  guint index);
 gboolean pu_is_drive(const gchar *device);
 gboolean pu_is_ext234_image(const gchar *path);
 gboolean pu_wait_for_partitions(GError **error);
@@ -65,5 +121,7 @@ gchar * pu_device_get_partition_pattern(const gchar *device,
                                         GError **error);
 gchar * pu_str_pre_remove(gchar *string,
                           guint n);
+void pu_json_append_string(GString *json,
+                           const gchar *str);
 
 #endif /* PARTUP_UTILS_H */
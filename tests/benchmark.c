@@ -0,0 +1,375 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <unistd.h>
+#include "helper.h"
+#include "pu-checksum.h"
+#include "pu-config.h"
+#include "pu-file.h"
+#include "pu-io.h"
+#include "pu-utils.h"
+
+#define BENCH_DATA_SIZE (64 * PED_MEBIBYTE_SIZE)
+#define BENCH_MIN_TIME  G_USEC_PER_SEC
+#define BENCH_MIN_RUNS  3
+
+typedef void (*BenchFunc)(gconstpointer params,
+                          const gchar *path);
+
+typedef struct {
+    const gchar *name;
+    gsize max_in_flight;
+    PedSector input_offset;
+    PedSector output_offset;
+} BenchWriteRaw;
+
+typedef struct {
+    const gchar *name;
+    GChecksumType type;
+} BenchChecksumType;
+
+typedef struct {
+    GChecksumType type;
+    gchar *checksum;
+} BenchChecksum;
+
+typedef struct {
+    const gchar *name;
+    guint partitions;
+} BenchConfig;
+
+static const BenchWriteRaw bench_write_raw_params[] = {
+    { "64k-in-flight", 64 * 1024, 0, 0 },
+    { "1m-in-flight", PU_IO_BUFFER_SIZE, 0, 0 },
+    { "8m-in-flight", 8 * PU_IO_BUFFER_SIZE, 0, 0 },
+    { "32m-in-flight", 32 * PU_IO_BUFFER_SIZE, 0, 0 },
+    { "input-offset", PU_IO_DEFAULT_MAX_IN_FLIGHT, 1, 0 },
+    { "output-offset", PU_IO_DEFAULT_MAX_IN_FLIGHT, 0, 7 }
+};
+
+static const BenchChecksumType bench_checksum_params[] = {
+    { "md5", G_CHECKSUM_MD5 },
+    { "sha1", G_CHECKSUM_SHA1 },
+    { "sha256", G_CHECKSUM_SHA256 },
+    { "sha384", G_CHECKSUM_SHA384 },
+    { "sha512", G_CHECKSUM_SHA512 }
+};
+
+static const BenchConfig bench_config_params[] = {
+    { "16-partitions", 16 },
+    { "256-partitions", 256 },
+    { "4096-partitions", 4096 }
+};
+
+static gchar *bench_dir = NULL;
+static gchar *bench_input = NULL;
+
+/*
+ * Print one line per benchmark in a fixed format, so results of different
+ * builds can be compared with standard text tools:
+ *   BENCH <path> <runs> runs <MB/s> MB/s <ns/op> ns/op
+ * Throughput is given in units of 10^6 bytes per second.
+ */
+static void
+bench_report(gsize bytes,
+             guint runs,
+             gint64 elapsed)
+{
+    gdouble ns_per_op = elapsed * 1000.0 / runs;
+    gdouble mb_per_sec = (gdouble) bytes * runs * G_USEC_PER_SEC / elapsed / 1e6;
+
+    if (bytes > 0)
+        g_print("BENCH %-52s %6u runs %10.2f MB/s %14.0f ns/op\n",
+                g_test_get_path(), runs, mb_per_sec, ns_per_op);
+    else
+        g_print("BENCH %-52s %6u runs %10s MB/s %14.0f ns/op\n",
+                g_test_get_path(), runs, "-", ns_per_op);
+}
+
+/* Repeat a benchmark after one warm-up run for at least BENCH_MIN_TIME */
+static void
+bench_run(BenchFunc func,
+          gconstpointer params,
+          const gchar *path,
+          gsize bytes)
+{
+    gint64 start;
+    gint64 elapsed;
+    guint runs = 0;
+
+    func(params, path);
+
+    start = g_get_monotonic_time();
+    do {
+        func(params, path);
+        runs++;
+        elapsed = g_get_monotonic_time() - start;
+    } while (elapsed < BENCH_MIN_TIME || runs < BENCH_MIN_RUNS);
+
+    bench_report(bytes, runs, elapsed);
+}
+
+static void
+bench_write_raw_func(gconstpointer params,
+                     const gchar *path)
+{
+    g_autoptr(GError) error = NULL;
+    const BenchWriteRaw *write_raw = params;
+    PedDevice device;
+
+    device.sector_size = 512;
+
+    g_assert_true(pu_write_raw(bench_input, path, &device,
+                               write_raw->input_offset, write_raw->output_offset,
+                               0, PU_WRITE_FLAGS_NONE, &error));
+    g_assert_no_error(error);
+}
+
+static void
+bench_write_raw(const BenchWriteRaw *write_raw,
+                const gchar *output)
+{
+    pu_io_set_max_in_flight(write_raw->max_in_flight);
+    bench_run(bench_write_raw_func, write_raw, output,
+              BENCH_DATA_SIZE - write_raw->input_offset * 512);
+    pu_io_set_max_in_flight(PU_IO_DEFAULT_MAX_IN_FLIGHT);
+}
+
+static void
+bench_output_set_up(EmptyFileFixture *fixture,
+                    G_GNUC_UNUSED gconstpointer user_data)
+{
+    empty_file_set_up(fixture, "output.bin");
+}
+
+static void
+bench_write_raw_file(EmptyFileFixture *fixture,
+                     gconstpointer user_data)
+{
+    g_autofree gchar *output = g_file_get_path(fixture->file);
+
+    bench_write_raw(user_data, output);
+}
+
+static void
+bench_write_raw_loop(EmptyDeviceFixture *fixture,
+                     gconstpointer user_data)
+{
+    bench_write_raw(user_data, fixture->loop_dev);
+}
+
+static void
+bench_checksum_verify_file_func(gconstpointer params,
+                                const gchar *path)
+{
+    g_autoptr(GError) error = NULL;
+    const BenchChecksum *checksum = params;
+
+    g_assert_true(pu_checksum_verify_file(path, checksum->checksum,
+                                          checksum->type, &error));
+    g_assert_no_error(error);
+}
+
+static void
+bench_checksum_verify_raw_func(gconstpointer params,
+                               const gchar *path)
+{
+    g_autoptr(GError) error = NULL;
+    const BenchChecksum *checksum = params;
+
+    g_assert_true(pu_checksum_verify_raw(path, 0, BENCH_DATA_SIZE,
+                                         checksum->checksum, checksum->type,
+                                         &error));
+    g_assert_no_error(error);
+}
+
+static void
+bench_checksum(gconstpointer user_data,
+               BenchFunc func)
+{
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *expected = NULL;
+    const BenchChecksumType *params = user_data;
+    BenchChecksum checksum;
+
+    expected = pu_checksum_new_from_file(bench_input, 0, params->type, &error);
+    g_assert_no_error(error);
+
+    checksum.type = params->type;
+    checksum.checksum = expected;
+    bench_run(func, &checksum, bench_input, BENCH_DATA_SIZE);
+}
+
+static void
+bench_checksum_verify_file(gconstpointer user_data)
+{
+    bench_checksum(user_data, bench_checksum_verify_file_func);
+}
+
+static void
+bench_checksum_verify_raw(gconstpointer user_data)
+{
+    bench_checksum(user_data, bench_checksum_verify_raw_func);
+}
+
+static void
+bench_file_read_raw_func(G_GNUC_UNUSED gconstpointer params,
+                         const gchar *path)
+{
+    g_autoptr(GError) error = NULL;
+    g_autofree guchar *buffer = NULL;
+    gsize bytes_read;
+
+    g_assert_true(pu_file_read_raw(path, &buffer, 0, -1, &bytes_read, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(bytes_read, ==, BENCH_DATA_SIZE);
+}
+
+static void
+bench_file_read_raw(void)
+{
+    bench_run(bench_file_read_raw_func, NULL, bench_input, BENCH_DATA_SIZE);
+}
+
+static gchar *
+bench_config_create(guint partitions,
+                    gsize *size)
+{
+    g_autoptr(GString) layout = g_string_new("api-version: 1\n"
+                                             "disklabel: gpt\n"
+                                             "partitions:\n");
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *filename = NULL;
+
+    for (guint i = 0; i < partitions; i++) {
+        g_string_append_printf(layout,
+                               "  - label: part%u\n"
+                               "    filesystem: ext4\n"
+                               "    size: 16MiB\n"
+                               "    input:\n"
+                               "      - filename: rootfs%u.tar.gz\n"
+                               "        sha256sum: %064x\n",
+                               i, i, i);
+    }
+
+    filename = g_strdup_printf("%s/layout-%u.yaml", bench_dir, partitions);
+    g_assert_true(g_file_set_contents(filename, layout->str, layout->len, &error));
+    g_assert_no_error(error);
+    *size = layout->len;
+
+    return g_steal_pointer(&filename);
+}
+
+static void
+bench_config_new_from_file_func(G_GNUC_UNUSED gconstpointer params,
+                                const gchar *path)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(PuConfig) config = NULL;
+
+    config = pu_config_new_from_file(path, &error);
+    g_assert_no_error(error);
+    g_assert_nonnull(config);
+}
+
+static void
+bench_config_new_from_file(gconstpointer user_data)
+{
+    const BenchConfig *params = user_data;
+    g_autofree gchar *filename = NULL;
+    gsize size;
+
+    filename = bench_config_create(params->partitions, &size);
+    bench_run(bench_config_new_from_file_func, NULL, filename, size);
+    g_assert_cmpint(g_remove(filename), ==, 0);
+}
+
+static void
+bench_create_input(void)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GRand) rand = g_rand_new_with_seed(0x70617274);
+    g_autofree guint32 *data = g_new(guint32, BENCH_DATA_SIZE / sizeof(guint32));
+
+    /* Random data defeats any shortcuts for zeroes in the I/O paths */
+    for (gsize i = 0; i < BENCH_DATA_SIZE / sizeof(guint32); i++)
+        data[i] = g_rand_int(rand);
+
+    bench_dir = g_dir_make_tmp("partup-bench-XXXXXX", &error);
+    g_assert_no_error(error);
+    bench_input = g_build_filename(bench_dir, "input.bin", NULL);
+    g_assert_true(g_file_set_contents(bench_input, (gchar *) data,
+                                      BENCH_DATA_SIZE, &error));
+    g_assert_no_error(error);
+}
+
+static void
+bench_remove_input(void)
+{
+    g_assert_cmpint(g_remove(bench_input), ==, 0);
+    g_assert_cmpint(g_rmdir(bench_dir), ==, 0);
+    g_clear_pointer(&bench_input, g_free);
+    g_clear_pointer(&bench_dir, g_free);
+}
+
+int
+main(int argc,
+     char *argv[])
+{
+    gint ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+#ifdef PARTUP_TEST_SRCDIR
+    g_chdir(PARTUP_TEST_SRCDIR);
+#endif
+
+    for (guint i = 0; i < G_N_ELEMENTS(bench_write_raw_params); i++) {
+        const BenchWriteRaw *params = &bench_write_raw_params[i];
+        g_autofree gchar *file = NULL;
+        g_autofree gchar *loop = NULL;
+
+        file = g_strdup_printf("/benchmark/write-raw/file/%s", params->name);
+        g_test_add(file, EmptyFileFixture, params, bench_output_set_up,
+                   bench_write_raw_file, empty_file_tear_down);
+
+        /* Loop devices are only available to root */
+        if (geteuid() == 0) {
+            loop = g_strdup_printf("/benchmark/write-raw/loop/%s", params->name);
+            g_test_add(loop, EmptyDeviceFixture, params, empty_device_set_up,
+                       bench_write_raw_loop, empty_device_tear_down);
+        }
+    }
+
+    for (guint i = 0; i < G_N_ELEMENTS(bench_checksum_params); i++) {
+        const BenchChecksumType *params = &bench_checksum_params[i];
+        g_autofree gchar *file = NULL;
+        g_autofree gchar *raw = NULL;
+
+        file = g_strdup_printf("/benchmark/checksum/verify-file/%s", params->name);
+        g_test_add_data_func(file, params, bench_checksum_verify_file);
+        raw = g_strdup_printf("/benchmark/checksum/verify-raw/%s", params->name);
+        g_test_add_data_func(raw, params, bench_checksum_verify_raw);
+    }
+
+    g_test_add_func("/benchmark/file/read-raw", bench_file_read_raw);
+
+    for (guint i = 0; i < G_N_ELEMENTS(bench_config_params); i++) {
+        const BenchConfig *params = &bench_config_params[i];
+        g_autofree gchar *path = NULL;
+
+        path = g_strdup_printf("/benchmark/config/new-from-file/%s", params->name);
+        g_test_add_data_func(path, params, bench_config_new_from_file);
+    }
+
+    bench_create_input();
+    ret = g_test_run();
+    bench_remove_input();
+
+    return ret;
+}
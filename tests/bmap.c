@@ -0,0 +1,122 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include "helper.h"
+#include "pu-bmap.h"
+#include "pu-error.h"
+#include "pu-file.h"
+#include "pu-utils.h"
+
+#define ROOT_EXT4_SIZE 262144
+
+static void
+test_bmap_parse(void)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(PuBmap) bmap = NULL;
+    g_autoptr(GArray) extents = NULL;
+    PuFileExtent *extent;
+
+    bmap = pu_bmap_new_from_file("data/root.bmap", &error);
+    g_assert_no_error(error);
+    g_assert_nonnull(bmap);
+    g_assert_cmpint(pu_bmap_get_image_size(bmap), ==, ROOT_EXT4_SIZE);
+
+    extents = pu_bmap_get_extents(bmap, 0);
+    g_assert_cmpuint(extents->len, ==, 3);
+    extent = &g_array_index(extents, PuFileExtent, 0);
+    g_assert_cmpint(extent->offset, ==, 0);
+    g_assert_cmpint(extent->length, ==, 8 * 4096);
+    g_array_unref(g_steal_pointer(&extents));
+
+    /* Extents are clipped to the given offset */
+    extents = pu_bmap_get_extents(bmap, 4096);
+    g_assert_cmpuint(extents->len, ==, 3);
+    extent = &g_array_index(extents, PuFileExtent, 0);
+    g_assert_cmpint(extent->offset, ==, 4096);
+    g_assert_cmpint(extent->length, ==, 7 * 4096);
+}
+
+static void
+test_bmap_parse_fail(void)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(PuBmap) bmap = NULL;
+
+    bmap = pu_bmap_new_from_file("data/lorem.txt", &error);
+    g_assert_nonnull(error);
+    g_assert_null(bmap);
+}
+
+static void
+test_bmap_find_for_file(void)
+{
+    g_autofree gchar *path = NULL;
+
+    path = pu_bmap_find_for_file("data/root.ext4");
+    g_assert_null(path);
+}
+
+static void
+test_bmap_verify(void)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(PuBmap) bmap = NULL;
+
+    bmap = pu_bmap_new_from_file("data/root.bmap", &error);
+    g_assert_no_error(error);
+
+    g_assert_true(pu_bmap_verify(bmap, "data/root.ext4", 0, &error));
+    g_assert_no_error(error);
+
+    g_assert_false(pu_bmap_verify(bmap, "data/root.ext4", 4096, &error));
+    g_assert_error(error, PU_ERROR, PU_ERROR_CHECKSUM);
+}
+
+static void
+test_bmap_write(EmptyFileFixture *fixture,
+                G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autoptr(PuBmap) bmap = NULL;
+    g_autoptr(GArray) extents = NULL;
+    g_autofree gchar *output = g_file_get_path(fixture->file);
+    PedDevice device;
+    device.sector_size = 512;
+
+    bmap = pu_bmap_new_from_file("data/root.bmap", &fixture->error);
+    g_assert_no_error(fixture->error);
+
+    extents = pu_bmap_get_extents(bmap, 0);
+    g_assert_true(pu_write_raw_extents("data/root.ext4", output, &device, 0, 8,
+                                       0, extents, NULL, PU_WRITE_FLAGS_NONE,
+                                       &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    g_assert_true(pu_bmap_verify(bmap, output, 8 * 512, &fixture->error));
+    g_assert_no_error(fixture->error);
+}
+
+int
+main(int argc,
+     char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+#ifdef PARTUP_TEST_SRCDIR
+    g_chdir(PARTUP_TEST_SRCDIR);
+#endif
+
+    g_test_add_func("/bmap/parse", test_bmap_parse);
+    g_test_add_func("/bmap/parse_fail", test_bmap_parse_fail);
+    g_test_add_func("/bmap/find_for_file", test_bmap_find_for_file);
+    g_test_add_func("/bmap/verify", test_bmap_verify);
+    g_test_add("/bmap/write", EmptyFileFixture, "file", empty_file_set_up,
+               test_bmap_write, empty_file_tear_down);
+
+    return g_test_run();
+}
@@ -6,6 +6,7 @@
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <gio/gio.h>
+#include "helper.h"
 #include "pu-checksum.h"
 #include "pu-error.h"
 
@@ -88,6 +89,104 @@ checksum_creation(void)
     g_assert_cmpstr(checksum, ==, LOREM_TXT_MD5SUM);
 }
 
+static void
+checksum_incremental(void)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GFile) file = g_file_new_for_path("data/random.bin");
+    g_autoptr(GFileInputStream) stream = NULL;
+    g_autoptr(PuChecksum) checksum = NULL;
+    g_autofree gchar *computed = NULL;
+
+    stream = g_file_read(file, NULL, &error);
+    g_assert_no_error(error);
+    g_assert_true(g_seekable_seek(G_SEEKABLE(stream), 1024, G_SEEK_SET, NULL,
+                                  &error));
+
+    /* Data may be added in arbitrary pieces */
+    checksum = pu_checksum_init(G_CHECKSUM_SHA256);
+    g_assert_true(pu_checksum_update_from_stream(checksum, G_INPUT_STREAM(stream),
+                                                 1000, &error));
+    g_assert_no_error(error);
+    g_assert_true(pu_checksum_update_from_stream(checksum, G_INPUT_STREAM(stream),
+                                                 2072, &error));
+    g_assert_no_error(error);
+
+    computed = pu_checksum_finish(checksum);
+    g_assert_cmpstr(computed, ==, RANDOM_BIN_1024_3072_SHA256SUM);
+    g_clear_pointer(&checksum, pu_checksum_free);
+    g_clear_pointer(&computed, g_free);
+
+    checksum = pu_checksum_init(G_CHECKSUM_MD5);
+    pu_checksum_update(checksum, (const guchar *) "", 0);
+    computed = pu_checksum_finish(checksum);
+    g_assert_cmpstr(computed, ==, "d41d8cd98f00b204e9800998ecf8427e");
+    g_clear_pointer(&checksum, pu_checksum_free);
+
+    /* Reading past the end of the stream fails if a count is given */
+    g_assert_true(g_seekable_seek(G_SEEKABLE(stream), 0, G_SEEK_END, NULL,
+                                  &error));
+    checksum = pu_checksum_init(G_CHECKSUM_MD5);
+    g_assert_false(pu_checksum_update_from_stream(checksum, G_INPUT_STREAM(stream),
+                                                  1, &error));
+    g_assert_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT);
+}
+
+static void
+checksum_cache(CopyFileFixture *fixture,
+               G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *path = g_file_get_path(fixture->file);
+    g_autoptr(GFileInfo) info = NULL;
+    g_autoptr(GFileIOStream) stream = NULL;
+
+    g_assert_no_error(fixture->error);
+
+    pu_checksum_cache_clear();
+    g_assert_null(pu_checksum_cache_lookup(path, G_CHECKSUM_SHA256));
+
+    g_assert_true(pu_checksum_verify_file(path, LOREM_TXT_SHA256SUM,
+                                          G_CHECKSUM_SHA256, &fixture->error));
+    g_assert_no_error(fixture->error);
+    g_assert_cmpstr(pu_checksum_cache_lookup(path, G_CHECKSUM_SHA256), ==,
+                    LOREM_TXT_SHA256SUM);
+    g_assert_null(pu_checksum_cache_lookup(path, G_CHECKSUM_MD5));
+
+    /* Different checksums given for the same file still conflict */
+    g_assert_false(pu_checksum_verify_file(path, RANDOM_BIN_1024_3072_SHA256SUM,
+                                           G_CHECKSUM_SHA256, &fixture->error));
+    g_assert_error(fixture->error, PU_ERROR, PU_ERROR_CHECKSUM);
+    g_clear_error(&fixture->error);
+
+    /* Modifying the file in place keeping its size and time is not detected */
+    info = g_file_query_info(fixture->file,
+                             G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                             G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                             G_FILE_QUERY_INFO_NONE, NULL, &fixture->error);
+    g_assert_no_error(fixture->error);
+    stream = g_file_open_readwrite(fixture->file, NULL, &fixture->error);
+    g_assert_no_error(fixture->error);
+    g_assert_true(g_output_stream_write_all(g_io_stream_get_output_stream(G_IO_STREAM(stream)),
+                                            "#", 1, NULL, NULL, &fixture->error));
+    g_assert_true(g_io_stream_close(G_IO_STREAM(stream), NULL, &fixture->error));
+    g_assert_true(g_file_set_attributes_from_info(fixture->file, info,
+                                                  G_FILE_QUERY_INFO_NONE, NULL,
+                                                  &fixture->error));
+    g_assert_true(pu_checksum_verify_file(path, LOREM_TXT_SHA256SUM,
+                                          G_CHECKSUM_SHA256, &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    /* A replaced file is checksummed again */
+    g_assert_true(g_file_set_contents(path, "lorem", -1, &fixture->error));
+    g_assert_false(pu_checksum_verify_file(path, LOREM_TXT_SHA256SUM,
+                                           G_CHECKSUM_SHA256, &fixture->error));
+    g_assert_error(fixture->error, PU_ERROR, PU_ERROR_CHECKSUM);
+    g_clear_error(&fixture->error);
+
+    pu_checksum_cache_clear();
+    g_assert_null(pu_checksum_cache_lookup(path, G_CHECKSUM_SHA256));
+}
+
 int
 main(int argc,
      char *argv[])
@@ -101,6 +200,9 @@ main(int argc,
     g_test_add_func("/checksum/good", checksum_good);
     g_test_add_func("/checksum/bad", checksum_bad);
     g_test_add_func("/checksum/creation", checksum_creation);
+    g_test_add_func("/checksum/incremental", checksum_incremental);
+    g_test_add("/checksum/cache", CopyFileFixture, "data/lorem.txt",
+               copy_file_setup, checksum_cache, copy_file_teardown);
 
     return g_test_run();
 }
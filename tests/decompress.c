@@ -0,0 +1,153 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include "helper.h"
+#include "pu-decompress.h"
+#include "pu-error.h"
+#include "pu-io.h"
+
+#define ROOT_EXT4_SIZE 262144
+
+static void
+test_compression_from_filename(void)
+{
+    g_autofree gchar *stripped = NULL;
+
+    g_assert_cmpint(pu_compression_from_filename("root.ext4"), ==,
+                    PU_COMPRESSION_NONE);
+    g_assert_cmpint(pu_compression_from_filename("root.ext4.gz"), ==,
+                    PU_COMPRESSION_GZIP);
+    g_assert_cmpint(pu_compression_from_filename("root.ext4.xz"), ==,
+                    PU_COMPRESSION_XZ);
+    g_assert_cmpint(pu_compression_from_filename("root.ext4.zst"), ==,
+                    PU_COMPRESSION_ZSTD);
+    g_assert_cmpstr(pu_compression_get_name(PU_COMPRESSION_ZSTD), ==, "zstd");
+
+    stripped = pu_compression_strip_suffix("data/root.ext4.zst");
+    g_assert_cmpstr(stripped, ==, "data/root.ext4");
+}
+
+static void
+decompress_file(const gchar *filename)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(PuDecompressor) decompressor = NULL;
+    g_autoptr(GArray) digests = NULL;
+    g_autofree gchar *expected = NULL;
+    g_autofree gchar *compressed = NULL;
+    g_autofree gchar *file_sha256sum = NULL;
+    g_autofree guchar *buffer = NULL;
+    gsize expected_len;
+    gsize compressed_len;
+    gsize bytes_read;
+    gsize length = 0;
+    goffset size;
+
+    g_assert_true(g_file_get_contents("data/root.ext4", &expected, &expected_len,
+                                      &error));
+    g_assert_true(g_file_get_contents(filename, &compressed, &compressed_len,
+                                      &error));
+    file_sha256sum = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                                 (guchar *) compressed,
+                                                 compressed_len);
+
+    g_assert_true(pu_decompress_get_size(filename, &size, &error));
+    g_assert_no_error(error);
+    g_assert_cmpint(size, ==, ROOT_EXT4_SIZE);
+
+    decompressor = pu_decompressor_new(filename, &error);
+    g_assert_no_error(error);
+    g_assert_nonnull(decompressor);
+
+    digests = pu_io_digests_new();
+    pu_io_digests_add(digests, PU_IO_DIGEST_FILE, G_CHECKSUM_SHA256);
+    pu_decompressor_set_digests(decompressor, digests);
+
+    /* Read in odd sized pieces to cross the boundaries of the input buffer */
+    buffer = g_new(guchar, ROOT_EXT4_SIZE + 1);
+    do {
+        g_assert_true(pu_decompressor_read(decompressor, buffer + length, 4099,
+                                           &bytes_read, &error));
+        g_assert_no_error(error);
+        length += bytes_read;
+    } while (bytes_read == 4099);
+
+    g_assert_cmpmem(buffer, length, expected, expected_len);
+
+    g_assert_true(pu_decompressor_finish(decompressor, &error));
+    g_assert_no_error(error);
+    g_assert_cmpstr(pu_io_digests_get_string(digests, PU_IO_DIGEST_FILE,
+                                             G_CHECKSUM_SHA256), ==, file_sha256sum);
+}
+
+static void
+test_decompress_gzip(void)
+{
+#ifdef PARTUP_HAVE_ZLIB
+    decompress_file("data/root.ext4.gz");
+#else
+    g_test_skip("Built without gzip support");
+#endif
+}
+
+static void
+test_decompress_xz(void)
+{
+#ifdef PARTUP_HAVE_LZMA
+    decompress_file("data/root.ext4.xz");
+#else
+    g_test_skip("Built without xz support");
+#endif
+}
+
+static void
+test_decompress_truncated(CopyFileFixture *fixture,
+                          G_GNUC_UNUSED gconstpointer user_data)
+{
+#ifdef PARTUP_HAVE_ZLIB
+    g_autoptr(PuDecompressor) decompressor = NULL;
+    g_autofree gchar *data = NULL;
+    g_autofree gchar *path = g_file_get_path(fixture->file);
+    g_autofree guchar *buffer = g_new(guchar, ROOT_EXT4_SIZE);
+    gsize length;
+    gsize bytes_read;
+
+    g_assert_true(g_file_get_contents(path, &data, &length, &fixture->error));
+    g_assert_true(g_file_set_contents(path, data, length / 2, &fixture->error));
+
+    decompressor = pu_decompressor_new(path, &fixture->error);
+    g_assert_no_error(fixture->error);
+
+    g_assert_false(pu_decompressor_read(decompressor, buffer, ROOT_EXT4_SIZE,
+                                        &bytes_read, &fixture->error));
+    g_assert_error(fixture->error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT);
+    g_clear_error(&fixture->error);
+#else
+    g_test_skip("Built without gzip support");
+#endif
+}
+
+int
+main(int argc,
+     char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+#ifdef PARTUP_TEST_SRCDIR
+    g_chdir(PARTUP_TEST_SRCDIR);
+#endif
+
+    g_test_add_func("/decompress/compression_from_filename",
+                    test_compression_from_filename);
+    g_test_add_func("/decompress/gzip", test_decompress_gzip);
+    g_test_add_func("/decompress/xz", test_decompress_xz);
+    g_test_add("/decompress/truncated", CopyFileFixture, "data/root.ext4.gz",
+               copy_file_setup, test_decompress_truncated, copy_file_teardown);
+
+    return g_test_run();
+}
@@ -7,9 +7,14 @@
 #include <glib/gstdio.h>
 #include <gio/gio.h>
 #include <parted/parted.h>
+#include <stdio.h>
+#include <string.h>
 #include "helper.h"
 #include "pu-emmc.h"
 #include "pu-error.h"
+#include "pu-file.h"
+#include "pu-gpt.h"
+#include "pu-mount.h"
 #include "pu-utils.h"
 
 static gboolean
@@ -151,6 +156,216 @@ test_partition_filesystem(EmptyDeviceFixture *fixture,
     g_assert_true(check_partition_fstype(dev, 7, "ext4"));
 }
 
+static void
+fill_device(const gchar *path,
+            goffset offset,
+            gsize size)
+{
+    g_autofree guchar *data = g_malloc(size);
+    FILE *file = fopen(path, "r+");
+
+    g_assert_nonnull(file);
+    memset(data, 0xa5, size);
+    g_assert_cmpint(fseek(file, offset, SEEK_SET), ==, 0);
+    g_assert_cmpuint(fwrite(data, 1, size, file), ==, size);
+    g_assert_cmpint(fclose(file), ==, 0);
+}
+
+static void
+assert_device_filled(const guchar *device,
+                     goffset offset,
+                     gsize size,
+                     guchar value)
+{
+    for (gsize i = 0; i < size; i++)
+        g_assert_cmpuint(device[offset + i], ==, value);
+}
+
+static void
+test_raw_clean(EmptyDeviceFixture *fixture,
+               G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autoptr(PuConfig) config = NULL;
+    g_autoptr(PuEmmc) emmc = NULL;
+    g_autofree gchar *device_path = g_file_get_path(fixture->device);
+    g_autofree guchar *device = NULL;
+    g_autofree gchar *input = NULL;
+    gsize device_len;
+    gsize input_len;
+
+    g_assert_true(g_file_get_contents("data/random.bin", &input, &input_len,
+                                      &fixture->error));
+    fill_device(device_path, 0, 4 * PED_MEBIBYTE_SIZE);
+
+    config = pu_config_new_from_file("config/raw-clean.yaml", &fixture->error);
+    g_assert_nonnull(config);
+
+    emmc = pu_emmc_new(fixture->loop_dev, config, "data", FALSE, &fixture->error);
+    g_assert_nonnull(emmc);
+
+    g_assert_true(pu_flash_init_device(PU_FLASH(emmc), &fixture->error));
+    g_assert_true(pu_flash_setup_layout(PU_FLASH(emmc), &fixture->error));
+    g_assert_true(pu_flash_write_data(PU_FLASH(emmc), &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    g_assert_true(pu_file_read_raw(fixture->loop_dev, &device, 0,
+                                   4 * PED_MEBIBYTE_SIZE, &device_len,
+                                   &fixture->error));
+    g_assert_cmpuint(device_len, ==, 4 * PED_MEBIBYTE_SIZE);
+
+    /* Binaries are written after cleaning the regions overlapping them */
+    g_assert_cmpmem(device + 64 * 1024, input_len, input, input_len);
+    g_assert_cmpmem(device + 1028 * 1024, input_len, input, input_len);
+    assert_device_filled(device, PED_MEBIBYTE_SIZE, 4 * 1024, 0);
+    assert_device_filled(device, 1028 * 1024 + input_len,
+                         2 * PED_MEBIBYTE_SIZE - 1028 * 1024 - input_len, 0);
+    assert_device_filled(device, 3 * PED_MEBIBYTE_SIZE,
+                         PED_MEBIBYTE_SIZE, 0xa5);
+}
+
+#define INCREMENTAL_PARTUUID "3b5a6c1e-9f1d-4c8e-8a3b-2d7f0e6c5a41"
+
+/* Install with a manifest on every partition with a filesystem */
+static void
+emmc_install(EmptyDeviceFixture *fixture)
+{
+    g_autoptr(PuConfig) config = NULL;
+    g_autoptr(PuEmmc) emmc = NULL;
+
+    config = pu_config_new_from_file("config/incremental.yaml", &fixture->error);
+    g_assert_nonnull(config);
+
+    emmc = pu_emmc_new(fixture->loop_dev, config, "data", FALSE, &fixture->error);
+    g_assert_nonnull(emmc);
+    g_object_set(emmc, "incremental", TRUE, NULL);
+
+    g_assert_true(pu_flash_init_device(PU_FLASH(emmc), &fixture->error));
+    g_assert_true(pu_flash_setup_layout(PU_FLASH(emmc), &fixture->error));
+    g_assert_true(pu_flash_write_data(PU_FLASH(emmc), &fixture->error));
+    g_assert_no_error(fixture->error);
+}
+
+/*
+ * Create or remove a file on a partition. Returns whether the file existed
+ * before.
+ */
+static gboolean
+edit_partition(EmptyDeviceFixture *fixture,
+               guint idx,
+               const gchar *filename,
+               gboolean create)
+{
+    g_autofree gchar *part_path = g_strdup_printf("%sp%u", fixture->loop_dev, idx);
+    g_autofree gchar *mount_point = NULL;
+    g_autofree gchar *path = NULL;
+    gboolean existed;
+
+    mount_point = g_dir_make_tmp("partup-XXXXXX", &fixture->error);
+    g_assert_no_error(fixture->error);
+    g_assert_true(pu_mount(part_path, mount_point, NULL, NULL, &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    path = g_build_filename(mount_point, filename, NULL);
+    existed = g_file_test(path, G_FILE_TEST_EXISTS);
+    if (create)
+        g_assert_true(g_file_set_contents(path, "marker\n", -1, &fixture->error));
+    else if (existed)
+        g_assert_cmpint(g_remove(path), ==, 0);
+    g_assert_no_error(fixture->error);
+
+    g_assert_true(pu_umount(mount_point, &fixture->error));
+    g_assert_no_error(fixture->error);
+    g_assert_cmpint(g_rmdir(mount_point), ==, 0);
+
+    return existed;
+}
+
+static void
+test_incremental_keep(EmptyDeviceFixture *fixture,
+                      G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *partuuid = NULL;
+
+    emmc_install(fixture);
+
+    /* Only the second partition differs from its manifest afterwards */
+    edit_partition(fixture, 1, "marker", TRUE);
+    edit_partition(fixture, 2, "marker", TRUE);
+    g_assert_true(edit_partition(fixture, 2, ".partup-manifest", FALSE));
+
+    emmc_install(fixture);
+
+    /* The table is kept, so the first partition is untouched */
+    g_assert_true(edit_partition(fixture, 1, "marker", FALSE));
+    g_assert_false(edit_partition(fixture, 2, "marker", FALSE));
+    g_assert_true(edit_partition(fixture, 2, ".partup-manifest", FALSE));
+    g_assert_true(edit_partition(fixture, 2, "lorem.txt", FALSE));
+
+    partuuid = pu_partition_get_partuuid(fixture->loop_dev, 1);
+    g_assert_cmpstr(partuuid, ==, INCREMENTAL_PARTUUID);
+}
+
+static void
+test_incremental_partuuid_mismatch(EmptyDeviceFixture *fixture,
+                                   G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autoptr(GPtrArray) partuuids = g_ptr_array_new();
+    g_autofree gchar *partuuid = NULL;
+    PedDevice *dev;
+
+    emmc_install(fixture);
+    edit_partition(fixture, 1, "marker", TRUE);
+
+    /* A differing PARTUUID makes the table differ from the layout */
+    dev = ped_device_get(fixture->loop_dev);
+    g_assert_nonnull(dev);
+    g_ptr_array_add(partuuids, "0f3c8e2a-5d4b-4a6e-9c1f-7b2e8d9a6c35");
+    g_assert_true(pu_gpt_set_partuuids(dev, partuuids, &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    emmc_install(fixture);
+
+    /* The device is repartitioned and all partitions are written again */
+    partuuid = pu_partition_get_partuuid(fixture->loop_dev, 1);
+    g_assert_cmpstr(partuuid, ==, INCREMENTAL_PARTUUID);
+    g_assert_false(edit_partition(fixture, 1, "marker", FALSE));
+    g_assert_true(edit_partition(fixture, 1, ".partup-manifest", FALSE));
+}
+
+static void
+test_incremental_flag_mismatch(EmptyDeviceFixture *fixture,
+                               G_GNUC_UNUSED gconstpointer user_data)
+{
+    PedDevice *dev;
+    PedDisk *disk;
+    PedPartition *part;
+
+    emmc_install(fixture);
+    edit_partition(fixture, 1, "marker", TRUE);
+
+    /* A flag not given by the layout makes the table differ from it */
+    dev = ped_device_get(fixture->loop_dev);
+    g_assert_nonnull(dev);
+    disk = ped_disk_new(dev);
+    g_assert_nonnull(disk);
+    part = ped_disk_get_partition(disk, 1);
+    g_assert_nonnull(part);
+    g_assert_true(ped_partition_set_flag(part, PED_PARTITION_LEGACY_BOOT, 1));
+    g_assert_true(ped_disk_commit_to_dev(disk));
+    ped_disk_destroy(disk);
+
+    emmc_install(fixture);
+
+    /* The device is repartitioned without the flag */
+    disk = ped_disk_new(dev);
+    g_assert_nonnull(disk);
+    part = ped_disk_get_partition(disk, 1);
+    g_assert_nonnull(part);
+    g_assert_false(ped_partition_get_flag(part, PED_PARTITION_LEGACY_BOOT));
+    ped_disk_destroy(disk);
+    g_assert_false(edit_partition(fixture, 1, "marker", FALSE));
+}
+
 int
 main(int argc,
      char *argv[])
@@ -172,6 +387,17 @@ main(int argc,
     g_test_add("/emmc/partition_filesystem", EmptyDeviceFixture, NULL,
                empty_device_set_up, test_partition_filesystem,
                empty_device_tear_down);
+    g_test_add("/emmc/raw_clean", EmptyDeviceFixture, NULL,
+               empty_device_set_up, test_raw_clean, empty_device_tear_down);
+    g_test_add("/emmc/incremental/keep", EmptyDeviceFixture, NULL,
+               empty_device_set_up, test_incremental_keep,
+               empty_device_tear_down);
+    g_test_add("/emmc/incremental/partuuid_mismatch", EmptyDeviceFixture, NULL,
+               empty_device_set_up, test_incremental_partuuid_mismatch,
+               empty_device_tear_down);
+    g_test_add("/emmc/incremental/flag_mismatch", EmptyDeviceFixture, NULL,
+               empty_device_set_up, test_incremental_flag_mismatch,
+               empty_device_tear_down);
 
     return g_test_run();
 }
@@ -0,0 +1,211 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <string.h>
+#include "helper.h"
+#include "pu-fat.h"
+#include "pu-io.h"
+
+#define LOREM_TXT_SHA256SUM "25623b53e0984428da972f4c635706d32d01ec92dcd2ab39066082e0b9488c9d"
+#define MANIFEST_DATA       "fingerprint=0123456789abcdef\n"
+
+static guint32
+fat_get(const guchar *buffer,
+        guint size)
+{
+    guint32 value = 0;
+
+    for (guint i = 0; i < size; i++)
+        value |= (guint32) buffer[i] << (8 * i);
+
+    return value;
+}
+
+/* Find the short directory entry of a file in the root directory */
+static const guchar *
+fat_find_entry(const guchar *image,
+               gsize root_offset,
+               const gchar *short_name)
+{
+    for (const guchar *entry = image + root_offset; entry[0] != 0; entry += 32) {
+        if (entry[11] == 0x0f || entry[11] == 0x08)
+            continue;
+        if (memcmp(entry, short_name, 11) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void
+fat_assert_file(const guchar *image,
+                gsize root_offset,
+                gsize data_offset,
+                gsize cluster_size,
+                const gchar *short_name,
+                const gchar *data,
+                gsize length)
+{
+    const guchar *entry = fat_find_entry(image, root_offset, short_name);
+    guint32 cluster;
+
+    g_assert_nonnull(entry);
+    g_assert_cmpuint(fat_get(entry + 28, 4), ==, length);
+    cluster = fat_get(entry + 26, 2) | fat_get(entry + 20, 2) << 16;
+    g_assert_cmpmem(image + data_offset + (cluster - 2) * cluster_size, length,
+                    data, length);
+}
+
+static void
+fat_set_up(EmptyFileFixture *fixture,
+           G_GNUC_UNUSED gconstpointer user_data)
+{
+    empty_file_set_up(fixture, "fat.img");
+}
+
+static void
+test_fat_write(EmptyFileFixture *fixture,
+               gconstpointer user_data)
+{
+    g_autoptr(PuFat) fat = NULL;
+    g_autoptr(GArray) digests = NULL;
+    g_autoptr(GBytes) manifest = NULL;
+    g_autofree gchar *path = g_file_get_path(fixture->file);
+    g_autofree gchar *fsck = NULL;
+    g_autofree gchar *image = NULL;
+    g_autofree gchar *lorem = NULL;
+    g_autofree gchar *random = NULL;
+    const gchar *fstype = user_data;
+    const guchar *boot;
+    PuFatType type;
+    gsize image_len;
+    gsize lorem_len;
+    gsize random_len;
+    gsize fat_offset;
+    gsize root_offset;
+    gsize data_offset;
+    gsize cluster_size;
+
+    g_assert_true(pu_fat_type_from_string(fstype, &type));
+    fat = pu_fat_new(type, "BOOT", &fixture->error);
+    g_assert_no_error(fixture->error);
+
+    digests = pu_io_digests_new();
+    pu_io_digests_add(digests, PU_IO_DIGEST_FILE, G_CHECKSUM_SHA256);
+    g_assert_true(pu_fat_add_file(fat, "data/lorem.txt", digests, &fixture->error));
+    g_assert_true(pu_fat_add_file(fat, "data/random.bin", NULL, &fixture->error));
+    manifest = g_bytes_new_static(MANIFEST_DATA, strlen(MANIFEST_DATA));
+    g_assert_true(pu_fat_add_data(fat, ".partup-manifest", manifest,
+                                  &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    /* Names are unique regardless of case */
+    g_assert_false(pu_fat_add_data(fat, "LOREM.TXT", manifest, &fixture->error));
+    g_assert_error(fixture->error, G_IO_ERROR, G_IO_ERROR_EXISTS);
+    g_clear_error(&fixture->error);
+
+    g_assert_true(pu_fat_write(fat, path, &fixture->error));
+    g_assert_no_error(fixture->error);
+    g_assert_cmpstr(pu_io_digests_get_string(digests, PU_IO_DIGEST_FILE,
+                                             G_CHECKSUM_SHA256), ==,
+                    LOREM_TXT_SHA256SUM);
+
+    g_assert_true(g_file_get_contents(path, &image, &image_len, &fixture->error));
+    g_assert_true(g_file_get_contents("data/lorem.txt", &lorem, &lorem_len,
+                                      &fixture->error));
+    g_assert_true(g_file_get_contents("data/random.bin", &random, &random_len,
+                                      &fixture->error));
+
+    boot = (const guchar *) image;
+    g_assert_cmpuint(boot[510], ==, 0x55);
+    g_assert_cmpuint(boot[511], ==, 0xaa);
+    g_assert_cmpuint(fat_get(boot + 11, 2), ==, 512);
+    cluster_size = boot[13] * 512;
+    fat_offset = fat_get(boot + 14, 2) * 512;
+
+    if (type == PU_FAT_TYPE_16) {
+        g_assert_cmpmem(boot + 54, 8, "FAT16   ", 8);
+        g_assert_cmpmem(boot + 43, 11, "BOOT       ", 11);
+        root_offset = fat_offset + boot[16] * fat_get(boot + 22, 2) * 512;
+        data_offset = root_offset + fat_get(boot + 17, 2) * 32;
+    } else {
+        g_assert_cmpmem(boot + 82, 8, "FAT32   ", 8);
+        g_assert_cmpmem(boot + 71, 11, "BOOT       ", 11);
+        g_assert_cmpmem(boot, 512, boot + 6 * 512, 512);
+        data_offset = fat_offset + boot[16] * fat_get(boot + 36, 4) * 512;
+        root_offset = data_offset + (fat_get(boot + 44, 4) - 2) * cluster_size;
+    }
+    g_assert_cmpuint(data_offset % cluster_size, ==, 0);
+
+    /* The volume label is the first entry of the root directory */
+    g_assert_cmpmem(image + root_offset, 11, "BOOT       ", 11);
+    g_assert_cmpuint(image[root_offset + 11], ==, 0x08);
+
+    fat_assert_file((guchar *) image, root_offset, data_offset, cluster_size,
+                    "LOREM   TXT", lorem, lorem_len);
+    fat_assert_file((guchar *) image, root_offset, data_offset, cluster_size,
+                    "RANDOM  BIN", random, random_len);
+    fat_assert_file((guchar *) image, root_offset, data_offset, cluster_size,
+                    "PARTUP~1   ", MANIFEST_DATA, strlen(MANIFEST_DATA));
+
+    /* Let dosfstools check the filesystem as a whole, if available */
+    fsck = g_find_program_in_path("fsck.fat");
+    if (fsck) {
+        g_autofree gchar *cmd = g_strdup_printf("%s -n %s", fsck, path);
+        gint wait_status;
+
+        g_assert_true(g_spawn_command_line_sync(cmd, NULL, NULL, &wait_status,
+                                                &fixture->error));
+        g_assert_true(g_spawn_check_wait_status(wait_status, &fixture->error));
+        g_assert_no_error(fixture->error);
+    }
+}
+
+static void
+test_fat_unsupported(EmptyFileFixture *fixture,
+                     G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autoptr(PuFat) fat = NULL;
+    g_autoptr(GFile) small = NULL;
+
+    fat = pu_fat_new(PU_FAT_TYPE_16, "LONGER LABEL", &fixture->error);
+    g_assert_null(fat);
+    g_assert_error(fixture->error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED);
+    g_clear_error(&fixture->error);
+
+    /* FAT32 requires at least 65525 clusters */
+    small = create_tmp_file("small.img", fixture->path, 4 * 1024 * 1024,
+                            &fixture->error);
+    fat = pu_fat_new(PU_FAT_TYPE_32, NULL, &fixture->error);
+    g_assert_no_error(fixture->error);
+    g_assert_false(pu_fat_write(fat, g_file_peek_path(small), &fixture->error));
+    g_assert_error(fixture->error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED);
+    g_clear_error(&fixture->error);
+
+    g_assert_true(g_file_delete(small, NULL, &fixture->error));
+}
+
+int
+main(int argc,
+     char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+#ifdef PARTUP_TEST_SRCDIR
+    g_chdir(PARTUP_TEST_SRCDIR);
+#endif
+
+    g_test_add("/fat/write/fat16", EmptyFileFixture, "fat16", fat_set_up,
+               test_fat_write, empty_file_tear_down);
+    g_test_add("/fat/write/fat32", EmptyFileFixture, "fat32", fat_set_up,
+               test_fat_write, empty_file_tear_down);
+    g_test_add("/fat/unsupported", EmptyFileFixture, NULL, fat_set_up,
+               test_fat_unsupported, empty_file_tear_down);
+
+    return g_test_run();
+}
@@ -58,6 +58,31 @@ test_file_get_size(void)
     g_assert_cmpuint(size, ==, ROOT_EXT4_SIZE);
 }
 
+static void
+test_file_get_data_extents(void)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GArray) extents = NULL;
+    goffset total = 0;
+    goffset last_end = 0;
+
+    extents = pu_file_get_data_extents("data/root.ext4", 0, -1, &error);
+    g_assert_no_error(error);
+    g_assert_nonnull(extents);
+    g_assert_cmpuint(extents->len, >, 0);
+
+    for (guint i = 0; i < extents->len; i++) {
+        PuFileExtent *extent = &g_array_index(extents, PuFileExtent, i);
+        g_assert_cmpint(extent->offset, >=, last_end);
+        g_assert_cmpint(extent->length, >, 0);
+        last_end = extent->offset + extent->length;
+        total += extent->length;
+    }
+
+    g_assert_cmpint(last_end, <=, ROOT_EXT4_SIZE);
+    g_assert_cmpint(total, <=, ROOT_EXT4_SIZE);
+}
+
 static void
 test_file_read_int64(void)
 {
@@ -95,6 +120,7 @@ main(int argc,
     g_test_add_func("/file/file_copy", test_file_copy);
     g_test_add_func("/file/file_copy_fail", test_file_copy_fail);
     g_test_add_func("/file/file_get_size", test_file_get_size);
+    g_test_add_func("/file/file_get_data_extents", test_file_get_data_extents);
     g_test_add_func("/file/file_read_int64", test_file_read_int64);
 
     return g_test_run();
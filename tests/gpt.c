@@ -0,0 +1,140 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <blkid.h>
+#include <parted/parted.h>
+#include <string.h>
+#include "helper.h"
+#include "pu-error.h"
+#include "pu-gpt.h"
+
+#define PARTUUID "428957a5-839d-45ae-adaf-4108c98a087b"
+
+static void
+gpt_set_up(EmptyFileFixture *fixture,
+           G_GNUC_UNUSED gconstpointer user_data)
+{
+    empty_file_set_up(fixture, "gpt.img");
+}
+
+static void
+test_gpt_parse_guid(void)
+{
+    const guchar expected[PU_GPT_GUID_SIZE] = {
+        0xa5, 0x57, 0x89, 0x42, 0x9d, 0x83, 0xae, 0x45,
+        0xad, 0xaf, 0x41, 0x08, 0xc9, 0x8a, 0x08, 0x7b
+    };
+    guchar guid[PU_GPT_GUID_SIZE];
+
+    g_assert_true(pu_gpt_parse_guid(PARTUUID, guid));
+    g_assert_cmpmem(guid, sizeof(guid), expected, sizeof(expected));
+    g_assert_false(pu_gpt_parse_guid("428957a5-839d-45ae-adaf", guid));
+}
+
+static void
+test_gpt_set_partuuids(EmptyFileFixture *fixture,
+                       G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *path = g_file_get_path(fixture->file);
+    g_autofree gchar *image = NULL;
+    g_autoptr(GPtrArray) partuuids = g_ptr_array_new();
+    PedDevice *device;
+    PedDisk *disk;
+    blkid_probe pr;
+    blkid_partlist list;
+    blkid_partition part;
+    gsize image_len;
+    gsize backup_offset;
+
+    device = ped_device_get(path);
+    g_assert_nonnull(device);
+    disk = ped_disk_new_fresh(device, ped_disk_type_get("gpt"));
+    g_assert_nonnull(disk);
+    for (PedSector start = 2048; start < 6144; start += 2048) {
+        PedPartition *newpart = ped_partition_new(disk, PED_PARTITION_NORMAL,
+                                                  NULL, start, start + 2047);
+
+        g_assert_nonnull(newpart);
+        g_assert_true(ped_disk_add_partition(disk, newpart,
+                                             ped_constraint_any(device)));
+    }
+    g_assert_true(ped_disk_commit_to_dev(disk));
+
+    /* Keep the PARTUUID of the first partition */
+    g_ptr_array_add(partuuids, NULL);
+    g_ptr_array_add(partuuids, PARTUUID);
+    g_assert_true(pu_gpt_set_partuuids(device, partuuids, &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    ped_disk_destroy(disk);
+    ped_device_destroy(device);
+
+    /* blkid only accepts the table if its checksums are valid */
+    pr = blkid_new_probe_from_filename(path);
+    g_assert_nonnull(pr);
+    list = blkid_probe_get_partitions(pr);
+    g_assert_nonnull(list);
+    g_assert_cmpint(blkid_partlist_numof_partitions(list), ==, 2);
+    part = blkid_partlist_get_partition_by_partno(list, 2);
+    g_assert_nonnull(part);
+    g_assert_cmpstr(blkid_partition_get_uuid(part), ==, PARTUUID);
+    part = blkid_partlist_get_partition_by_partno(list, 1);
+    g_assert_nonnull(part);
+    g_assert_cmpstr(blkid_partition_get_uuid(part), !=, PARTUUID);
+    blkid_free_probe(pr);
+
+    /* The backup table has the same entries as the primary one */
+    g_assert_true(g_file_get_contents(path, &image, &image_len, &fixture->error));
+    backup_offset = image_len - 512;
+    g_assert_cmpmem(image + backup_offset, 8, "EFI PART", 8);
+    g_assert_cmpmem(image + backup_offset + 88, 4, image + 512 + 88, 4);
+}
+
+static void
+test_gpt_invalid(EmptyFileFixture *fixture,
+                 G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *path = g_file_get_path(fixture->file);
+    g_autoptr(GPtrArray) partuuids = g_ptr_array_new();
+    PedDevice *device;
+
+    device = ped_device_get(path);
+    g_assert_nonnull(device);
+    g_ptr_array_add(partuuids, PARTUUID);
+
+    /* There is no partition table to update */
+    g_assert_false(pu_gpt_set_partuuids(device, partuuids, &fixture->error));
+    g_assert_error(fixture->error, PU_ERROR, PU_ERROR_FLASH_LAYOUT);
+    g_clear_error(&fixture->error);
+
+    g_ptr_array_index(partuuids, 0) = "no-uuid";
+    g_assert_false(pu_gpt_set_partuuids(device, partuuids, &fixture->error));
+    g_assert_error(fixture->error, PU_ERROR, PU_ERROR_FLASH_LAYOUT);
+    g_clear_error(&fixture->error);
+
+    ped_device_destroy(device);
+}
+
+int
+main(int argc,
+     char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+#ifdef PARTUP_TEST_SRCDIR
+    g_chdir(PARTUP_TEST_SRCDIR);
+#endif
+
+    g_test_add_func("/gpt/parse_guid", test_gpt_parse_guid);
+    g_test_add("/gpt/set_partuuids", EmptyFileFixture, NULL, gpt_set_up,
+               test_gpt_set_partuuids, empty_file_tear_down);
+    g_test_add("/gpt/invalid", EmptyFileFixture, NULL, gpt_set_up,
+               test_gpt_invalid, empty_file_tear_down);
+
+    return g_test_run();
+}
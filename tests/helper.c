@@ -48,7 +48,7 @@ create_partition(const gchar *device,
     g_assert_no_error(*error);
 
     g_assert_true(pu_make_filesystem(g_strdup_printf("%sp1", device), "ext4",
-                                     "", NULL, error));
+                                     "", NULL, PU_MKFS_FLAGS_NONE, error));
     g_assert_no_error(*error);
 }
 
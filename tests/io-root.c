@@ -0,0 +1,126 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef PARTUP_HAVE_IO_URING
+#include <liburing.h>
+#endif
+#include "helper.h"
+#include "pu-file.h"
+#include "pu-io.h"
+
+/* Offset of the data on the device, moving the extents like a partition */
+#define DATA_SHIFT (1024 * 1024)
+
+/*
+ * Read back unaligned extents from a loop device, which is opened with
+ * O_DIRECT and needs the reads widened to its logical block size.
+ */
+static void
+checksum_extents_direct(EmptyDeviceFixture *fixture,
+                        PuIoBackend backend)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GArray) extents = NULL;
+    g_autofree gchar *data = NULL;
+    g_autofree gchar *expected = NULL;
+    g_autofree gchar *checksum = NULL;
+    PuFileExtent extent_first;
+    PuFileExtent extent_second;
+    GChecksum *sum;
+    gsize length;
+    gint fd;
+
+    g_assert_true(g_file_get_contents("data/root.ext4", &data, &length, &error));
+    g_assert_no_error(error);
+
+    fd = g_open(fixture->loop_dev, O_WRONLY, 0);
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_true(pu_io_pwrite_all(fd, fixture->loop_dev, (guchar *) data,
+                                   length, DATA_SHIFT, &error));
+    g_assert_no_error(error);
+    g_assert_cmpint(fsync(fd), ==, 0);
+    g_close(fd, NULL);
+
+    extent_first = (PuFileExtent) { 100, 4000 };
+    extent_second = (PuFileExtent) { 8199, length - 8199 - 3 };
+
+    sum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_checksum_update(sum, (guchar *) data + extent_first.offset,
+                      extent_first.length);
+    g_checksum_update(sum, (guchar *) data + extent_second.offset,
+                      extent_second.length);
+    expected = g_strdup(g_checksum_get_string(sum));
+    g_checksum_free(sum);
+
+    extents = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+    g_array_append_val(extents, extent_first);
+    g_array_append_val(extents, extent_second);
+
+    pu_io_set_backend(backend);
+    pu_io_set_queue_depth(4);
+    checksum = pu_io_checksum_extents(fixture->loop_dev, extents, DATA_SHIFT,
+                                      G_CHECKSUM_SHA256, &error);
+    g_assert_no_error(error);
+    g_assert_cmpstr(checksum, ==, expected);
+
+    pu_io_set_backend(PU_IO_BACKEND_AUTO);
+    pu_io_set_queue_depth(PU_IO_DEFAULT_QUEUE_DEPTH);
+}
+
+static void
+test_checksum_extents_direct_sync(EmptyDeviceFixture *fixture,
+                                  G_GNUC_UNUSED gconstpointer user_data)
+{
+    checksum_extents_direct(fixture, PU_IO_BACKEND_SYNC);
+}
+
+static void
+test_checksum_extents_direct_io_uring(EmptyDeviceFixture *fixture,
+                                      G_GNUC_UNUSED gconstpointer user_data)
+{
+#ifdef PARTUP_HAVE_IO_URING
+    struct io_uring ring;
+
+    /* Forcing the backend warns about a kernel without io_uring */
+    if (io_uring_queue_init(1, &ring, 0) < 0) {
+        g_test_skip("io_uring unavailable");
+        return;
+    }
+    io_uring_queue_exit(&ring);
+
+    checksum_extents_direct(fixture, PU_IO_BACKEND_IO_URING);
+#else
+    g_test_skip("Built without io_uring support");
+#endif
+}
+
+int
+main(int argc,
+     char *argv[])
+{
+    /* Skip tests when not run as root */
+    if (getuid() != 0)
+        return 77;
+
+    g_test_init(&argc, &argv, NULL);
+
+#ifdef PARTUP_TEST_SRCDIR
+    g_chdir(PARTUP_TEST_SRCDIR);
+#endif
+
+    g_test_add("/io/checksum_extents_direct_sync", EmptyDeviceFixture, NULL,
+               empty_device_set_up, test_checksum_extents_direct_sync,
+               empty_device_tear_down);
+    g_test_add("/io/checksum_extents_direct_io_uring", EmptyDeviceFixture, NULL,
+               empty_device_set_up, test_checksum_extents_direct_io_uring,
+               empty_device_tear_down);
+
+    return g_test_run();
+}
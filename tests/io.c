@@ -0,0 +1,551 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <string.h>
+#include "helper.h"
+#include "pu-error.h"
+#include "pu-file.h"
+#include "pu-io.h"
+#include "pu-stats.h"
+
+#define ROOT_EXT4_SIZE 262144
+
+static void
+copy_extents(EmptyFileFixture *fixture,
+             gsize max_in_flight)
+{
+    g_autoptr(GArray) extents = NULL;
+    g_autofree gchar *output = g_file_get_path(fixture->file);
+    g_autofree gchar *input_data = NULL;
+    g_autofree gchar *output_data = NULL;
+    gsize input_len;
+    gsize output_len;
+    PuFileExtent extent = { 0, ROOT_EXT4_SIZE };
+    gint input_fd;
+    gint output_fd;
+
+    pu_io_set_max_in_flight(max_in_flight);
+
+    extents = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+    g_array_append_val(extents, extent);
+
+    input_fd = g_open("data/root.ext4", O_RDONLY, 0);
+    g_assert_cmpint(input_fd, >=, 0);
+    output_fd = g_open(output, O_WRONLY, 0);
+    g_assert_cmpint(output_fd, >=, 0);
+
+    g_assert_true(pu_io_copy_extents(input_fd, "data/root.ext4", output_fd,
+                                     output, extents, 4096, NULL,
+                                     &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    g_assert_true(g_close(input_fd, NULL));
+    g_assert_true(g_close(output_fd, NULL));
+
+    g_assert_true(g_file_get_contents("data/root.ext4", &input_data, &input_len,
+                                      &fixture->error));
+    g_assert_true(g_file_get_contents(output, &output_data, &output_len,
+                                      &fixture->error));
+    g_assert_cmpmem(input_data, input_len, output_data + 4096, input_len);
+
+    pu_io_set_max_in_flight(PU_IO_DEFAULT_MAX_IN_FLIGHT);
+}
+
+static void
+test_copy_extents(EmptyFileFixture *fixture,
+                  G_GNUC_UNUSED gconstpointer user_data)
+{
+    copy_extents(fixture, PU_IO_DEFAULT_MAX_IN_FLIGHT);
+}
+
+static void
+test_copy_extents_min_in_flight(EmptyFileFixture *fixture,
+                                G_GNUC_UNUSED gconstpointer user_data)
+{
+    copy_extents(fixture, PU_IO_MIN_MAX_IN_FLIGHT);
+}
+
+static void
+test_copy_extents_digests(EmptyFileFixture *fixture,
+                          G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autoptr(GArray) extents = NULL;
+    g_autoptr(GArray) digests = NULL;
+    g_autofree gchar *output = g_file_get_path(fixture->file);
+    g_autofree gchar *data = NULL;
+    g_autofree gchar *input_sha256sum = NULL;
+    g_autofree gchar *written_sha1sum = NULL;
+    gsize length;
+    PuFileExtent extent = { 4096, 8192 };
+    gint input_fd;
+    gint output_fd;
+
+    extents = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+    g_array_append_val(extents, extent);
+
+    digests = pu_io_digests_new();
+    pu_io_digests_add(digests, PU_IO_DIGEST_INPUT, G_CHECKSUM_SHA256);
+    pu_io_digests_add(digests, PU_IO_DIGEST_WRITTEN, G_CHECKSUM_SHA1);
+
+    input_fd = g_open("data/root.ext4", O_RDONLY, 0);
+    g_assert_cmpint(input_fd, >=, 0);
+    output_fd = g_open(output, O_WRONLY, 0);
+    g_assert_cmpint(output_fd, >=, 0);
+
+    g_assert_true(pu_io_copy_extents(input_fd, "data/root.ext4", output_fd,
+                                     output, extents, 0, digests,
+                                     &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    g_assert_true(g_close(input_fd, NULL));
+    g_assert_true(g_close(output_fd, NULL));
+
+    /* The input digest covers the whole file, not only the written extents */
+    g_assert_true(g_file_get_contents("data/root.ext4", &data, &length,
+                                      &fixture->error));
+    input_sha256sum = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                                  (guchar *) data, length);
+    written_sha1sum = g_compute_checksum_for_data(G_CHECKSUM_SHA1,
+                                                  (guchar *) data + extent.offset,
+                                                  extent.length);
+
+    g_assert_cmpstr(pu_io_digests_get_string(digests, PU_IO_DIGEST_INPUT,
+                                             G_CHECKSUM_SHA256), ==, input_sha256sum);
+    g_assert_cmpstr(pu_io_digests_get_string(digests, PU_IO_DIGEST_WRITTEN,
+                                             G_CHECKSUM_SHA1), ==, written_sha1sum);
+    g_assert_null(pu_io_digests_get_string(digests, PU_IO_DIGEST_INPUT,
+                                           G_CHECKSUM_MD5));
+}
+
+static void
+test_copy_extents_fail(EmptyFileFixture *fixture,
+                       G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autoptr(GArray) extents = NULL;
+    g_autofree gchar *output = g_file_get_path(fixture->file);
+    PuFileExtent extent = { 0, 2 * ROOT_EXT4_SIZE };
+    gint input_fd;
+    gint output_fd;
+
+    extents = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+    g_array_append_val(extents, extent);
+
+    input_fd = g_open("data/root.ext4", O_RDONLY, 0);
+    g_assert_cmpint(input_fd, >=, 0);
+    output_fd = g_open(output, O_WRONLY, 0);
+    g_assert_cmpint(output_fd, >=, 0);
+
+    g_assert_false(pu_io_copy_extents(input_fd, "data/root.ext4", output_fd,
+                                      output, extents, 0, NULL, &fixture->error));
+    g_assert_error(fixture->error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT);
+    g_clear_error(&fixture->error);
+
+    g_assert_true(g_close(input_fd, NULL));
+    g_assert_true(g_close(output_fd, NULL));
+}
+
+static void
+test_copy_stream(EmptyFileFixture *fixture,
+                 G_GNUC_UNUSED gconstpointer user_data)
+{
+#ifdef PARTUP_HAVE_ZLIB
+    g_autoptr(PuDecompressor) decompressor = NULL;
+    g_autoptr(GArray) extents = NULL;
+    g_autoptr(GArray) digests = NULL;
+    g_autofree gchar *output = g_file_get_path(fixture->file);
+    g_autofree gchar *input_data = NULL;
+    g_autofree gchar *file_data = NULL;
+    g_autofree gchar *output_data = NULL;
+    g_autofree gchar *file_md5sum = NULL;
+    g_autofree gchar *input_sha256sum = NULL;
+    gsize input_len;
+    gsize file_len;
+    gsize output_len;
+    PuFileExtent extent = { 8192, G_MAXINT64 - 8192 };
+    gint output_fd;
+
+    extents = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+    g_array_append_val(extents, extent);
+
+    digests = pu_io_digests_new();
+    pu_io_digests_add(digests, PU_IO_DIGEST_FILE, G_CHECKSUM_MD5);
+    pu_io_digests_add(digests, PU_IO_DIGEST_INPUT, G_CHECKSUM_SHA256);
+
+    decompressor = pu_decompressor_new("data/root.ext4.gz", &fixture->error);
+    g_assert_no_error(fixture->error);
+    output_fd = g_open(output, O_WRONLY, 0);
+    g_assert_cmpint(output_fd, >=, 0);
+
+    pu_io_set_max_in_flight(PU_IO_MIN_MAX_IN_FLIGHT);
+    g_assert_true(pu_io_copy_stream(decompressor, "data/root.ext4.gz", output_fd,
+                                    output, extents, -4096, digests,
+                                    &fixture->error));
+    g_assert_no_error(fixture->error);
+    pu_io_set_max_in_flight(PU_IO_DEFAULT_MAX_IN_FLIGHT);
+
+    g_assert_true(g_close(output_fd, NULL));
+
+    /* The data is written from the extent up to the end of the input */
+    g_assert_true(g_file_get_contents("data/root.ext4", &input_data, &input_len,
+                                      &fixture->error));
+    g_assert_true(g_file_get_contents(output, &output_data, &output_len,
+                                      &fixture->error));
+    g_assert_cmpmem(input_data + 8192, input_len - 8192, output_data + 4096,
+                    input_len - 8192);
+
+    g_assert_true(g_file_get_contents("data/root.ext4.gz", &file_data, &file_len,
+                                      &fixture->error));
+    file_md5sum = g_compute_checksum_for_data(G_CHECKSUM_MD5, (guchar *) file_data,
+                                              file_len);
+    input_sha256sum = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                                  (guchar *) input_data, input_len);
+    g_assert_cmpstr(pu_io_digests_get_string(digests, PU_IO_DIGEST_FILE,
+                                             G_CHECKSUM_MD5), ==, file_md5sum);
+    g_assert_cmpstr(pu_io_digests_get_string(digests, PU_IO_DIGEST_INPUT,
+                                             G_CHECKSUM_SHA256), ==, input_sha256sum);
+#else
+    g_test_skip("Built without gzip support");
+#endif
+}
+
+/* Copy in compare mode and return the JSON report of the bytes written */
+static gchar *
+copy_extents_compared(EmptyFileFixture *fixture)
+{
+    gchar *json;
+
+    pu_stats_enable();
+    pu_io_set_compare(TRUE);
+    copy_extents(fixture, PU_IO_MIN_MAX_IN_FLIGHT);
+    pu_io_set_compare(FALSE);
+    json = pu_stats_to_json();
+    pu_stats_reset();
+
+    return json;
+}
+
+static void
+test_copy_extents_compare(EmptyFileFixture *fixture,
+                          G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *output = g_file_get_path(fixture->file);
+    g_autofree gchar *output_data = NULL;
+    g_autofree gchar *json = NULL;
+    gsize output_len;
+    gint fd;
+
+    copy_extents(fixture, PU_IO_MIN_MAX_IN_FLIGHT);
+
+    /* Nothing is written to an output already holding the input */
+    json = copy_extents_compared(fixture);
+    g_assert_nonnull(strstr(json, "\"name\": \"raw-write\""));
+    g_assert_nonnull(strstr(json, "\"bytes\": 0,"));
+    g_clear_pointer(&json, g_free);
+
+    /*
+     * Change part of the output, which must be rewritten. With the minimum
+     * in flight, it is exactly one chunk of the input copied to offset 4096.
+     */
+    fd = g_open(output, O_WRONLY, 0);
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_true(pu_io_write_zeroes(fd, output, 65536, 4096, &fixture->error));
+    g_assert_no_error(fixture->error);
+    g_assert_true(g_close(fd, NULL));
+
+    json = copy_extents_compared(fixture);
+    g_assert_nonnull(strstr(json, "\"bytes\": 4096,"));
+
+    g_assert_true(g_file_get_contents(output, &output_data, &output_len,
+                                      &fixture->error));
+    g_assert_cmpuint(output_len, ==, ROOT_EXT4_SIZE + 4096);
+}
+
+static void
+test_copy_extents_multi(EmptyFileFixture *fixture,
+                        G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autoptr(GArray) extents = NULL;
+    g_autoptr(GArray) digests = NULL;
+    g_autofree gchar *first = g_file_get_path(fixture->file);
+    g_autofree gchar *second = g_build_filename(fixture->path, "second", NULL);
+    g_autofree gchar *input_data = NULL;
+    g_autofree gchar *written_sha1sum = NULL;
+    PuFileExtent extent = { 0, ROOT_EXT4_SIZE };
+    PuIoOutput outputs[2];
+    gsize input_len;
+    gint input_fd;
+
+    g_assert_true(g_file_set_contents(second, "", 0, &fixture->error));
+
+    extents = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+    g_array_append_val(extents, extent);
+
+    digests = pu_io_digests_new();
+    pu_io_digests_add(digests, PU_IO_DIGEST_WRITTEN, G_CHECKSUM_SHA1);
+
+    input_fd = g_open("data/root.ext4", O_RDONLY, 0);
+    g_assert_cmpint(input_fd, >=, 0);
+    outputs[0].path = first;
+    outputs[0].fd = g_open(first, O_WRONLY, 0);
+    g_assert_cmpint(outputs[0].fd, >=, 0);
+    outputs[1].path = second;
+    outputs[1].fd = g_open(second, O_WRONLY, 0);
+    g_assert_cmpint(outputs[1].fd, >=, 0);
+
+    pu_io_set_max_in_flight(PU_IO_MIN_MAX_IN_FLIGHT);
+    g_assert_true(pu_io_copy_extents_multi(input_fd, "data/root.ext4", outputs,
+                                           G_N_ELEMENTS(outputs), extents, 0,
+                                           digests, &fixture->error));
+    g_assert_no_error(fixture->error);
+    pu_io_set_max_in_flight(PU_IO_DEFAULT_MAX_IN_FLIGHT);
+
+    g_assert_true(g_close(input_fd, NULL));
+    g_assert_true(g_close(outputs[0].fd, NULL));
+    g_assert_true(g_close(outputs[1].fd, NULL));
+
+    /* Both outputs hold the input, which is only digested once */
+    g_assert_true(g_file_get_contents("data/root.ext4", &input_data, &input_len,
+                                      &fixture->error));
+    for (guint i = 0; i < G_N_ELEMENTS(outputs); i++) {
+        g_autofree gchar *output_data = NULL;
+        gsize output_len;
+
+        g_assert_true(g_file_get_contents(outputs[i].path, &output_data,
+                                          &output_len, &fixture->error));
+        g_assert_cmpmem(input_data, input_len, output_data, input_len);
+    }
+    written_sha1sum = g_compute_checksum_for_data(G_CHECKSUM_SHA1,
+                                                  (guchar *) input_data, input_len);
+    g_assert_cmpstr(pu_io_digests_get_string(digests, PU_IO_DIGEST_WRITTEN,
+                                             G_CHECKSUM_SHA1), ==, written_sha1sum);
+
+    g_assert_cmpint(g_remove(second), ==, 0);
+}
+
+static void
+test_flush(EmptyFileFixture *fixture,
+           G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *output = g_file_get_path(fixture->file);
+
+    g_assert_true(pu_io_flush(output, &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    g_assert_true(pu_io_flush_filesystem(".", &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    g_assert_false(pu_io_flush("file/not/found", &fixture->error));
+    g_assert_error(fixture->error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+    g_clear_error(&fixture->error);
+}
+
+static void
+test_clean(EmptyFileFixture *fixture,
+           G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *output = g_file_get_path(fixture->file);
+    g_autofree gchar *zeroes = g_new0(gchar, 65536);
+    PuIoCleanMethod methods[] = {
+        PU_IO_CLEAN_AUTO,
+        PU_IO_CLEAN_ZERO,
+        PU_IO_CLEAN_DISCARD,
+        PU_IO_CLEAN_SECURE_DISCARD,
+        PU_IO_CLEAN_WRITE
+    };
+
+    for (guint i = 0; i < G_N_ELEMENTS(methods); i++) {
+        g_autofree gchar *input_data = NULL;
+        g_autofree gchar *output_data = NULL;
+        gsize input_len;
+        gsize output_len;
+
+        g_assert_true(g_file_get_contents("data/root.ext4", &input_data,
+                                          &input_len, &fixture->error));
+        g_assert_true(g_file_set_contents(output, input_data, input_len,
+                                          &fixture->error));
+
+        g_assert_true(pu_io_clean(output, 65536, 65536, methods[i],
+                                  &fixture->error));
+        g_assert_no_error(fixture->error);
+
+        g_assert_true(g_file_get_contents(output, &output_data, &output_len,
+                                          &fixture->error));
+        g_assert_cmpuint(output_len, ==, input_len);
+        g_assert_cmpmem(output_data, 65536, input_data, 65536);
+        g_assert_cmpmem(output_data + 65536, 65536, zeroes, 65536);
+        g_assert_cmpmem(output_data + 131072, input_len - 131072,
+                        input_data + 131072, input_len - 131072);
+    }
+
+    g_assert_false(pu_io_clean("file/not/found", 0, 512, PU_IO_CLEAN_AUTO,
+                               &fixture->error));
+    g_assert_error(fixture->error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+    g_clear_error(&fixture->error);
+}
+
+static void
+test_discard(EmptyFileFixture *fixture,
+             G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autoptr(GArray) extents = NULL;
+    g_autofree gchar *output = g_file_get_path(fixture->file);
+    g_autofree gchar *input_data = NULL;
+    g_autofree gchar *output_data = NULL;
+    g_autofree gchar *zeroes = g_new0(gchar, 65536);
+    gsize input_len;
+    gsize output_len;
+    PuFileExtent extent_first = { 0, 65536 };
+    PuFileExtent extent_second = { 131072, 65536 };
+
+    g_assert_true(g_file_get_contents("data/root.ext4", &input_data, &input_len,
+                                      &fixture->error));
+    g_assert_true(g_file_set_contents(output, input_data, input_len,
+                                      &fixture->error));
+
+    extents = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+    g_array_append_val(extents, extent_first);
+    g_array_append_val(extents, extent_second);
+
+    g_assert_true(pu_io_discard(output, extents, &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    g_assert_true(g_file_get_contents(output, &output_data, &output_len,
+                                      &fixture->error));
+    g_assert_cmpuint(output_len, ==, input_len);
+    g_assert_cmpmem(output_data, 65536, zeroes, 65536);
+    g_assert_cmpmem(output_data + 65536, 65536, input_data + 65536, 65536);
+    g_assert_cmpmem(output_data + 131072, 65536, zeroes, 65536);
+}
+
+static void
+test_clean_method_from_string(void)
+{
+    g_autoptr(GError) error = NULL;
+    PuIoCleanMethod method;
+
+    g_assert_true(pu_io_clean_method_from_string("secure-discard", &method,
+                                                 &error));
+    g_assert_no_error(error);
+    g_assert_cmpint(method, ==, PU_IO_CLEAN_SECURE_DISCARD);
+
+    g_assert_false(pu_io_clean_method_from_string("shred", &method, &error));
+    g_assert_error(error, PU_ERROR, PU_ERROR_FAILED);
+}
+
+static void
+checksum_extents(PuIoBackend backend)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GArray) extents = NULL;
+    g_autofree gchar *data = NULL;
+    g_autofree gchar *expected = NULL;
+    g_autofree gchar *checksum = NULL;
+    gsize length;
+    PuFileExtent extent_first = { 0, 4096 };
+    PuFileExtent extent_second = { 8192, ROOT_EXT4_SIZE - 8192 };
+    GChecksum *sum;
+
+    g_assert_true(g_file_get_contents("data/root.ext4", &data, &length, &error));
+    g_assert_no_error(error);
+
+    sum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_checksum_update(sum, (guchar *) data, 4096);
+    g_checksum_update(sum, (guchar *) data + 8192, ROOT_EXT4_SIZE - 8192);
+    expected = g_strdup(g_checksum_get_string(sum));
+    g_checksum_free(sum);
+
+    extents = g_array_new(FALSE, FALSE, sizeof(PuFileExtent));
+    g_array_append_val(extents, extent_first);
+    g_array_append_val(extents, extent_second);
+
+    pu_io_set_backend(backend);
+    pu_io_set_queue_depth(4);
+    checksum = pu_io_checksum_extents("data/root.ext4", extents, 0,
+                                      G_CHECKSUM_SHA256, &error);
+    g_assert_no_error(error);
+    g_assert_cmpstr(checksum, ==, expected);
+
+    pu_io_set_backend(PU_IO_BACKEND_AUTO);
+    pu_io_set_queue_depth(PU_IO_DEFAULT_QUEUE_DEPTH);
+}
+
+static void
+test_checksum_extents_sync(void)
+{
+    checksum_extents(PU_IO_BACKEND_SYNC);
+}
+
+static void
+test_checksum_extents_auto(void)
+{
+    checksum_extents(PU_IO_BACKEND_AUTO);
+}
+
+static void
+test_backend_from_string(void)
+{
+    g_autoptr(GError) error = NULL;
+    PuIoBackend backend;
+
+    g_assert_true(pu_io_backend_from_string("sync", &backend, &error));
+    g_assert_no_error(error);
+    g_assert_cmpint(backend, ==, PU_IO_BACKEND_SYNC);
+
+#ifdef PARTUP_HAVE_IO_URING
+    g_assert_true(pu_io_backend_from_string("io_uring", &backend, &error));
+    g_assert_no_error(error);
+    g_assert_cmpint(backend, ==, PU_IO_BACKEND_IO_URING);
+#endif
+
+    g_assert_false(pu_io_backend_from_string("aio", &backend, &error));
+    g_assert_error(error, PU_ERROR, PU_ERROR_FAILED);
+}
+
+int
+main(int argc,
+     char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+#ifdef PARTUP_TEST_SRCDIR
+    g_chdir(PARTUP_TEST_SRCDIR);
+#endif
+
+    g_test_add("/io/copy_extents", EmptyFileFixture, "file", empty_file_set_up,
+               test_copy_extents, empty_file_tear_down);
+    g_test_add("/io/copy_extents_min_in_flight", EmptyFileFixture, "file",
+               empty_file_set_up, test_copy_extents_min_in_flight,
+               empty_file_tear_down);
+    g_test_add("/io/copy_extents_compare", EmptyFileFixture, "file",
+               empty_file_set_up, test_copy_extents_compare, empty_file_tear_down);
+    g_test_add("/io/copy_extents_digests", EmptyFileFixture, "file",
+               empty_file_set_up, test_copy_extents_digests,
+               empty_file_tear_down);
+    g_test_add("/io/copy_extents_fail", EmptyFileFixture, "file",
+               empty_file_set_up, test_copy_extents_fail, empty_file_tear_down);
+    g_test_add("/io/copy_extents_multi", EmptyFileFixture, "file",
+               empty_file_set_up, test_copy_extents_multi, empty_file_tear_down);
+    g_test_add("/io/copy_stream", EmptyFileFixture, "file", empty_file_set_up,
+               test_copy_stream, empty_file_tear_down);
+    g_test_add("/io/flush", EmptyFileFixture, "file", empty_file_set_up,
+               test_flush, empty_file_tear_down);
+    g_test_add("/io/clean", EmptyFileFixture, "file", empty_file_set_up,
+               test_clean, empty_file_tear_down);
+    g_test_add("/io/discard", EmptyFileFixture, "file", empty_file_set_up,
+               test_discard, empty_file_tear_down);
+    g_test_add_func("/io/clean_method_from_string",
+                    test_clean_method_from_string);
+    g_test_add_func("/io/checksum_extents_sync", test_checksum_extents_sync);
+    g_test_add_func("/io/checksum_extents_auto", test_checksum_extents_auto);
+    g_test_add_func("/io/backend_from_string", test_backend_from_string);
+
+    return g_test_run();
+}
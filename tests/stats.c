@@ -0,0 +1,59 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#include <glib.h>
+#include <string.h>
+#include "pu-stats.h"
+
+static void
+test_stats_disabled(void)
+{
+    g_assert_false(pu_stats_is_enabled());
+    g_assert_null(pu_stats_begin("mkfs", "/dev/null"));
+    pu_stats_end(NULL, 0, TRUE);
+}
+
+static void
+test_stats_json(void)
+{
+    g_autofree gchar *json = NULL;
+    PuStatsStep *outer;
+    PuStatsStep *inner;
+
+    pu_stats_enable();
+    g_assert_true(pu_stats_is_enabled());
+
+    outer = pu_stats_begin("mkfs", "/dev/mmcblk0p1");
+    g_assert_nonnull(outer);
+    inner = pu_stats_begin("command", "mkfs.ext4 -L \"root\" /dev/mmcblk0p1");
+    pu_stats_end(inner, 0, TRUE);
+    pu_stats_end(outer, 0, FALSE);
+    pu_stats_end(pu_stats_begin("raw-write", NULL), 4096, TRUE);
+
+    json = pu_stats_to_json();
+    g_assert_nonnull(strstr(json, "\"name\": \"mkfs\", \"detail\": \"/dev/mmcblk0p1\", "
+                                  "\"depth\": 0"));
+    g_assert_nonnull(strstr(json, "\"detail\": \"mkfs.ext4 -L \\\"root\\\" "
+                                  "/dev/mmcblk0p1\", \"depth\": 1"));
+    g_assert_nonnull(strstr(json, "\"name\": \"raw-write\", \"detail\": null, "
+                                  "\"depth\": 0"));
+    g_assert_nonnull(strstr(json, "\"bytes\": 4096"));
+    g_assert_nonnull(strstr(json, "\"throughput\": null, \"success\": false"));
+
+    pu_stats_reset();
+    g_assert_false(pu_stats_is_enabled());
+}
+
+int
+main(int argc,
+     char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/stats/disabled", test_stats_disabled);
+    g_test_add_func("/stats/json", test_stats_json);
+
+    return g_test_run();
+}
@@ -0,0 +1,81 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pu-tar.h"
+
+/* IDs without an entry in the user and group database of the host */
+#define OWNER_ID 4321
+
+static void
+test_tar_numeric_owner(void)
+{
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *path = NULL;
+    g_autofree gchar *source = NULL;
+    g_autofree gchar *dest = NULL;
+    g_autofree gchar *file = NULL;
+    g_autofree gchar *archive = NULL;
+    g_autofree gchar *dest_file = NULL;
+    g_autofree gchar *cmd = NULL;
+    GStatBuf st;
+    gint wait_status;
+
+    path = g_dir_make_tmp("partup-XXXXXX", &error);
+    g_assert_no_error(error);
+    source = g_build_filename(path, "source", NULL);
+    dest = g_build_filename(path, "dest", NULL);
+    file = g_build_filename(source, "setuid", NULL);
+    archive = g_build_filename(path, "archive.tar", NULL);
+    dest_file = g_build_filename(dest, "setuid", NULL);
+    g_assert_cmpint(g_mkdir(source, 0755), ==, 0);
+    g_assert_cmpint(g_mkdir(dest, 0755), ==, 0);
+    g_assert_true(g_file_set_contents(file, "#!/bin/sh\n", -1, &error));
+    g_assert_cmpint(g_chmod(file, 04755), ==, 0);
+
+    /* Names resolving to root must not take precedence over the numeric IDs */
+    cmd = g_strdup_printf("tar --owner=root:%d --group=root:%d -C %s -cf %s setuid",
+                          OWNER_ID, OWNER_ID, source, archive);
+    g_assert_true(g_spawn_command_line_sync(cmd, NULL, NULL, &wait_status, &error));
+    g_assert_true(g_spawn_check_wait_status(wait_status, &error));
+    g_assert_no_error(error);
+
+    g_assert_true(pu_tar_extract(archive, dest, &error));
+    g_assert_no_error(error);
+
+    /* The set-user-ID bit survives changing the owner */
+    g_assert_cmpint(g_lstat(dest_file, &st), ==, 0);
+    g_assert_cmpuint(st.st_uid, ==, OWNER_ID);
+    g_assert_cmpuint(st.st_gid, ==, OWNER_ID);
+    g_assert_cmpuint(st.st_mode & 07777, ==, 04755);
+
+    g_free(cmd);
+    cmd = g_strdup_printf("rm -rf %s", path);
+    g_assert_true(g_spawn_command_line_sync(cmd, NULL, NULL, &wait_status, &error));
+    g_assert_no_error(error);
+}
+
+int
+main(int argc,
+     char *argv[])
+{
+    /* Skip tests when not run as root */
+    if (getuid() != 0)
+        return 77;
+
+    g_test_init(&argc, &argv, NULL);
+
+#ifdef PARTUP_TEST_SRCDIR
+    g_chdir(PARTUP_TEST_SRCDIR);
+#endif
+
+    g_test_add_func("/tar/numeric_owner", test_tar_numeric_owner);
+
+    return g_test_run();
+}
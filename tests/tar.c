@@ -0,0 +1,450 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#define _GNU_SOURCE
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include "pu-tar.h"
+#include "pu-utils.h"
+
+#define LONG_NAME "directory-with-a-name-exceeding-the-one-hundred-characters-of-the-ustar-name-field-of-the-header"
+#define XATTR_NAME "user.partup"
+#define XATTR_VALUE "key=value\nwith a newline"
+
+/* Archive format and the options of tar compressing the archive */
+typedef struct {
+    const gchar *format;
+    const gchar *suffix;
+    const gchar *compress;
+    const gchar *program;
+} TarArchiveType;
+
+static const TarArchiveType tar_gnu = { "gnu", "tar", "", NULL };
+static const TarArchiveType tar_pax_gz = { "pax", "tar.gz", "-z", "gzip" };
+static const TarArchiveType tar_pax_xz = { "pax", "tar.xz", "-J", "xz" };
+static const TarArchiveType tar_pax_zst = { "pax", "tar.zst", "--zstd", "zstd" };
+
+typedef struct {
+    GError *error;
+    gchar *path;
+    gchar *source;
+    gchar *dest;
+} TarFixture;
+
+static void
+tar_run(const gchar *cmd,
+        GError **error)
+{
+    gint wait_status;
+
+    g_assert_true(g_spawn_command_line_sync(cmd, NULL, NULL, &wait_status, error));
+    g_assert_true(g_spawn_check_wait_status(wait_status, error));
+    g_assert_no_error(*error);
+}
+
+static void
+tar_set_up(TarFixture *fixture,
+           G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *dir = NULL;
+    g_autofree gchar *long_dir = NULL;
+    g_autofree gchar *small = NULL;
+    g_autofree gchar *large = NULL;
+    g_autofree gchar *hardlink = NULL;
+    g_autofree gchar *symlink_path = NULL;
+    g_autofree gchar *large_data = g_malloc(3 * 1024 * 1024 + 17);
+
+    fixture->path = g_dir_make_tmp("partup-XXXXXX", &fixture->error);
+    g_assert_no_error(fixture->error);
+    fixture->source = g_build_filename(fixture->path, "source", NULL);
+    fixture->dest = g_build_filename(fixture->path, "dest", NULL);
+    dir = g_build_filename(fixture->source, "etc", "config", NULL);
+    long_dir = g_build_filename(fixture->source, LONG_NAME, NULL);
+    g_assert_cmpint(g_mkdir_with_parents(dir, 0755), ==, 0);
+    g_assert_cmpint(g_mkdir_with_parents(long_dir, 0700), ==, 0);
+    g_assert_cmpint(g_mkdir(fixture->dest, 0755), ==, 0);
+
+    /* One small file for the workers and one large file written directly */
+    small = g_build_filename(dir, "small.conf", NULL);
+    g_assert_true(g_file_set_contents(small, "key=value\n", -1, &fixture->error));
+    g_assert_cmpint(g_chmod(small, 0640), ==, 0);
+    for (gsize i = 0; i < 3 * 1024 * 1024 + 17; i++)
+        large_data[i] = (gchar) (i * 7 % 251);
+    large = g_build_filename(long_dir, "large.bin", NULL);
+    g_assert_true(g_file_set_contents(large, large_data, 3 * 1024 * 1024 + 17,
+                                      &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    hardlink = g_build_filename(fixture->source, "hardlink.conf", NULL);
+    g_assert_cmpint(link(small, hardlink), ==, 0);
+    symlink_path = g_build_filename(fixture->source, "symlink", NULL);
+    g_assert_cmpint(symlink("etc/config/small.conf", symlink_path), ==, 0);
+}
+
+static void
+tar_tear_down(TarFixture *fixture,
+              G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *cmd = g_strdup_printf("rm -rf %s", fixture->path);
+
+    tar_run(cmd, &fixture->error);
+    g_free(fixture->path);
+    g_free(fixture->source);
+    g_free(fixture->dest);
+    g_clear_error(&fixture->error);
+}
+
+static void
+tar_assert_same_file(TarFixture *fixture,
+                     const gchar *name)
+{
+    g_autofree gchar *source = g_build_filename(fixture->source, name, NULL);
+    g_autofree gchar *dest = g_build_filename(fixture->dest, name, NULL);
+    g_autofree gchar *source_data = NULL;
+    g_autofree gchar *dest_data = NULL;
+    gsize source_len;
+    gsize dest_len;
+    GStatBuf source_st;
+    GStatBuf dest_st;
+
+    g_assert_cmpint(g_lstat(source, &source_st), ==, 0);
+    g_assert_cmpint(g_lstat(dest, &dest_st), ==, 0);
+    g_assert_cmpuint(source_st.st_mode, ==, dest_st.st_mode);
+    g_assert_cmpint(source_st.st_mtime, ==, dest_st.st_mtime);
+
+    g_assert_true(g_file_get_contents(source, &source_data, &source_len, NULL));
+    g_assert_true(g_file_get_contents(dest, &dest_data, &dest_len, NULL));
+    g_assert_cmpmem(source_data, source_len, dest_data, dest_len);
+}
+
+static void
+test_tar_extract(TarFixture *fixture,
+                 gconstpointer user_data)
+{
+    const TarArchiveType *type = user_data;
+    g_autofree gchar *archive_name = g_strdup_printf("archive.%s", type->suffix);
+    g_autofree gchar *archive = g_build_filename(fixture->path, archive_name, NULL);
+    g_autofree gchar *program = NULL;
+    g_autofree gchar *cmd = NULL;
+    g_autofree gchar *small = NULL;
+    g_autofree gchar *hardlink = NULL;
+    g_autofree gchar *target = NULL;
+    g_autofree gchar *symlink_path = NULL;
+    GStatBuf small_st;
+    GStatBuf link_st;
+
+#ifndef PARTUP_HAVE_ZLIB
+    if (type == &tar_pax_gz) {
+        g_test_skip("Built without gzip support");
+        return;
+    }
+#endif
+#ifndef PARTUP_HAVE_LZMA
+    if (type == &tar_pax_xz) {
+        g_test_skip("Built without xz support");
+        return;
+    }
+#endif
+#ifndef PARTUP_HAVE_ZSTD
+    if (type == &tar_pax_zst) {
+        g_test_skip("Built without zstd support");
+        return;
+    }
+#endif
+
+    if (type->program) {
+        program = g_find_program_in_path(type->program);
+        if (!program) {
+            g_test_skip("Compressor for creating the archive not found");
+            return;
+        }
+    }
+
+    cmd = g_strdup_printf("tar --format=%s %s -C %s -cf %s .", type->format,
+                          type->compress, fixture->source, archive);
+    tar_run(cmd, &fixture->error);
+
+    g_assert_true(pu_tar_extract(archive, fixture->dest, &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    tar_assert_same_file(fixture, "etc/config/small.conf");
+    tar_assert_same_file(fixture, LONG_NAME "/large.bin");
+
+    /* Hard links share the inode of their target */
+    small = g_build_filename(fixture->dest, "etc", "config", "small.conf", NULL);
+    hardlink = g_build_filename(fixture->dest, "hardlink.conf", NULL);
+    g_assert_cmpint(g_lstat(small, &small_st), ==, 0);
+    g_assert_cmpint(g_lstat(hardlink, &link_st), ==, 0);
+    g_assert_cmpuint(small_st.st_ino, ==, link_st.st_ino);
+
+    symlink_path = g_build_filename(fixture->dest, "symlink", NULL);
+    target = g_file_read_link(symlink_path, &fixture->error);
+    g_assert_no_error(fixture->error);
+    g_assert_cmpstr(target, ==, "etc/config/small.conf");
+}
+
+static void
+test_tar_dotdot(TarFixture *fixture,
+                G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *archive = g_build_filename(fixture->path, "archive.tar", NULL);
+    g_autofree gchar *outside = g_build_filename(fixture->path, "hardlink.conf", NULL);
+    g_autofree gchar *cmd = NULL;
+
+    /* Keep the leading '..' when creating the archive */
+    cmd = g_strdup_printf("tar -P -C %s/etc -cf %s ../hardlink.conf",
+                          fixture->source, archive);
+    tar_run(cmd, &fixture->error);
+
+    g_assert_false(pu_tar_extract(archive, fixture->dest, &fixture->error));
+    g_assert_error(fixture->error, G_IO_ERROR, G_IO_ERROR_INVALID_FILENAME);
+    g_assert_false(g_file_test(outside, G_FILE_TEST_EXISTS));
+}
+
+static void
+test_tar_symlink_escape(TarFixture *fixture,
+                        G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *archive = g_build_filename(fixture->path, "archive.tar", NULL);
+    g_autofree gchar *links = g_build_filename(fixture->path, "links", NULL);
+    g_autofree gchar *files = g_build_filename(fixture->path, "files", NULL);
+    g_autofree gchar *outside = g_build_filename(fixture->path, "outside", NULL);
+    g_autofree gchar *escape = g_build_filename(links, "escape", NULL);
+    g_autofree gchar *file_dir = g_build_filename(files, "escape", NULL);
+    g_autofree gchar *file = g_build_filename(file_dir, "file", NULL);
+    g_autofree gchar *outside_file = g_build_filename(outside, "file", NULL);
+    g_autofree gchar *cmd = NULL;
+
+    g_assert_cmpint(g_mkdir(links, 0755), ==, 0);
+    g_assert_cmpint(g_mkdir(outside, 0755), ==, 0);
+    g_assert_cmpint(g_mkdir_with_parents(file_dir, 0755), ==, 0);
+    g_assert_cmpint(symlink("../outside", escape), ==, 0);
+    g_assert_true(g_file_set_contents(file, "escaped\n", -1, &fixture->error));
+
+    /* A symlink leading out of the destination and a member below it */
+    cmd = g_strdup_printf("tar -C %s -cf %s escape", links, archive);
+    tar_run(cmd, &fixture->error);
+    g_free(cmd);
+    cmd = g_strdup_printf("tar -C %s -rf %s escape/file", files, archive);
+    tar_run(cmd, &fixture->error);
+
+    g_assert_false(pu_tar_extract(archive, fixture->dest, &fixture->error));
+    g_assert_error(fixture->error, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY);
+    g_assert_false(g_file_test(outside_file, G_FILE_TEST_EXISTS));
+}
+
+static void
+test_tar_symlink_delayed(TarFixture *fixture,
+                         G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *archive = g_build_filename(fixture->path, "archive.tar", NULL);
+    g_autofree gchar *links = g_build_filename(fixture->path, "links", NULL);
+    g_autofree gchar *up = g_build_filename(links, "up", NULL);
+    g_autofree gchar *up_link = g_build_filename(links, "up-link", NULL);
+    g_autofree gchar *dest_up = g_build_filename(fixture->dest, "up", NULL);
+    g_autofree gchar *dest_up_link = g_build_filename(fixture->dest, "up-link", NULL);
+    g_autofree gchar *target = NULL;
+    g_autofree gchar *link_target = NULL;
+    g_autofree gchar *cmd = NULL;
+
+    /* A symlink leading out of the destination and a hard link to it */
+    g_assert_cmpint(g_mkdir(links, 0755), ==, 0);
+    g_assert_cmpint(symlink("../outside", up), ==, 0);
+    g_assert_cmpint(link(up, up_link), ==, 0);
+    cmd = g_strdup_printf("tar -C %s -cf %s up up-link", links, archive);
+    tar_run(cmd, &fixture->error);
+
+    g_assert_true(pu_tar_extract(archive, fixture->dest, &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    /* Both are created as symlinks after all other members */
+    target = g_file_read_link(dest_up, &fixture->error);
+    g_assert_no_error(fixture->error);
+    g_assert_cmpstr(target, ==, "../outside");
+    link_target = g_file_read_link(dest_up_link, &fixture->error);
+    g_assert_no_error(fixture->error);
+    g_assert_cmpstr(link_target, ==, "../outside");
+}
+
+static void
+test_tar_xattr(TarFixture *fixture,
+               G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *archive = g_build_filename(fixture->path, "archive.tar", NULL);
+    g_autofree gchar *source = g_build_filename(fixture->source, "etc", "config",
+                                                "small.conf", NULL);
+    g_autofree gchar *dest = g_build_filename(fixture->dest, "etc", "config",
+                                              "small.conf", NULL);
+    g_autofree gchar *cmd = NULL;
+    gchar value[64];
+    gssize size;
+
+    if (setxattr(source, XATTR_NAME, XATTR_VALUE, strlen(XATTR_VALUE), 0) < 0) {
+        g_test_skip("Extended user attributes not supported");
+        return;
+    }
+
+    /* Stored as SCHILY.xattr record of a pax extended header */
+    cmd = g_strdup_printf("tar --format=pax --xattrs -C %s -cf %s .",
+                          fixture->source, archive);
+    tar_run(cmd, &fixture->error);
+
+    g_assert_true(pu_tar_extract(archive, fixture->dest, &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    size = getxattr(dest, XATTR_NAME, value, sizeof(value));
+    g_assert_cmpint(size, ==, strlen(XATTR_VALUE));
+    g_assert_cmpmem(value, size, XATTR_VALUE, strlen(XATTR_VALUE));
+    tar_assert_same_file(fixture, "etc/config/small.conf");
+}
+
+static void
+test_tar_replace_queued(TarFixture *fixture,
+                        G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *archive = g_build_filename(fixture->path, "archive.tar", NULL);
+    g_autofree gchar *versions = g_build_filename(fixture->path, "versions", NULL);
+    g_autofree gchar *file = g_build_filename(versions, "file", NULL);
+    g_autofree gchar *file_link = g_build_filename(versions, "link", NULL);
+    g_autofree gchar *dest = g_build_filename(fixture->dest, "file", NULL);
+    g_autofree gchar *dest_link = g_build_filename(fixture->dest, "link", NULL);
+    g_autofree gchar *data = NULL;
+    g_autofree gchar *cmd = NULL;
+    GStatBuf dest_st;
+    GStatBuf link_st;
+
+    g_assert_cmpint(g_mkdir(versions, 0755), ==, 0);
+    g_assert_true(g_file_set_contents(file, "first\n", -1, &fixture->error));
+    cmd = g_strdup_printf("tar -C %s -cf %s file", versions, archive);
+    tar_run(cmd, &fixture->error);
+    g_free(cmd);
+
+    /*
+     * The first version is handed to the workers. The second one and a hard
+     * link to it may only be created once the first one was written.
+     */
+    g_assert_cmpint(g_unlink(file), ==, 0);
+    g_assert_true(g_file_set_contents(file, "second\n", -1, &fixture->error));
+    g_assert_cmpint(link(file, file_link), ==, 0);
+    cmd = g_strdup_printf("tar -C %s -rf %s file link", versions, archive);
+    tar_run(cmd, &fixture->error);
+
+    g_assert_true(pu_tar_extract(archive, fixture->dest, &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    g_assert_true(g_file_get_contents(dest, &data, NULL, &fixture->error));
+    g_assert_cmpstr(data, ==, "second\n");
+    g_assert_cmpint(g_lstat(dest, &dest_st), ==, 0);
+    g_assert_cmpint(g_lstat(dest_link, &link_st), ==, 0);
+    g_assert_cmpuint(dest_st.st_ino, ==, link_st.st_ino);
+}
+
+static void
+test_tar_fallback(TarFixture *fixture,
+                  G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *archive = g_build_filename(fixture->path, "archive.tar", NULL);
+    g_autofree gchar *sparse_dir = g_build_filename(fixture->path, "sparse", NULL);
+    g_autofree gchar *sparse = g_build_filename(sparse_dir, "sparse.bin", NULL);
+    g_autofree gchar *partial = g_build_filename(fixture->path, "partial", NULL);
+    g_autofree gchar *dest_sparse = g_build_filename(fixture->dest, "sparse.bin", NULL);
+    g_autofree gchar *source_dir = g_build_filename(fixture->source, LONG_NAME, NULL);
+    g_autofree gchar *dest_dir = g_build_filename(fixture->dest, LONG_NAME, NULL);
+    g_autofree gchar *source_data = NULL;
+    g_autofree gchar *dest_data = NULL;
+    g_autofree gchar *cmd = NULL;
+    gsize source_len;
+    gsize dest_len;
+    GStatBuf source_st;
+    GStatBuf dest_st;
+    gint fd;
+
+    /* A sparse member following the others, which only tar can extract */
+    g_assert_cmpint(g_mkdir(sparse_dir, 0755), ==, 0);
+    g_assert_cmpint(g_mkdir(partial, 0755), ==, 0);
+    fd = g_open(sparse, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_cmpint(pwrite(fd, "data", 4, 1024 * 1024), ==, 4);
+    g_assert_cmpint(close(fd), ==, 0);
+    cmd = g_strdup_printf("tar --format=gnu -S -C %s -cf %s . -C %s sparse.bin",
+                          fixture->source, archive, sparse_dir);
+    tar_run(cmd, &fixture->error);
+
+    if (pu_tar_extract(archive, partial, &fixture->error)) {
+        g_test_skip("Filesystem does not support sparse files");
+        return;
+    }
+    g_assert_error(fixture->error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED);
+    g_clear_error(&fixture->error);
+
+    /* Extracted again by tar over what was written before finding it */
+    g_assert_true(pu_archive_extract(archive, fixture->dest, &fixture->error));
+    g_assert_no_error(fixture->error);
+
+    tar_assert_same_file(fixture, "etc/config/small.conf");
+    tar_assert_same_file(fixture, LONG_NAME "/large.bin");
+    g_assert_true(g_file_get_contents(sparse, &source_data, &source_len, NULL));
+    g_assert_true(g_file_get_contents(dest_sparse, &dest_data, &dest_len, NULL));
+    g_assert_cmpmem(source_data, source_len, dest_data, dest_len);
+
+    /* Metadata of directories is restored by tar */
+    g_assert_cmpint(g_lstat(source_dir, &source_st), ==, 0);
+    g_assert_cmpint(g_lstat(dest_dir, &dest_st), ==, 0);
+    g_assert_cmpuint(source_st.st_mode, ==, dest_st.st_mode);
+    g_assert_cmpint(source_st.st_mtime, ==, dest_st.st_mtime);
+}
+
+static void
+test_tar_unsupported(TarFixture *fixture,
+                     G_GNUC_UNUSED gconstpointer user_data)
+{
+    /* Leave files not recognized as tar archives to tar itself */
+    g_assert_false(pu_tar_extract("data/random.bin", fixture->dest,
+                                  &fixture->error));
+    g_assert_error(fixture->error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED);
+}
+
+int
+main(int argc,
+     char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+#ifdef PARTUP_TEST_SRCDIR
+    g_chdir(PARTUP_TEST_SRCDIR);
+#endif
+
+    g_test_add("/tar/extract/gnu", TarFixture, &tar_gnu, tar_set_up,
+               test_tar_extract, tar_tear_down);
+    g_test_add("/tar/extract/pax", TarFixture, &tar_pax_gz, tar_set_up,
+               test_tar_extract, tar_tear_down);
+    g_test_add("/tar/extract/xz", TarFixture, &tar_pax_xz, tar_set_up,
+               test_tar_extract, tar_tear_down);
+    g_test_add("/tar/extract/zstd", TarFixture, &tar_pax_zst, tar_set_up,
+               test_tar_extract, tar_tear_down);
+    g_test_add("/tar/xattr", TarFixture, NULL, tar_set_up,
+               test_tar_xattr, tar_tear_down);
+    g_test_add("/tar/replace_queued", TarFixture, NULL, tar_set_up,
+               test_tar_replace_queued, tar_tear_down);
+    g_test_add("/tar/dotdot", TarFixture, NULL, tar_set_up,
+               test_tar_dotdot, tar_tear_down);
+    g_test_add("/tar/symlink/escape", TarFixture, NULL, tar_set_up,
+               test_tar_symlink_escape, tar_tear_down);
+    g_test_add("/tar/symlink/delayed", TarFixture, NULL, tar_set_up,
+               test_tar_symlink_delayed, tar_tear_down);
+    g_test_add("/tar/unsupported", TarFixture, NULL, tar_set_up,
+               test_tar_unsupported, tar_tear_down);
+    g_test_add("/tar/fallback", TarFixture, NULL, tar_set_up,
+               test_tar_fallback, tar_tear_down);
+
+    return g_test_run();
+}
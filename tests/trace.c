@@ -0,0 +1,66 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright (c) 2026 PHYTEC Messtechnik GmbH
+ */
+
+#include <glib.h>
+#include <string.h>
+#include "pu-trace.h"
+
+static void
+test_trace_disabled(void)
+{
+    g_autofree gchar *json = NULL;
+
+    g_assert_false(pu_trace_is_enabled());
+    pu_trace_begin("mkfs", "/dev/null");
+    pu_trace_end("mkfs");
+    pu_trace_counter("full-buffers", 1);
+
+    json = pu_trace_to_json();
+    g_assert_null(strstr(json, "mkfs"));
+    g_assert_null(strstr(json, "full-buffers"));
+}
+
+static void
+test_trace_json(void)
+{
+    g_autofree gchar *json = NULL;
+
+    pu_trace_enable();
+    g_assert_true(pu_trace_is_enabled());
+
+    pu_trace_set_thread_name("partup-test");
+    pu_trace_begin("mkfs", "mkfs.ext4 -L \"root\"");
+    pu_trace_counter("full-buffers", 3);
+    pu_trace_end("mkfs");
+
+    json = pu_trace_to_json();
+    g_assert_true(g_str_has_prefix(json, "{\"traceEvents\": ["));
+    g_assert_nonnull(strstr(json, "\"name\": \"thread_name\", \"ph\": \"M\""));
+    g_assert_nonnull(strstr(json, "\"args\": {\"name\": \"partup-test\"}"));
+    g_assert_nonnull(strstr(json, "\"name\": \"mkfs\", \"cat\": \"partup\", "
+                                  "\"ph\": \"B\""));
+    g_assert_nonnull(strstr(json, "\"args\": {\"detail\": \"mkfs.ext4 -L "
+                                  "\\\"root\\\"\"}"));
+    g_assert_nonnull(strstr(json, "\"ph\": \"C\""));
+    g_assert_nonnull(strstr(json, "\"args\": {\"full-buffers\": 3}"));
+    g_assert_nonnull(strstr(json, "\"name\": \"mkfs\", \"cat\": \"partup\", "
+                                  "\"ph\": \"E\""));
+    g_assert_nonnull(strstr(json, "\"displayTimeUnit\": \"ms\"}"));
+
+    pu_trace_reset();
+    g_assert_false(pu_trace_is_enabled());
+}
+
+int
+main(int argc,
+     char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/trace/disabled", test_trace_disabled);
+    g_test_add_func("/trace/json", test_trace_json);
+
+    return g_test_run();
+}
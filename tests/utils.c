@@ -3,6 +3,11 @@
  * Copyright (c) 2023 PHYTEC Messtechnik GmbH
  */
 
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <gio/gio.h>
@@ -41,7 +46,7 @@ test_make_filesystem(EmptyFileFixture *fixture,
     gint wait_status;
 
     g_assert_true(pu_make_filesystem(g_file_get_path(fixture->file), "ext4",
-                  "test", NULL, &fixture->error));
+                  "test", NULL, PU_MKFS_FLAGS_NONE, &fixture->error));
     g_assert_no_error(fixture->error);
 
     cmd = g_strdup_printf("blkid -o value -s TYPE %s", g_file_get_path(fixture->file));
@@ -59,6 +64,56 @@ test_make_filesystem(EmptyFileFixture *fixture,
     g_assert_nonnull(strstr(output, "test"));
 }
 
+static void
+assert_ext_file_content(const gchar *image,
+                        const gchar *filename,
+                        const gchar *expected)
+{
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *cmd = NULL;
+    g_autofree gchar *output = NULL;
+    g_autofree gchar *content = NULL;
+    gint wait_status;
+
+    g_assert_true(g_file_get_contents(expected, &content, NULL, &error));
+    cmd = g_strdup_printf("debugfs -R \"cat /%s\" %s", filename, image);
+    g_assert_true(g_spawn_command_line_sync(cmd, &output, NULL, &wait_status,
+                                            &error));
+    g_assert_true(g_spawn_check_wait_status(wait_status, &error));
+    g_assert_no_error(error);
+    g_assert_cmpstr(output, ==, content);
+}
+
+static void
+test_make_filesystem_populated(EmptyFileFixture *fixture,
+                               G_GNUC_UNUSED gconstpointer user_data)
+{
+    g_autofree gchar *path = g_file_get_path(fixture->file);
+
+    g_assert_false(pu_make_filesystem_populated(path, "fat32", "", NULL,
+                                                PU_MKFS_FLAGS_NONE, "data",
+                                                &fixture->error));
+    g_assert_error(fixture->error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED);
+    g_clear_error(&fixture->error);
+
+    g_assert_true(pu_make_filesystem_populated(path, "ext4", "test", NULL,
+                                               PU_MKFS_FLAGS_NONE, "data",
+                                               &fixture->error));
+    g_assert_no_error(fixture->error);
+    assert_ext_file_content(path, "lorem.txt", "data/lorem.txt");
+
+    if (!pu_mkfs_ext_supports_tar()) {
+        g_test_message("mke2fs does not support tar archives");
+        return;
+    }
+
+    g_assert_true(pu_make_filesystem_populated(path, "ext4", "test", "-F",
+                                               PU_MKFS_FLAGS_NONE,
+                                               "data/lorem.tar", &fixture->error));
+    g_assert_no_error(fixture->error);
+    assert_ext_file_content(path, "lorem.txt", "data/lorem.txt");
+}
+
 static void
 test_set_ext_label(EmptyFileFixture *fixture,
                    G_GNUC_UNUSED gconstpointer user_data)
@@ -68,7 +123,7 @@ test_set_ext_label(EmptyFileFixture *fixture,
     gint wait_status;
 
     g_assert_true(pu_make_filesystem(g_file_get_path(fixture->file), "ext4",
-                  "", NULL, &fixture->error));
+                  "", NULL, PU_MKFS_FLAGS_NONE, &fixture->error));
     g_assert_no_error(fixture->error);
 
     g_assert_true(pu_set_ext_label(g_file_get_path(fixture->file), "test",
@@ -94,7 +149,7 @@ test_write_raw(EmptyFileFixture *fixture,
     device.sector_size = 512;
 
     g_assert_true(pu_write_raw("data/root.ext4", g_file_get_path(fixture->file),
-                  &device, 0, 0, 0, &fixture->error));
+                  &device, 0, 0, 0, PU_WRITE_FLAGS_NONE, &fixture->error));
     g_assert_no_error(fixture->error);
 
     cmd = g_strdup_printf("blkid -o value -s TYPE %s", g_file_get_path(fixture->file));
@@ -112,8 +167,87 @@ test_write_raw_input_offset(EmptyFileFixture *fixture,
     PedDevice device;
     device.sector_size = 512;
     g_assert_true(pu_write_raw("data/root.ext4", g_file_get_path(fixture->file),
-                  &device, 2, 0, 0, &fixture->error));
+                  &device, 2, 0, 0, PU_WRITE_FLAGS_NONE, &fixture->error));
+    g_assert_no_error(fixture->error);
+}
+
+static gchar *
+create_sparse_file(const gchar *dir,
+                   GError **error)
+{
+    g_autofree gchar *path = g_build_filename(dir, "sparse.bin", NULL);
+    g_autofree gchar *data = NULL;
+    gint fd;
+
+    data = g_malloc(4096);
+    memset(data, 0x5a, 4096);
+
+    fd = g_open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_cmpint(pwrite(fd, data, 4096, 0), ==, 4096);
+    g_assert_cmpint(pwrite(fd, data, 4096, 2 * PED_MEBIBYTE_SIZE), ==, 4096);
+    g_assert_cmpint(ftruncate(fd, 4 * PED_MEBIBYTE_SIZE), ==, 0);
+    g_assert_true(g_close(fd, error));
+
+    return g_steal_pointer(&path);
+}
+
+static void
+write_raw_sparse(EmptyFileFixture *fixture,
+                 PuWriteFlags flags)
+{
+    g_autofree gchar *input = NULL;
+    g_autofree gchar *output = g_file_get_path(fixture->file);
+    g_autofree gchar *input_data = NULL;
+    g_autofree gchar *output_data = NULL;
+    g_autofree gchar *ones = NULL;
+    gsize input_len;
+    gsize output_len;
+    PedDevice device;
+    device.sector_size = 512;
+
+    input = create_sparse_file(fixture->path, &fixture->error);
+    g_assert_no_error(fixture->error);
+
+    /* Prefill the output, so that skipped holes can be told apart */
+    ones = g_malloc(4 * PED_MEBIBYTE_SIZE);
+    memset(ones, 0xff, 4 * PED_MEBIBYTE_SIZE);
+    g_assert_true(g_file_set_contents(output, ones, 4 * PED_MEBIBYTE_SIZE,
+                                      &fixture->error));
+
+    g_assert_true(pu_write_raw(input, output, &device, 0, 0, 0, flags,
+                               &fixture->error));
     g_assert_no_error(fixture->error);
+
+    g_assert_true(g_file_get_contents(input, &input_data, &input_len,
+                                      &fixture->error));
+    g_assert_true(g_file_get_contents(output, &output_data, &output_len,
+                                      &fixture->error));
+    g_assert_cmpuint(input_len, ==, output_len);
+
+    /* Data regions are always written */
+    g_assert_cmpmem(input_data, 4096, output_data, 4096);
+    g_assert_cmpmem(input_data + 2 * PED_MEBIBYTE_SIZE, 4096,
+                    output_data + 2 * PED_MEBIBYTE_SIZE, 4096);
+
+    if (flags & PU_WRITE_FLAGS_ZERO_HOLES)
+        g_assert_cmpmem(input_data, input_len, output_data, output_len);
+
+    g_assert_cmpint(g_remove(input), ==, 0);
+}
+
+static void
+test_write_raw_sparse(EmptyFileFixture *fixture,
+                      G_GNUC_UNUSED gconstpointer user_data)
+{
+    write_raw_sparse(fixture, PU_WRITE_FLAGS_NONE);
+}
+
+static void
+test_write_raw_sparse_zero_holes(EmptyFileFixture *fixture,
+                                 G_GNUC_UNUSED gconstpointer user_data)
+{
+    write_raw_sparse(fixture, PU_WRITE_FLAGS_ZERO_HOLES);
 }
 
 static void
@@ -218,12 +352,19 @@ main(int argc,
     g_test_add_func("/utils/archive_extract", test_archive_extract);
     g_test_add("/utils/make_filesystem", EmptyFileFixture, "file", empty_file_set_up,
                test_make_filesystem, empty_file_tear_down);
+    g_test_add("/utils/make_filesystem_populated", EmptyFileFixture, "file",
+               empty_file_set_up, test_make_filesystem_populated,
+               empty_file_tear_down);
     g_test_add("/utils/set_ext_label", EmptyFileFixture, "file", empty_file_set_up,
                test_set_ext_label, empty_file_tear_down);
     g_test_add("/utils/write_raw", EmptyFileFixture, "file", empty_file_set_up,
                test_write_raw, empty_file_tear_down);
     g_test_add("/utils/write_raw_input_offset", EmptyFileFixture, "file", empty_file_set_up,
                test_write_raw_input_offset, empty_file_tear_down);
+    g_test_add("/utils/write_raw_sparse", EmptyFileFixture, "file", empty_file_set_up,
+               test_write_raw_sparse, empty_file_tear_down);
+    g_test_add("/utils/write_raw_sparse_zero_holes", EmptyFileFixture, "file",
+               empty_file_set_up, test_write_raw_sparse_zero_holes, empty_file_tear_down);
     g_test_add_func("/utils/path_from_filename", test_path_from_filename);
     g_test_add_func("/utils/path_from_filename_empty", test_path_from_filename_empty);
     g_test_add_func("/utils/device_get_partition_path_mmc",